@@ -0,0 +1,135 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/adaptive_measurement.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/itineraries/perf_event_registry.h"
+#include "cpu_instructions/util/sample_statistics.h"
+#include "glog/logging.h"
+#include "util/task/status.h"
+
+namespace cpu_instructions {
+
+namespace {
+
+// Returns true if the confidence intervals of all counters in 'statistics' are
+// narrow enough.
+bool HasConverged(const AdaptiveMeasurementOptions& options,
+                  const std::map<PerfEventId, SampleStatistics>& statistics) {
+  for (const auto& key_val : statistics) {
+    const SampleStatistics& counter = key_val.second;
+    const double max_half_width = std::max(
+        options.max_absolute_confidence_interval,
+        options.max_relative_confidence_interval * std::abs(counter.median));
+    if (counter.confidence_interval_half_width > max_half_width) return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+Status MeasureAdaptively(const AdaptiveMeasurementOptions& options,
+                         const MeasurementRun& run, PerfResult* result) {
+  CHECK(result != nullptr);
+  CHECK_GE(options.num_warmup_runs, 0);
+  CHECK_GE(options.min_num_runs, 1);
+  CHECK_GE(options.max_num_runs, options.min_num_runs);
+  using Clock = std::chrono::steady_clock;
+  const Clock::time_point start_time = Clock::now();
+  const auto is_over_budget = [&options, start_time]() {
+    return options.time_budget_seconds > 0 &&
+           std::chrono::duration<double>(Clock::now() - start_time).count() >
+               options.time_budget_seconds;
+  };
+
+  for (int i = 0; i < options.num_warmup_runs; ++i) {
+    PerfResult warmup_result;
+    const Status status = run(&warmup_result);
+    if (!status.ok()) return status;
+  }
+
+  PerfResult total;
+  uint64_t total_scale_factor = 0;
+  // The scaled values of each counter in the recorded runs.
+  std::map<PerfEventId, std::vector<double>> samples;
+  std::map<PerfEventId, SampleStatistics> statistics;
+  int num_runs = 0;
+  while (num_runs < options.max_num_runs) {
+    PerfResult run_result;
+    const Status status = run(&run_result);
+    if (!status.ok()) return status;
+    for (const PerfEventId id : run_result.EventIds()) {
+      samples[id].push_back(run_result.GetScaledOrDie(id));
+    }
+    total.Accumulate(run_result);
+    total_scale_factor += run_result.scale_factor();
+    ++num_runs;
+    if (num_runs < options.min_num_runs) continue;
+    for (const auto& key_val : samples) {
+      statistics[key_val.first] = ComputeSampleStatistics(
+          key_val.second, options.trim_fraction, options.confidence_z);
+    }
+    if (HasConverged(options, statistics)) break;
+    if (is_over_budget()) {
+      LOG(WARNING) << "The time budget ran out after " << num_runs
+                   << " runs, before the measurements converged";
+      break;
+    }
+  }
+  VLOG(1) << "Measured " << num_runs << " runs";
+
+  *result = total;
+  result->SetScaleFactor(total_scale_factor);
+  for (const auto& key_val : statistics) {
+    result->SetStatistics(key_val.first, key_val.second);
+  }
+  return util::OkStatus();
+}
+
+void AddObservations(const PerfResult& result,
+                     ObservationVector* observations) {
+  CHECK(observations != nullptr);
+  const std::vector<PerfEventId> ids = result.EventIdsByName();
+  observations->mutable_observations()->Reserve(
+      observations->observations_size() + ids.size());
+  for (const PerfEventId id : ids) {
+    ObservationVector::Observation* const observation =
+        observations->add_observations();
+    observation->set_event_name(GetPerfEventName(id));
+    observation->set_measurement(result.GetScaledOrDie(id));
+    if (!result.HasStatistics(id)) continue;
+    const SampleStatistics& statistics = result.GetStatisticsOrDie(id);
+    ObservationVector::Observation::Distribution* const distribution =
+        observation->mutable_distribution();
+    distribution->set_num_samples(statistics.num_samples);
+    distribution->set_min(statistics.min);
+    distribution->set_max(statistics.max);
+    distribution->set_median(statistics.median);
+    distribution->set_median_absolute_deviation(
+        statistics.median_absolute_deviation);
+    distribution->set_trimmed_mean(statistics.trimmed_mean);
+    distribution->set_confidence_interval_half_width(
+        statistics.confidence_interval_half_width);
+  }
+}
+
+}  // namespace cpu_instructions
@@ -0,0 +1,74 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A measurement engine that repeats the measurement of a snippet until the
+// value of each counter is known precisely enough. The first runs are
+// discarded, because they are slowed down by cold caches and untrained branch
+// predictors; the other runs are summarized with robust statistics (see
+// util/sample_statistics.h), so that the runs disturbed by an interrupt or by
+// another process do not move the result.
+
+#ifndef CPU_INSTRUCTIONS_ITINERARIES_ADAPTIVE_MEASUREMENT_H_
+#define CPU_INSTRUCTIONS_ITINERARIES_ADAPTIVE_MEASUREMENT_H_
+
+#include <functional>
+
+#include "cpu_instructions/itineraries/perf_subsystem.h"
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "util/task/status.h"
+
+namespace cpu_instructions {
+
+using ::cpu_instructions::util::Status;
+
+struct AdaptiveMeasurementOptions {
+  // The number of runs at the beginning that are not recorded.
+  int num_warmup_runs = 2;
+  // The number of recorded runs is between these two values.
+  int min_num_runs = 5;
+  int max_num_runs = 100;
+  // The measurement stops when, for all counters, the half-width of the
+  // confidence interval of the median is below this fraction of the median...
+  double max_relative_confidence_interval = 0.01;
+  // ...or below this absolute value, for counters whose median is close to
+  // zero.
+  double max_absolute_confidence_interval = 0.01;
+  // The number of standard errors in the confidence interval; 1.96 is 95%.
+  double confidence_z = 1.96;
+  // The fraction of the runs removed at each end for the trimmed mean.
+  double trim_fraction = 0.1;
+  // When not zero, the measurement stops after this time, even if the
+  // confidence intervals are too wide. The time of the warm-up runs counts.
+  double time_budget_seconds = 10.0;
+};
+
+// Runs the measurement once, and stores the counters to 'result', with the
+// scale factor set.
+using MeasurementRun = std::function<Status(PerfResult* result)>;
+
+// Runs 'run' repeatedly as specified by 'options'. Stores to 'result' the sum
+// of the counters of the recorded runs, and the distribution of the scaled
+// value of each counter over these runs; PerfResult::GetScaledOrDie returns
+// the median of the distribution. Returns the first error of 'run'.
+Status MeasureAdaptively(const AdaptiveMeasurementOptions& options,
+                         const MeasurementRun& run, PerfResult* result);
+
+// Adds an observation to 'observations' for each counter of 'result', with
+// the distribution of the counter when it is known.
+void AddObservations(const PerfResult& result,
+                     ObservationVector* observations);
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_ITINERARIES_ADAPTIVE_MEASUREMENT_H_
@@ -0,0 +1,121 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/adaptive_measurement.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "util/task/canonical_errors.h"
+#include "util/task/status.h"
+
+namespace cpu_instructions {
+namespace {
+
+// Returns a run that produces the values in 'cycles' one after the other, and
+// counts the number of runs in 'num_runs'.
+MeasurementRun MakeRun(const std::vector<uint64_t>& cycles, int* num_runs) {
+  return [cycles, num_runs](PerfResult* result) {
+    const uint64_t value = cycles[*num_runs % cycles.size()];
+    ++*num_runs;
+    *result = PerfResult({{"cycles", TimingInfo(10 * value, 1, 1)}});
+    result->SetScaleFactor(10);
+    return util::OkStatus();
+  };
+}
+
+TEST(AdaptiveMeasurementTest, StopsWhenConverged) {
+  AdaptiveMeasurementOptions options;
+  options.num_warmup_runs = 2;
+  options.min_num_runs = 5;
+  int num_runs = 0;
+  PerfResult result;
+  ASSERT_TRUE(
+      MeasureAdaptively(options, MakeRun({4}, &num_runs), &result).ok());
+  // The values are all the same, so the measurement stops after the minimal
+  // number of runs.
+  EXPECT_EQ(num_runs, 7);
+  EXPECT_EQ(result.scale_factor(), 50);
+  EXPECT_DOUBLE_EQ(result.GetScaledOrDie("cycles"), 4.0);
+  ASSERT_TRUE(result.HasStatistics("cycles"));
+  EXPECT_EQ(result.GetStatisticsOrDie("cycles").num_samples, 5);
+}
+
+TEST(AdaptiveMeasurementTest, DiscardsWarmupAndOutliers) {
+  AdaptiveMeasurementOptions options;
+  options.num_warmup_runs = 1;
+  options.min_num_runs = 9;
+  options.max_num_runs = 20;
+  int num_runs = 0;
+  PerfResult result;
+  // The first run is slow, and every fifth run is disturbed.
+  const std::vector<uint64_t> kCycles = {100, 4, 4, 4, 4, 40, 4, 4, 4, 4};
+  ASSERT_TRUE(
+      MeasureAdaptively(options, MakeRun(kCycles, &num_runs), &result).ok());
+  EXPECT_DOUBLE_EQ(result.GetScaledOrDie("cycles"), 4.0);
+  const SampleStatistics& statistics = result.GetStatisticsOrDie("cycles");
+  EXPECT_DOUBLE_EQ(statistics.max, 40.0);
+  EXPECT_DOUBLE_EQ(statistics.median_absolute_deviation, 0.0);
+}
+
+TEST(AdaptiveMeasurementTest, StopsAtMaxNumRuns) {
+  AdaptiveMeasurementOptions options;
+  options.num_warmup_runs = 0;
+  options.min_num_runs = 2;
+  options.max_num_runs = 6;
+  options.max_absolute_confidence_interval = 0.0;
+  options.max_relative_confidence_interval = 0.0;
+  int num_runs = 0;
+  PerfResult result;
+  ASSERT_TRUE(
+      MeasureAdaptively(options, MakeRun({1, 5, 9}, &num_runs), &result).ok());
+  EXPECT_EQ(num_runs, 6);
+  EXPECT_EQ(result.GetStatisticsOrDie("cycles").num_samples, 6);
+}
+
+TEST(AdaptiveMeasurementTest, ReturnsErrors) {
+  AdaptiveMeasurementOptions options;
+  PerfResult result;
+  const Status status = MeasureAdaptively(
+      options,
+      [](PerfResult* result) { return util::InternalError("Failed"); },
+      &result);
+  EXPECT_FALSE(status.ok());
+}
+
+TEST(AdaptiveMeasurementTest, AddObservations) {
+  PerfResult result({{"cycles", TimingInfo(8, 1, 1)},
+                     {"instructions", TimingInfo(4, 1, 1)}});
+  result.SetScaleFactor(2);
+  SampleStatistics statistics;
+  statistics.num_samples = 3;
+  statistics.median = 3.5;
+  result.SetStatistics("cycles", statistics);
+  ObservationVector observations;
+  AddObservations(result, &observations);
+  ASSERT_EQ(observations.observations_size(), 2);
+  const ObservationVector::Observation& cycles = observations.observations(0);
+  EXPECT_EQ(cycles.event_name(), "cycles");
+  EXPECT_DOUBLE_EQ(cycles.measurement(), 3.5);
+  EXPECT_EQ(cycles.distribution().num_samples(), 3);
+  const ObservationVector::Observation& instructions =
+      observations.observations(1);
+  EXPECT_EQ(instructions.event_name(), "instructions");
+  EXPECT_DOUBLE_EQ(instructions.measurement(), 2.0);
+  EXPECT_FALSE(instructions.has_distribution());
+}
+
+}  // namespace
+}  // namespace cpu_instructions
@@ -19,7 +19,6 @@
 #include <cmath>
 #include <iterator>
 #include <numeric>
-#include <unordered_map>
 #include <utility>
 #include "strings/string.h"
 
@@ -61,6 +60,8 @@ int ComputeNumExecutionPorts(const std::vector<PortMask>& port_masks) {
   return max_execution_port_num + 1;
 }
 
+constexpr int DecompositionSolver::kUopsRetiredPort;
+
 DecompositionSolver::DecompositionSolver(
     const MicroArchitecture& microarchitecture)
     : microarchitecture_(&microarchitecture),
@@ -68,7 +69,13 @@ DecompositionSolver::DecompositionSolver(
           ComputeNumExecutionPorts(microarchitecture_->port_masks())),
       num_port_masks_(microarchitecture_->port_masks().size()),
       solver_(new MPSolver("DecompositionLPForInstruction",
-                           MPSolver::GLPK_MIXED_INTEGER_PROGRAMMING)) {}
+                           MPSolver::GLPK_MIXED_INTEGER_PROGRAMMING)) {
+  // TODO(bdb): Only consider user-time measurements with the :u modifier.
+  event_ports_["uops_retired:all"] = kUopsRetiredPort;
+  for (int port = 0; port < num_execution_ports_; ++port) {
+    event_ports_[StrCat("uops_executed_port:port_", port)] = port;
+  }
+}
 
 MPModelProto DecompositionSolver::GetModelProto() const {
   MPModelProto model;
@@ -83,23 +90,22 @@ string DecompositionSolver::GetModelLPString() const {
 }
 
 Status DecompositionSolver::Run(const ObservationVector& observations) {
-  std::unordered_map<string, double> key_val;
-  for (const auto& observation : observations.observations()) {
-    key_val[observation.event_name()] = observation.measurement();
-  }
-  // TODO(bdb): Only consider user-time measurements with the :u modifier.
-  const double uops_retired = FindWithDefault(key_val, "uops_retired:all", 0.0);
+  // We use 0.0 if the data does not exist. This may happen if the CPU
+  // has fewer execution ports than Haswell. This means that it is the duty
+  // of the PMU subsystem to check that the data it measures is properly
+  // stored.
+  // TODO(bdb): Add execution port information for architectures other than
+  // Haswell.
+  double uops_retired = 0.0;
   std::vector<double> measurements(num_execution_ports_, 0.0);
-  for (int port = 0; port < num_execution_ports_; ++port) {
-    // We use 0.0 if the data does not exist. This may happen if the CPU
-    // has fewer execution ports than Haswell. This means that it is the duty
-    // of the PMU subsystem to check that the data it measures is properly
-    // stored.
-    // TODO(bdb): Add execution port information for architectures other than
-    // Haswell.
-    // TODO(bdb): Only consider user-time measurements with the :u modifier.
-    measurements[port] =
-        FindWithDefault(key_val, StrCat("uops_executed_port:port_", port), 0.0);
+  for (const auto& observation : observations.observations()) {
+    const int* const port = FindOrNull(event_ports_, observation.event_name());
+    if (port == nullptr) continue;
+    if (*port == kUopsRetiredPort) {
+      uops_retired = observation.measurement();
+    } else {
+      measurements[*port] = observation.measurement();
+    }
   }
   return Run(measurements, uops_retired);
 }
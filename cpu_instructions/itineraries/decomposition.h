@@ -16,6 +16,7 @@
 #define CPU_INSTRUCTIONS_ITINERARIES_DECOMPOSITION_H_
 
 #include <algorithm>
+#include <unordered_map>
 #include <vector>
 #include "cpu_instructions/base/cpu_model.h"
 #include "cpu_instructions/base/port_mask.h"
@@ -222,6 +223,13 @@ class DecompositionSolver {
   // The underlying MIP solver.
   std::unique_ptr<operations_research::MPSolver> solver_;
 
+  // The events read by Run(const ObservationVector&), mapped to the execution
+  // port whose micro-operations they count, or to kUopsRetiredPort for the
+  // number of retired micro-operations. Built once, so that Run() only looks up
+  // the names of the observations.
+  static constexpr int kUopsRetiredPort = -1;
+  std::unordered_map<string, int> event_ports_;
+
   // is_used_[mask][n] is a binary variable representing that the nth
   // micro-operation using 'mask' is executed.
   std::vector<std::vector<operations_research::MPVariable*>> is_used_;
@@ -0,0 +1,424 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/instruction_snippets.h"
+
+#include <cstdint>
+#include <set>
+#include <unordered_set>
+#include "strings/string.h"
+
+#include "cpu_instructions/util/instruction_syntax.h"
+#include "cpu_instructions/x86/operand_translator.h"
+#include "glog/logging.h"
+#include "strings/str_cat.h"
+#include "strings/str_join.h"
+#include "strings/string_view_utils.h"
+#include "util/gtl/map_util.h"
+#include "util/task/canonical_errors.h"
+
+namespace cpu_instructions {
+
+namespace {
+
+using x86::RegisterClass;
+using x86::RegisterInfo;
+
+// The mnemonics of the instructions that change the control flow or the stack
+// pointer, and thus can't be repeated in a loop by the harness. The
+// conditional jumps are recognized by their first letter.
+bool IsControlFlowOrStackMnemonic(const string& mnemonic) {
+  static const std::unordered_set<string>* const kMnemonics =
+      new std::unordered_set<string>({
+          "CALL",   "ENTER",  "HLT",     "INT",     "INT1",    "INT3",
+          "INTO",   "IRET",   "IRETD",   "IRETQ",   "LEAVE",   "LOOP",
+          "LOOPE",  "LOOPNE", "POP",     "POPA",    "POPAD",   "POPF",
+          "POPFD",  "POPFQ",  "PUSH",    "PUSHA",   "PUSHAD",  "PUSHF",
+          "PUSHFD", "PUSHFQ", "RET",     "SYSCALL", "SYSENTER", "SYSEXIT",
+          "SYSRET", "UD0",    "UD1",     "UD2",     "XABORT",  "XBEGIN",
+          "XEND",
+      });
+  return (!mnemonic.empty() && mnemonic[0] == 'J') ||
+         ContainsKey(*kMnemonics, mnemonic);
+}
+
+// The mnemonics of the instructions that fault on some values of their
+// operands, e.g. a zero divisor. The harness does not control the values in
+// the registers.
+bool IsValueDependentFaultMnemonic(const string& mnemonic) {
+  return mnemonic == "DIV" || mnemonic == "IDIV";
+}
+
+// The mnemonics of the user-level instructions that change the state of the
+// thread beyond the registers of the snippet, and thus break the following
+// snippets or the process itself: the loads of the x87 and SSE control words
+// (with the zeroed scratch memory, they unmask all floating point exceptions),
+// the writes of the FS and GS bases (the thread-local storage), and the writes
+// of the protection key rights.
+bool IsThreadStateMnemonic(const string& mnemonic) {
+  static const std::unordered_set<string>* const kMnemonics =
+      new std::unordered_set<string>({
+          "FLDCW",     "FLDENV",   "FRSTOR",   "FXRSTOR",  "FXRSTOR64",
+          "LDMXCSR",   "VLDMXCSR", "WRFSBASE", "WRGSBASE", "WRPKRU",
+          "XRSTOR",    "XRSTOR64", "XRSTORS",  "XRSTORS64",
+      });
+  return ContainsKey(*kMnemonics, mnemonic);
+}
+
+// The mnemonics of the user-level instructions that fault when the operating
+// system enables the user-mode instruction prevention (UMIP).
+bool IsUmipMnemonic(const string& mnemonic) {
+  return mnemonic == "SGDT" || mnemonic == "SIDT" || mnemonic == "SLDT" ||
+         mnemonic == "SMSW" || mnemonic == "STR";
+}
+
+// Returns true if 'name' is the vendor name of a segment register operand.
+bool IsSegmentRegisterOperand(const string& name) {
+  return name == "Sreg" || name == "CS" || name == "DS" || name == "ES" ||
+         name == "FS" || name == "GS" || name == "SS";
+}
+
+// The mnemonics of the instructions that do not depend on their inputs when
+// all their inputs are the same register. The VEX versions are recognized by
+// their 'V' prefix.
+bool IsDependencyBreakingMnemonic(const string& mnemonic) {
+  static const std::unordered_set<string>* const kMnemonics =
+      new std::unordered_set<string>({
+          "ANDNPD",  "ANDNPS",  "PANDN",   "PCMPEQB", "PCMPEQD", "PCMPEQQ",
+          "PCMPEQW", "PCMPGTB", "PCMPGTD", "PCMPGTQ", "PCMPGTW", "PSUBB",
+          "PSUBD",   "PSUBQ",   "PSUBW",   "PXOR",    "SUB",     "XOR",
+          "XORPD",   "XORPS",
+      });
+  if (ContainsKey(*kMnemonics, mnemonic)) return true;
+  return !mnemonic.empty() && mnemonic[0] == 'V' &&
+         ContainsKey(*kMnemonics, mnemonic.substr(1));
+}
+
+bool IsMemoryAddressingMode(InstructionOperand::AddressingMode mode) {
+  switch (mode) {
+    case InstructionOperand::INDIRECT_ADDRESSING:
+    case InstructionOperand::INDIRECT_ADDRESSING_WITH_BASE:
+    case InstructionOperand::INDIRECT_ADDRESSING_WITH_DISPLACEMENT:
+    case InstructionOperand::INDIRECT_ADDRESSING_WITH_BASE_AND_DISPLACEMENT:
+    case InstructionOperand::
+        INDIRECT_ADDRESSING_WITH_BASE_DISPLACEMENT_AND_INDEX:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns true if 'name' is the vendor name of a class of registers, e.g.
+// "r32" or "xmm1", and not the name of a fixed register, e.g. "AL" or
+// "<XMM0>". The vendor syntax uses upper case for the fixed registers.
+bool IsRegisterPlaceholder(const string& name) {
+  for (const char c : name) {
+    if (c >= 'a' && c <= 'z') return true;
+  }
+  return false;
+}
+
+// Returns the kind of an operand from its specification and its code.
+SnippetOperand::Kind GetOperandKind(const InstructionOperand& operand,
+                                    const string& code) {
+  if (operand.addressing_mode() == InstructionOperand::NO_ADDRESSING) {
+    return SnippetOperand::kImmediate;
+  }
+  if (IsMemoryAddressingMode(operand.addressing_mode())) {
+    return SnippetOperand::kMemory;
+  }
+  if (x86::GetRegisterInfo(code).register_class != RegisterClass::kNone) {
+    return SnippetOperand::kRegister;
+  }
+  if (code.find('[') != string::npos) return SnippetOperand::kMemory;
+  return SnippetOperand::kOther;
+}
+
+// Adds the implicit operand 'name' to 'instruction', or marks the existing
+// one as an input or an output.
+void AddImplicitOperand(const string& name, bool is_input,
+                        SnippetInstruction* instruction) {
+  for (SnippetOperand& operand : instruction->operands) {
+    if (operand.operand_index < 0 && operand.name == name) {
+      operand.is_input |= is_input;
+      operand.is_output |= !is_input;
+      return;
+    }
+  }
+  SnippetOperand operand;
+  operand.name = name;
+  operand.register_info = x86::GetRegisterInfo(name);
+  operand.kind = operand.register_info.register_class == RegisterClass::kNone
+                     ? SnippetOperand::kOther
+                     : SnippetOperand::kRegister;
+  operand.is_input = is_input;
+  operand.is_output = !is_input;
+  instruction->operands.push_back(operand);
+}
+
+Status ReservedRegisterError(const InstructionProto& instruction,
+                             const string& name) {
+  return util::InvalidArgumentError(
+      StrCat(instruction.vendor_syntax().mnemonic(), " uses ", name,
+             " implicitly, and it is reserved by the harness"));
+}
+
+// Returns the name of 'info' in the clobber list of an inline assembly
+// statement.
+string GetClobberName(const RegisterInfo& info) {
+  switch (info.register_class) {
+    case RegisterClass::kGeneralPurpose:
+      return x86::GetRegisterName(info.register_class, info.index, 64);
+    case RegisterClass::kVector:
+      return x86::GetRegisterName(info.register_class, info.index, 128);
+    case RegisterClass::kMmx:
+    case RegisterClass::kOpmask:
+      return x86::GetRegisterName(info.register_class, info.index,
+                                  info.size_bits);
+    case RegisterClass::kFlags:
+    case RegisterClass::kNone:
+      return "";
+  }
+  return "";
+}
+
+}  // namespace
+
+string GetInstructionName(const InstructionProto& instruction) {
+  return instruction.llvm_mnemonic().empty()
+             ? instruction.vendor_syntax().mnemonic()
+             : instruction.llvm_mnemonic();
+}
+
+bool IsReservedRegister(const RegisterInfo& info) {
+  return info.register_class == RegisterClass::kGeneralPurpose &&
+         !info.is_high_byte &&
+         (info.index == 4 || info.index == 5 || info.index == 6 ||
+          info.index == 7);
+}
+
+Status CheckInstructionIsMeasurable(const InstructionProto& instruction) {
+  const InstructionFormat& vendor_syntax = instruction.vendor_syntax();
+  if (!instruction.available_in_64_bit()) {
+    return util::InvalidArgumentError(StrCat(
+        vendor_syntax.mnemonic(), " is not available in 64-bit mode"));
+  }
+  if (instruction.protection_mode() >= 0 && instruction.protection_mode() < 3) {
+    return util::InvalidArgumentError(
+        StrCat(vendor_syntax.mnemonic(), " is privileged"));
+  }
+  if (IsControlFlowOrStackMnemonic(vendor_syntax.mnemonic())) {
+    return util::InvalidArgumentError(StrCat(
+        vendor_syntax.mnemonic(),
+        " changes the control flow or the stack pointer"));
+  }
+  if (IsValueDependentFaultMnemonic(vendor_syntax.mnemonic())) {
+    return util::InvalidArgumentError(StrCat(
+        vendor_syntax.mnemonic(),
+        " may fault depending on the values of its operands"));
+  }
+  if (IsThreadStateMnemonic(vendor_syntax.mnemonic())) {
+    return util::InvalidArgumentError(
+        StrCat(vendor_syntax.mnemonic(), " changes the state of the thread"));
+  }
+  if (IsUmipMnemonic(vendor_syntax.mnemonic())) {
+    return util::InvalidArgumentError(StrCat(
+        vendor_syntax.mnemonic(), " faults when UMIP is enabled"));
+  }
+  for (const InstructionOperand& operand : vendor_syntax.operands()) {
+    const string& name = operand.name();
+    // Loading a segment register faults on most values, and the harness does
+    // not control them.
+    if (IsSegmentRegisterOperand(name) &&
+        operand.usage() != InstructionOperand::USAGE_READ) {
+      return util::InvalidArgumentError(StrCat(
+          vendor_syntax.mnemonic(), " ", name, " writes a segment register"));
+    }
+    if (strings::StartsWith(name, "rel") ||
+        strings::StartsWith(name, "ptr16:") ||
+        strings::StartsWith(name, "m16:")) {
+      return util::InvalidArgumentError(StrCat(
+          vendor_syntax.mnemonic(), " ", name, " changes the control flow"));
+    }
+    switch (operand.addressing_mode()) {
+      case InstructionOperand::INDIRECT_ADDRESSING_WITH_VSIB:
+      case InstructionOperand::INDIRECT_ADDRESSING_BY_RSI:
+      case InstructionOperand::INDIRECT_ADDRESSING_BY_RDI:
+        return util::InvalidArgumentError(
+            StrCat(vendor_syntax.mnemonic(), " ", name,
+                   " addresses the memory through fixed registers"));
+      default:
+        break;
+    }
+  }
+  for (const string& name : instruction.implicit_input_operands()) {
+    if (IsReservedRegister(x86::GetRegisterInfo(name))) {
+      return ReservedRegisterError(instruction, name);
+    }
+  }
+  for (const string& name : instruction.implicit_output_operands()) {
+    if (IsReservedRegister(x86::GetRegisterInfo(name))) {
+      return ReservedRegisterError(instruction, name);
+    }
+  }
+  return util::OkStatus();
+}
+
+Status CheckHostSupportsInstruction(const HostCpuInfo& host_cpu,
+                                    const InstructionProto& instruction) {
+  const string& feature_name = instruction.feature_name();
+  if (feature_name.empty()) return util::OkStatus();
+  // HostCpuInfo::SupportsFeature does not handle nested feature expressions.
+  if (feature_name.find_first_of("()") != string::npos) {
+    return util::InvalidArgumentError(
+        StrCat("The CPU features of ", instruction.vendor_syntax().mnemonic(),
+               " can't be checked: ", feature_name));
+  }
+  if (!host_cpu.SupportsFeature(feature_name)) {
+    return util::InvalidArgumentError(
+        StrCat(instruction.vendor_syntax().mnemonic(), " requires ",
+               feature_name, ", which the host CPU does not support"));
+  }
+  return util::OkStatus();
+}
+
+StatusOr<SnippetInstruction> InstantiateSnippetInstruction(
+    const InstructionProto& instruction) {
+  const Status status = CheckInstructionIsMeasurable(instruction);
+  if (!status.ok()) return status;
+  const InstructionFormat instance = x86::InstantiateOperands(instruction);
+  const InstructionFormat& vendor_syntax = instruction.vendor_syntax();
+  SnippetInstruction result;
+  result.mnemonic = instance.mnemonic();
+  // InstantiateOperands drops the operands that do not appear in the code.
+  int instance_index = 0;
+  for (int i = 0; i < vendor_syntax.operands_size(); ++i) {
+    const InstructionOperand& vendor_operand = vendor_syntax.operands(i);
+    SnippetOperand operand;
+    operand.name = vendor_operand.name();
+    operand.operand_index = i;
+    const bool is_in_code = vendor_operand.name() != "<XMM0>";
+    if (is_in_code) {
+      CHECK_LT(instance_index, instance.operands_size());
+      operand.code = instance.operands(instance_index++).name();
+    }
+    operand.kind = GetOperandKind(
+        vendor_operand, is_in_code ? operand.code : vendor_operand.name());
+    if (operand.kind == SnippetOperand::kRegister) {
+      operand.register_info =
+          x86::GetRegisterInfo(is_in_code ? operand.code : operand.name);
+      operand.is_renameable =
+          is_in_code &&
+          vendor_operand.encoding() != InstructionOperand::IMPLICIT_ENCODING &&
+          IsRegisterPlaceholder(vendor_operand.name());
+    }
+    switch (vendor_operand.usage()) {
+      case InstructionOperand::USAGE_READ:
+        operand.is_input = true;
+        break;
+      case InstructionOperand::USAGE_WRITE:
+        operand.is_output = true;
+        break;
+      case InstructionOperand::USAGE_READ_WRITE:
+        operand.is_input = true;
+        operand.is_output = true;
+        break;
+      default:
+        break;
+    }
+    result.operands.push_back(operand);
+  }
+  for (const string& name : instruction.implicit_input_operands()) {
+    AddImplicitOperand(name, /*is_input=*/true, &result);
+  }
+  for (const string& name : instruction.implicit_output_operands()) {
+    AddImplicitOperand(name, /*is_input=*/false, &result);
+  }
+  return result;
+}
+
+bool RenameRegister(int index, SnippetOperand* operand) {
+  CHECK(operand != nullptr);
+  if (!operand->is_renameable) return false;
+  const RegisterInfo& info = operand->register_info;
+  const string name =
+      x86::GetRegisterName(info.register_class, index, info.size_bits);
+  if (name.empty()) return false;
+  operand->code = name;
+  operand->register_info = x86::GetRegisterInfo(name);
+  return true;
+}
+
+string ToCodeString(const SnippetInstruction& instruction) {
+  InstructionFormat format;
+  format.set_mnemonic(instruction.mnemonic);
+  for (const SnippetOperand& operand : instruction.operands) {
+    if (!operand.code.empty()) format.add_operands()->set_name(operand.code);
+  }
+  return ConvertToCodeString(format);
+}
+
+bool UsesMemory(const SnippetInstruction& instruction) {
+  for (const SnippetOperand& operand : instruction.operands) {
+    if (operand.operand_index >= 0 && operand.kind == SnippetOperand::kMemory) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool IsDependencyBreakingIdiom(const SnippetInstruction& instruction) {
+  if (!IsDependencyBreakingMnemonic(instruction.mnemonic)) return false;
+  const RegisterInfo* first_input = nullptr;
+  int num_inputs = 0;
+  for (const SnippetOperand& operand : instruction.operands) {
+    if (operand.operand_index < 0 || !operand.is_input) continue;
+    if (operand.kind != SnippetOperand::kRegister) return false;
+    if (first_input == nullptr) {
+      first_input = &operand.register_info;
+    } else if (!x86::RegistersAlias(*first_input, operand.register_info)) {
+      return false;
+    }
+    ++num_inputs;
+  }
+  return num_inputs >= 2;
+}
+
+string MakeScratchMemoryInitCode(const MappedMemory& scratch_memory) {
+  return StrCat("MOVABS RSI, ",
+                reinterpret_cast<uintptr_t>(scratch_memory.data()));
+}
+
+string MakeClobberConstraints(
+    const std::vector<SnippetInstruction>& instructions) {
+  std::set<string> clobbered;
+  for (const SnippetInstruction& instruction : instructions) {
+    if (UsesMemory(instruction)) clobbered.insert("rsi");
+    for (const SnippetOperand& operand : instruction.operands) {
+      if (operand.kind != SnippetOperand::kRegister) continue;
+      const string name = GetClobberName(operand.register_info);
+      if (!name.empty()) clobbered.insert(name);
+    }
+  }
+  std::vector<string> constraints;
+  for (const string& name : clobbered) {
+    constraints.push_back(StrCat("~{", name, "}"));
+  }
+  constraints.push_back("~{dirflag}");
+  constraints.push_back("~{fpsr}");
+  constraints.push_back("~{flags}");
+  return strings::Join(constraints, ",");
+}
+
+}  // namespace cpu_instructions
@@ -0,0 +1,142 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Building blocks for the generators of measured snippets. An instruction is
+// instantiated with x86::InstantiateOperands, and each of its operands is
+// classified by the way it is used (input, output), by its kind (register,
+// memory, immediate value) and by whether its register can be changed. The
+// generators then rename the registers of the instances to create or to break
+// the dependencies between consecutive instances.
+//
+// Instructions that would not return to the measurement harness (jumps, calls,
+// privileged instructions, instructions that move the stack pointer) or that
+// would break the following snippets are rejected, so that a whole
+// instruction set can be processed without crashing the measurement process.
+
+#ifndef CPU_INSTRUCTIONS_ITINERARIES_INSTRUCTION_SNIPPETS_H_
+#define CPU_INSTRUCTIONS_ITINERARIES_INSTRUCTION_SNIPPETS_H_
+
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/base/host_cpu.h"
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "cpu_instructions/util/mapped_memory.h"
+#include "cpu_instructions/x86/registers.h"
+#include "util/task/status.h"
+#include "util/task/statusor.h"
+
+namespace cpu_instructions {
+
+using ::cpu_instructions::util::Status;
+using ::cpu_instructions::util::StatusOr;
+
+// An operand of an instruction instantiated for a measurement.
+struct SnippetOperand {
+  enum Kind { kRegister, kMemory, kImmediate, kOther };
+
+  // The vendor name of an explicit operand (e.g. "r32" or "xmm1"), or the name
+  // of an implicit operand (e.g. "EFLAGS").
+  string name;
+  // The index of the operand in the vendor syntax of the instruction, or -1
+  // for implicit operands.
+  int operand_index = -1;
+  Kind kind = kOther;
+  // Whether the operand is read and written by the instruction. Operands
+  // whose usage is not known are neither.
+  bool is_input = false;
+  bool is_output = false;
+  // True for the register operands whose register is encoded in the
+  // instruction, and can thus be replaced by any register of its class.
+  bool is_renameable = false;
+  // The register of the operand, for operands of kind kRegister.
+  x86::RegisterInfo register_info;
+  // The operand in the assembly code, in the Intel syntax; empty for the
+  // operands that do not appear in the code, e.g. implicit operands.
+  string code;
+};
+
+// An instruction instantiated for a measurement.
+struct SnippetInstruction {
+  string mnemonic;
+  // The explicit operands in the order of the vendor syntax, followed by the
+  // implicit operands.
+  std::vector<SnippetOperand> operands;
+};
+
+// Returns the name of 'instruction' in the reports of the generators: its LLVM
+// mnemonic, or its vendor mnemonic if the LLVM mnemonic is not known.
+string GetInstructionName(const InstructionProto& instruction);
+
+// Returns true if 'info' is one of the general purpose registers that the
+// harness uses, and that the measured code must neither read nor write: RSP
+// and RBP hold the frame of the measured function, RSI holds the address of
+// the memory operands, and RDI, the implicit address of string instructions,
+// is not set by the harness.
+bool IsReservedRegister(const x86::RegisterInfo& info);
+
+// Returns an error if 'instruction' can't be executed in a loop by the
+// measurement harness: it changes the control flow or the stack pointer, it is
+// privileged, it is not available in 64-bit mode, it may fault depending on
+// the values of its operands (divisions, segment register loads, descriptor
+// table instructions under UMIP), it changes the state of the thread (the x87
+// and SSE control words, the FS and GS bases, the protection keys), or it
+// addresses memory through registers that are not under the control of the
+// harness. The snippets run in the measurement process, so this is what keeps
+// a bad instruction from bringing down the whole batch.
+Status CheckInstructionIsMeasurable(const InstructionProto& instruction);
+
+// Returns an error if 'host_cpu' does not have the CPU features required by
+// 'instruction', as given by its feature_name. Executing the instruction on
+// such a CPU raises SIGILL, which would bring down the whole measurement
+// process.
+Status CheckHostSupportsInstruction(const HostCpuInfo& host_cpu,
+                                    const InstructionProto& instruction);
+
+// Instantiates the operands of 'instruction', and classifies them. The memory
+// operands address the memory through RSI; see MakeScratchMemoryInitCode.
+// Returns an error if the instruction is not measurable.
+StatusOr<SnippetInstruction> InstantiateSnippetInstruction(
+    const InstructionProto& instruction);
+
+// Replaces the register of 'operand' by the register of the same class and
+// size with the given index. Returns false, and leaves 'operand' unchanged, if
+// there is no such register or if the operand is not renameable.
+bool RenameRegister(int index, SnippetOperand* operand);
+
+// Returns the code of 'instruction' in the Intel syntax.
+string ToCodeString(const SnippetInstruction& instruction);
+
+// Returns true if 'instruction' has an explicit memory operand.
+bool UsesMemory(const SnippetInstruction& instruction);
+
+// Returns true if 'instruction' is an idiom recognized by the CPU as not
+// depending on its inputs, e.g. "XOR ecx, ecx" or "PCMPEQD xmm1, xmm1". Such
+// instances can't carry a dependency chain.
+bool IsDependencyBreakingIdiom(const SnippetInstruction& instruction);
+
+// Returns the code that makes the memory operands of the instances point to
+// the beginning of 'scratch_memory'. The code is meant to be used as the
+// 'init_code' of EvaluateAssemblyString.
+string MakeScratchMemoryInitCode(const MappedMemory& scratch_memory);
+
+// Returns the constraints for EvaluateAssemblyString that mark all registers
+// used by 'instructions' as clobbered, together with the flags. RSI is also
+// clobbered when one of the instructions uses memory.
+string MakeClobberConstraints(
+    const std::vector<SnippetInstruction>& instructions);
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_ITINERARIES_INSTRUCTION_SNIPPETS_H_
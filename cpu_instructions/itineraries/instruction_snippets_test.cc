@@ -0,0 +1,201 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/instruction_snippets.h"
+
+#include "cpu_instructions/util/proto_util.h"
+#include "gtest/gtest.h"
+#include "util/task/status.h"
+
+namespace cpu_instructions {
+namespace {
+
+constexpr const char kAddRegMem[] = R"(
+    vendor_syntax {
+      mnemonic: "ADD"
+      operands {
+        addressing_mode: DIRECT_ADDRESSING encoding: MODRM_REG_ENCODING
+        value_size_bits: 32 name: "r32" usage: USAGE_READ_WRITE }
+      operands {
+        addressing_mode: INDIRECT_ADDRESSING encoding: MODRM_RM_ENCODING
+        value_size_bits: 32 name: "m32" usage: USAGE_READ }
+    }
+    implicit_output_operands: "EFLAGS")";
+
+TEST(InstructionSnippetsTest, InstantiateSnippetInstruction) {
+  const StatusOr<SnippetInstruction> instance_or_status =
+      InstantiateSnippetInstruction(
+          ParseProtoFromStringOrDie<InstructionProto>(kAddRegMem));
+  ASSERT_TRUE(instance_or_status.ok());
+  const SnippetInstruction& instance = instance_or_status.ValueOrDie();
+  EXPECT_EQ(ToCodeString(instance), "ADD ecx,dword ptr[RSI]");
+  ASSERT_EQ(instance.operands.size(), 3);
+
+  const SnippetOperand& destination = instance.operands[0];
+  EXPECT_EQ(destination.operand_index, 0);
+  EXPECT_EQ(destination.kind, SnippetOperand::kRegister);
+  EXPECT_TRUE(destination.is_input);
+  EXPECT_TRUE(destination.is_output);
+  EXPECT_TRUE(destination.is_renameable);
+  EXPECT_EQ(destination.register_info.index, 1);
+
+  const SnippetOperand& source = instance.operands[1];
+  EXPECT_EQ(source.kind, SnippetOperand::kMemory);
+  EXPECT_TRUE(source.is_input);
+  EXPECT_FALSE(source.is_output);
+
+  const SnippetOperand& flags = instance.operands[2];
+  EXPECT_EQ(flags.name, "EFLAGS");
+  EXPECT_EQ(flags.operand_index, -1);
+  EXPECT_EQ(flags.kind, SnippetOperand::kRegister);
+  EXPECT_FALSE(flags.is_input);
+  EXPECT_TRUE(flags.is_output);
+  EXPECT_FALSE(flags.is_renameable);
+  EXPECT_TRUE(flags.code.empty());
+
+  EXPECT_TRUE(UsesMemory(instance));
+  EXPECT_EQ(MakeClobberConstraints({instance}),
+            "~{rcx},~{rsi},~{dirflag},~{fpsr},~{flags}");
+}
+
+TEST(InstructionSnippetsTest, MergesImplicitOperands) {
+  const StatusOr<SnippetInstruction> instance_or_status =
+      InstantiateSnippetInstruction(
+          ParseProtoFromStringOrDie<InstructionProto>(R"(
+              vendor_syntax { mnemonic: "CLC" }
+              implicit_input_operands: "EFLAGS"
+              implicit_output_operands: "EFLAGS")"));
+  ASSERT_TRUE(instance_or_status.ok());
+  const SnippetInstruction& instance = instance_or_status.ValueOrDie();
+  ASSERT_EQ(instance.operands.size(), 1);
+  EXPECT_TRUE(instance.operands[0].is_input);
+  EXPECT_TRUE(instance.operands[0].is_output);
+  EXPECT_FALSE(UsesMemory(instance));
+}
+
+TEST(InstructionSnippetsTest, RenameRegister) {
+  SnippetInstruction instance =
+      InstantiateSnippetInstruction(
+          ParseProtoFromStringOrDie<InstructionProto>(kAddRegMem))
+          .ValueOrDie();
+  EXPECT_TRUE(RenameRegister(10, &instance.operands[0]));
+  EXPECT_EQ(instance.operands[0].code, "r10d");
+  EXPECT_EQ(instance.operands[0].register_info.index, 10);
+  EXPECT_FALSE(RenameRegister(20, &instance.operands[0]));
+  EXPECT_FALSE(RenameRegister(1, &instance.operands[1]));
+  EXPECT_FALSE(RenameRegister(0, &instance.operands[2]));
+  EXPECT_EQ(ToCodeString(instance), "ADD r10d,dword ptr[RSI]");
+}
+
+TEST(InstructionSnippetsTest, RejectsUnsafeInstructions) {
+  for (const char* const instruction : {
+           R"(vendor_syntax { mnemonic: "JMP"
+                              operands { addressing_mode: NO_ADDRESSING
+                                         name: "rel8" } })",
+           R"(vendor_syntax { mnemonic: "PUSH"
+                              operands { name: "r64" } })",
+           R"(vendor_syntax { mnemonic: "HLT" } protection_mode: 0)",
+           R"(vendor_syntax { mnemonic: "AAA" } available_in_64_bit: false)",
+           R"(vendor_syntax { mnemonic: "DIV"
+                              operands { name: "r32" } })",
+           R"(vendor_syntax { mnemonic: "MOVSB" }
+              implicit_input_operands: "RSI")",
+           R"(vendor_syntax { mnemonic: "MOV"
+                              operands { name: "Sreg" usage: USAGE_WRITE }
+                              operands { name: "r/m16" usage: USAGE_READ } })",
+           R"(vendor_syntax { mnemonic: "LDMXCSR"
+                              operands { name: "m32" usage: USAGE_READ } })",
+           R"(vendor_syntax { mnemonic: "FXRSTOR"
+                              operands { name: "m512byte" } })",
+           R"(vendor_syntax { mnemonic: "FLDCW"
+                              operands { name: "m2byte" } })",
+           R"(vendor_syntax { mnemonic: "WRFSBASE"
+                              operands { name: "r64" } })",
+           R"(vendor_syntax { mnemonic: "WRGSBASE"
+                              operands { name: "r32" } })",
+           R"(vendor_syntax { mnemonic: "WRPKRU" })",
+           R"(vendor_syntax { mnemonic: "SGDT"
+                              operands { name: "m" } })",
+           R"(vendor_syntax { mnemonic: "SMSW"
+                              operands { name: "r/m16" } })",
+           R"(vendor_syntax { mnemonic: "STR"
+                              operands { name: "r/m16" } })",
+       }) {
+    const InstructionProto proto =
+        ParseProtoFromStringOrDie<InstructionProto>(instruction);
+    EXPECT_FALSE(CheckInstructionIsMeasurable(proto).ok()) << instruction;
+    EXPECT_FALSE(InstantiateSnippetInstruction(proto).ok()) << instruction;
+  }
+  EXPECT_TRUE(CheckInstructionIsMeasurable(
+                  ParseProtoFromStringOrDie<InstructionProto>(kAddRegMem))
+                  .ok());
+  // Reading a segment register is harmless.
+  EXPECT_TRUE(CheckInstructionIsMeasurable(
+                  ParseProtoFromStringOrDie<InstructionProto>(R"(
+                      vendor_syntax {
+                        mnemonic: "MOV"
+                        operands { name: "r/m16" usage: USAGE_WRITE }
+                        operands { name: "Sreg" usage: USAGE_READ } })"))
+                  .ok());
+}
+
+TEST(InstructionSnippetsTest, IsReservedRegister) {
+  for (const char* const name : {"RSP", "ebp", "si", "DIL"}) {
+    EXPECT_TRUE(IsReservedRegister(x86::GetRegisterInfo(name))) << name;
+  }
+  for (const char* const name : {"RAX", "ah", "r12d", "xmm4", "EFLAGS"}) {
+    EXPECT_FALSE(IsReservedRegister(x86::GetRegisterInfo(name))) << name;
+  }
+}
+
+TEST(InstructionSnippetsTest, CheckHostSupportsInstruction) {
+  const HostCpuInfo host_cpu("doesnotexist", {"AVX", "SSE4_1"});
+  const auto check = [&host_cpu](const char* feature_name) {
+    InstructionProto instruction;
+    instruction.mutable_vendor_syntax()->set_mnemonic("VPADDD");
+    instruction.set_feature_name(feature_name);
+    return CheckHostSupportsInstruction(host_cpu, instruction).ok();
+  };
+  EXPECT_TRUE(check(""));
+  EXPECT_TRUE(check("AVX"));
+  EXPECT_TRUE(check("AVX2 || AVX"));
+  EXPECT_FALSE(check("AVX2"));
+  EXPECT_FALSE(check("AVX && AVX2"));
+  EXPECT_FALSE(check("(AVX512F && AVX512VL) || AVX"));
+}
+
+TEST(InstructionSnippetsTest, IsDependencyBreakingIdiom) {
+  const auto make_instance = [](const char* mnemonic) {
+    InstructionProto proto = ParseProtoFromStringOrDie<InstructionProto>(R"(
+        vendor_syntax {
+          operands {
+            addressing_mode: DIRECT_ADDRESSING encoding: MODRM_REG_ENCODING
+            value_size_bits: 32 name: "r32" usage: USAGE_READ_WRITE }
+          operands {
+            addressing_mode: DIRECT_ADDRESSING encoding: MODRM_RM_ENCODING
+            value_size_bits: 32 name: "r32" usage: USAGE_READ }
+        })");
+    proto.mutable_vendor_syntax()->set_mnemonic(mnemonic);
+    return InstantiateSnippetInstruction(proto).ValueOrDie();
+  };
+  SnippetInstruction xor_instance = make_instance("XOR");
+  EXPECT_EQ(ToCodeString(xor_instance), "XOR ecx,ecx");
+  EXPECT_TRUE(IsDependencyBreakingIdiom(xor_instance));
+  ASSERT_TRUE(RenameRegister(2, &xor_instance.operands[1]));
+  EXPECT_FALSE(IsDependencyBreakingIdiom(xor_instance));
+  EXPECT_FALSE(IsDependencyBreakingIdiom(make_instance("ADD")));
+}
+
+}  // namespace
+}  // namespace cpu_instructions
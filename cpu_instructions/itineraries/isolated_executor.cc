@@ -0,0 +1,358 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/isolated_executor.h"
+
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#include "glog/logging.h"
+#include "strings/str_cat.h"
+#include "util/task/canonical_errors.h"
+
+namespace cpu_instructions {
+
+namespace {
+
+// The alignment of the snippets in the code buffer. This is the alignment of
+// the functions created by DirectAssembler, so the alignment of the code is
+// preserved by the copy.
+constexpr size_t kSnippetAlignmentBytes = 4096;
+
+// The interval at which the parent checks whether the worker is still alive.
+constexpr int kPollIntervalMs = 10;
+
+// The special values of SnippetSlot::result_size: the snippet did not
+// complete, or its result does not fit in the result buffer.
+constexpr int64_t kNoResult = -1;
+constexpr int64_t kResultTooLarge = -2;
+
+size_t RoundUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+void* MapSharedMemoryOrDie(size_t size_bytes, int protection) {
+  void* const data = mmap(nullptr, size_bytes, protection,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  CHECK(data != MAP_FAILED) << "mmap failed: " << strerror(errno);
+  return data;
+}
+
+// Waits for 'semaphore', retrying when interrupted by a signal.
+void WaitForSemaphore(sem_t* semaphore) {
+  while (sem_wait(semaphore) != 0) {
+    CHECK_EQ(errno, EINTR);
+  }
+}
+
+}  // namespace
+
+// The state shared by the parent, the helper and the worker. The semaphores
+// are process-shared; the other fields are accessed by one process at a time,
+// except for the atomic fields that the parent reads while the worker runs.
+struct IsolatedExecutor::ControlBlock {
+  // Posted by the parent when the worker should run the snippets of the batch
+  // starting at 'next_snippet', or stop when 'stop' is set.
+  sem_t request;
+  // Posted by the worker when it completed a request.
+  sem_t done;
+  // Posted by the parent when the helper should fork a new worker, or exit
+  // when 'stop' is set.
+  sem_t spawn;
+  // Posted by the helper when it started the worker 'worker_pid', and when the
+  // worker terminated with 'worker_wait_status'.
+  sem_t worker_started;
+  sem_t worker_exited;
+  pid_t worker_pid;
+  int worker_wait_status;
+  int num_snippets;
+  std::atomic<int> next_snippet;
+  // The number of the last request posted by the parent, and of the last
+  // requests started and completed by the worker. A post of 'done' for an
+  // earlier request is never taken for the end of the current one, and a
+  // worker that died before it started the request is not blamed for it.
+  std::atomic<uint64_t> generation;
+  std::atomic<uint64_t> started_generation;
+  std::atomic<uint64_t> completed_generation;
+  bool stop;
+};
+
+struct IsolatedExecutor::SnippetSlot {
+  size_t code_offset;
+  size_t code_size;
+  int64_t result_size;
+};
+
+IsolatedExecutor::IsolatedExecutor(const IsolatedExecutorOptions& options,
+                                   Runner runner)
+    : options_(options), runner_(std::move(runner)) {
+  CHECK_GT(options_.max_batch_size, 0);
+  CHECK_GT(options_.code_buffer_bytes, 0);
+  const size_t slots_offset = RoundUp(sizeof(ControlBlock), alignof(uint64_t));
+  const size_t results_offset =
+      slots_offset + options_.max_batch_size * sizeof(SnippetSlot);
+  control_size_bytes_ =
+      results_offset + options_.max_batch_size * options_.max_result_bytes;
+  char* const shared = static_cast<char*>(
+      MapSharedMemoryOrDie(control_size_bytes_, PROT_READ | PROT_WRITE));
+  control_ = new (shared) ControlBlock();
+  slots_ = reinterpret_cast<SnippetSlot*>(shared + slots_offset);
+  results_ = shared + results_offset;
+  for (sem_t* const semaphore :
+       {&control_->request, &control_->done, &control_->spawn,
+        &control_->worker_started, &control_->worker_exited}) {
+    CHECK_EQ(0, sem_init(semaphore, /*pshared=*/1, 0));
+  }
+  code_ = static_cast<uint8_t*>(
+      MapSharedMemoryOrDie(options_.code_buffer_bytes,
+                           PROT_READ | PROT_WRITE | PROT_EXEC));
+  const pid_t pid = fork();
+  CHECK_GE(pid, 0) << "fork failed: " << strerror(errno);
+  if (pid == 0) RunHelper();
+  helper_pid_ = pid;
+  StartWorker();
+}
+
+IsolatedExecutor::~IsolatedExecutor() {
+  control_->stop = true;
+  if (worker_pid_ != 0) {
+    CHECK_EQ(0, sem_post(&control_->request));
+    int wait_status = 0;
+    CollectWorker(/*wait=*/true, &wait_status);
+  }
+  CHECK_EQ(0, sem_post(&control_->spawn));
+  int wait_status = 0;
+  CHECK_EQ(helper_pid_, waitpid(helper_pid_, &wait_status, 0));
+  for (sem_t* const semaphore :
+       {&control_->request, &control_->done, &control_->spawn,
+        &control_->worker_started, &control_->worker_exited}) {
+    sem_destroy(semaphore);
+  }
+  control_->~ControlBlock();
+  munmap(control_, control_size_bytes_);
+  munmap(code_, options_.code_buffer_bytes);
+}
+
+Status IsolatedExecutor::AddSnippet(const VoidFunction& function) {
+  CHECK(function.IsValid());
+  const size_t code_offset = RoundUp(code_used_bytes_, kSnippetAlignmentBytes);
+  if (batch_size_ >= options_.max_batch_size ||
+      code_offset + function.size > options_.code_buffer_bytes) {
+    return util::FailedPreconditionError("The batch is full");
+  }
+  memcpy(code_ + code_offset, reinterpret_cast<const void*>(function.ptr),
+         function.size);
+  SnippetSlot& slot = slots_[batch_size_++];
+  slot.code_offset = code_offset;
+  slot.code_size = function.size;
+  slot.result_size = kNoResult;
+  code_used_bytes_ = code_offset + function.size;
+  return util::OkStatus();
+}
+
+std::vector<StatusOr<string>> IsolatedExecutor::RunBatch() {
+  std::vector<StatusOr<string>> results(batch_size_);
+  control_->num_snippets = batch_size_;
+  control_->next_snippet = 0;
+  // A worker that died since the last batch is replaced without blaming any of
+  // the snippets.
+  int wait_status = 0;
+  if (worker_pid_ != 0 && CollectWorker(/*wait=*/false, &wait_status)) {
+    LOG(WARNING) << "The worker died between two batches: "
+                 << DescribeTermination(wait_status);
+  }
+  while (control_->next_snippet < batch_size_) {
+    if (worker_pid_ == 0) {
+      StartWorker();
+      ++num_worker_restarts_;
+    }
+    const uint64_t generation = ++control_->generation;
+    CHECK_EQ(0, sem_post(&control_->request));
+    if (WaitForWorker(generation, &wait_status)) break;
+    if (control_->started_generation != generation) {
+      // The worker died before it started the request; the request is sent
+      // again to a new worker.
+      LOG(WARNING) << "The worker died before running the batch: "
+                   << DescribeTermination(wait_status);
+      continue;
+    }
+    // The worker died while running the snippet at 'next_snippet'.
+    const int failed_snippet = control_->next_snippet;
+    if (failed_snippet < batch_size_) {
+      results[failed_snippet] = util::InternalError(
+          StrCat("Snippet ", failed_snippet, " terminated the worker: ",
+                 DescribeTermination(wait_status)));
+      LOG(WARNING) << results[failed_snippet].status();
+      control_->next_snippet = failed_snippet + 1;
+    }
+  }
+  for (int i = 0; i < batch_size_; ++i) {
+    const int64_t result_size = slots_[i].result_size;
+    if (result_size == kResultTooLarge) {
+      results[i] = util::InternalError(
+          StrCat("The result of snippet ", i, " is too large"));
+    } else if (result_size >= 0) {
+      results[i] =
+          string(results_ + i * options_.max_result_bytes, result_size);
+    }
+  }
+  batch_size_ = 0;
+  code_used_bytes_ = 0;
+  return results;
+}
+
+void IsolatedExecutor::RunHelper() {
+  // The helper is single-threaded, so it can fork safely. Neither the helper
+  // nor the workers outlive their parent.
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  while (true) {
+    WaitForSemaphore(&control_->spawn);
+    if (control_->stop) _exit(0);
+    const pid_t pid = fork();
+    CHECK_GE(pid, 0) << "fork failed: " << strerror(errno);
+    if (pid == 0) {
+      prctl(PR_SET_PDEATHSIG, SIGKILL);
+      RunWorker();
+    }
+    control_->worker_pid = pid;
+    CHECK_EQ(0, sem_post(&control_->worker_started));
+    int wait_status = 0;
+    while (waitpid(pid, &wait_status, 0) != pid) {
+      CHECK_EQ(errno, EINTR);
+    }
+    control_->worker_wait_status = wait_status;
+    CHECK_EQ(0, sem_post(&control_->worker_exited));
+  }
+}
+
+void IsolatedExecutor::RunWorker() {
+  while (true) {
+    WaitForSemaphore(&control_->request);
+    if (control_->stop) _exit(0);
+    const uint64_t generation = control_->generation;
+    control_->started_generation = generation;
+    for (int i = control_->next_snippet; i < control_->num_snippets; ++i) {
+      // The parent reads 'next_snippet' to find the faulting snippet when the
+      // worker dies.
+      control_->next_snippet = i;
+      SnippetSlot& slot = slots_[i];
+      const VoidFunction function(
+          reinterpret_cast<VoidFunction::Pointer>(code_ + slot.code_offset),
+          slot.code_size);
+      const string result = runner_(function);
+      if (result.size() > options_.max_result_bytes) {
+        slot.result_size = kResultTooLarge;
+      } else {
+        memcpy(results_ + i * options_.max_result_bytes, result.data(),
+               result.size());
+        slot.result_size = result.size();
+      }
+    }
+    control_->next_snippet = control_->num_snippets;
+    control_->completed_generation = generation;
+    CHECK_EQ(0, sem_post(&control_->done));
+  }
+}
+
+void IsolatedExecutor::StartWorker() {
+  CHECK_EQ(worker_pid_, 0);
+  // The requests and the completions posted for the dead worker must not be
+  // seen by the new one.
+  while (sem_trywait(&control_->request) == 0) {
+  }
+  while (sem_trywait(&control_->done) == 0) {
+  }
+  CHECK_EQ(0, sem_post(&control_->spawn));
+  WaitForSemaphore(&control_->worker_started);
+  worker_pid_ = control_->worker_pid;
+}
+
+bool IsolatedExecutor::CollectWorker(bool wait, int* wait_status) {
+  if (wait) {
+    WaitForSemaphore(&control_->worker_exited);
+  } else if (sem_trywait(&control_->worker_exited) != 0) {
+    CHECK(errno == EAGAIN || errno == EINTR) << strerror(errno);
+    return false;
+  }
+  *wait_status = control_->worker_wait_status;
+  worker_pid_ = 0;
+  return true;
+}
+
+bool IsolatedExecutor::WaitForWorker(uint64_t generation, int* wait_status) {
+  using Clock = std::chrono::steady_clock;
+  int last_snippet = control_->next_snippet;
+  Clock::time_point last_progress_time = Clock::now();
+  while (true) {
+    timespec deadline;
+    CHECK_EQ(0, clock_gettime(CLOCK_REALTIME, &deadline));
+    deadline.tv_nsec += kPollIntervalMs * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_nsec -= 1000000000L;
+      ++deadline.tv_sec;
+    }
+    if (sem_timedwait(&control_->done, &deadline) == 0) {
+      if (control_->completed_generation == generation) return true;
+      // A stale completion of an earlier request.
+      continue;
+    }
+    CHECK(errno == ETIMEDOUT || errno == EINTR) << strerror(errno);
+
+    if (CollectWorker(/*wait=*/false, wait_status)) {
+      return control_->completed_generation == generation;
+    }
+
+    if (options_.snippet_timeout_ms > 0) {
+      const int current_snippet = control_->next_snippet;
+      const Clock::time_point now = Clock::now();
+      if (current_snippet != last_snippet) {
+        last_snippet = current_snippet;
+        last_progress_time = now;
+      } else if (now - last_progress_time >
+                 std::chrono::milliseconds(options_.snippet_timeout_ms)) {
+        // The killed worker is collected right away, so that it is never
+        // blamed for a later batch. It may have completed the request just
+        // before it was killed.
+        kill(worker_pid_, SIGKILL);
+        CollectWorker(/*wait=*/true, wait_status);
+        return control_->completed_generation == generation;
+      }
+    }
+  }
+}
+
+string IsolatedExecutor::DescribeTermination(int wait_status) {
+  if (WIFSIGNALED(wait_status)) {
+    const int signal_number = WTERMSIG(wait_status);
+    return StrCat("killed by signal ", signal_number, " (",
+                  strsignal(signal_number), ")");
+  }
+  if (WIFEXITED(wait_status)) {
+    return StrCat("exited with status ", WEXITSTATUS(wait_status));
+  }
+  return StrCat("terminated with wait status ", wait_status);
+}
+
+}  // namespace cpu_instructions
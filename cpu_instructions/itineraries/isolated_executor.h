@@ -0,0 +1,156 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Fault-isolated execution of measured code. A snippet that raises SIGILL or
+// SIGSEGV (e.g. because it uses an instruction not supported by the host, or
+// because it accesses an invalid memory address) terminates only a worker
+// process, and not the whole measurement campaign.
+//
+// The worker is forked in advance and it communicates with the parent through
+// shared memory: the parent copies the machine code of the snippets to a
+// shared executable buffer, and the worker runs a whole batch of snippets
+// without any other synchronization. When the worker dies, the snippet it was
+// running is reported as failed, a new worker is forked, and the batch
+// continues with the next snippet.
+//
+// The workers are not forked by the measurement process, which typically runs
+// threads (ParallelMeasurementPool, LLVM) that may hold locks at the time of
+// the fork. Instead, the constructor forks a single-threaded helper process,
+// and the helper forks the workers on request. The executor must therefore be
+// created before the process starts any threads.
+
+#ifndef CPU_INSTRUCTIONS_ITINERARIES_ISOLATED_EXECUTOR_H_
+#define CPU_INSTRUCTIONS_ITINERARIES_ISOLATED_EXECUTOR_H_
+
+#include <sys/types.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/llvm/inline_asm.h"
+#include "util/task/status.h"
+#include "util/task/statusor.h"
+
+namespace cpu_instructions {
+
+using ::cpu_instructions::util::Status;
+using ::cpu_instructions::util::StatusOr;
+
+struct IsolatedExecutorOptions {
+  // The size of the shared buffer for the machine code of a batch.
+  size_t code_buffer_bytes = 64 << 20;
+  // The maximal number of snippets in a batch.
+  int max_batch_size = 4096;
+  // The maximal size of the result of a single snippet.
+  size_t max_result_bytes = 4096;
+  // The worker is killed if a single snippet runs longer than this, and the
+  // snippet is reported as failed. Zero disables the timeout, and a snippet
+  // that never returns then blocks the executor forever.
+  int snippet_timeout_ms = 5000;
+};
+
+// Runs batches of snippets in a worker process. Not thread-safe.
+class IsolatedExecutor {
+ public:
+  // Runs a snippet in the worker process, and returns its result. 'function'
+  // points to the copy of the snippet in the shared buffer. The result must
+  // not be longer than IsolatedExecutorOptions::max_result_bytes.
+  using Runner = std::function<string(const VoidFunction& function)>;
+
+  // Creates the shared memory, forks the helper process, and starts the first
+  // worker. The worker runs 'runner' on the snippets. Must be called before
+  // the process starts any threads; see the comment at the top of the file.
+  IsolatedExecutor(const IsolatedExecutorOptions& options, Runner runner);
+
+  // Stops the worker and the helper process.
+  ~IsolatedExecutor();
+
+  IsolatedExecutor(const IsolatedExecutor&) = delete;
+  IsolatedExecutor& operator=(const IsolatedExecutor&) = delete;
+
+  // Adds a copy of the machine code of 'function' to the next batch. The code
+  // must be position-independent; this is the case for the functions created
+  // by DirectAssembler. Each snippet starts at a page boundary of the shared
+  // buffer. Returns an error when the batch is full.
+  Status AddSnippet(const VoidFunction& function);
+
+  // Returns the number of snippets in the next batch.
+  int batch_size() const { return batch_size_; }
+
+  // Runs all snippets of the batch in the worker, and starts a new batch.
+  // Returns the results of the runner in the order of the snippets, or an
+  // error for the snippets that terminated the worker.
+  std::vector<StatusOr<string>> RunBatch();
+
+  // Returns the number of times a worker was forked after the first one.
+  int num_worker_restarts() const { return num_worker_restarts_; }
+
+  // Returns the process id of the current worker.
+  pid_t worker_pid() const { return worker_pid_; }
+
+ private:
+  struct ControlBlock;
+  struct SnippetSlot;
+
+  // The main loop of the helper process: forks a worker whenever the parent
+  // asks for one, and reports its termination. Never returns.
+  void RunHelper();
+
+  // The main loop of the worker process. Never returns.
+  void RunWorker();
+
+  // Asks the helper for a new worker, and waits until it is started. The
+  // previous worker must be dead.
+  void StartWorker();
+
+  // Returns true if the worker died, and stores its wait status to
+  // 'wait_status'. With 'wait', blocks until the worker dies.
+  bool CollectWorker(bool wait, int* wait_status);
+
+  // Waits until the worker finishes the request 'generation', or until it
+  // dies. Returns true if the request was completed. Otherwise, stores the
+  // status of the dead worker to 'wait_status'. When a snippet runs longer
+  // than the timeout, the worker is killed. The worker is never running when
+  // this returns false.
+  bool WaitForWorker(uint64_t generation, int* wait_status);
+
+  // Returns the error message for a worker that terminated with 'wait_status'.
+  static string DescribeTermination(int wait_status);
+
+  const IsolatedExecutorOptions options_;
+  const Runner runner_;
+
+  // The shared memory: the control block followed by the snippet slots and
+  // the results, and the executable code buffer. Both are mapped before the
+  // first fork, so all the workers see the same pages as the parent.
+  ControlBlock* control_ = nullptr;
+  size_t control_size_bytes_ = 0;
+  SnippetSlot* slots_ = nullptr;
+  char* results_ = nullptr;
+  uint8_t* code_ = nullptr;
+
+  int batch_size_ = 0;
+  size_t code_used_bytes_ = 0;
+
+  pid_t helper_pid_ = 0;
+  // The current worker, or zero when it died and was not restarted yet.
+  pid_t worker_pid_ = 0;
+  int num_worker_restarts_ = 0;
+};
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_ITINERARIES_ISOLATED_EXECUTOR_H_
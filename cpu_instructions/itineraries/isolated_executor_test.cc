@@ -0,0 +1,147 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/isolated_executor.h"
+
+#include <signal.h>
+#include <cstdint>
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/testing/test_util.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "strings/str_cat.h"
+
+namespace cpu_instructions {
+namespace {
+
+using ::testing::HasSubstr;
+
+// Machine code of small void() functions.
+constexpr uint8_t kReturn[] = {0xc3};
+// ud2
+constexpr uint8_t kIllegalInstruction[] = {0x0f, 0x0b};
+// mov rax, qword ptr [0]; ret
+constexpr uint8_t kInvalidMemoryAccess[] = {0x48, 0x8b, 0x04, 0x25, 0x00,
+                                            0x00, 0x00, 0x00, 0xc3};
+// jmp $
+constexpr uint8_t kInfiniteLoop[] = {0xeb, 0xfe};
+
+template <size_t kSize>
+VoidFunction MakeFunction(const uint8_t (&code)[kSize]) {
+  return VoidFunction(reinterpret_cast<VoidFunction::Pointer>(
+                          const_cast<uint8_t*>(code)),
+                      kSize);
+}
+
+// Calls the function, and returns its size as the result.
+string RunAndReturnSize(const VoidFunction& function) {
+  function.CallOrDie();
+  return StrCat(function.size);
+}
+
+TEST(IsolatedExecutorTest, RunsABatch) {
+  IsolatedExecutor executor(IsolatedExecutorOptions(), &RunAndReturnSize);
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_OK(executor.AddSnippet(MakeFunction(kReturn)));
+  }
+  EXPECT_EQ(executor.batch_size(), 10);
+  const std::vector<StatusOr<string>> results = executor.RunBatch();
+  ASSERT_EQ(results.size(), 10);
+  for (const StatusOr<string>& result : results) {
+    ASSERT_OK(result.status());
+    EXPECT_EQ(result.ValueOrDie(), "1");
+  }
+  EXPECT_EQ(executor.batch_size(), 0);
+  EXPECT_EQ(executor.num_worker_restarts(), 0);
+}
+
+TEST(IsolatedExecutorTest, SkipsFaultingSnippets) {
+  IsolatedExecutor executor(IsolatedExecutorOptions(), &RunAndReturnSize);
+  ASSERT_OK(executor.AddSnippet(MakeFunction(kReturn)));
+  ASSERT_OK(executor.AddSnippet(MakeFunction(kIllegalInstruction)));
+  ASSERT_OK(executor.AddSnippet(MakeFunction(kInvalidMemoryAccess)));
+  ASSERT_OK(executor.AddSnippet(MakeFunction(kReturn)));
+  const std::vector<StatusOr<string>> results = executor.RunBatch();
+  ASSERT_EQ(results.size(), 4);
+  EXPECT_OK(results[0].status());
+  EXPECT_THAT(results[1].status().ToString(), HasSubstr("signal 4"));
+  EXPECT_THAT(results[2].status().ToString(), HasSubstr("signal 11"));
+  ASSERT_OK(results[3].status());
+  EXPECT_EQ(results[3].ValueOrDie(), "1");
+  EXPECT_EQ(executor.num_worker_restarts(), 2);
+
+  // The executor still works after the faults.
+  ASSERT_OK(executor.AddSnippet(MakeFunction(kReturn)));
+  const std::vector<StatusOr<string>> next_results = executor.RunBatch();
+  ASSERT_EQ(next_results.size(), 1);
+  EXPECT_OK(next_results[0].status());
+}
+
+TEST(IsolatedExecutorTest, KillsSnippetsThatTimeOut) {
+  IsolatedExecutorOptions options;
+  options.snippet_timeout_ms = 100;
+  IsolatedExecutor executor(options, &RunAndReturnSize);
+  ASSERT_OK(executor.AddSnippet(MakeFunction(kInfiniteLoop)));
+  ASSERT_OK(executor.AddSnippet(MakeFunction(kReturn)));
+  const std::vector<StatusOr<string>> results = executor.RunBatch();
+  ASSERT_EQ(results.size(), 2);
+  EXPECT_THAT(results[0].status().ToString(), HasSubstr("signal 9"));
+  EXPECT_OK(results[1].status());
+}
+
+TEST(IsolatedExecutorTest, TimesOutByDefault) {
+  EXPECT_GT(IsolatedExecutorOptions().snippet_timeout_ms, 0);
+}
+
+TEST(IsolatedExecutorTest, ReplacesAWorkerThatDiedBetweenBatches) {
+  IsolatedExecutor executor(IsolatedExecutorOptions(), &RunAndReturnSize);
+  ASSERT_OK(executor.AddSnippet(MakeFunction(kReturn)));
+  ASSERT_OK(executor.RunBatch()[0].status());
+  ASSERT_EQ(0, kill(executor.worker_pid(), SIGKILL));
+  // No snippet is blamed for the death of the worker.
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_OK(executor.AddSnippet(MakeFunction(kReturn)));
+  }
+  const std::vector<StatusOr<string>> results = executor.RunBatch();
+  ASSERT_EQ(results.size(), 3);
+  for (const StatusOr<string>& result : results) {
+    EXPECT_OK(result.status());
+  }
+  EXPECT_EQ(executor.num_worker_restarts(), 1);
+}
+
+TEST(IsolatedExecutorTest, ResultTooLarge) {
+  IsolatedExecutorOptions options;
+  options.max_result_bytes = 4;
+  IsolatedExecutor executor(
+      options, [](const VoidFunction& function) { return string(5, 'x'); });
+  ASSERT_OK(executor.AddSnippet(MakeFunction(kReturn)));
+  const std::vector<StatusOr<string>> results = executor.RunBatch();
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_THAT(results[0].status().ToString(), HasSubstr("too large"));
+}
+
+TEST(IsolatedExecutorTest, BatchIsFull) {
+  IsolatedExecutorOptions options;
+  options.max_batch_size = 2;
+  IsolatedExecutor executor(options, &RunAndReturnSize);
+  EXPECT_OK(executor.AddSnippet(MakeFunction(kReturn)));
+  EXPECT_OK(executor.AddSnippet(MakeFunction(kReturn)));
+  EXPECT_FALSE(executor.AddSnippet(MakeFunction(kReturn)).ok());
+}
+
+}  // namespace
+}  // namespace cpu_instructions
@@ -14,18 +14,48 @@
 
 #include "cpu_instructions/itineraries/jit_perf_evaluator.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <limits>
 #include <map>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
 #include <vector>
 #include "strings/string.h"
 
 #include "base/stringprintf.h"
+#include "cpu_instructions/base/cpu_model.h"
+#include "cpu_instructions/base/host_cpu.h"
+#include "cpu_instructions/itineraries/perf_event_scheduler.h"
 #include "cpu_instructions/itineraries/perf_subsystem.h"
+#include "cpu_instructions/llvm/direct_assembler.h"
 #include "cpu_instructions/llvm/inline_asm.h"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
 #include "strings/str_cat.h"
+#include "strings/str_split.h"
+#include "strings/strip.h"
 #include "util/gtl/map_util.h"
+#include "util/gtl/ptr_util.h"
 #include "util/task/canonical_errors.h"
 #include "util/task/status.h"
+#include "util/task/statusor.h"
+
+DEFINE_string(cpu_instructions_jit_object_cache_dir, "",
+              "When not empty, the object code compiled for the measured code "
+              "is cached in this directory, and reused by later runs.");
+DEFINE_bool(cpu_instructions_subtract_harness_overhead, false,
+            "Measure the code of EvaluateAssemblyString with an empty "
+            "measured code, and subtract the result from the measurements. "
+            "This removes the cost of the loop, of the update code, and of "
+            "the prefix and suffix code.");
+DEFINE_bool(cpu_instructions_use_huge_pages, false,
+            "Place the measured code and the scratch buffers on huge pages, "
+            "to avoid TLB misses during the measurements. Uses MAP_HUGETLB "
+            "or transparent huge pages when available.");
 
 namespace cpu_instructions {
 
@@ -35,22 +65,184 @@ std::string RepeatCode(int num_repeats, const std::string& code) {
 }
 
 using util::OkStatus;
+using util::StatusOr;
+
+HugePagePolicy GetHugePagePolicy() {
+  return FLAGS_cpu_instructions_use_huge_pages ? PREFER_HUGE_PAGES
+                                               : REGULAR_PAGES_ONLY;
+}
+
+// The size of the L1 instruction cache used when the actual size is not known.
+constexpr int kDefaultL1InstructionCacheBytes = 1 << 15;
 
 }  // namespace
 
-// The list of perf events we want to measure.
-constexpr const PerfSubsystem::EventCategory kPerfEventCategories[] = {
-    &PerfEventsProto::cycle_events, &PerfEventsProto::computation_events,
-    &PerfEventsProto::memory_events, &PerfEventsProto::uops_events};
+void MeasureFunction(const VoidFunction& function, PerfResult* result) {
+  PerfSubsystem perf_subsystem;
+  MeasureFunction(function, &perf_subsystem, result);
+}
 
-Status EvaluateAssemblyString(
-    llvm::InlineAsm::AsmDialect dialect, const string& mcpu,
-    const int num_outer_iterations, const int num_inner_iterations,
+void MeasureFunction(const VoidFunction& function,
+                     PerfSubsystem* perf_subsystem, PerfResult* result) {
+  CHECK(perf_subsystem != nullptr);
+  std::vector<TimingInfo> before;
+  std::vector<TimingInfo> after;
+  for (const std::vector<string>& events :
+       SchedulePerfEvents(perf_subsystem->GetHostEvents(),
+                          perf_subsystem->GetCounterCapacity())) {
+    perf_subsystem->StartCollectingEventGroup(events);
+    if (perf_subsystem->CanReadCountersInUserSpace()) {
+      // Reading the counters with rdpmc right before and after the call keeps
+      // the system calls that start and stop the counters out of the
+      // measurement.
+      perf_subsystem->SnapshotCounters(&before);
+      function.CallOrDie();
+      perf_subsystem->SnapshotCounters(&after);
+      perf_subsystem->StopAndReadCounters();
+      result->Accumulate(perf_subsystem->SnapshotDifference(before, after));
+    } else {
+      function.CallOrDie();
+      result->Accumulate(perf_subsystem->StopAndReadCounters());
+    }
+  }
+}
+
+PerfEventGroups::PerfEventGroups()
+    : PerfEventGroups([]() -> std::unique_ptr<PerfCounterBackend> {
+        return gtl::MakeUnique<LibPfmCounterBackend>();
+      }) {}
+
+PerfEventGroups::PerfEventGroups(
+    const std::function<std::unique_ptr<PerfCounterBackend>()>&
+        make_backend) {
+  // The first group reuses the perf subsystem used for the scheduling.
+  std::unique_ptr<PerfSubsystem> host =
+      gtl::MakeUnique<PerfSubsystem>(make_backend());
+  const std::vector<std::vector<string>> schedule =
+      SchedulePerfEvents(host->GetHostEvents(), host->GetCounterCapacity());
+  for (const std::vector<string>& events : schedule) {
+    std::unique_ptr<PerfSubsystem> group =
+        host != nullptr ? std::move(host)
+                        : gtl::MakeUnique<PerfSubsystem>(make_backend());
+    // The counters are added disabled; they count only between StartCollecting
+    // and StopCollecting.
+    for (const string& event : events) {
+      group->AddEvent(event);
+    }
+    groups_.push_back(std::move(group));
+  }
+}
+
+void PerfEventGroups::MeasureFunction(const VoidFunction& function,
+                                      PerfResult* result) {
+  CHECK(result != nullptr);
+  for (const std::unique_ptr<PerfSubsystem>& group : groups_) {
+    if (group->CanReadCountersInUserSpace()) {
+      // Reading the counters with rdpmc while they run keeps the system calls
+      // that start and stop them out of the measurement.
+      group->StartCollecting();
+      group->SnapshotCounters(&before_);
+      function.CallOrDie();
+      group->SnapshotCounters(&after_);
+      group->StopCollecting();
+    } else {
+      group->SnapshotCounters(&before_);
+      group->StartCollecting();
+      function.CallOrDie();
+      group->StopCollecting();
+      group->SnapshotCounters(&after_);
+    }
+    result->Accumulate(group->SnapshotDifference(before_, after_));
+  }
+}
+
+string MeasureFunctionToString(const VoidFunction& function) {
+  PerfResult result;
+  MeasureFunction(function, &result);
+  return result.SerializeToString();
+}
+
+std::unique_ptr<MappedMemory> AllocateScratchMemory(size_t size_bytes) {
+  return MappedMemory::Create(size_bytes, GetHugePagePolicy(),
+                              /*executable=*/false);
+}
+
+CodeCacheSizes GetCodeCacheSizes(const CpuModel* cpu_model) {
+  CodeCacheSizes sizes;
+  sizes.l1_instruction_cache_bytes = kDefaultL1InstructionCacheBytes;
+  if (cpu_model == nullptr) return sizes;
+  const CpuModelProto& cpu_model_proto = cpu_model->proto();
+  if (cpu_model_proto.l1_instruction_cache().size() > 0) {
+    sizes.l1_instruction_cache_bytes =
+        cpu_model_proto.l1_instruction_cache().size();
+  }
+  sizes.decoded_stream_buffer_uops = cpu_model->microarchitecture()
+                                         .proto()
+                                         .decoded_stream_buffer()
+                                         .size();
+  return sizes;
+}
+
+CodeCacheSizes GetHostCodeCacheSizes() {
+  return GetCodeCacheSizes(CpuModel::FromCpuId(HostCpuInfo::Get().cpu_id()));
+}
+
+int CountAssemblyStatements(const string& code) {
+  int num_statements = 0;
+  for (const string& line : strings::Split(code, "\n")) {
+    for (string statement : strings::Split(line, ";")) {
+      const size_t comment_start = statement.find('#');
+      if (comment_start != string::npos) statement.resize(comment_start);
+      StripWhitespace(&statement);
+      if (statement.empty() || statement[0] == '.' ||
+          statement.back() == ':') {
+        continue;
+      }
+      ++num_statements;
+    }
+  }
+  return num_statements;
+}
+
+int ComputeUnrollFactor(const CodeCacheSizes& cache_sizes, int body_size_bytes,
+                        int body_num_instructions, int max_unroll_factor) {
+  CHECK_GE(max_unroll_factor, 1);
+  int unroll_factor = max_unroll_factor;
+  if (body_size_bytes > 0) {
+    unroll_factor =
+        std::min(unroll_factor,
+                 cache_sizes.l1_instruction_cache_bytes / body_size_bytes);
+  }
+  const int dsb_size_uops = cache_sizes.decoded_stream_buffer_uops;
+  if (dsb_size_uops > 0 && body_num_instructions > 0 &&
+      body_num_instructions <= dsb_size_uops) {
+    unroll_factor =
+        std::min(unroll_factor, dsb_size_uops / body_num_instructions);
+  }
+  return std::max(1, unroll_factor);
+}
+
+std::unique_ptr<JitCompiler> MakeMeasurementJitCompiler(
+    llvm::InlineAsm::AsmDialect dialect, const string& mcpu) {
+  auto jit = gtl::MakeUnique<JitCompiler>(dialect, mcpu,
+                                          JitCompiler::RETURN_NULLPTR_ON_ERROR);
+  jit->SetHugePagePolicy(GetHugePagePolicy());
+  if (!FLAGS_cpu_instructions_jit_object_cache_dir.empty()) {
+    jit->EnableObjectCache(FLAGS_cpu_instructions_jit_object_cache_dir);
+  }
+  return jit;
+}
+
+namespace {
+
+// Compiles the function measured by EvaluateAssemblyString with 'jit'. Returns
+// an undefined function and sets 'status' on error.
+VoidFunction CompileMeasuredFunction(
+    JitCompiler* jit, int num_outer_iterations, int num_inner_iterations,
     const std::string& init_code, const std::string& prefix_code,
     const std::string& measured_code, const std::string& update_code,
     const std::string& suffix_code, const std::string& cleanup_code,
-    const std::string& constraints, PerfResult* result) {
-  JitCompiler jit(dialect, mcpu, JitCompiler::RETURN_NULLPTR_ON_ERROR);
+    const std::string& constraints, Status* status) {
   const string code =
       StrCat(prefix_code, "\n",
              RepeatCode(num_inner_iterations,
@@ -58,34 +250,393 @@ Status EvaluateAssemblyString(
              "\n", suffix_code);
   // NOTE(bdb): constraints are the same for 'code', 'init_code' and
   // 'cleanup_code'.
-  VoidFunction inline_asm_function = jit.CompileInlineAssemblyToFunction(
+  VoidFunction inline_asm_function = jit->CompileInlineAssemblyToFunction(
       num_outer_iterations, init_code, constraints, code, constraints,
       cleanup_code, constraints);
   if (!inline_asm_function.IsValid()) {
-    return util::UnknownError("Could not compile the measured code");
+    *status = util::UnknownError("Could not compile the measured code");
+    return VoidFunction::Undefined();
   }
 
   // Because of the decode window size, a large instruction is likely going to
   // take at least 1 cycle on average.
   // Make sure that the repeated instruction fits in the cache to avoid noise
   // from cache misses.
-  constexpr int kL1CodeCacheSize = 1 << 15;
-  if (inline_asm_function.size >= kL1CodeCacheSize) {
-    return util::UnknownError(
+  if (inline_asm_function.size >=
+      GetHostCodeCacheSizes().l1_instruction_cache_bytes) {
+    *status = util::UnknownError(
         StrCat("Cannot fit ", num_inner_iterations,
                " repetitions of the measured code in the L1 cache"));
+    return VoidFunction::Undefined();
   }
+  *status = OkStatus();
+  return inline_asm_function;
+}
 
+// The parameters of EvaluateAssemblyString that determine the overhead of the
+// harness: the dialect, the CPU, the iteration counts, the init, prefix,
+// update, suffix and cleanup code, and the constraints.
+using HarnessKey = std::tuple<int, string, int, int, string, string, string,
+                              string, string, string>;
+
+// The baselines measured by GetHarnessBaseline, and the mutex that protects
+// them. A baseline is added to the map when its calibration starts, so that
+// the other threads that need it wait for the result instead of calibrating
+// the same harness again.
+std::mutex harness_baselines_mutex;
+std::map<HarnessKey, std::shared_future<StatusOr<PerfResult>>>* const
+    harness_baselines =
+        new std::map<HarnessKey, std::shared_future<StatusOr<PerfResult>>>();
+
+// Compiles the harness of EvaluateAssemblyString with an empty measured code,
+// and measures it with 'perf_subsystem'.
+StatusOr<PerfResult> MeasureHarnessBaseline(
+    PerfSubsystem* perf_subsystem, llvm::InlineAsm::AsmDialect dialect,
+    const string& mcpu, const int num_outer_iterations,
+    const int num_inner_iterations, const std::string& init_code,
+    const std::string& prefix_code, const std::string& update_code,
+    const std::string& suffix_code, const std::string& cleanup_code,
+    const std::string& constraints) {
+  const std::unique_ptr<JitCompiler> jit =
+      MakeMeasurementJitCompiler(dialect, mcpu);
+  Status status;
+  const VoidFunction empty_function = CompileMeasuredFunction(
+      jit.get(), num_outer_iterations, num_inner_iterations, init_code,
+      prefix_code, /*measured_code=*/"", update_code, suffix_code,
+      cleanup_code, constraints, &status);
+  if (!status.ok()) return status;
+  // The baseline is reused for many measurements; the robust estimate is
+  // worth the additional runs.
+  const auto run = [&empty_function, perf_subsystem, num_outer_iterations,
+                    num_inner_iterations](PerfResult* run_result) {
+    MeasureFunction(empty_function, perf_subsystem, run_result);
+    run_result->SetScaleFactor(static_cast<uint64_t>(num_outer_iterations) *
+                               num_inner_iterations);
+    return OkStatus();
+  };
+  PerfResult baseline;
+  status = MeasureAdaptively(AdaptiveMeasurementOptions(), run, &baseline);
+  if (!status.ok()) return status;
+  VLOG(1) << "Harness baseline: " << baseline.ToString();
+  return baseline;
+}
+
+}  // namespace
+
+Status GetHarnessBaseline(
+    PerfSubsystem* perf_subsystem, llvm::InlineAsm::AsmDialect dialect,
+    const string& mcpu, const int num_outer_iterations,
+    const int num_inner_iterations, const std::string& init_code,
+    const std::string& prefix_code, const std::string& update_code,
+    const std::string& suffix_code, const std::string& cleanup_code,
+    const std::string& constraints, PerfResult* baseline) {
+  CHECK(perf_subsystem != nullptr);
+  CHECK(baseline != nullptr);
+  const HarnessKey key(dialect, mcpu, num_outer_iterations,
+                       num_inner_iterations, init_code, prefix_code,
+                       update_code, suffix_code, cleanup_code, constraints);
+  std::promise<StatusOr<PerfResult>> calibration;
+  std::shared_future<StatusOr<PerfResult>> cached;
+  bool calibrate = false;
+  {
+    std::lock_guard<std::mutex> lock(harness_baselines_mutex);
+    std::shared_future<StatusOr<PerfResult>>& entry = (*harness_baselines)[key];
+    if (!entry.valid()) {
+      entry = calibration.get_future().share();
+      calibrate = true;
+    }
+    cached = entry;
+  }
+  // The errors are cached too: they come from the compilation of the harness,
+  // which depends only on the key.
+  if (calibrate) {
+    calibration.set_value(MeasureHarnessBaseline(
+        perf_subsystem, dialect, mcpu, num_outer_iterations,
+        num_inner_iterations, init_code, prefix_code, update_code, suffix_code,
+        cleanup_code, constraints));
+  }
+  const StatusOr<PerfResult>& baseline_or_status = cached.get();
+  if (!baseline_or_status.ok()) return baseline_or_status.status();
+  *baseline = baseline_or_status.ValueOrDie();
+  return OkStatus();
+}
+
+void ClearHarnessBaselines() {
+  std::lock_guard<std::mutex> lock(harness_baselines_mutex);
+  harness_baselines->clear();
+}
+
+namespace {
+
+// Subtracts the overhead of the harness from 'result' when this is enabled by
+// the command-line flag.
+Status MaybeSubtractHarnessBaseline(
+    PerfSubsystem* perf_subsystem, llvm::InlineAsm::AsmDialect dialect,
+    const string& mcpu, int num_outer_iterations, int num_inner_iterations,
+    const std::string& init_code, const std::string& prefix_code,
+    const std::string& update_code, const std::string& suffix_code,
+    const std::string& cleanup_code, const std::string& constraints,
+    PerfResult* result) {
+  if (!FLAGS_cpu_instructions_subtract_harness_overhead) return OkStatus();
+  PerfResult baseline;
+  const Status status = GetHarnessBaseline(
+      perf_subsystem, dialect, mcpu, num_outer_iterations,
+      num_inner_iterations, init_code, prefix_code, update_code, suffix_code,
+      cleanup_code, constraints, &baseline);
+  if (!status.ok()) return status;
+  result->SubtractBaseline(baseline);
+  return OkStatus();
+}
+
+}  // namespace
+
+Status EvaluateAssemblyString(
+    llvm::InlineAsm::AsmDialect dialect, const string& mcpu,
+    const int num_outer_iterations, const int num_inner_iterations,
+    const std::string& init_code, const std::string& prefix_code,
+    const std::string& measured_code, const std::string& update_code,
+    const std::string& suffix_code, const std::string& cleanup_code,
+    const std::string& constraints, PerfResult* result) {
+  const std::unique_ptr<JitCompiler> jit =
+      MakeMeasurementJitCompiler(dialect, mcpu);
   PerfSubsystem perf_subsystem;
-  for (const auto& events : kPerfEventCategories) {
-    perf_subsystem.StartCollectingEvents(events);
-    inline_asm_function.CallOrDie();
-    result->Accumulate(perf_subsystem.StopAndReadCounters());
+  return EvaluateAssemblyString(
+      jit.get(), &perf_subsystem, dialect, mcpu, num_outer_iterations,
+      num_inner_iterations, init_code, prefix_code, measured_code, update_code,
+      suffix_code, cleanup_code, constraints, result);
+}
+
+Status EvaluateAssemblyString(
+    JitCompiler* jit, PerfSubsystem* perf_subsystem,
+    llvm::InlineAsm::AsmDialect dialect, const string& mcpu,
+    const int num_outer_iterations, const int num_inner_iterations,
+    const std::string& init_code, const std::string& prefix_code,
+    const std::string& measured_code, const std::string& update_code,
+    const std::string& suffix_code, const std::string& cleanup_code,
+    const std::string& constraints, PerfResult* result) {
+  CHECK(jit != nullptr);
+  Status status;
+  const VoidFunction inline_asm_function = CompileMeasuredFunction(
+      jit, num_outer_iterations, num_inner_iterations, init_code, prefix_code,
+      measured_code, update_code, suffix_code, cleanup_code, constraints,
+      &status);
+  if (!status.ok()) return status;
+
+  MeasureFunction(inline_asm_function, perf_subsystem, result);
+  result->SetScaleFactor(static_cast<uint64_t>(num_outer_iterations) *
+                         num_inner_iterations);
+  result->SetCodePageBacking(jit->code_page_backing());
+  return MaybeSubtractHarnessBaseline(
+      perf_subsystem, dialect, mcpu, num_outer_iterations,
+      num_inner_iterations, init_code, prefix_code, update_code, suffix_code,
+      cleanup_code, constraints, result);
+}
+
+Status EvaluateAssemblyStringAdaptively(
+    llvm::InlineAsm::AsmDialect dialect, const string& mcpu,
+    const int num_outer_iterations, const int num_inner_iterations,
+    const std::string& init_code, const std::string& prefix_code,
+    const std::string& measured_code, const std::string& update_code,
+    const std::string& suffix_code, const std::string& cleanup_code,
+    const std::string& constraints, const AdaptiveMeasurementOptions& options,
+    PerfResult* result) {
+  const std::unique_ptr<JitCompiler> jit =
+      MakeMeasurementJitCompiler(dialect, mcpu);
+  Status status;
+  const VoidFunction inline_asm_function = CompileMeasuredFunction(
+      jit.get(), num_outer_iterations, num_inner_iterations, init_code,
+      prefix_code, measured_code, update_code, suffix_code, cleanup_code,
+      constraints, &status);
+  if (!status.ok()) return status;
+
+  // The function is compiled once, and measured as many times as needed. The
+  // counters are opened once for all the runs.
+  PerfEventGroups perf_event_groups;
+  const auto run = [&inline_asm_function, &perf_event_groups,
+                    num_outer_iterations,
+                    num_inner_iterations](PerfResult* run_result) {
+    perf_event_groups.MeasureFunction(inline_asm_function, run_result);
+    run_result->SetScaleFactor(static_cast<uint64_t>(num_outer_iterations) *
+                               num_inner_iterations);
+    return OkStatus();
+  };
+  status = MeasureAdaptively(options, run, result);
+  if (!status.ok()) return status;
+  result->SetCodePageBacking(jit->code_page_backing());
+  PerfSubsystem perf_subsystem;
+  return MaybeSubtractHarnessBaseline(
+      &perf_subsystem, dialect, mcpu, num_outer_iterations,
+      num_inner_iterations, init_code, prefix_code, update_code, suffix_code,
+      cleanup_code, constraints, result);
+}
+
+namespace {
+
+// Builds the description of the function used by EvaluateUnrolledAssemblyString
+// and by EvaluateAlignmentSweep. Computes the unroll factor when it is not
+// given by 'options'.
+Status MakeUnrolledLoopCode(DirectAssembler* assembler,
+                            const UnrolledLoopOptions& options,
+                            const CodeCacheSizes& cache_sizes,
+                            const std::string& init_code,
+                            const std::string& prefix_code,
+                            const std::string& measured_code,
+                            const std::string& update_code,
+                            const std::string& suffix_code,
+                            const std::string& cleanup_code,
+                            UnrolledLoopCode* code) {
+  code->num_iterations = options.num_outer_iterations;
+  code->loop_alignment_bytes = options.loop_alignment_bytes;
+  code->body_alignment_bytes = options.body_alignment_bytes;
+  code->loop_offset_bytes = options.loop_offset_bytes;
+  code->init_code = init_code;
+  code->prefix_code = prefix_code;
+  code->body_code = StrCat(measured_code, "\n", update_code);
+  code->suffix_code = suffix_code;
+  code->cleanup_code = cleanup_code;
+
+  code->unroll_factor = options.unroll_factor;
+  if (code->unroll_factor == 0) {
+    const auto body_or_status = assembler->AssembleToBytes(code->body_code);
+    if (!body_or_status.ok()) return body_or_status.status();
+    // Each copy of the body is padded to the requested alignment.
+    const int body_size = body_or_status.ValueOrDie().size();
+    const int padded_body_size =
+        (body_size + options.body_alignment_bytes - 1) /
+        options.body_alignment_bytes * options.body_alignment_bytes;
+    const int num_body_instructions =
+        options.num_measured_instructions > 0
+            ? options.num_measured_instructions +
+                  CountAssemblyStatements(update_code)
+            : CountAssemblyStatements(code->body_code);
+    code->unroll_factor =
+        ComputeUnrollFactor(cache_sizes, padded_body_size,
+                            num_body_instructions, options.max_unroll_factor);
+    VLOG(1) << "Using unroll factor " << code->unroll_factor;
+  }
+  return OkStatus();
+}
+
+// Assembles the function described by 'code', and measures it.
+Status MeasureUnrolledLoop(DirectAssembler* assembler,
+                           const UnrolledLoopCode& code,
+                           const CodeCacheSizes& cache_sizes,
+                           const MappedMemory* scratch_memory,
+                           PerfResult* result) {
+  if (scratch_memory != nullptr) {
+    result->SetDataPageBacking(scratch_memory->backing());
   }
-  result->SetScaleFactor(num_outer_iterations * num_inner_iterations);
+  const VoidFunction function = assembler->AssembleUnrolledLoop(code);
+  if (!function.IsValid()) {
+    return util::UnknownError("Could not assemble the measured code");
+  }
+  if (function.size >= cache_sizes.l1_instruction_cache_bytes) {
+    return util::UnknownError(
+        StrCat("Cannot fit ", code.unroll_factor,
+               " repetitions of the measured code in the L1 cache"));
+  }
+
+  MeasureFunction(function, result);
+  result->SetScaleFactor(static_cast<uint64_t>(code.num_iterations) *
+                         code.unroll_factor);
+  result->SetCodePageBacking(assembler->code_page_backing());
   return OkStatus();
 }
 
+}  // namespace
+
+Status EvaluateUnrolledAssemblyString(
+    llvm::InlineAsm::AsmDialect dialect, const string& mcpu,
+    const UnrolledLoopOptions& options, const std::string& init_code,
+    const std::string& prefix_code, const std::string& measured_code,
+    const std::string& update_code, const std::string& suffix_code,
+    const std::string& cleanup_code, PerfResult* result) {
+  CHECK(result != nullptr);
+  DirectAssembler assembler(dialect, mcpu);
+  assembler.SetHugePagePolicy(GetHugePagePolicy());
+  const CodeCacheSizes cache_sizes = GetHostCodeCacheSizes();
+  UnrolledLoopCode code;
+  const Status status = MakeUnrolledLoopCode(
+      &assembler, options, cache_sizes, init_code, prefix_code, measured_code,
+      update_code, suffix_code, cleanup_code, &code);
+  if (!status.ok()) return status;
+  return MeasureUnrolledLoop(&assembler, code, cache_sizes,
+                             options.scratch_memory, result);
+}
+
+std::vector<int> MakeLoopOffsets(int boundary_bytes, int step_bytes) {
+  CHECK_GT(boundary_bytes, 0);
+  CHECK_GT(step_bytes, 0);
+  std::vector<int> offsets;
+  for (int offset = 0; offset < boundary_bytes; offset += step_bytes) {
+    offsets.push_back(offset);
+  }
+  return offsets;
+}
+
+Status EvaluateAlignmentSweep(
+    llvm::InlineAsm::AsmDialect dialect, const string& mcpu,
+    const UnrolledLoopOptions& options,
+    const std::vector<int>& loop_offsets_bytes, const std::string& init_code,
+    const std::string& prefix_code, const std::string& measured_code,
+    const std::string& update_code, const std::string& suffix_code,
+    const std::string& cleanup_code,
+    std::vector<AlignmentSweepPoint>* results) {
+  CHECK(results != nullptr);
+  results->clear();
+  DirectAssembler assembler(dialect, mcpu);
+  assembler.SetHugePagePolicy(GetHugePagePolicy());
+  const CodeCacheSizes cache_sizes = GetHostCodeCacheSizes();
+  // The unroll factor is computed only once, so that all the points of the
+  // sweep execute exactly the same instructions.
+  UnrolledLoopCode code;
+  const Status status = MakeUnrolledLoopCode(
+      &assembler, options, cache_sizes, init_code, prefix_code, measured_code,
+      update_code, suffix_code, cleanup_code, &code);
+  if (!status.ok()) return status;
+  for (const int offset : loop_offsets_bytes) {
+    if (offset < 0) {
+      return util::InvalidArgumentError(
+          StrCat("Invalid loop offset: ", offset));
+    }
+    code.loop_offset_bytes = offset;
+    AlignmentSweepPoint point;
+    point.loop_offset_bytes = offset;
+    const Status measure_status =
+        MeasureUnrolledLoop(&assembler, code, cache_sizes,
+                            options.scratch_memory, &point.result);
+    if (!measure_status.ok()) return measure_status;
+    results->push_back(std::move(point));
+  }
+  return OkStatus();
+}
+
+double GetAlignmentSensitivity(const std::vector<AlignmentSweepPoint>& results,
+                               const string& event_name) {
+  bool found = false;
+  double min_value = 0.0;
+  double max_value = 0.0;
+  for (const AlignmentSweepPoint& point : results) {
+    if (!point.result.HasTiming(event_name)) continue;
+    const double value = point.result.GetScaledOrDie(event_name);
+    if (!found) {
+      min_value = max_value = value;
+      found = true;
+    } else {
+      min_value = std::min(min_value, value);
+      max_value = std::max(max_value, value);
+    }
+  }
+  if (!found || max_value <= 0.0) return 0.0;
+  if (min_value <= 0.0) return std::numeric_limits<double>::infinity();
+  return (max_value - min_value) / min_value;
+}
+
+bool IsAlignmentSensitive(const std::vector<AlignmentSweepPoint>& results,
+                          const string& event_name, double max_variation) {
+  return GetAlignmentSensitivity(results, event_name) > max_variation;
+}
+
 Status DebugCPUStateChange(llvm::InlineAsm::AsmDialect dialect,
                            const string& mcpu, const std::string& prefix_code,
                            const std::string& code,
@@ -15,9 +15,17 @@
 #ifndef CPU_INSTRUCTIONS_ITINERARIES_JIT_PERF_EVALUATOR_H_
 #define CPU_INSTRUCTIONS_ITINERARIES_JIT_PERF_EVALUATOR_H_
 
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
 #include "strings/string.h"
 
+#include "cpu_instructions/base/cpu_model.h"
+#include "cpu_instructions/itineraries/adaptive_measurement.h"
 #include "cpu_instructions/itineraries/perf_subsystem.h"
+#include "cpu_instructions/llvm/inline_asm.h"
+#include "cpu_instructions/util/mapped_memory.h"
 #include "cpu_instructions/x86/cpu_state.h"
 #include "llvm/IR/InlineAsm.h"
 #include "util/task/status.h"
@@ -26,6 +34,11 @@ namespace cpu_instructions {
 
 using ::cpu_instructions::util::Status;
 
+// Allocates a buffer for the memory operands of the measured code. The buffer
+// uses huge pages when --cpu_instructions_use_huge_pages is set, and falls back
+// to regular pages when huge pages are not available.
+std::unique_ptr<MappedMemory> AllocateScratchMemory(size_t size_bytes);
+
 // Run Perf on an assembly code string that is to be assembled using the
 // LLVM JIT assembler.
 // 'dialect' is either llvm::InlineAsm::AD_ATT, or llvm::InlineAsm::INTEL.
@@ -33,7 +46,8 @@ using ::cpu_instructions::util::Status;
 // measurement is made over 'num_outer_iterations' of the resulting duplication
 // of the code. Thus, 'measured_code' is executed (num_outer_iterations *
 // num_inner_iterations) times.
-// The results are returned in 'result'.
+// The results are returned in 'result', together with the kind of pages that
+// backed the measured code.
 // The different parameters are used to generate code that will look like:
 //     init_code              ; save registers, for example.
 //     loop num_outer_iterations:
@@ -56,6 +70,217 @@ Status EvaluateAssemblyString(
     const std::string& suffix_code, const std::string& cleanup_code,
     const std::string& constraints, PerfResult* result);
 
+// A version of EvaluateAssemblyString that compiles the code with 'jit' and
+// measures it with 'perf_subsystem', instead of creating them for the
+// measurement. This lets a thread that measures many snippets reuse them. 'jit'
+// must have been created by MakeMeasurementJitCompiler with the same 'dialect'
+// and 'mcpu'. The compiled code stays in 'jit'.
+Status EvaluateAssemblyString(
+    JitCompiler* jit, PerfSubsystem* perf_subsystem,
+    llvm::InlineAsm::AsmDialect dialect, const string& mcpu,
+    int num_outer_iterations, int num_inner_iterations,
+    const std::string& init_code, const std::string& prefix_code,
+    const std::string& measured_code, const std::string& update_code,
+    const std::string& suffix_code, const std::string& cleanup_code,
+    const std::string& constraints, PerfResult* result);
+
+// Creates the JIT compiler used by EvaluateAssemblyString, configured by the
+// command-line flags. The measured code is placed on huge pages when
+// --cpu_instructions_use_huge_pages is set.
+std::unique_ptr<JitCompiler> MakeMeasurementJitCompiler(
+    llvm::InlineAsm::AsmDialect dialect, const string& mcpu);
+
+// Measures the overhead of the harness of EvaluateAssemblyString: the same
+// function with an empty 'measured_code', that contains the loop, the update
+// code, and the prefix and suffix code. The overhead is measured with
+// MeasureAdaptively using the counters of 'perf_subsystem', and cached for each
+// set of arguments; concurrent calls with the same arguments wait for a single
+// measurement. When --cpu_instructions_subtract_harness_overhead is set,
+// EvaluateAssemblyString and EvaluateAssemblyStringAdaptively subtract it from
+// their results.
+Status GetHarnessBaseline(
+    PerfSubsystem* perf_subsystem, llvm::InlineAsm::AsmDialect dialect,
+    const string& mcpu, int num_outer_iterations, int num_inner_iterations,
+    const std::string& init_code, const std::string& prefix_code,
+    const std::string& update_code, const std::string& suffix_code,
+    const std::string& cleanup_code, const std::string& constraints,
+    PerfResult* baseline);
+
+// Removes the baselines cached by GetHarnessBaseline.
+void ClearHarnessBaselines();
+
+// A version of EvaluateAssemblyString that compiles the code once, and then
+// measures it repeatedly with MeasureAdaptively until the value of each
+// counter is known precisely enough. The distribution of each counter is
+// stored in 'result'.
+Status EvaluateAssemblyStringAdaptively(
+    llvm::InlineAsm::AsmDialect dialect, const string& mcpu,
+    int num_outer_iterations, int num_inner_iterations,
+    const std::string& init_code, const std::string& prefix_code,
+    const std::string& measured_code, const std::string& update_code,
+    const std::string& suffix_code, const std::string& cleanup_code,
+    const std::string& constraints, const AdaptiveMeasurementOptions& options,
+    PerfResult* result);
+
+// The sizes of the code caches of a CPU that limit the size of the measured
+// code.
+struct CodeCacheSizes {
+  // The size of the L1 instruction cache in bytes.
+  int l1_instruction_cache_bytes = 0;
+  // The size of the decoded stream buffer (the micro-operation cache) in
+  // micro-operations; zero if the CPU does not have one or if it is unknown.
+  int decoded_stream_buffer_uops = 0;
+};
+
+// Returns the code cache sizes of 'cpu_model'. Uses 32 KiB for the L1
+// instruction cache if the size is not known. 'cpu_model' may be nullptr.
+CodeCacheSizes GetCodeCacheSizes(const CpuModel* cpu_model);
+
+// Returns the code cache sizes of the host CPU.
+CodeCacheSizes GetHostCodeCacheSizes();
+
+// Returns the number of assembly statements in 'code', not counting the empty
+// statements, the labels, the directives and the comments. This is used as an
+// estimate of the number of instructions in the code.
+int CountAssemblyStatements(const string& code);
+
+// Returns the largest unroll factor n <= 'max_unroll_factor' such that n copies
+// of a loop body of 'body_size_bytes' bytes fit in the L1 instruction cache,
+// and the n * 'body_num_instructions' instructions fit in the decoded stream
+// buffer. The second condition is checked only when the size of the decoded
+// stream buffer is known, and the body alone fits in it; otherwise, the
+// measured code runs from the legacy decoders anyway. Each instruction is
+// assumed to be decoded to a single micro-operation. Returns at least 1.
+int ComputeUnrollFactor(const CodeCacheSizes& cache_sizes, int body_size_bytes,
+                        int body_num_instructions, int max_unroll_factor);
+
+// Options for EvaluateUnrolledAssemblyString.
+struct UnrolledLoopOptions {
+  int num_outer_iterations = 1000;
+  // The number of copies of the measured code in the loop. When zero, the
+  // unroll factor is computed by ComputeUnrollFactor from the code cache sizes
+  // of the host CPU, up to 'max_unroll_factor'.
+  int unroll_factor = 0;
+  int max_unroll_factor = 1024;
+  // The number of instructions in the measured code, used to compute the
+  // unroll factor. When zero, it is estimated by CountAssemblyStatements. This
+  // must be set when the measured code is given as data directives.
+  int num_measured_instructions = 0;
+  // The alignment of the loop and of each copy of the measured code, in bytes.
+  int loop_alignment_bytes = 64;
+  int body_alignment_bytes = 1;
+  // The offset of the beginning of the loop from the 'loop_alignment_bytes'
+  // boundary, in bytes.
+  int loop_offset_bytes = 0;
+  // The buffer accessed by the memory operands of the measured code, if any.
+  // Its backing is recorded in the result. Not owned.
+  const MappedMemory* scratch_memory = nullptr;
+};
+
+// A version of EvaluateAssemblyString that builds the code with
+// DirectAssembler: the measured code and the update code are assembled once,
+// and their machine code is replicated instead of using the .rept directive.
+// The unroll factor and the alignment are given by 'options'. The code does not
+// use constraints: all callee-saved registers are saved by the function, and
+// all other registers may be modified freely. The measured code is executed
+// (options.num_outer_iterations * unroll factor) times.
+Status EvaluateUnrolledAssemblyString(
+    llvm::InlineAsm::AsmDialect dialect, const string& mcpu,
+    const UnrolledLoopOptions& options, const std::string& init_code,
+    const std::string& prefix_code, const std::string& measured_code,
+    const std::string& update_code, const std::string& suffix_code,
+    const std::string& cleanup_code, PerfResult* result);
+
+// The result of the measurement of the code at one loop offset.
+struct AlignmentSweepPoint {
+  int loop_offset_bytes = 0;
+  PerfResult result;
+};
+
+// Returns the loop offsets {0, step_bytes, 2 * step_bytes, ...} that are
+// smaller than 'boundary_bytes'. For example, MakeLoopOffsets(64, 8) places
+// the loop at each 8-byte position within a cache line.
+std::vector<int> MakeLoopOffsets(int boundary_bytes, int step_bytes);
+
+// Measures the same code as EvaluateUnrolledAssemblyString once for each
+// offset in 'loop_offsets_bytes'. The loop is placed at the given offset from
+// the 'options.loop_alignment_bytes' boundary; 'options.loop_offset_bytes' is
+// ignored. The unroll factor is computed once, so all measurements run the
+// same instructions, and only the placement of the code changes. Loops that
+// cross a 32-byte or a 64-byte boundary at some of the offsets may be delivered
+// by a different front-end path (the decoded stream buffer or the loop stream
+// detector), which shows up as a change in the counters. The results are
+// stored in 'results', in the order of 'loop_offsets_bytes'.
+Status EvaluateAlignmentSweep(
+    llvm::InlineAsm::AsmDialect dialect, const string& mcpu,
+    const UnrolledLoopOptions& options,
+    const std::vector<int>& loop_offsets_bytes, const std::string& init_code,
+    const std::string& prefix_code, const std::string& measured_code,
+    const std::string& update_code, const std::string& suffix_code,
+    const std::string& cleanup_code, std::vector<AlignmentSweepPoint>* results);
+
+// Returns the relative difference between the largest and the smallest scaled
+// value of the counter 'event_name' over the points in 'results', i.e.
+// (max - min) / min. The points that do not have the counter are ignored.
+// Returns zero when no point has the counter.
+double GetAlignmentSensitivity(const std::vector<AlignmentSweepPoint>& results,
+                               const string& event_name);
+
+// Returns true if the relative difference of the counter 'event_name' over
+// the points in 'results' is greater than 'max_variation'; for example, 0.05
+// flags the code if its cycle count changes by more than 5% with the offset.
+bool IsAlignmentSensitive(const std::vector<AlignmentSweepPoint>& results,
+                          const string& event_name, double max_variation);
+
+// Runs 'function' once for each group of the perf events of the host, as
+// scheduled by SchedulePerfEvents, and accumulates the values of the counters
+// in 'result'. When the kernel allows it, the counters are read with rdpmc
+// right around the call.
+void MeasureFunction(const VoidFunction& function, PerfResult* result);
+
+// Same as above, but uses the counters of 'perf_subsystem'. 'perf_subsystem'
+// must not be collecting events.
+void MeasureFunction(const VoidFunction& function,
+                     PerfSubsystem* perf_subsystem, PerfResult* result);
+
+// The counters of all the perf events of the host, split into groups by
+// SchedulePerfEvents. The counters of each group are opened once, when the
+// object is created; each measurement only starts and stops them. This keeps
+// the system calls that open the counters and map their pages out of the loop
+// when the same function is measured many times.
+class PerfEventGroups {
+ public:
+  // Opens the counters of the host with a LibPfmCounterBackend per group.
+  PerfEventGroups();
+  // Opens the counters of the host with a backend returned by 'make_backend'
+  // per group. Used in tests.
+  explicit PerfEventGroups(
+      const std::function<std::unique_ptr<PerfCounterBackend>()>&
+          make_backend);
+
+  int num_groups() const { return groups_.size(); }
+
+  // Same as MeasureFunction above, but uses the open counters. The values of
+  // the counters are the differences between their values right before and
+  // right after the call, so the counters do not need to be reopened or reset
+  // between the measurements.
+  void MeasureFunction(const VoidFunction& function, PerfResult* result);
+
+ private:
+  // One perf subsystem per group, with the events of the group added.
+  std::vector<std::unique_ptr<PerfSubsystem>> groups_;
+  // The snapshots of the counters, kept to avoid allocations during the
+  // measurements.
+  std::vector<TimingInfo> before_;
+  std::vector<TimingInfo> after_;
+};
+
+// Same as MeasureFunction, but returns the counters serialized with
+// PerfResult::SerializeToString. This can be used as the runner of an
+// IsolatedExecutor, to measure functions without risking a crash of the
+// measurement process; the results are parsed with PerfResult::ParseFromString.
+string MeasureFunctionToString(const VoidFunction& function);
+
 // Executes the given code, measuring the CPU state before and after execution
 // of 'code'. 'prefix_code' is run before measurements, and cleanup_code
 // afterwards.
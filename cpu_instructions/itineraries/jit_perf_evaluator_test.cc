@@ -15,17 +15,26 @@
 #include "cpu_instructions/itineraries/jit_perf_evaluator.h"
 
 #include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #include "base/stringprintf.h"
+#include "cpu_instructions/itineraries/isolated_executor.h"
 #include "cpu_instructions/itineraries/perf_subsystem.h"
+#include "cpu_instructions/itineraries/simulated_counter_backend.h"
+#include "cpu_instructions/llvm/direct_assembler.h"
 #include "cpu_instructions/testing/test_util.h"
+#include "cpu_instructions/x86/microarchitectures.h"
 #include "glog/logging.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "util/gtl/ptr_util.h"
 
 namespace cpu_instructions {
 namespace {
 
+using ::testing::ElementsAre;
 using ::testing::HasSubstr;
 
 const int kOuterIter = 1000;
@@ -127,6 +136,51 @@ TEST(JitPerfEvaluatorTest, CvtSi2Sd) {
       /*constraints=*/"~{xmm0}");
 }
 
+TEST(JitPerfEvaluatorTest, GetHarnessBaseline) {
+  ClearHarnessBaselines();
+  PerfSubsystem perf_subsystem;
+  PerfResult baseline;
+  ASSERT_OK(GetHarnessBaseline(&perf_subsystem, llvm::InlineAsm::AD_ATT,
+                               kGenericMcpu, kOuterIter, kInnerIter,
+                               /*init_code=*/"", /*prefix_code=*/"",
+                               /*update_code=*/"", /*suffix_code=*/"",
+                               /*cleanup_code=*/"", /*constraints=*/"",
+                               &baseline));
+  LOG(INFO) << baseline.ToString();
+  // The second call returns the cached baseline.
+  PerfResult cached_baseline;
+  ASSERT_OK(GetHarnessBaseline(&perf_subsystem, llvm::InlineAsm::AD_ATT,
+                               kGenericMcpu, kOuterIter, kInnerIter,
+                               /*init_code=*/"", /*prefix_code=*/"",
+                               /*update_code=*/"", /*suffix_code=*/"",
+                               /*cleanup_code=*/"", /*constraints=*/"",
+                               &cached_baseline));
+  EXPECT_EQ(baseline.ToString(), cached_baseline.ToString());
+}
+
+TEST(JitPerfEvaluatorTest, GetHarnessBaselineConcurrently) {
+  ClearHarnessBaselines();
+  // All threads get the result of the same calibration.
+  constexpr int kNumThreads = 4;
+  std::vector<PerfResult> baselines(kNumThreads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([&baselines, i]() {
+      PerfSubsystem perf_subsystem;
+      CHECK_OK(GetHarnessBaseline(&perf_subsystem, llvm::InlineAsm::AD_ATT,
+                                  kGenericMcpu, kOuterIter, kInnerIter,
+                                  /*init_code=*/"", /*prefix_code=*/"",
+                                  /*update_code=*/"", /*suffix_code=*/"",
+                                  /*cleanup_code=*/"", /*constraints=*/"",
+                                  &baselines[i]));
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  for (int i = 1; i < kNumThreads; ++i) {
+    EXPECT_EQ(baselines[i].ToString(), baselines[0].ToString());
+  }
+}
+
 TEST(JitPerfEvaluatorTest, DebugCPUStateChange) {
   constexpr const uint64_t kExpectedFPUControlWord = 0x0025;
   uint16_t fpu_control_word_save = 0;
@@ -173,5 +227,161 @@ TEST(JitPerfEvaluatorTest, DebugCPUStateChange) {
       fx_state_buffer_out.GetFPUControlWord().raw_value_ & kMaskOutReserved);
 }
 
+TEST(JitPerfEvaluatorTest, EvaluateUnrolledAssemblyString) {
+  UnrolledLoopOptions options;
+  options.num_outer_iterations = kOuterIter;
+  options.unroll_factor = 100;
+  PerfResult result;
+  ASSERT_OK(EvaluateUnrolledAssemblyString(
+      llvm::InlineAsm::AD_ATT, kGenericMcpu, options, /*init_code=*/"",
+      /*prefix_code=*/"", "addl %ecx, %edx", /*update_code=*/"",
+      /*suffix_code=*/"", /*cleanup_code=*/"", &result));
+  EXPECT_THAT(result.ToString(), HasSubstr("num_times"));
+}
+
+TEST(JitPerfEvaluatorTest, EvaluateUnrolledAssemblyStringWithUnrollFromCpu) {
+  UnrolledLoopOptions options;
+  options.num_outer_iterations = kOuterIter;
+  options.body_alignment_bytes = 16;
+  PerfResult result;
+  ASSERT_OK(EvaluateUnrolledAssemblyString(
+      llvm::InlineAsm::AD_Intel, kGenericMcpu, options,
+      /*init_code=*/"mov rbx, 1", /*prefix_code=*/"", "add rdx, rbx",
+      /*update_code=*/"inc rcx", /*suffix_code=*/"", /*cleanup_code=*/"",
+      &result));
+  EXPECT_THAT(result.ToString(), HasSubstr("num_times"));
+}
+
+TEST(JitPerfEvaluatorTest, EvaluateUnrolledAssemblyStringWithScratchMemory) {
+  const std::unique_ptr<MappedMemory> scratch_memory =
+      AllocateScratchMemory(4096);
+  UnrolledLoopOptions options;
+  options.num_outer_iterations = kOuterIter;
+  options.unroll_factor = 10;
+  options.scratch_memory = scratch_memory.get();
+  PerfResult result;
+  ASSERT_OK(EvaluateUnrolledAssemblyString(
+      llvm::InlineAsm::AD_Intel, kGenericMcpu, options,
+      /*init_code=*/
+      StringPrintf("movabs r11,%p", scratch_memory->data()),
+      /*prefix_code=*/"", "add qword ptr [r11], 1", /*update_code=*/"",
+      /*suffix_code=*/"", /*cleanup_code=*/"", &result));
+  EXPECT_TRUE(result.has_code_page_backing());
+  ASSERT_TRUE(result.has_data_page_backing());
+  EXPECT_EQ(result.data_page_backing(), scratch_memory->backing());
+  EXPECT_THAT(result.ToString(), HasSubstr("data_pages"));
+}
+
+void DoNothing() {}
+
+// The number of executions counted by each run of the simulated counters.
+constexpr int kNumExecutions = 1000;
+
+TEST(PerfEventGroupsTest, OpensTheCountersOnce) {
+  const ItineraryProto itinerary;
+  int num_backends = 0;
+  PerfEventGroups groups(
+      [&itinerary, &num_backends]() -> std::unique_ptr<PerfCounterBackend> {
+        ++num_backends;
+        return gtl::MakeUnique<SimulatedCounterBackend>(
+            x86::HaswellMicroArchitecture(), itinerary, kNumExecutions);
+      });
+  // The events of Haswell need several groups of four counters.
+  EXPECT_GT(groups.num_groups(), 1);
+  EXPECT_EQ(num_backends, groups.num_groups());
+  const VoidFunction function(&DoNothing, 0);
+  for (int i = 0; i < 3; ++i) {
+    PerfResult result;
+    groups.MeasureFunction(function, &result);
+    // Each measurement counts only its own run, although the counters are not
+    // reset.
+    EXPECT_DOUBLE_EQ(result.GetScaledOrDie("instructions"), kNumExecutions);
+  }
+  EXPECT_EQ(num_backends, groups.num_groups());
+}
+
+TEST(JitPerfEvaluatorTest, MeasureFunctionsInIsolatedExecutor) {
+  DirectAssembler assembler(llvm::InlineAsm::AD_ATT, kGenericMcpu);
+  const VoidFunction function =
+      assembler.AssembleToFunction(kOuterIter, "", "addl %ecx, %edx", "");
+  ASSERT_TRUE(function.IsValid());
+  IsolatedExecutor executor(IsolatedExecutorOptions(),
+                            &MeasureFunctionToString);
+  ASSERT_OK(executor.AddSnippet(function));
+  const std::vector<StatusOr<string>> results = executor.RunBatch();
+  ASSERT_EQ(results.size(), 1);
+  ASSERT_OK(results[0].status());
+  PerfResult result;
+  ASSERT_TRUE(PerfResult::ParseFromString(results[0].ValueOrDie(), &result));
+  EXPECT_FALSE(result.Keys().empty());
+}
+
+TEST(JitPerfEvaluatorTest, EvaluateAlignmentSweep) {
+  UnrolledLoopOptions options;
+  options.num_outer_iterations = kOuterIter;
+  options.unroll_factor = 10;
+  const std::vector<int> offsets = MakeLoopOffsets(64, 16);
+  std::vector<AlignmentSweepPoint> results;
+  ASSERT_OK(EvaluateAlignmentSweep(
+      llvm::InlineAsm::AD_ATT, kGenericMcpu, options, offsets,
+      /*init_code=*/"", /*prefix_code=*/"", "addl %ecx, %edx",
+      /*update_code=*/"", /*suffix_code=*/"", /*cleanup_code=*/"", &results));
+  ASSERT_EQ(results.size(), offsets.size());
+  for (int i = 0; i < results.size(); ++i) {
+    EXPECT_EQ(results[i].loop_offset_bytes, offsets[i]);
+    EXPECT_THAT(results[i].result.ToString(), HasSubstr("num_times"));
+  }
+}
+
+TEST(JitPerfEvaluatorTest, MakeLoopOffsets) {
+  EXPECT_THAT(MakeLoopOffsets(64, 16), ElementsAre(0, 16, 32, 48));
+  EXPECT_THAT(MakeLoopOffsets(32, 12), ElementsAre(0, 12, 24));
+}
+
+AlignmentSweepPoint MakeSweepPoint(int offset, uint64_t cycles) {
+  AlignmentSweepPoint point;
+  point.loop_offset_bytes = offset;
+  point.result = PerfResult({{"cycles", TimingInfo(cycles, 1, 1)}});
+  return point;
+}
+
+TEST(JitPerfEvaluatorTest, AlignmentSensitivity) {
+  const std::vector<AlignmentSweepPoint> stable = {
+      MakeSweepPoint(0, 1000), MakeSweepPoint(16, 1010),
+      MakeSweepPoint(32, 1000)};
+  EXPECT_DOUBLE_EQ(GetAlignmentSensitivity(stable, "cycles"), 0.01);
+  EXPECT_FALSE(IsAlignmentSensitive(stable, "cycles", 0.05));
+  EXPECT_EQ(GetAlignmentSensitivity(stable, "instructions"), 0.0);
+
+  const std::vector<AlignmentSweepPoint> sensitive = {
+      MakeSweepPoint(0, 1000), MakeSweepPoint(16, 1500)};
+  EXPECT_DOUBLE_EQ(GetAlignmentSensitivity(sensitive, "cycles"), 0.5);
+  EXPECT_TRUE(IsAlignmentSensitive(sensitive, "cycles", 0.05));
+}
+
+TEST(ComputeUnrollFactorTest, LimitedByInstructionCache) {
+  CodeCacheSizes cache_sizes;
+  cache_sizes.l1_instruction_cache_bytes = 32768;
+  EXPECT_EQ(ComputeUnrollFactor(cache_sizes, 16, 4, 10000), 2048);
+  EXPECT_EQ(ComputeUnrollFactor(cache_sizes, 16, 4, 100), 100);
+  EXPECT_EQ(ComputeUnrollFactor(cache_sizes, 65536, 4, 100), 1);
+}
+
+TEST(ComputeUnrollFactorTest, LimitedByDecodedStreamBuffer) {
+  CodeCacheSizes cache_sizes;
+  cache_sizes.l1_instruction_cache_bytes = 32768;
+  cache_sizes.decoded_stream_buffer_uops = 1536;
+  EXPECT_EQ(ComputeUnrollFactor(cache_sizes, 16, 4, 10000), 384);
+  // The body does not fit in the decoded stream buffer; only the size of the
+  // instruction cache is used.
+  EXPECT_EQ(ComputeUnrollFactor(cache_sizes, 8192, 2000, 10000), 4);
+}
+
+TEST(GetCodeCacheSizesTest, UnknownCpuModel) {
+  const CodeCacheSizes cache_sizes = GetCodeCacheSizes(nullptr);
+  EXPECT_EQ(cache_sizes.l1_instruction_cache_bytes, 32768);
+  EXPECT_EQ(cache_sizes.decoded_stream_buffer_uops, 0);
+}
+
 }  // namespace
 }  // namespace cpu_instructions
@@ -0,0 +1,213 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/latency_chains.h"
+
+#include <cmath>
+#include <utility>
+#include "strings/string.h"
+
+#include "cpu_instructions/itineraries/adaptive_measurement.h"
+#include "glog/logging.h"
+#include "strings/str_cat.h"
+#include "util/task/canonical_errors.h"
+#include "util/task/status.h"
+
+namespace cpu_instructions {
+
+namespace {
+
+// Returns the description of 'operand' in the error messages.
+string DescribeOperand(const SnippetOperand& operand) {
+  return operand.code.empty() ? operand.name
+                              : StrCat(operand.name, " (", operand.code, ")");
+}
+
+// Instantiates 'instruction' so that 'output' is the same register as 'input'.
+// Returns an error if this is not possible.
+StatusOr<SnippetInstruction> MakeChainedInstance(
+    const SnippetInstruction& instruction, int input, int output) {
+  const SnippetOperand& input_operand = instruction.operands[input];
+  const SnippetOperand& output_operand = instruction.operands[output];
+  if (input_operand.kind == SnippetOperand::kMemory ||
+      output_operand.kind == SnippetOperand::kMemory) {
+    return util::InvalidArgumentError(
+        "Dependencies through memory are not chained");
+  }
+  if (input_operand.kind != SnippetOperand::kRegister ||
+      output_operand.kind != SnippetOperand::kRegister) {
+    return util::InvalidArgumentError(
+        StrCat("The register of ", DescribeOperand(input_operand), " or ",
+               DescribeOperand(output_operand), " is not supported"));
+  }
+  const x86::RegisterInfo& input_register = input_operand.register_info;
+  const x86::RegisterInfo& output_register = output_operand.register_info;
+  if (input_register.register_class != output_register.register_class) {
+    return util::InvalidArgumentError(
+        StrCat(DescribeOperand(output_operand), " and ",
+               DescribeOperand(input_operand),
+               " are registers of different classes"));
+  }
+  SnippetInstruction instance = instruction;
+  if (!x86::RegistersAlias(input_register, output_register) &&
+      !RenameRegister(output_register.index, &instance.operands[input]) &&
+      !RenameRegister(input_register.index, &instance.operands[output])) {
+    return util::InvalidArgumentError(
+        StrCat(DescribeOperand(output_operand), " and ",
+               DescribeOperand(input_operand),
+               " are different fixed registers"));
+  }
+  if (IsDependencyBreakingIdiom(instance)) {
+    return util::InvalidArgumentError(
+        StrCat(ToCodeString(instance), " is a dependency-breaking idiom"));
+  }
+  return instance;
+}
+
+}  // namespace
+
+LatencyChains MakeLatencyChains(const InstructionProto& instruction) {
+  LatencyChains result;
+  result.instruction = GetInstructionName(instruction);
+  const string& instruction_name = result.instruction;
+  const StatusOr<SnippetInstruction> instance_or_status =
+      InstantiateSnippetInstruction(instruction);
+  if (!instance_or_status.ok()) {
+    result.unmeasurable.push_back(
+        {instruction_name, OperandPair(),
+         instance_or_status.status().error_message()});
+    return result;
+  }
+  const SnippetInstruction& instance = instance_or_status.ValueOrDie();
+  const int num_operands = instance.operands.size();
+  for (int input = 0; input < num_operands; ++input) {
+    const SnippetOperand& input_operand = instance.operands[input];
+    if (!input_operand.is_input ||
+        input_operand.kind == SnippetOperand::kImmediate) {
+      continue;
+    }
+    for (int output = 0; output < num_operands; ++output) {
+      const SnippetOperand& output_operand = instance.operands[output];
+      if (!output_operand.is_output) continue;
+      OperandPair operands;
+      operands.input_operand = input_operand.name;
+      operands.input_operand_index = input_operand.operand_index;
+      operands.output_operand = output_operand.name;
+      operands.output_operand_index = output_operand.operand_index;
+      const StatusOr<SnippetInstruction> chained =
+          MakeChainedInstance(instance, input, output);
+      if (chained.ok()) {
+        result.chains.push_back({operands, chained.ValueOrDie()});
+      } else {
+        result.unmeasurable.push_back(
+            {instruction_name, operands, chained.status().error_message()});
+      }
+    }
+  }
+  if (result.chains.empty() && result.unmeasurable.empty()) {
+    result.unmeasurable.push_back(
+        {instruction_name, OperandPair(),
+         "The instruction has no input and output operands with known usage"});
+  }
+  return result;
+}
+
+void AddLatencies(const LatencyChains& chains,
+                  const std::vector<StatusOr<PerfResult>>& results,
+                  ItineraryProto* itinerary,
+                  std::vector<UnmeasurableLatency>* unmeasurable) {
+  CHECK(itinerary != nullptr);
+  CHECK(unmeasurable != nullptr);
+  CHECK_EQ(chains.chains.size(), results.size());
+  itinerary->clear_operand_latencies();
+  const PerfResult* slowest_result = nullptr;
+  double min_latency = 0.0;
+  double max_latency = 0.0;
+  for (int i = 0; i < results.size(); ++i) {
+    const LatencyChain& chain = chains.chains[i];
+    if (!results[i].ok()) {
+      unmeasurable->push_back(
+          {chains.instruction, chain.operands,
+           StrCat(ToCodeString(chain.instruction), ": ",
+                  results[i].status().error_message())});
+      continue;
+    }
+    const PerfResult& result = results[i].ValueOrDie();
+    if (!result.HasTiming(kCyclesEvent)) {
+      unmeasurable->push_back({chains.instruction, chain.operands,
+                               "The cycles were not measured"});
+      continue;
+    }
+    const double latency = result.GetScaledOrDie(kCyclesEvent);
+    ItineraryProto::OperandLatency* const operand_latency =
+        itinerary->add_operand_latencies();
+    operand_latency->set_input_operand(chain.operands.input_operand);
+    operand_latency->set_input_operand_index(
+        chain.operands.input_operand_index);
+    operand_latency->set_output_operand(chain.operands.output_operand);
+    operand_latency->set_output_operand_index(
+        chain.operands.output_operand_index);
+    operand_latency->set_latency(latency);
+    if (slowest_result == nullptr || latency < min_latency) {
+      min_latency = latency;
+    }
+    if (slowest_result == nullptr || latency > max_latency) {
+      max_latency = latency;
+      slowest_result = &result;
+    }
+  }
+  if (slowest_result == nullptr) return;
+  itinerary->set_min_latency(std::lround(min_latency));
+  itinerary->set_max_latency(std::lround(max_latency));
+  itinerary->clear_latency_observation();
+  AddObservations(*slowest_result, itinerary->mutable_latency_observation());
+}
+
+void MeasureLatencies(const LatencyMeasurementOptions& options,
+                      const InstructionSetProto& instruction_set,
+                      ParallelMeasurementPool* pool,
+                      InstructionSetItinerariesProto* itineraries,
+                      std::vector<UnmeasurableLatency>* unmeasurable) {
+  CHECK(unmeasurable != nullptr);
+  std::vector<LatencyChains> chains(instruction_set.instructions_size());
+  const auto make_snippets =
+      [&instruction_set, &chains](
+          int index) -> StatusOr<std::vector<SnippetCode>> {
+    chains[index] = MakeLatencyChains(instruction_set.instructions(index));
+    std::vector<SnippetCode> codes;
+    for (const LatencyChain& chain : chains[index].chains) {
+      codes.push_back({chain.instruction});
+    }
+    return codes;
+  };
+  const auto add_results = [&chains, unmeasurable](
+                               int index,
+                               const std::vector<StatusOr<PerfResult>>& results,
+                               ItineraryProto* itinerary) {
+    unmeasurable->insert(unmeasurable->end(),
+                         chains[index].unmeasurable.begin(),
+                         chains[index].unmeasurable.end());
+    AddLatencies(chains[index], results, itinerary, unmeasurable);
+  };
+  const auto report_unmeasurable = [&instruction_set, unmeasurable](
+                                       int index, const Status& status) {
+    unmeasurable->push_back(
+        {GetInstructionName(instruction_set.instructions(index)),
+         OperandPair(), status.error_message()});
+  };
+  MeasureSnippetBatch(options, instruction_set, pool, make_snippets,
+                      add_results, report_unmeasurable, itineraries);
+}
+
+}  // namespace cpu_instructions
@@ -0,0 +1,105 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Generates and measures the dependency chains that give the latencies of an
+// instruction. For each pair of an input and an output operand, the
+// instruction is instantiated so that the output register of an instance is
+// the input register of the next instance: a renameable input is set to the
+// output register, or a renameable output to the input register. The number of
+// cycles per instance of the repeated instruction is then the latency from the
+// input to the output.
+//
+// Pairs that can't be chained without a helper instruction (e.g. through
+// memory, or between registers of different classes), and instructions that
+// can't be measured at all, are reported with the reason.
+
+#ifndef CPU_INSTRUCTIONS_ITINERARIES_LATENCY_CHAINS_H_
+#define CPU_INSTRUCTIONS_ITINERARIES_LATENCY_CHAINS_H_
+
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/itineraries/instruction_snippets.h"
+#include "cpu_instructions/itineraries/parallel_measurement.h"
+#include "cpu_instructions/itineraries/perf_subsystem.h"
+#include "cpu_instructions/itineraries/snippet_batch.h"
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "util/task/statusor.h"
+
+namespace cpu_instructions {
+
+// An input and an output operand of an instruction. See SnippetOperand for the
+// meaning of the names and the indices.
+struct OperandPair {
+  string input_operand;
+  int input_operand_index = -1;
+  string output_operand;
+  int output_operand_index = -1;
+};
+
+// The dependency chain for one pair of operands.
+struct LatencyChain {
+  OperandPair operands;
+  // The instance of the instruction that is repeated to form the chain.
+  SnippetInstruction instruction;
+};
+
+// A latency that can't be measured. When the whole instruction can't be
+// measured, the operands are empty.
+struct UnmeasurableLatency {
+  // The LLVM mnemonic of the instruction, or its vendor mnemonic if the LLVM
+  // mnemonic is not known.
+  string instruction;
+  OperandPair operands;
+  string reason;
+};
+
+struct LatencyChains {
+  // The name of the instruction, as in UnmeasurableLatency.
+  string instruction;
+  std::vector<LatencyChain> chains;
+  std::vector<UnmeasurableLatency> unmeasurable;
+};
+
+// Creates the dependency chains for all pairs of an input and an output
+// operand of 'instruction'. Immediate values are not inputs for this purpose.
+LatencyChains MakeLatencyChains(const InstructionProto& instruction);
+
+// The options of MeasureLatencies. Each chain is measured by a snippet that
+// contains one instance of its instruction.
+struct LatencyMeasurementOptions : public SnippetBatchOptions {};
+
+// Stores the latencies of 'chains' into 'itinerary': one OperandLatency for
+// each chain, and the range of the latencies in min_latency and max_latency.
+// The latency_observation of the itinerary is the one of the slowest chain.
+// 'results[i]' is the measurement of 'chains.chains[i]'. The chains whose
+// measurement failed are added to 'unmeasurable'.
+void AddLatencies(const LatencyChains& chains,
+                  const std::vector<StatusOr<PerfResult>>& results,
+                  ItineraryProto* itinerary,
+                  std::vector<UnmeasurableLatency>* unmeasurable);
+
+// Measures the latencies of all instructions of 'instruction_set' with
+// MeasureSnippetBatch, and stores them into the itineraries with
+// AddLatencies. The latencies that can't be measured, including the failed
+// measurements, are stored in 'unmeasurable'.
+void MeasureLatencies(const LatencyMeasurementOptions& options,
+                      const InstructionSetProto& instruction_set,
+                      ParallelMeasurementPool* pool,
+                      InstructionSetItinerariesProto* itineraries,
+                      std::vector<UnmeasurableLatency>* unmeasurable);
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_ITINERARIES_LATENCY_CHAINS_H_
@@ -0,0 +1,185 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/latency_chains.h"
+
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/util/proto_util.h"
+#include "gtest/gtest.h"
+#include "util/task/canonical_errors.h"
+
+namespace cpu_instructions {
+namespace {
+
+// Returns the code of the chain from operand 'input' to operand 'output', or
+// an empty string if there is no such chain.
+string GetChainCode(const LatencyChains& chains, const string& input,
+                    const string& output) {
+  for (const LatencyChain& chain : chains.chains) {
+    if (chain.operands.input_operand == input &&
+        chain.operands.output_operand == output) {
+      return ToCodeString(chain.instruction);
+    }
+  }
+  return "";
+}
+
+TEST(LatencyChainsTest, RenamesTheInput) {
+  const LatencyChains chains =
+      MakeLatencyChains(ParseProtoFromStringOrDie<InstructionProto>(R"(
+          llvm_mnemonic: "VADDPSrr"
+          vendor_syntax {
+            mnemonic: "VADDPS"
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: MODRM_REG_ENCODING value_size_bits: 128
+                       name: "xmm1" usage: USAGE_WRITE }
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: VEX_V_ENCODING value_size_bits: 128
+                       name: "xmm2" usage: USAGE_READ }
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: MODRM_RM_ENCODING value_size_bits: 128
+                       name: "xmm3" usage: USAGE_READ }
+          })"));
+  EXPECT_EQ(chains.instruction, "VADDPSrr");
+  EXPECT_TRUE(chains.unmeasurable.empty());
+  ASSERT_EQ(chains.chains.size(), 2);
+  EXPECT_EQ(GetChainCode(chains, "xmm2", "xmm1"), "VADDPS xmm1,xmm1,xmm3");
+  EXPECT_EQ(GetChainCode(chains, "xmm3", "xmm1"), "VADDPS xmm1,xmm2,xmm1");
+  EXPECT_EQ(chains.chains[0].operands.input_operand_index, 1);
+  EXPECT_EQ(chains.chains[0].operands.output_operand_index, 0);
+}
+
+TEST(LatencyChainsTest, ChainsImplicitOperands) {
+  const LatencyChains chains =
+      MakeLatencyChains(ParseProtoFromStringOrDie<InstructionProto>(R"(
+          vendor_syntax {
+            mnemonic: "MUL"
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: MODRM_RM_ENCODING value_size_bits: 32
+                       name: "r32" usage: USAGE_READ }
+          }
+          implicit_input_operands: "EAX"
+          implicit_output_operands: "EAX"
+          implicit_output_operands: "EDX"
+          implicit_output_operands: "EFLAGS")"));
+  EXPECT_EQ(GetChainCode(chains, "r32", "EAX"), "MUL eax");
+  EXPECT_EQ(GetChainCode(chains, "r32", "EDX"), "MUL edx");
+  EXPECT_EQ(GetChainCode(chains, "EAX", "EAX"), "MUL ecx");
+  EXPECT_EQ(chains.chains.size(), 3);
+  // EAX -> EDX uses two fixed registers, and the flags are not a general
+  // purpose register.
+  EXPECT_EQ(chains.unmeasurable.size(), 3);
+  for (const UnmeasurableLatency& unmeasurable : chains.unmeasurable) {
+    EXPECT_FALSE(unmeasurable.reason.empty());
+    EXPECT_FALSE(unmeasurable.operands.output_operand.empty());
+  }
+}
+
+TEST(LatencyChainsTest, ReportsUnchainableOperands) {
+  const LatencyChains chains =
+      MakeLatencyChains(ParseProtoFromStringOrDie<InstructionProto>(R"(
+          vendor_syntax {
+            mnemonic: "XOR"
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: MODRM_REG_ENCODING value_size_bits: 32
+                       name: "r32" usage: USAGE_READ_WRITE }
+            operands { addressing_mode: INDIRECT_ADDRESSING
+                       encoding: MODRM_RM_ENCODING value_size_bits: 32
+                       name: "m32" usage: USAGE_READ }
+          })"));
+  ASSERT_EQ(chains.chains.size(), 1);
+  EXPECT_EQ(GetChainCode(chains, "r32", "r32"), "XOR ecx,dword ptr[RSI]");
+  ASSERT_EQ(chains.unmeasurable.size(), 1);
+  EXPECT_EQ(chains.unmeasurable[0].operands.input_operand, "m32");
+
+  const LatencyChains idiom =
+      MakeLatencyChains(ParseProtoFromStringOrDie<InstructionProto>(R"(
+          vendor_syntax {
+            mnemonic: "XOR"
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: MODRM_REG_ENCODING value_size_bits: 32
+                       name: "r32" usage: USAGE_READ_WRITE }
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: MODRM_RM_ENCODING value_size_bits: 32
+                       name: "r32" usage: USAGE_READ }
+          })"));
+  EXPECT_TRUE(idiom.chains.empty());
+  EXPECT_EQ(idiom.unmeasurable.size(), 2);
+}
+
+TEST(LatencyChainsTest, ReportsUnmeasurableInstructions) {
+  const LatencyChains jump =
+      MakeLatencyChains(ParseProtoFromStringOrDie<InstructionProto>(R"(
+          vendor_syntax {
+            mnemonic: "JMP"
+            operands { addressing_mode: NO_ADDRESSING name: "rel8"
+                       usage: USAGE_READ }
+          })"));
+  EXPECT_TRUE(jump.chains.empty());
+  ASSERT_EQ(jump.unmeasurable.size(), 1);
+  EXPECT_EQ(jump.unmeasurable[0].instruction, "JMP");
+  EXPECT_TRUE(jump.unmeasurable[0].operands.input_operand.empty());
+
+  const LatencyChains no_usage =
+      MakeLatencyChains(ParseProtoFromStringOrDie<InstructionProto>(R"(
+          vendor_syntax { mnemonic: "NOP" })"));
+  EXPECT_TRUE(no_usage.chains.empty());
+  EXPECT_EQ(no_usage.unmeasurable.size(), 1);
+}
+
+TEST(LatencyChainsTest, AddLatencies) {
+  LatencyChains chains;
+  chains.instruction = "IMUL32rr";
+  chains.chains.resize(3);
+  chains.chains[0].operands.input_operand = "r32";
+  chains.chains[0].operands.input_operand_index = 1;
+  chains.chains[0].operands.output_operand = "r32";
+  chains.chains[0].operands.output_operand_index = 0;
+  chains.chains[1].operands.input_operand = "EFLAGS";
+  chains.chains[1].operands.output_operand = "r32";
+  chains.chains[1].operands.output_operand_index = 0;
+  std::vector<StatusOr<PerfResult>> results;
+  PerfResult three_cycles({{"cycles", TimingInfo(300, 1, 1)}});
+  three_cycles.SetScaleFactor(100);
+  results.push_back(three_cycles);
+  PerfResult one_cycle({{"cycles", TimingInfo(104, 1, 1)}});
+  one_cycle.SetScaleFactor(100);
+  results.push_back(one_cycle);
+  results.push_back(util::InternalError("Failed to compile"));
+
+  ItineraryProto itinerary;
+  std::vector<UnmeasurableLatency> unmeasurable;
+  AddLatencies(chains, results, &itinerary, &unmeasurable);
+  ASSERT_EQ(itinerary.operand_latencies_size(), 2);
+  const ItineraryProto::OperandLatency& latency =
+      itinerary.operand_latencies(0);
+  EXPECT_EQ(latency.input_operand(), "r32");
+  EXPECT_EQ(latency.input_operand_index(), 1);
+  EXPECT_EQ(latency.output_operand_index(), 0);
+  EXPECT_DOUBLE_EQ(latency.latency(), 3.0);
+  EXPECT_EQ(itinerary.operand_latencies(1).input_operand_index(), -1);
+  EXPECT_DOUBLE_EQ(itinerary.operand_latencies(1).latency(), 1.04);
+  EXPECT_EQ(itinerary.min_latency(), 1);
+  EXPECT_EQ(itinerary.max_latency(), 3);
+  const ObservationVector& observation = itinerary.latency_observation();
+  ASSERT_EQ(observation.observations_size(), 1);
+  EXPECT_DOUBLE_EQ(observation.observations(0).measurement(), 3.0);
+  ASSERT_EQ(unmeasurable.size(), 1);
+  EXPECT_EQ(unmeasurable[0].instruction, "IMUL32rr");
+}
+
+}  // namespace
+}  // namespace cpu_instructions
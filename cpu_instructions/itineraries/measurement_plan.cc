@@ -0,0 +1,199 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/measurement_plan.h"
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <unordered_set>
+#include <utility>
+
+#include "cpu_instructions/base/host_cpu.h"
+#include "cpu_instructions/llvm/direct_assembler.h"
+#include "glog/logging.h"
+#include "strings/str_cat.h"
+#include "util/task/status.h"
+
+namespace cpu_instructions {
+
+namespace {
+
+// Returns a data directive that emits 'machine_code' to the code section. It
+// is used as the measured code, so that the measured instructions are exactly
+// the ones of the variant.
+string MakeByteDirective(const std::vector<uint8_t>& machine_code) {
+  if (machine_code.empty()) return "";
+  string directive = ".byte ";
+  for (int i = 0; i < machine_code.size(); ++i) {
+    StrAppend(&directive, i == 0 ? "" : ",", machine_code[i]);
+  }
+  return directive;
+}
+
+// The LLVM names of the CPU features used in InstructionProto.feature_name.
+// The features that are not listed (e.g. CLFSH or FPU) are not optional in
+// LLVM, and they are assumed to be available on all CPU models.
+constexpr const char* const kLLVMFeatureNames[][2] = {
+    {"ADX", "adx"},
+    {"AES", "aes"},
+    {"AVX", "avx"},
+    {"AVX2", "avx2"},
+    {"AVX512BW", "avx512bw"},
+    {"AVX512CD", "avx512cd"},
+    {"AVX512DQ", "avx512dq"},
+    {"AVX512ER", "avx512er"},
+    {"AVX512F", "avx512f"},
+    {"AVX512PF", "avx512pf"},
+    {"AVX512VL", "avx512vl"},
+    {"AVX512_IFMA", "avx512ifma"},
+    {"AVX512_VBMI", "avx512vbmi"},
+    {"BMI1", "bmi"},
+    {"BMI2", "bmi2"},
+    {"CLFLUSHOPT", "clflushopt"},
+    {"F16C", "f16c"},
+    {"FMA", "fma"},
+    {"FSGSBASE", "fsgsbase"},
+    {"INVPCID", "invpcid"},
+    {"LZCNT", "lzcnt"},
+    {"MMX", "mmx"},
+    {"MOVBE", "movbe"},
+    {"PCLMULQDQ", "pclmul"},
+    {"POPCNT", "popcnt"},
+    {"PRFCHW", "prfchw"},
+    {"RDPID", "rdpid"},
+    {"RDRAND", "rdrnd"},
+    {"RDSEED", "rdseed"},
+    {"RTM", "rtm"},
+    {"SHA", "sha"},
+    {"SSE", "sse"},
+    {"SSE2", "sse2"},
+    {"SSE3", "sse3"},
+    {"SSE4_1", "sse4.1"},
+    {"SSE4_2", "sse4.2"},
+    {"SSSE3", "ssse3"},
+    {"XSAVE", "xsave"},
+    {"XSAVEC", "xsavec"},
+    {"XSAVEOPT", "xsaveopt"},
+};
+
+// Returns the features of the CPU model of 'assembler' among the features that
+// appear in 'feature_name', in the form used by HostCpuInfo.
+HostCpuInfo GetCpuInfo(const string& mcpu, const DirectAssembler& assembler,
+                       const string& feature_name) {
+  string feature_list = feature_name;
+  std::replace(feature_list.begin(), feature_list.end(), '&', ' ');
+  std::replace(feature_list.begin(), feature_list.end(), '|', ' ');
+  std::istringstream features_stream(feature_list);
+  std::unordered_set<string> features;
+  string feature;
+  while (features_stream >> feature) {
+    const char* llvm_feature = nullptr;
+    for (const auto& names : kLLVMFeatureNames) {
+      if (feature == names[0]) llvm_feature = names[1];
+    }
+    if (llvm_feature == nullptr || assembler.HasCpuFeature(llvm_feature)) {
+      features.insert(feature);
+    }
+  }
+  return HostCpuInfo(mcpu, std::move(features));
+}
+
+}  // namespace
+
+MeasurementPlan MakeMeasurementPlan(llvm::InlineAsm::AsmDialect dialect,
+                                    const std::vector<string>& mcpus,
+                                    const string& feature_name,
+                                    const string& code) {
+  MeasurementPlan plan;
+  plan.dialect = dialect;
+  plan.code = code;
+  // The index of the variant in plan.variants for each distinct machine code.
+  std::map<std::vector<uint8_t>, int> variant_index;
+  for (const string& mcpu : mcpus) {
+    if (plan.unsupported_mcpus.count(mcpu) > 0) continue;
+    DirectAssembler assembler(dialect, mcpu);
+    if (!assembler.IsKnownCpu()) {
+      plan.unsupported_mcpus[mcpu] = StrCat("Unknown CPU model: ", mcpu);
+      continue;
+    }
+    // HostCpuInfo::SupportsFeature does not handle nested feature expressions.
+    if (feature_name.find_first_of("()") != string::npos) {
+      plan.unsupported_mcpus[mcpu] =
+          StrCat("The CPU features can't be checked: ", feature_name);
+      continue;
+    }
+    if (!feature_name.empty() &&
+        !GetCpuInfo(mcpu, assembler, feature_name)
+             .SupportsFeature(feature_name)) {
+      plan.unsupported_mcpus[mcpu] =
+          StrCat("The CPU model does not have ", feature_name);
+      continue;
+    }
+    const auto bytes_or_status = assembler.AssembleToBytes(code);
+    if (!bytes_or_status.ok()) {
+      plan.unsupported_mcpus[mcpu] = bytes_or_status.status().error_message();
+      continue;
+    }
+    const std::vector<uint8_t>& machine_code = bytes_or_status.ValueOrDie();
+    const auto inserted =
+        variant_index.emplace(machine_code, plan.variants.size());
+    if (inserted.second) {
+      plan.variants.emplace_back();
+      plan.variants.back().machine_code = machine_code;
+    }
+    std::vector<string>& variant_mcpus =
+        plan.variants[inserted.first->second].mcpus;
+    // The same CPU model may be listed several times.
+    if (std::find(variant_mcpus.begin(), variant_mcpus.end(), mcpu) ==
+        variant_mcpus.end()) {
+      variant_mcpus.push_back(mcpu);
+    }
+  }
+  VLOG(1) << "Found " << plan.variants.size() << " variants for "
+          << mcpus.size() << " CPU models";
+  return plan;
+}
+
+Status EvaluateMeasurementPlan(const MeasurementPlan& plan,
+                               const UnrolledLoopOptions& options,
+                               const string& init_code,
+                               const string& prefix_code,
+                               const string& update_code,
+                               const string& suffix_code,
+                               const string& cleanup_code,
+                               std::vector<MeasurementPlanResult>* results) {
+  CHECK(results != nullptr);
+  results->clear();
+  // The data directives are not counted as instructions.
+  UnrolledLoopOptions variant_options = options;
+  if (variant_options.num_measured_instructions == 0) {
+    variant_options.num_measured_instructions =
+        CountAssemblyStatements(plan.code);
+  }
+  for (const MeasurementPlanVariant& variant : plan.variants) {
+    CHECK(!variant.mcpus.empty());
+    MeasurementPlanResult variant_result;
+    variant_result.mcpus = variant.mcpus;
+    const Status status = EvaluateUnrolledAssemblyString(
+        plan.dialect, variant.mcpus.front(), variant_options, init_code,
+        prefix_code, MakeByteDirective(variant.machine_code), update_code,
+        suffix_code, cleanup_code, &variant_result.result);
+    if (!status.ok()) return status;
+    results->push_back(std::move(variant_result));
+  }
+  return util::OkStatus();
+}
+
+}  // namespace cpu_instructions
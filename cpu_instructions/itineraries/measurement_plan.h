@@ -0,0 +1,98 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measurement plans for snippets of assembly code targeting several CPU models.
+// Most instructions are encoded the same way on all CPU models that support
+// them; the CPU models differ only in which instructions are available. A
+// measurement plan checks the CPU features required by the snippet against all
+// CPU models in one pass, and groups the CPU models for which the snippet is
+// assembled to the same machine code, so that each distinct variant is
+// compiled and measured only once.
+
+#ifndef CPU_INSTRUCTIONS_ITINERARIES_MEASUREMENT_PLAN_H_
+#define CPU_INSTRUCTIONS_ITINERARIES_MEASUREMENT_PLAN_H_
+
+#include <cstdint>
+#include <map>
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/itineraries/jit_perf_evaluator.h"
+#include "cpu_instructions/itineraries/perf_subsystem.h"
+#include "llvm/IR/InlineAsm.h"
+#include "util/task/status.h"
+
+namespace cpu_instructions {
+
+// A distinct variant of the snippet of a measurement plan.
+struct MeasurementPlanVariant {
+  // The LLVM names of the CPU models covered by the variant, in the order in
+  // which they were passed to MakeMeasurementPlan.
+  std::vector<string> mcpus;
+  // The machine code of the snippet for all CPU models in 'mcpus'.
+  std::vector<uint8_t> machine_code;
+};
+
+// The measurement plan of a snippet of assembly code.
+struct MeasurementPlan {
+  llvm::InlineAsm::AsmDialect dialect = llvm::InlineAsm::AD_ATT;
+  // The snippet of assembly code.
+  string code;
+  // The distinct variants of the snippet, in the order of their first CPU
+  // model.
+  std::vector<MeasurementPlanVariant> variants;
+  // The CPU models that do not have the CPU features required by the snippet,
+  // that LLVM does not know, or for which the snippet could not be assembled,
+  // mapped to the error message.
+  std::map<string, string> unsupported_mcpus;
+};
+
+// Assembles 'code' for each CPU model in 'mcpus' that supports it, and groups
+// the CPU models by the machine code of the snippet. The LLVM assembler accepts
+// all instructions for all CPU models, so the availability is decided from
+// 'feature_name': the CPU features required by the snippet, in the syntax of
+// InstructionProto.feature_name, or an empty string when the snippet runs on
+// all CPU models. Uses DirectAssembler; 'code' must not require relocations.
+MeasurementPlan MakeMeasurementPlan(llvm::InlineAsm::AsmDialect dialect,
+                                    const std::vector<string>& mcpus,
+                                    const string& feature_name,
+                                    const string& code);
+
+// The result of the measurement of one variant of a measurement plan.
+struct MeasurementPlanResult {
+  // The CPU models covered by the measured variant.
+  std::vector<string> mcpus;
+  PerfResult result;
+};
+
+// Measures each variant of 'plan' on the host CPU with
+// EvaluateUnrolledAssemblyString. The measured code is the stored machine code
+// of the variant, so the snippet is not assembled again; the first CPU model of
+// the variant is used for the rest of the code. The other arguments are passed
+// to EvaluateUnrolledAssemblyString. The results are stored in 'results', in
+// the order of the variants.
+// The host CPU must support all instructions of all the variants; the caller
+// should remove the other variants from the plan.
+Status EvaluateMeasurementPlan(const MeasurementPlan& plan,
+                               const UnrolledLoopOptions& options,
+                               const string& init_code,
+                               const string& prefix_code,
+                               const string& update_code,
+                               const string& suffix_code,
+                               const string& cleanup_code,
+                               std::vector<MeasurementPlanResult>* results);
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_ITINERARIES_MEASUREMENT_PLAN_H_
@@ -0,0 +1,113 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/measurement_plan.h"
+
+#include <cstdint>
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/testing/test_util.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "llvm/IR/InlineAsm.h"
+
+namespace cpu_instructions {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::HasSubstr;
+using ::testing::IsEmpty;
+using ::testing::Key;
+using ::testing::UnorderedElementsAre;
+
+TEST(MeasurementPlanTest, SameEncodingOnAllCpus) {
+  const MeasurementPlan plan = MakeMeasurementPlan(
+      llvm::InlineAsm::AD_ATT, {"skylake", "haswell", "sandybridge"},
+      /*feature_name=*/"", "addl %ecx, %edx");
+  EXPECT_THAT(plan.unsupported_mcpus, IsEmpty());
+  ASSERT_EQ(plan.variants.size(), 1);
+  EXPECT_THAT(plan.variants[0].mcpus,
+              ElementsAre("skylake", "haswell", "sandybridge"));
+  EXPECT_EQ(plan.variants[0].machine_code, std::vector<uint8_t>({0x01, 0xca}));
+}
+
+TEST(MeasurementPlanTest, InstructionNotAvailableOnAllCpus) {
+  // AVX2 is not available on Sandy Bridge.
+  const MeasurementPlan plan = MakeMeasurementPlan(
+      llvm::InlineAsm::AD_Intel,
+      {"skylake", "sandybridge", "haswell", "skylake", "not_a_cpu"}, "AVX2",
+      "vpaddd ymm0, ymm1, ymm2");
+  EXPECT_THAT(plan.unsupported_mcpus,
+              UnorderedElementsAre(Key("sandybridge"), Key("not_a_cpu")));
+  ASSERT_EQ(plan.variants.size(), 1);
+  EXPECT_THAT(plan.variants[0].mcpus, ElementsAre("skylake", "haswell"));
+}
+
+TEST(MeasurementPlanTest, FeatureExpressions) {
+  const MeasurementPlan plan = MakeMeasurementPlan(
+      llvm::InlineAsm::AD_Intel, {"skylake-avx512", "skylake", "knl"},
+      "AVX512F && AVX512VL", "vpaddd xmm0, xmm1, xmm2");
+  EXPECT_THAT(plan.unsupported_mcpus,
+              UnorderedElementsAre(Key("skylake"), Key("knl")));
+  ASSERT_EQ(plan.variants.size(), 1);
+  EXPECT_THAT(plan.variants[0].mcpus, ElementsAre("skylake-avx512"));
+
+  // CLFSH is not an optional feature in LLVM.
+  const MeasurementPlan flush_plan = MakeMeasurementPlan(
+      llvm::InlineAsm::AD_Intel, {"sandybridge", "skylake"}, "CLFSH || SSE2",
+      "clflush [rax]");
+  EXPECT_THAT(flush_plan.unsupported_mcpus, IsEmpty());
+}
+
+TEST(MeasurementPlanTest, EvaluateMeasurementPlan) {
+  const MeasurementPlan plan = MakeMeasurementPlan(
+      llvm::InlineAsm::AD_ATT, {"generic", "x86-64"}, /*feature_name=*/"",
+      "addl %ecx, %edx");
+  ASSERT_EQ(plan.variants.size(), 1);
+  UnrolledLoopOptions options;
+  options.num_outer_iterations = 100;
+  options.unroll_factor = 10;
+  std::vector<MeasurementPlanResult> results;
+  ASSERT_OK(EvaluateMeasurementPlan(plan, options, /*init_code=*/"",
+                                    /*prefix_code=*/"", /*update_code=*/"",
+                                    /*suffix_code=*/"", /*cleanup_code=*/"",
+                                    &results));
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_THAT(results[0].mcpus, ElementsAre("generic", "x86-64"));
+  EXPECT_THAT(results[0].result.ToString(), HasSubstr("num_times"));
+}
+
+TEST(MeasurementPlanTest, EvaluatesTheStoredMachineCode) {
+  // The snippet is not assembled again; only the machine code of the variant
+  // is measured.
+  MeasurementPlan plan;
+  plan.dialect = llvm::InlineAsm::AD_ATT;
+  plan.code = "not an instruction";
+  plan.variants.emplace_back();
+  plan.variants[0].mcpus = {"generic"};
+  plan.variants[0].machine_code = {0x01, 0xca};
+  UnrolledLoopOptions options;
+  options.num_outer_iterations = 100;
+  std::vector<MeasurementPlanResult> results;
+  ASSERT_OK(EvaluateMeasurementPlan(plan, options, /*init_code=*/"",
+                                    /*prefix_code=*/"", /*update_code=*/"",
+                                    /*suffix_code=*/"", /*cleanup_code=*/"",
+                                    &results));
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_THAT(results[0].mcpus, ElementsAre("generic"));
+}
+
+}  // namespace
+}  // namespace cpu_instructions
@@ -0,0 +1,111 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/parallel_measurement.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "cpu_instructions/itineraries/jit_perf_evaluator.h"
+#include "cpu_instructions/llvm/llvm_utils.h"
+#include "cpu_instructions/util/system.h"
+#include "glog/logging.h"
+#include "util/task/status.h"
+
+namespace cpu_instructions {
+
+namespace {
+
+// The amount of code and data compiled by a worker after which its JIT compiler
+// releases the memory of the snippets measured so far.
+constexpr int64_t kWorkerCodeSizeBudgetBytes = 1 << 20;
+
+}  // namespace
+
+ParallelMeasurementPool::ParallelMeasurementPool(
+    llvm::InlineAsm::AsmDialect dialect, const string& mcpu,
+    const std::vector<int>& core_ids)
+    : dialect_(dialect), mcpu_(mcpu), core_ids_(core_ids) {
+  CHECK(!core_ids_.empty());
+  // The global initialization of LLVM is the only step shared by all the
+  // workers; do it before starting them.
+  EnsureLLVMWasInitialized();
+  workers_.reserve(core_ids_.size());
+  for (const int core_id : core_ids_) {
+    workers_.emplace_back(&ParallelMeasurementPool::RunWorker, this, core_id);
+  }
+  LOG(INFO) << "Started " << workers_.size() << " measurement workers";
+}
+
+ParallelMeasurementPool::ParallelMeasurementPool(
+    llvm::InlineAsm::AsmDialect dialect, const string& mcpu)
+    : ParallelMeasurementPool(dialect, mcpu, GetPhysicalCores()) {}
+
+ParallelMeasurementPool::~ParallelMeasurementPool() {
+  queue_.Stop();
+  for (std::thread& worker : workers_) worker.join();
+}
+
+std::future<StatusOr<PerfResult>>
+ParallelMeasurementPool::EvaluateAssemblyString(
+    const AssemblySnippet& snippet) {
+  const llvm::InlineAsm::AsmDialect dialect = dialect_;
+  const string mcpu = mcpu_;
+  return queue_.SubmitWithResult<StatusOr<PerfResult>>(
+      [snippet, dialect, mcpu](
+          const MeasurementWorker& worker) -> StatusOr<PerfResult> {
+        PerfResult perf_result;
+        const Status status = ::cpu_instructions::EvaluateAssemblyString(
+            worker.jit, worker.perf_subsystem, dialect, mcpu,
+            snippet.num_outer_iterations, snippet.num_inner_iterations,
+            snippet.init_code, snippet.prefix_code, snippet.measured_code,
+            snippet.update_code, snippet.suffix_code, snippet.cleanup_code,
+            snippet.constraints, &perf_result);
+        if (!status.ok()) return status;
+        return perf_result;
+      });
+}
+
+std::vector<StatusOr<PerfResult>>
+ParallelMeasurementPool::EvaluateAssemblyStrings(
+    const std::vector<AssemblySnippet>& snippets) {
+  std::vector<std::future<StatusOr<PerfResult>>> futures;
+  futures.reserve(snippets.size());
+  for (const AssemblySnippet& snippet : snippets) {
+    futures.push_back(EvaluateAssemblyString(snippet));
+  }
+  std::vector<StatusOr<PerfResult>> results;
+  results.reserve(snippets.size());
+  for (std::future<StatusOr<PerfResult>>& future : futures) {
+    results.push_back(future.get());
+  }
+  return results;
+}
+
+void ParallelMeasurementPool::RunWorker(int core_id) {
+  // The thread is pinned first, so that all the work of the worker, including
+  // the compilation, runs on its core and stays away from the other workers.
+  SetCoreAffinity(core_id);
+  const std::unique_ptr<JitCompiler> jit =
+      MakeMeasurementJitCompiler(dialect_, mcpu_);
+  // Each snippet is measured right after it is compiled, and its code is not
+  // needed after that; keep the memory used by the compiler bounded.
+  jit->SetCodeSizeBudget(kWorkerCodeSizeBudgetBytes);
+  PerfSubsystem perf_subsystem;
+  const MeasurementWorker worker = {core_id, jit.get(), &perf_subsystem};
+  queue_.Run(worker);
+}
+
+}  // namespace cpu_instructions
@@ -0,0 +1,129 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A pool of measurement workers that measure snippets of code in parallel, one
+// per physical core. Each worker is pinned to its core, and owns its own
+// JitCompiler and PerfSubsystem, so the workers share no mutable state. Only
+// one hardware thread of each core is used: the SMT siblings stay idle, so that
+// a measurement does not compete with another one for the execution units of
+// the core, and the results are the same as when the snippets are measured one
+// at a time. The wall time of a large set of measurements thus goes down with
+// the number of physical cores.
+
+#ifndef CPU_INSTRUCTIONS_ITINERARIES_PARALLEL_MEASUREMENT_H_
+#define CPU_INSTRUCTIONS_ITINERARIES_PARALLEL_MEASUREMENT_H_
+
+#include <future>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/itineraries/perf_subsystem.h"
+#include "cpu_instructions/llvm/inline_asm.h"
+#include "cpu_instructions/util/work_queue.h"
+#include "llvm/IR/InlineAsm.h"
+#include "util/task/statusor.h"
+
+namespace cpu_instructions {
+
+using ::cpu_instructions::util::StatusOr;
+
+// The code measured by EvaluateAssemblyString; see jit_perf_evaluator.h for the
+// meaning of the fields.
+struct AssemblySnippet {
+  int num_outer_iterations = 1;
+  int num_inner_iterations = 1;
+  string init_code;
+  string prefix_code;
+  string measured_code;
+  string update_code;
+  string suffix_code;
+  string cleanup_code;
+  string constraints;
+};
+
+// The resources of a measurement worker. They may be used only by the tasks
+// running on the worker.
+struct MeasurementWorker {
+  // The core to which the thread of the worker is pinned.
+  int core_id;
+  JitCompiler* jit;
+  PerfSubsystem* perf_subsystem;
+};
+
+// The tasks are processed in the order in which they were submitted, by the
+// first available worker. All public methods are thread-safe.
+class ParallelMeasurementPool {
+ public:
+  // Creates one worker pinned to each core in 'core_ids'. The JitCompiler of
+  // each worker is created by MakeMeasurementJitCompiler with 'dialect' and
+  // 'mcpu'. To keep the measurements free of noise, 'core_ids' should contain
+  // at most one hardware thread of each physical core.
+  ParallelMeasurementPool(llvm::InlineAsm::AsmDialect dialect,
+                          const string& mcpu, const std::vector<int>& core_ids);
+
+  // Same as above, with one worker for each physical core on which the current
+  // thread is allowed to run, as returned by GetPhysicalCores().
+  ParallelMeasurementPool(llvm::InlineAsm::AsmDialect dialect,
+                          const string& mcpu);
+
+  // Waits until all submitted tasks are done, and stops the workers.
+  ~ParallelMeasurementPool();
+
+  ParallelMeasurementPool(const ParallelMeasurementPool&) = delete;
+  ParallelMeasurementPool& operator=(const ParallelMeasurementPool&) = delete;
+
+  using Task = WorkQueue<MeasurementWorker>::Task;
+
+  // Adds 'task' to the queue of the pool.
+  void Submit(Task task) { queue_.Submit(std::move(task)); }
+
+  // Submits the measurement of 'snippet' with EvaluateAssemblyString. The
+  // returned future becomes ready when the measurement is done.
+  std::future<StatusOr<PerfResult>> EvaluateAssemblyString(
+      const AssemblySnippet& snippet);
+
+  // Measures all 'snippets' in parallel, and returns the results in the order
+  // of 'snippets'.
+  std::vector<StatusOr<PerfResult>> EvaluateAssemblyStrings(
+      const std::vector<AssemblySnippet>& snippets);
+
+  // Blocks until the queue is empty and no task is running.
+  void WaitUntilIdle() { queue_.WaitUntilIdle(); }
+
+  // Returns the cores of the workers.
+  const std::vector<int>& core_ids() const { return core_ids_; }
+
+  // Returns the number of workers.
+  int num_workers() const { return workers_.size(); }
+
+ private:
+  // The main loop of a worker thread. Pins the thread to 'core_id', creates
+  // the resources of the worker, and runs the tasks from the queue until the
+  // pool is stopped and the queue is empty.
+  void RunWorker(int core_id);
+
+  const llvm::InlineAsm::AsmDialect dialect_;
+  const string mcpu_;
+  const std::vector<int> core_ids_;
+
+  WorkQueue<MeasurementWorker> queue_;
+
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_ITINERARIES_PARALLEL_MEASUREMENT_H_
@@ -0,0 +1,88 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/parallel_measurement.h"
+
+#include <sched.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/util/system.h"
+#include "gtest/gtest.h"
+#include "llvm/IR/InlineAsm.h"
+
+namespace cpu_instructions {
+namespace {
+
+constexpr const char kGenericMcpu[] = "generic";
+
+TEST(ParallelMeasurementPoolTest, UsesOneWorkerPerPhysicalCore) {
+  ParallelMeasurementPool pool(llvm::InlineAsm::AD_ATT, kGenericMcpu);
+  EXPECT_EQ(pool.core_ids(), GetPhysicalCores());
+  EXPECT_EQ(pool.num_workers(), pool.core_ids().size());
+}
+
+TEST(ParallelMeasurementPoolTest, RunsTasksOnPinnedWorkers) {
+  constexpr int kNumTasks = 50;
+  ParallelMeasurementPool pool(llvm::InlineAsm::AD_ATT, kGenericMcpu);
+  std::mutex mutex;
+  // The compiler seen by the first task on each core.
+  std::map<int, const JitCompiler*> compilers;
+  std::atomic<int> num_tasks(0);
+  std::atomic<int> num_misplaced_tasks(0);
+  std::atomic<int> num_foreign_compilers(0);
+  for (int i = 0; i < kNumTasks; ++i) {
+    pool.Submit([&](const MeasurementWorker& worker) {
+      if (sched_getcpu() != worker.core_id) ++num_misplaced_tasks;
+      std::lock_guard<std::mutex> lock(mutex);
+      const auto inserted = compilers.emplace(worker.core_id, worker.jit);
+      if (inserted.first->second != worker.jit) ++num_foreign_compilers;
+      ++num_tasks;
+    });
+  }
+  pool.WaitUntilIdle();
+  EXPECT_EQ(num_tasks, kNumTasks);
+  EXPECT_EQ(num_misplaced_tasks, 0);
+  // Each task sees the compiler of its core, and the cores do not share them.
+  EXPECT_EQ(num_foreign_compilers, 0);
+  std::set<const JitCompiler*> distinct_compilers;
+  for (const auto& core_and_compiler : compilers) {
+    EXPECT_TRUE(distinct_compilers.insert(core_and_compiler.second).second);
+  }
+}
+
+TEST(ParallelMeasurementPoolTest, EvaluatesSnippets) {
+  ParallelMeasurementPool pool(llvm::InlineAsm::AD_ATT, kGenericMcpu);
+  AssemblySnippet snippet;
+  snippet.num_outer_iterations = 100;
+  snippet.num_inner_iterations = 10;
+  snippet.measured_code = "add %eax, %eax";
+  snippet.constraints = "~{eax}";
+  AssemblySnippet invalid_snippet = snippet;
+  invalid_snippet.measured_code = "this is not an instruction";
+  const std::vector<StatusOr<PerfResult>> results =
+      pool.EvaluateAssemblyStrings({snippet, invalid_snippet, snippet});
+  ASSERT_EQ(results.size(), 3);
+  ASSERT_TRUE(results[0].ok());
+  EXPECT_FALSE(results[1].ok());
+  ASSERT_TRUE(results[2].ok());
+  EXPECT_EQ(results[0].ValueOrDie().scale_factor(), 1000);
+}
+
+}  // namespace
+}  // namespace cpu_instructions
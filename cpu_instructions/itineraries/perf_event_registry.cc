@@ -0,0 +1,68 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/perf_event_registry.h"
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include "strings/string.h"
+
+#include "glog/logging.h"
+
+namespace cpu_instructions {
+
+namespace {
+
+struct PerfEventRegistry {
+  // Protects the other fields.
+  std::mutex mutex;
+  std::unordered_map<string, PerfEventId> ids;
+  // The name of each ID. A deque does not move its elements when it grows, so
+  // the references returned by GetPerfEventName remain valid.
+  std::deque<string> names;
+};
+
+PerfEventRegistry* GetRegistry() {
+  static PerfEventRegistry* const registry = new PerfEventRegistry();
+  return registry;
+}
+
+}  // namespace
+
+PerfEventId InternPerfEvent(const string& event_name) {
+  PerfEventRegistry* const registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  const auto inserted =
+      registry->ids.emplace(event_name, registry->names.size());
+  if (inserted.second) registry->names.push_back(event_name);
+  return inserted.first->second;
+}
+
+PerfEventId FindPerfEventId(const string& event_name) {
+  PerfEventRegistry* const registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  const auto it = registry->ids.find(event_name);
+  return it == registry->ids.end() ? kInvalidPerfEventId : it->second;
+}
+
+const string& GetPerfEventName(PerfEventId id) {
+  PerfEventRegistry* const registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  CHECK_GE(id, 0);
+  CHECK_LT(id, registry->names.size());
+  return registry->names[id];
+}
+
+}  // namespace cpu_instructions
@@ -0,0 +1,50 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A process-wide registry that interns the names of perf events to small
+// integer IDs. The measurement code identifies the counters by their ID, so
+// that accumulating the results of many runs is done on flat arrays instead of
+// maps keyed by strings. The names are only needed at the boundaries: when
+// adding the events to the counters, and when printing or serializing results.
+
+#ifndef CPU_INSTRUCTIONS_ITINERARIES_PERF_EVENT_REGISTRY_H_
+#define CPU_INSTRUCTIONS_ITINERARIES_PERF_EVENT_REGISTRY_H_
+
+#include "strings/string.h"
+
+namespace cpu_instructions {
+
+// The ID of an interned event name. The IDs are consecutive, starting at 0, in
+// the order in which the names were first interned. They are not stable
+// across processes; serialize the names instead.
+using PerfEventId = int;
+
+// The ID returned by FindPerfEventId for names that were never interned.
+constexpr PerfEventId kInvalidPerfEventId = -1;
+
+// Returns the ID of 'event_name', interning it on first use. Event names are
+// case sensitive. Thread-safe.
+PerfEventId InternPerfEvent(const string& event_name);
+
+// Returns the ID of 'event_name', or kInvalidPerfEventId if it was never
+// interned. Thread-safe.
+PerfEventId FindPerfEventId(const string& event_name);
+
+// Returns the name of the event 'id'. Dies if 'id' is not a valid ID. The
+// reference remains valid until the end of the process. Thread-safe.
+const string& GetPerfEventName(PerfEventId id);
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_ITINERARIES_PERF_EVENT_REGISTRY_H_
@@ -0,0 +1,63 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/perf_event_registry.h"
+
+#include <thread>
+#include <vector>
+#include "strings/string.h"
+
+#include "gtest/gtest.h"
+#include "strings/str_cat.h"
+
+namespace cpu_instructions {
+namespace {
+
+TEST(PerfEventRegistryTest, InternsNames) {
+  const PerfEventId cycles = InternPerfEvent("registry_test_cycles");
+  const PerfEventId instructions =
+      InternPerfEvent("registry_test_instructions");
+  EXPECT_NE(cycles, instructions);
+  EXPECT_EQ(InternPerfEvent("registry_test_cycles"), cycles);
+  EXPECT_EQ(FindPerfEventId("registry_test_cycles"), cycles);
+  EXPECT_EQ(GetPerfEventName(instructions), "registry_test_instructions");
+  // The names are case sensitive.
+  EXPECT_EQ(FindPerfEventId("REGISTRY_TEST_CYCLES"), kInvalidPerfEventId);
+}
+
+TEST(PerfEventRegistryTest, IsThreadSafe) {
+  constexpr int kNumThreads = 4;
+  constexpr int kNumEvents = 100;
+  std::vector<std::vector<PerfEventId>> ids(kNumThreads);
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < kNumThreads; ++thread) {
+    threads.emplace_back([thread, &ids]() {
+      for (int event = 0; event < kNumEvents; ++event) {
+        ids[thread].push_back(
+            InternPerfEvent(StrCat("registry_test_event_", event)));
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  for (int thread = 1; thread < kNumThreads; ++thread) {
+    EXPECT_EQ(ids[thread], ids[0]);
+  }
+  for (int event = 0; event < kNumEvents; ++event) {
+    EXPECT_EQ(GetPerfEventName(ids[0][event]),
+              StrCat("registry_test_event_", event));
+  }
+}
+
+}  // namespace
+}  // namespace cpu_instructions
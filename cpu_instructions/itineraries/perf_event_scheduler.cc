@@ -0,0 +1,136 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/perf_event_scheduler.h"
+
+#include <set>
+#include <unordered_map>
+#include "strings/string.h"
+
+#include "glog/logging.h"
+#include "strings/case.h"
+#include "strings/string_view_utils.h"
+
+namespace cpu_instructions {
+
+namespace {
+
+// The names of the events counted by the fixed counters, in lower case, and
+// the index of the fixed counter for each of them. Both the names of libpfm4
+// and the generic names of the kernel are used.
+const std::unordered_map<string, int>& GetFixedCounterIndices() {
+  static const auto* const kIndices = new std::unordered_map<string, int>({
+      {"instructions", 0},
+      {"instruction_retired", 0},
+      {"inst_retired:any", 0},
+      {"perf::instructions", 0},
+      {"cycles", 1},
+      {"unhalted_core_cycles", 1},
+      {"cpu_clk_unhalted:thread", 1},
+      {"perf::cycles", 1},
+      {"perf::cpu-cycles", 1},
+      {"unhalted_reference_cycles", 2},
+      {"cpu_clk_unhalted:ref_tsc", 2},
+      {"ref-cycles", 2},
+      {"perf::ref-cycles", 2},
+  });
+  return *kIndices;
+}
+
+// The aliases of libpfm4 for the software events of the kernel, in lower case.
+const std::set<string>& GetSoftwareEventAliases() {
+  static const auto* const kAliases = new std::set<string>({
+      "perf::alignment-faults", "perf::context-switches", "perf::cpu-clock",
+      "perf::cpu-migrations", "perf::cs", "perf::emulation-faults",
+      "perf::faults", "perf::major-faults", "perf::migrations",
+      "perf::minor-faults", "perf::page-faults", "perf::task-clock",
+  });
+  return *kAliases;
+}
+
+string ToLower(const string& event_name) {
+  string lower_case = event_name;
+  LowerString(&lower_case);
+  return lower_case;
+}
+
+}  // namespace
+
+int GetFixedCounterIndex(const string& event_name) {
+  const auto& indices = GetFixedCounterIndices();
+  const auto it = indices.find(ToLower(event_name));
+  return it == indices.end() ? -1 : it->second;
+}
+
+bool IsSoftwareEvent(const string& event_name) {
+  const string lower_case = ToLower(event_name);
+  return strings::StartsWith(lower_case, "perf::perf_count_sw_") ||
+         GetSoftwareEventAliases().count(lower_case) > 0;
+}
+
+std::vector<std::vector<string>> SchedulePerfEvents(
+    const std::vector<string>& event_names,
+    const PerfCounterCapacity& capacity) {
+  CHECK_GT(capacity.num_general_counters, 0);
+  CHECK_GE(capacity.num_fixed_counters, 0);
+  std::vector<std::vector<string>> groups;
+  // The number of general purpose counters used by each group.
+  std::vector<int> num_general_counters;
+  // For each group, whether each fixed counter is used.
+  std::vector<std::vector<bool>> fixed_counters;
+  std::vector<string> software_events;
+  std::set<string> scheduled_events;
+  for (const string& event_name : event_names) {
+    if (!scheduled_events.insert(event_name).second) continue;
+    if (IsSoftwareEvent(event_name)) {
+      software_events.push_back(event_name);
+      continue;
+    }
+    // The event goes to the first group that has room for it: in its fixed
+    // counter when it has one and it is free, and in a general purpose counter
+    // otherwise. A new group is created only when no group has room.
+    const int fixed_counter = GetFixedCounterIndex(event_name);
+    const bool has_fixed_counter =
+        fixed_counter >= 0 && fixed_counter < capacity.num_fixed_counters;
+    const auto fixed_counter_is_free = [&](int group) {
+      return has_fixed_counter && !fixed_counters[group][fixed_counter];
+    };
+    int group = 0;
+    for (; group < groups.size(); ++group) {
+      if (fixed_counter_is_free(group) ||
+          num_general_counters[group] < capacity.num_general_counters) {
+        break;
+      }
+    }
+    if (group == groups.size()) {
+      groups.emplace_back();
+      num_general_counters.push_back(0);
+      fixed_counters.emplace_back(capacity.num_fixed_counters, false);
+    }
+    if (fixed_counter_is_free(group)) {
+      fixed_counters[group][fixed_counter] = true;
+    } else {
+      ++num_general_counters[group];
+    }
+    groups[group].push_back(event_name);
+  }
+  if (!software_events.empty()) {
+    if (groups.empty()) groups.emplace_back();
+    groups.front().insert(groups.front().end(), software_events.begin(),
+                          software_events.end());
+  }
+  return groups;
+}
+
+}  // namespace cpu_instructions
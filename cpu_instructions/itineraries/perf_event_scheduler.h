@@ -0,0 +1,67 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Scheduling of perf events on the hardware counters of the host. When more
+// events are enabled than there are counters, the kernel multiplexes them,
+// and the values are extrapolated from the fraction of the time each event
+// was counted. This is not precise enough for short snippets, so we split the
+// events into groups that fit in the counters, and run the measured code once
+// per group.
+
+#ifndef CPU_INSTRUCTIONS_ITINERARIES_PERF_EVENT_SCHEDULER_H_
+#define CPU_INSTRUCTIONS_ITINERARIES_PERF_EVENT_SCHEDULER_H_
+
+#include <vector>
+#include "strings/string.h"
+
+namespace cpu_instructions {
+
+// The number of hardware counters available to a single logical CPU. On
+// Intel CPUs, the general purpose counters of a core are split between its
+// hyper-threads when SMT is enabled; the number reported by the CPU (CPUID
+// leaf 0xA) and by libpfm4 is already the number available to one thread.
+struct PerfCounterCapacity {
+  // The number of general purpose counters, which can count any event.
+  int num_general_counters = 4;
+  // The number of fixed counters, which count only one given event each. See
+  // GetFixedCounterIndex.
+  int num_fixed_counters = 0;
+};
+
+// Returns the index of the fixed counter that counts 'event_name', or -1 when
+// the event is not counted by a fixed counter. The indices are the ones of
+// the architectural fixed counters of Intel CPUs: 0 counts the retired
+// instructions, 1 the core cycles, and 2 the reference cycles.
+int GetFixedCounterIndex(const string& event_name);
+
+// Returns true if 'event_name' is a software event of the kernel, e.g.
+// "perf::PERF_COUNT_SW_TASK_CLOCK". Software events do not use any hardware
+// counter.
+bool IsSoftwareEvent(const string& event_name);
+
+// Splits 'event_names' into the fewest groups that can be counted at the same
+// time without multiplexing, given 'capacity'. The events counted by fixed
+// counters go to their fixed counter when it is free, and to a free general
+// purpose counter of the same group otherwise; a new group is created only
+// when neither is free. The software events are all added to the first group.
+// Duplicate events are counted only once. The order of the events is
+// preserved within each group, except for the software events that are added
+// after the hardware events, so that a hardware event leads the group.
+std::vector<std::vector<string>> SchedulePerfEvents(
+    const std::vector<string>& event_names,
+    const PerfCounterCapacity& capacity);
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_ITINERARIES_PERF_EVENT_SCHEDULER_H_
@@ -0,0 +1,104 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/perf_event_scheduler.h"
+
+#include <vector>
+#include "strings/string.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace cpu_instructions {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+TEST(PerfEventSchedulerTest, GetFixedCounterIndex) {
+  EXPECT_EQ(GetFixedCounterIndex("instructions"), 0);
+  EXPECT_EQ(GetFixedCounterIndex("cycles"), 1);
+  EXPECT_EQ(GetFixedCounterIndex("perf::CYCLES"), 1);
+  EXPECT_EQ(GetFixedCounterIndex("unhalted_reference_cycles"), 2);
+  EXPECT_EQ(GetFixedCounterIndex("uops_issued:any"), -1);
+}
+
+TEST(PerfEventSchedulerTest, IsSoftwareEvent) {
+  EXPECT_TRUE(IsSoftwareEvent("perf::PERF_COUNT_SW_TASK_CLOCK"));
+  EXPECT_TRUE(IsSoftwareEvent("perf::PAGE-FAULTS"));
+  EXPECT_FALSE(IsSoftwareEvent("perf::CYCLES"));
+  EXPECT_FALSE(IsSoftwareEvent("uops_issued:any"));
+}
+
+TEST(PerfEventSchedulerTest, NoEvents) {
+  EXPECT_THAT(SchedulePerfEvents({}, PerfCounterCapacity()), IsEmpty());
+}
+
+TEST(PerfEventSchedulerTest, GeneralCounters) {
+  PerfCounterCapacity capacity;
+  capacity.num_general_counters = 2;
+  EXPECT_THAT(SchedulePerfEvents({"a", "b", "c", "a", "d", "e"}, capacity),
+              ElementsAre(ElementsAre("a", "b"), ElementsAre("c", "d"),
+                          ElementsAre("e")));
+}
+
+TEST(PerfEventSchedulerTest, FixedCounters) {
+  PerfCounterCapacity capacity;
+  capacity.num_general_counters = 2;
+  capacity.num_fixed_counters = 3;
+  // "cycles" and "instructions" do not use the general purpose counters.
+  EXPECT_THAT(
+      SchedulePerfEvents({"a", "cycles", "b", "instructions"}, capacity),
+      ElementsAre(ElementsAre("a", "cycles", "b", "instructions")));
+}
+
+TEST(PerfEventSchedulerTest, FixedCounterFallsBackToGeneralCounter) {
+  PerfCounterCapacity capacity;
+  capacity.num_general_counters = 2;
+  capacity.num_fixed_counters = 3;
+  // The second alias of the fixed counter uses a general purpose counter of
+  // the same group.
+  EXPECT_THAT(SchedulePerfEvents({"cycles", "perf::CYCLES", "a"}, capacity),
+              ElementsAre(ElementsAre("cycles", "perf::CYCLES", "a")));
+  // A new group is created only when the general purpose counters are full.
+  EXPECT_THAT(
+      SchedulePerfEvents({"a", "b", "cycles", "perf::CYCLES"}, capacity),
+      ElementsAre(ElementsAre("a", "b", "cycles"),
+                  ElementsAre("perf::CYCLES")));
+}
+
+TEST(PerfEventSchedulerTest, NoFixedCounters) {
+  PerfCounterCapacity capacity;
+  capacity.num_general_counters = 2;
+  capacity.num_fixed_counters = 0;
+  EXPECT_THAT(
+      SchedulePerfEvents({"a", "cycles", "b", "instructions"}, capacity),
+      ElementsAre(ElementsAre("a", "cycles"),
+                  ElementsAre("b", "instructions")));
+}
+
+TEST(PerfEventSchedulerTest, SoftwareEvents) {
+  PerfCounterCapacity capacity;
+  capacity.num_general_counters = 1;
+  EXPECT_THAT(SchedulePerfEvents({"perf::PERF_COUNT_SW_TASK_CLOCK", "a", "b"},
+                                 capacity),
+              ElementsAre(ElementsAre("a", "perf::PERF_COUNT_SW_TASK_CLOCK"),
+                          ElementsAre("b")));
+  EXPECT_THAT(
+      SchedulePerfEvents({"perf::PERF_COUNT_SW_TASK_CLOCK"}, capacity),
+      ElementsAre(ElementsAre("perf::PERF_COUNT_SW_TASK_CLOCK")));
+}
+
+}  // namespace
+}  // namespace cpu_instructions
@@ -18,8 +18,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <algorithm>
 #include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <sstream>
 #include <utility>
 
 #include "base/stringprintf.h"
@@ -28,6 +33,7 @@
 #include "include/perfmon/pfmlib_perf_event.h"
 #include "strings/str_cat.h"
 #include "util/gtl/map_util.h"
+#include "util/gtl/ptr_util.h"
 
 namespace cpu_instructions {
 
@@ -41,31 +47,154 @@ double PerfResult::Scale(const TimingInfo& timing) const {
          static_cast<double>(num_times_);
 }
 
-double PerfResult::GetScaledOrDie(const string& name) const {
-  return Scale(FindOrDie(timings_, name));
+PerfResult::PerfResult(const std::map<string, TimingInfo>& timings) {
+  for (const auto& key_val : timings) {
+    AddTiming(InternPerfEvent(key_val.first), key_val.second);
+  }
+}
+
+void PerfResult::AddTiming(PerfEventId id, const TimingInfo& timing) {
+  CHECK_GE(id, 0);
+  if (id >= timings_.size()) {
+    timings_.resize(id + 1);
+    has_timing_.resize(id + 1, false);
+  }
+  timings_[id].Accumulate(timing);
+  has_timing_[id] = true;
+}
+
+double PerfResult::GetScaledOrDie(PerfEventId id) const {
+  CHECK(HasTiming(id)) << "Unknown counter " << id;
+  const SampleStatistics* const statistics = FindOrNull(statistics_, id);
+  const double value =
+      statistics != nullptr ? statistics->median : Scale(timings_[id]);
+  const double* const baseline = FindOrNull(baselines_, id);
+  if (baseline == nullptr) return value;
+  return std::max(0.0, value - *baseline);
+}
+
+void PerfResult::SubtractBaseline(const PerfResult& baseline) {
+  for (int id = 0; id < has_timing_.size(); ++id) {
+    if (has_timing_[id] && baseline.HasTiming(id)) {
+      baselines_[id] = baseline.GetScaledOrDie(id);
+    }
+  }
 }
 
 string PerfResult::ToString() const {
   string result;
-  for (const auto& key_value : timings_) {
-    StringAppendF(&result, "%s: %.2f, ", key_value.first.c_str(),
-                  Scale(key_value.second));
+  for (const PerfEventId id : EventIdsByName()) {
+    const string& name = GetPerfEventName(id);
+    const SampleStatistics* const statistics = FindOrNull(statistics_, id);
+    if (statistics == nullptr) {
+      StringAppendF(&result, "%s: %.2f, ", name.c_str(), GetScaledOrDie(id));
+    } else {
+      StringAppendF(&result, "%s: %.2f +/- %.2f, ", name.c_str(),
+                    GetScaledOrDie(id),
+                    statistics->confidence_interval_half_width);
+    }
   }
-  StringAppendF(&result, "(num_times: %lu)", num_times_);
+  StringAppendF(&result, "(num_times: %lu", num_times_);
+  if (has_code_page_backing_) {
+    StringAppendF(&result, ", code_pages: %s",
+                  PageBackingName(code_page_backing_));
+  }
+  if (has_data_page_backing_) {
+    StringAppendF(&result, ", data_pages: %s",
+                  PageBackingName(data_page_backing_));
+  }
+  result += ")";
   return result;
 }
 
 void PerfResult::Accumulate(const PerfResult& delta) {
-  for (const auto& key_val : delta.timings_) {
-    const string& name = key_val.first;
-    timings_[name].Accumulate(key_val.second);
+  // The counters are summed element by element; this is the operation that
+  // runs once per measurement.
+  if (timings_.size() < delta.timings_.size()) {
+    timings_.resize(delta.timings_.size());
+    has_timing_.resize(delta.has_timing_.size(), false);
+  }
+  for (int id = 0; id < delta.has_timing_.size(); ++id) {
+    if (!delta.has_timing_[id]) continue;
+    timings_[id].Accumulate(delta.timings_[id]);
+    has_timing_[id] = true;
+  }
+  for (const auto& key_val : delta.statistics_) {
+    statistics_[key_val.first] = key_val.second;
+  }
+  for (const auto& key_val : delta.baselines_) {
+    baselines_[key_val.first] = key_val.second;
+  }
+  if (!has_code_page_backing_ && delta.has_code_page_backing_) {
+    SetCodePageBacking(delta.code_page_backing_);
+  }
+  if (!has_data_page_backing_ && delta.has_data_page_backing_) {
+    SetDataPageBacking(delta.data_page_backing_);
+  }
+}
+
+string PerfResult::SerializeToString() const {
+  // One line for each counter: the name, followed by the three values.
+  string result;
+  StringAppendF(&result, "%lu\n", num_times_);
+  for (const PerfEventId id : EventIds()) {
+    const TimingInfo& timing = timings_[id];
+    StringAppendF(&result, "%s %lu %lu %lu\n", GetPerfEventName(id).c_str(),
+                  timing.raw_count, timing.time_enabled, timing.time_running);
+  }
+  return result;
+}
+
+bool PerfResult::ParseFromString(const string& data, PerfResult* result) {
+  CHECK(result != nullptr);
+  std::istringstream stream(data);
+  PerfResult parsed;
+  string line;
+  if (!std::getline(stream, line)) return false;
+  std::istringstream num_times_stream(line);
+  if (!(num_times_stream >> parsed.num_times_)) return false;
+  // Each of the other lines must contain a complete record.
+  while (std::getline(stream, line)) {
+    std::istringstream line_stream(line);
+    string name;
+    TimingInfo timing;
+    if (!(line_stream >> name >> timing.raw_count >> timing.time_enabled >>
+          timing.time_running)) {
+      return false;
+    }
+    const PerfEventId id = InternPerfEvent(name);
+    if (parsed.HasTiming(id)) parsed.timings_[id] = TimingInfo();
+    parsed.AddTiming(id, timing);
+  }
+  *result = parsed;
+  return true;
+}
+
+std::vector<PerfEventId> PerfResult::EventIds() const {
+  std::vector<PerfEventId> ids;
+  for (int id = 0; id < has_timing_.size(); ++id) {
+    if (has_timing_[id]) ids.push_back(id);
   }
+  return ids;
+}
+
+std::vector<PerfEventId> PerfResult::EventIdsByName() const {
+  // Each name is looked up only once.
+  std::vector<std::pair<string, PerfEventId>> names;
+  for (const PerfEventId id : EventIds()) {
+    names.emplace_back(GetPerfEventName(id), id);
+  }
+  std::sort(names.begin(), names.end());
+  std::vector<PerfEventId> ids;
+  ids.reserve(names.size());
+  for (const auto& name_and_id : names) ids.push_back(name_and_id.second);
+  return ids;
 }
 
 std::vector<string> PerfResult::Keys() const {
   std::vector<string> result;
-  for (const auto& key_val : timings_) {
-    result.push_back(key_val.first);
+  for (const PerfEventId id : EventIdsByName()) {
+    result.push_back(GetPerfEventName(id));
   }
   return result;
 }
@@ -76,41 +205,98 @@ bool Contains(const string& big, const string& small) {
   return big.find(small) != string::npos;
 }
 
+// Reads the hardware performance counter 'counter'.
+inline uint64_t ReadPmc(uint32_t counter) {
+  uint32_t low, high;
+  asm volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+  return (static_cast<uint64_t>(high) << 32) | low;
+}
+
+// Reads the time stamp counter.
+inline uint64_t ReadTsc() {
+  uint32_t low, high;
+  asm volatile("rdtsc" : "=a"(low), "=d"(high));
+  return (static_cast<uint64_t>(high) << 32) | low;
+}
+
+// Prevents the compiler from moving memory accesses across the barrier.
+inline void CompilerBarrier() { asm volatile("" ::: "memory"); }
+
+// Returns true if the NMI watchdog of the kernel is enabled. The watchdog
+// keeps one hardware counter busy on each CPU.
+bool IsNmiWatchdogEnabled() {
+  std::ifstream file("/proc/sys/kernel/nmi_watchdog");
+  int enabled = 0;
+  return (file >> enabled) && enabled != 0;
+}
+
+// libpfm4 has global state, and neither its initialization nor its
+// termination are thread safe. The library is initialized when the first
+// PerfSubsystem is created, and terminated when the last one is destroyed, so
+// that threads may have their own PerfSubsystem.
+std::mutex pfm_mutex;
+int num_pfm_users = 0;
+
+void AcquirePfm() {
+  std::lock_guard<std::mutex> lock(pfm_mutex);
+  if (num_pfm_users++ == 0) CHECK_EQ(PFM_SUCCESS, pfm_initialize());
+}
+
+void ReleasePfm() {
+  std::lock_guard<std::mutex> lock(pfm_mutex);
+  CHECK_GT(num_pfm_users, 0);
+  if (--num_pfm_users == 0) pfm_terminate();
+}
+
 }  // namespace
 
-PerfSubsystem::PerfSubsystem()
-    : microarchitecture_(
-          CHECK_NOTNULL(CpuModel::FromCpuId(HostCpuInfo::Get().cpu_id()))
-              ->microarchitecture()) {
+LibPfmCounterBackend::LibPfmCounterBackend() {
   counter_fds_.reserve(kMaxNumCounters);
-  event_names_.reserve(kMaxNumCounters);
-  timers_.resize(kMaxNumCounters);
-  const int ret = pfm_initialize();
-  CHECK_EQ(PFM_SUCCESS, ret);
+  counter_pages_.reserve(kMaxNumCounters);
+  read_buffer_.resize(kGroupReadHeaderSize + kMaxNumCounters);
+  AcquirePfm();
+  const CpuModel* const cpu_model =
+      CpuModel::FromCpuId(HostCpuInfo::Get().cpu_id());
+  if (cpu_model == nullptr) {
+    LOG(WARNING) << "Unknown host CPU, only events added by name can be used";
+    return;
+  }
   // Check the consistency between CPUs that p4lib and we detect.
   // p4lib does not make a difference between skl and skx.
-  const string cpu_id = microarchitecture_.proto().id() == "skx"
+  const MicroArchitecture& microarchitecture = cpu_model->microarchitecture();
+  const string cpu_id = microarchitecture.proto().id() == "skx"
                             ? "skl"
-                            : microarchitecture_.proto().id();
-  CHECK(Contains(Info(), cpu_id))
-      << "'" << Info() << "' vs '" << cpu_id << "' ('"
-      << microarchitecture_.proto().id() << ")'";
+                            : microarchitecture.proto().id();
+  if (!Contains(Info(), cpu_id)) {
+    // This happens e.g. in virtual machines that do not expose the PMU.
+    LOG(WARNING) << "'" << Info() << "' vs '" << cpu_id << "' ('"
+                 << microarchitecture.proto().id()
+                 << ")', only events added by name can be used";
+    return;
+  }
+  microarchitecture_ = &microarchitecture;
 }
 
-PerfSubsystem::~PerfSubsystem() {
-  CleanUp();
-  pfm_terminate();
+LibPfmCounterBackend::~LibPfmCounterBackend() {
+  RemoveCounters();
+  ReleasePfm();
 }
 
-void PerfSubsystem::CleanUp() {
+void LibPfmCounterBackend::RemoveCounters() {
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  for (const perf_event_mmap_page* const page : counter_pages_) {
+    if (page == nullptr) continue;
+    munmap(const_cast<perf_event_mmap_page*>(page), page_size);
+  }
   for (const int fd : counter_fds_) {
     close(fd);
   }
+  counter_pages_.resize(0);
   counter_fds_.resize(0);
-  event_names_.resize(0);
+  running_ = false;
 }
 
-string PerfSubsystem::Info() const {
+string LibPfmCounterBackend::Info() const {
   string result;
   int i;
   pfm_for_all_pmus(i) {
@@ -128,7 +314,31 @@ string PerfSubsystem::Info() const {
   return result;
 }
 
-void PerfSubsystem::ListEvents() {
+PerfCounterCapacity LibPfmCounterBackend::GetCounterCapacity() const {
+  PerfCounterCapacity capacity;
+  int i;
+  pfm_for_all_pmus(i) {
+    pfm_pmu_info_t pmu_info;
+    memset(&pmu_info, 0, sizeof(pmu_info));
+    const int pfm_result =
+        pfm_get_pmu_info(static_cast<pfm_pmu_t>(i), &pmu_info);
+    // The default PMU is the core PMU of the host, that counts the events
+    // given without a PMU prefix.
+    if (pfm_result == PFM_SUCCESS && pmu_info.is_present && pmu_info.is_dfl) {
+      capacity.num_general_counters = pmu_info.num_cntrs;
+      capacity.num_fixed_counters = pmu_info.num_fixed_cntrs;
+      break;
+    }
+  }
+  // The watchdog counts cycles, on the fixed cycle counter when there is one.
+  // Either way, our events may need one more general purpose counter.
+  if (IsNmiWatchdogEnabled() && capacity.num_general_counters > 1) {
+    --capacity.num_general_counters;
+  }
+  return capacity;
+}
+
+void LibPfmCounterBackend::ListEvents() const {
   int i;
   pfm_for_all_pmus(i) {
     pfm_pmu_t pmu = static_cast<pfm_pmu_t>(i);
@@ -151,7 +361,8 @@ void PerfSubsystem::ListEvents() {
   }
 }
 
-int PerfSubsystem::AddEvent(const string& event_name) {
+void LibPfmCounterBackend::AddCounter(const string& event_name) {
+  CHECK_LT(counter_fds_.size(), kMaxNumCounters);
   struct perf_event_attr attr = {0};
   memset(&attr, 0, sizeof(attr));
   attr.size = sizeof(attr);
@@ -159,32 +370,201 @@ int PerfSubsystem::AddEvent(const string& event_name) {
       event_name.c_str(), PFM_PLM3, &attr, nullptr, nullptr);
   CHECK_EQ(PFM_SUCCESS, pfm_result)
       << pfm_strerror(pfm_result) << " " << event_name << " " << Info();
-  attr.disabled = 1;
+  // All the counters are in a single group, led by the first counter. Only the
+  // leader is disabled; the other counters are started and stopped with it.
+  const bool is_group_leader = counter_fds_.empty();
+  attr.disabled = is_group_leader ? 1 : 0;
   // attr.pinned;
   attr.exclude_kernel = 1;
 
-  // Always collect stats for how often the collection was occurring.
-  attr.read_format =
-      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
-  const int fd = perf_event_open(&attr, getpid(), -1, -1, 0);
+  // Always collect stats for how often the collection was occurring. The
+  // values of all counters of the group are read from the leader.
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  const int group_fd = is_group_leader ? -1 : counter_fds_.front();
+  // The counters follow the calling thread, on any CPU; each thread of a
+  // parallel measurement has its own PerfSubsystem.
+  const int fd = perf_event_open(&attr, 0, -1, group_fd, 0);
   CHECK_LE(0, fd) << pfm_strerror(fd) << ": " << event_name;
+  // The first page of the mapping exposes the state of the counter, which is
+  // used to read it in user space. The mapping is optional. Software events
+  // are not counted by the PMU, and they can't be read in user space.
+  const bool is_software_event = attr.type == PERF_TYPE_SOFTWARE ||
+                                 attr.type == PERF_TYPE_TRACEPOINT;
+  void* const page =
+      is_software_event ? MAP_FAILED : mmap(nullptr, sysconf(_SC_PAGESIZE),
+                                            PROT_READ, MAP_SHARED, fd, 0);
+  if (page == MAP_FAILED) {
+    VLOG(1) << "Could not map the page of " << event_name << ": "
+            << strerror(errno);
+    counter_pages_.push_back(nullptr);
+  } else {
+    counter_pages_.push_back(static_cast<const perf_event_mmap_page*>(page));
+  }
   counter_fds_.push_back(fd);
-  event_names_.push_back(event_name);
-  return counter_fds_.size() - 1;
 }
 
-void PerfSubsystem::StartCollecting() {
-  for (const int fd : counter_fds_) {
-    const int ret = ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
-    CHECK_EQ(0, ret) << strerror(errno) << ", fd = " << fd;
+void LibPfmCounterBackend::StartCounters() {
+  if (counter_fds_.empty()) return;
+  const int fd = counter_fds_.front();
+  const int ret = ioctl(fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  CHECK_EQ(0, ret) << strerror(errno) << ", fd = " << fd;
+  running_ = true;
+}
+
+void LibPfmCounterBackend::StopCounters() {
+  if (counter_fds_.empty()) return;
+  const int fd = counter_fds_.front();
+  const int ret = ioctl(fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  CHECK_EQ(0, ret) << strerror(errno) << " fd = " << fd;
+  running_ = false;
+}
+
+void LibPfmCounterBackend::ReadGroup() {
+  // With PERF_FORMAT_GROUP, the leader returns the number of counters, the
+  // times, and the values of all counters of the group, in the order in which
+  // they were added.
+  const int num_counters = counter_fds_.size();
+  const int bytes_to_read =
+      (kGroupReadHeaderSize + num_counters) * sizeof(uint64_t);
+  const int bytes_read =
+      read(counter_fds_.front(), read_buffer_.data(), bytes_to_read);
+  CHECK_EQ(bytes_to_read, bytes_read) << strerror(errno);
+  CHECK_EQ(num_counters, read_buffer_[0]);
+}
+
+TimingInfo LibPfmCounterBackend::GetGroupTiming(int counter) const {
+  return TimingInfo(read_buffer_[kGroupReadHeaderSize + counter],
+                    read_buffer_[1], read_buffer_[2]);
+}
+
+bool LibPfmCounterBackend::CanReadCountersInUserSpace() const {
+  if (counter_pages_.empty()) return false;
+  for (const perf_event_mmap_page* const page : counter_pages_) {
+    if (page == nullptr || !page->cap_user_rdpmc || !page->cap_user_time) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool LibPfmCounterBackend::ReadCounterInUserSpace(int counter,
+                                                  TimingInfo* timing) const {
+  // See the documentation of perf_event_mmap_page in linux/perf_event.h. The
+  // kernel increments 'lock' whenever it updates the page; the values are
+  // consistent when 'lock' did not change while reading them.
+  const volatile perf_event_mmap_page* const page = counter_pages_[counter];
+  uint32_t sequence;
+  do {
+    sequence = page->lock;
+    CompilerBarrier();
+    if (!page->cap_user_rdpmc || !page->cap_user_time) return false;
+    const uint32_t index = page->index;
+    uint64_t count = page->offset;
+    // The index is zero when the counter is not on the hardware, e.g. because
+    // it is multiplexed out; 'offset' contains the full count in that case.
+    if (index != 0) {
+      const int shift = 64 - page->pmc_width;
+      // The hardware counter is pmc_width bits wide; sign-extend it.
+      int64_t pmc = ReadPmc(index - 1);
+      pmc = static_cast<int64_t>(static_cast<uint64_t>(pmc) << shift) >> shift;
+      count += pmc;
+    }
+    // The times are extrapolated from the last update of the page with the
+    // time stamp counter.
+    const uint64_t cycles = ReadTsc();
+    const uint16_t time_shift = page->time_shift;
+    const uint32_t time_mult = page->time_mult;
+    const uint64_t quotient = cycles >> time_shift;
+    const uint64_t remainder = cycles & ((uint64_t{1} << time_shift) - 1);
+    const uint64_t delta = page->time_offset + quotient * time_mult +
+                           ((remainder * time_mult) >> time_shift);
+    timing->raw_count = count;
+    timing->time_enabled = page->time_enabled + delta;
+    timing->time_running = page->time_running + (index != 0 ? delta : 0);
+    CompilerBarrier();
+  } while (page->lock != sequence);
+  return true;
+}
+
+void LibPfmCounterBackend::ReadCounters(std::vector<TimingInfo>* timings) {
+  const int num_counters = counter_fds_.size();
+  CHECK_EQ(num_counters, timings->size());
+  // The times in the mapped pages are extrapolated with the time stamp
+  // counter, which is only valid while the counters run.
+  bool read_in_user_space = running_;
+  for (int i = 0; read_in_user_space && i < num_counters; ++i) {
+    read_in_user_space = counter_pages_[i] != nullptr &&
+                         ReadCounterInUserSpace(i, &(*timings)[i]);
+  }
+  if (read_in_user_space || num_counters == 0) return;
+  ReadGroup();
+  for (int i = 0; i < num_counters; ++i) {
+    (*timings)[i] = GetGroupTiming(i);
   }
 }
 
+PerfSubsystem::PerfSubsystem()
+    : PerfSubsystem(gtl::MakeUnique<LibPfmCounterBackend>()) {}
+
+PerfSubsystem::PerfSubsystem(std::unique_ptr<PerfCounterBackend> backend)
+    : backend_(std::move(backend)) {
+  CHECK(backend_ != nullptr);
+  event_ids_.reserve(kMaxNumEvents);
+  timings_buffer_.reserve(kMaxNumEvents);
+}
+
+PerfSubsystem::~PerfSubsystem() { CleanUp(); }
+
+void PerfSubsystem::CleanUp() {
+  backend_->RemoveCounters();
+  event_ids_.resize(0);
+}
+
+std::vector<string> PerfSubsystem::GetHostEvents() const {
+  const MicroArchitecture* const microarchitecture =
+      backend_->microarchitecture();
+  CHECK(microarchitecture != nullptr)
+      << "The performance monitoring unit of the host is not supported";
+  const PerfEventsProto& perf_events = microarchitecture->proto().perf_events();
+  std::vector<string> events;
+  for (const auto* const category :
+       {&perf_events.cycle_events(), &perf_events.computation_events(),
+        &perf_events.memory_events(), &perf_events.uops_events()}) {
+    events.insert(events.end(), category->begin(), category->end());
+  }
+  return events;
+}
+
+int PerfSubsystem::AddEvent(const string& event_name) {
+  backend_->AddCounter(event_name);
+  event_ids_.push_back(InternPerfEvent(event_name));
+  return event_ids_.size() - 1;
+}
+
+void PerfSubsystem::StartCollecting() {
+  if (event_ids_.empty()) return;
+  backend_->StartCounters();
+}
+
 void PerfSubsystem::StartCollectingEvents(EventCategory category) {
+  const MicroArchitecture* const microarchitecture =
+      backend_->microarchitecture();
+  CHECK(microarchitecture != nullptr)
+      << "The performance monitoring unit of the host is not supported";
+  const auto& category_events =
+      (microarchitecture->proto().perf_events().*(category))();
+  const std::vector<string> events(category_events.begin(),
+                                   category_events.end());
+  CHECK_LE(SchedulePerfEvents(events, GetCounterCapacity()).size(), 1)
+      << "The events do not fit in the counters of the host, use "
+         "SchedulePerfEvents to avoid multiplexing";
+  StartCollectingEventGroup(events);
+}
+
+void PerfSubsystem::StartCollectingEventGroup(
+    const std::vector<string>& events) {
   CleanUp();
-  const auto& events = (microarchitecture_.proto().perf_events().*(category))();
-  CHECK_LE(events.size(), 4)
-      << "There should be less that 4 events to avoid multiplexing";
   for (const string& event : events) {
     AddEvent(event);
   }
@@ -192,27 +572,45 @@ void PerfSubsystem::StartCollectingEvents(EventCategory category) {
 }
 
 void PerfSubsystem::StopCollecting() {
-  for (const int fd : counter_fds_) {
-    const int ret = ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
-    CHECK_EQ(0, ret) << strerror(errno) << " fd = " << fd;
-  }
+  if (event_ids_.empty()) return;
+  backend_->StopCounters();
 }
 
 PerfResult PerfSubsystem::ReadCounters() {
-  const int num_fds = counter_fds_.size();
-  const int bytes_to_read = sizeof(TimingInfo);
-  for (int i = 0; i < num_fds; ++i) {
-    const int bytes_read =
-        read(counter_fds_[i], timers_.data() + i, bytes_to_read);
-    CHECK_EQ(bytes_to_read, bytes_read) << strerror(errno) << " i = " << i;
-  }
-  // We copy the result to the resulting vector here to avoid polluting the
-  // counters with the call to resize().
-  std::map<string, TimingInfo> timings;
-  for (int i = 0; i < num_fds; ++i) {
-    InsertOrDie(&timings, event_names_[i], timers_[i]);
-  }
-  return PerfResult(std::move(timings));
+  const int num_counters = event_ids_.size();
+  if (num_counters == 0) return PerfResult();
+  timings_buffer_.resize(num_counters);
+  backend_->ReadCounters(&timings_buffer_);
+  // The counters are stopped, so building the result does not pollute them.
+  PerfResult result;
+  for (int i = 0; i < num_counters; ++i) {
+    result.AddTiming(event_ids_[i], timings_buffer_[i]);
+  }
+  return result;
+}
+
+void PerfSubsystem::SnapshotCounters(std::vector<TimingInfo>* timings) {
+  CHECK(timings != nullptr);
+  timings->resize(event_ids_.size());
+  if (event_ids_.empty()) return;
+  backend_->ReadCounters(timings);
+}
+
+PerfResult PerfSubsystem::SnapshotDifference(
+    const std::vector<TimingInfo>& before,
+    const std::vector<TimingInfo>& after) const {
+  const int num_counters = event_ids_.size();
+  CHECK_EQ(num_counters, before.size());
+  CHECK_EQ(num_counters, after.size());
+  PerfResult result;
+  for (int i = 0; i < num_counters; ++i) {
+    result.AddTiming(
+        event_ids_[i],
+        TimingInfo(after[i].raw_count - before[i].raw_count,
+                   after[i].time_enabled - before[i].time_enabled,
+                   after[i].time_running - before[i].time_running));
+  }
+  return result;
 }
 
 }  // namespace cpu_instructions
@@ -15,20 +15,26 @@
 #ifndef CPU_INSTRUCTIONS_ITINERARIES_PERF_SUBSYSTEM_H_
 #define CPU_INSTRUCTIONS_ITINERARIES_PERF_SUBSYSTEM_H_
 
+#include <linux/perf_event.h>
 #include <cstdint>
 #include <map>
+#include <memory>
 #include <vector>
 #include "strings/string.h"
 
 #include "cpu_instructions/base/cpu_model.h"
+#include "cpu_instructions/itineraries/perf_event_registry.h"
+#include "cpu_instructions/itineraries/perf_event_scheduler.h"
 #include "cpu_instructions/proto/microarchitecture.pb.h"
+#include "cpu_instructions/util/mapped_memory.h"
+#include "cpu_instructions/util/sample_statistics.h"
 #include "glog/logging.h"
 #include "src/google/protobuf/repeated_field.h"
 #include "util/gtl/map_util.h"
 
 namespace cpu_instructions {
 // A minimalistic interface to the Linux kernel perf subsystem, based on
-// libpfm4.
+// libpfm4, or to a simulation of the counters.
 
 // The perf subsystem counters consist of three 64-bit integers.
 struct TimingInfo {
@@ -49,11 +55,13 @@ struct TimingInfo {
 };
 
 // Used to store the result of a profiled run.
-// The names of each event are stored in the map so that the object can
-// actually be used independently from a PerfSubsystem object.
-// We use an ordered map, because they are out of the critical performance path,
-// they are small (less than 10 pairs), and they enable to display sorted
-// results easily.
+// The counters are identified by the ID of their event in the registry of
+// perf_event_registry.h, and stored in a flat array indexed by the ID, so that
+// accumulating many results does not involve any string handling. The names of
+// the events are kept in the registry, so the object can be used
+// independently from a PerfSubsystem object. The methods that take an event
+// name are convenient out of the critical performance path; the names are
+// listed in sorted order, to display sorted results easily.
 class PerfResult {
  public:
   PerfResult() = default;
@@ -61,17 +69,60 @@ class PerfResult {
   PerfResult& operator=(const PerfResult&) = default;
 
   // For tests.
-  explicit PerfResult(std::map<string, TimingInfo> timings)
-      : timings_(std::move(timings)) {}
+  explicit PerfResult(const std::map<string, TimingInfo>& timings);
 
+  bool HasTiming(PerfEventId id) const {
+    return id >= 0 && id < has_timing_.size() && has_timing_[id];
+  }
   bool HasTiming(const string& name) const {
-    return ContainsKey(timings_, name);
+    return HasTiming(FindPerfEventId(name));
+  }
+
+  // Adds 'timing' to the counter of the event 'id'.
+  void AddTiming(PerfEventId id, const TimingInfo& timing);
+
+  // Returns the scaled value for the given counter. When the distribution
+  // of the counter is known (see SetStatistics), returns its median. When a
+  // baseline was subtracted (see SubtractBaseline), returns the difference.
+  double GetScaledOrDie(PerfEventId id) const;
+  double GetScaledOrDie(const string& name) const {
+    return GetScaledOrDie(FindPerfEventId(name));
   }
 
-  // Returns the scaled value for the given counter name.
-  double GetScaledOrDie(const string& name) const;
+  void SetScaleFactor(uint64_t num_times) { num_times_ = num_times; }
+  uint64_t scale_factor() const { return num_times_; }
+
+  // Records the distribution of the scaled values of the counter 'name' over
+  // several measurements. The statistics are printed by ToString, but they
+  // are not serialized by SerializeToString.
+  void SetStatistics(PerfEventId id, const SampleStatistics& statistics) {
+    statistics_[id] = statistics;
+  }
+  void SetStatistics(const string& name, const SampleStatistics& statistics) {
+    SetStatistics(InternPerfEvent(name), statistics);
+  }
+  bool HasStatistics(PerfEventId id) const {
+    return ContainsKey(statistics_, id);
+  }
+  bool HasStatistics(const string& name) const {
+    return HasStatistics(FindPerfEventId(name));
+  }
+  const SampleStatistics& GetStatisticsOrDie(PerfEventId id) const {
+    return FindOrDie(statistics_, id);
+  }
+  const SampleStatistics& GetStatisticsOrDie(const string& name) const {
+    return GetStatisticsOrDie(FindPerfEventId(name));
+  }
 
-  void SetScaleFactor(int num_times) { num_times_ = num_times; }
+  // Subtracts the scaled values of the counters of 'baseline', e.g. the
+  // overhead of the measurement harness, from the scaled values of the same
+  // counters of this result. The differences are clamped at zero, as the
+  // baseline is itself a noisy measurement. The baseline is not serialized
+  // by SerializeToString.
+  void SubtractBaseline(const PerfResult& baseline);
+  bool HasBaseline(const string& name) const {
+    return ContainsKey(baselines_, FindPerfEventId(name));
+  }
 
   // Returns a human-readable cycle count for `result`.
   string ToString() const;
@@ -79,16 +130,165 @@ class PerfResult {
   // Accumulates the counters in delta.
   void Accumulate(const PerfResult& delta);
 
-  // Returns all keys.
+  // Returns the IDs of all counters, in increasing order. Does not access the
+  // perf event registry.
+  std::vector<PerfEventId> EventIds() const;
+
+  // Returns the IDs of all counters, in the order of the names of their
+  // events. Used when the counters are printed or stored.
+  std::vector<PerfEventId> EventIdsByName() const;
+
+  // Returns all keys, in sorted order.
   std::vector<string> Keys() const;
 
+  // Serializes the raw counters and the scale factor to a string, and parses
+  // them back. Used to pass the results between processes. ParseFromString
+  // returns false if 'data' is not a valid serialized PerfResult.
+  string SerializeToString() const;
+  static bool ParseFromString(const string& data, PerfResult* result);
+
+  // Records the kind of pages that backed the measured code (resp. the data
+  // accessed by the memory operands of the measured code). The backings are
+  // printed by ToString when they are known.
+  void SetCodePageBacking(PageBacking backing) {
+    has_code_page_backing_ = true;
+    code_page_backing_ = backing;
+  }
+  void SetDataPageBacking(PageBacking backing) {
+    has_data_page_backing_ = true;
+    data_page_backing_ = backing;
+  }
+  bool has_code_page_backing() const { return has_code_page_backing_; }
+  PageBacking code_page_backing() const { return code_page_backing_; }
+  bool has_data_page_backing() const { return has_data_page_backing_; }
+  PageBacking data_page_backing() const { return data_page_backing_; }
+
  private:
   double Scale(const TimingInfo& info) const;
 
-  std::map<string, TimingInfo> timings_;
+  // The counters, indexed by the ID of their event. Only the elements for
+  // which 'has_timing_' is true are counters of this result.
+  std::vector<TimingInfo> timings_;
+  std::vector<bool> has_timing_;
+  std::map<PerfEventId, SampleStatistics> statistics_;
+  // The scaled values subtracted from the counters.
+  std::map<PerfEventId, double> baselines_;
   uint64_t num_times_ = 1;
+  bool has_code_page_backing_ = false;
+  PageBacking code_page_backing_ = REGULAR_PAGES;
+  bool has_data_page_backing_ = false;
+  PageBacking data_page_backing_ = REGULAR_PAGES;
 };  // namespace cpu_instructions
 
+// The source of the counters of a PerfSubsystem. A backend counts a group of
+// events: the counters are started, stopped and read together. The backend
+// used on real hardware is LibPfmCounterBackend; tests and benchmarks of the
+// layers above the counters can use a simulated backend instead (see
+// simulated_counter_backend.h). Not thread safe.
+class PerfCounterBackend {
+ public:
+  virtual ~PerfCounterBackend() {}
+
+  // Returns a string indicating which performance monitoring units are used
+  // by the backend.
+  virtual string Info() const = 0;
+
+  // Returns the microarchitecture whose events are counted by the backend, or
+  // nullptr when only the events added by name can be used.
+  virtual const MicroArchitecture* microarchitecture() const = 0;
+
+  // Returns the number of counters available to one thread.
+  virtual PerfCounterCapacity GetCounterCapacity() const = 0;
+
+  // Lists all the events supported by the backend.
+  virtual void ListEvents() const = 0;
+
+  // Adds a counter for 'event_name' to the group. Dies if the event is not
+  // supported.
+  virtual void AddCounter(const string& event_name) = 0;
+
+  // Removes all the counters.
+  virtual void RemoveCounters() = 0;
+
+  // Starts and stops all the counters of the group.
+  virtual void StartCounters() = 0;
+  virtual void StopCounters() = 0;
+
+  // Stores the values of the counters, in the order in which they were added,
+  // to 'timings'. 'timings' has one element per counter. Works both when the
+  // counters are stopped and when they are running; the counts are cumulative
+  // since the counters were added.
+  virtual void ReadCounters(std::vector<TimingInfo>* timings) = 0;
+
+  // Returns true if ReadCounters reads the counters without a system call.
+  virtual bool CanReadCountersInUserSpace() const = 0;
+};
+
+// The counters of the Linux kernel perf subsystem, configured with libpfm4.
+// The counters of the group are started, stopped and read with one system
+// call each. The counters measure only the thread that starts them.
+class LibPfmCounterBackend : public PerfCounterBackend {
+ public:
+  // Creates a backend for the host microarchitecture. When the host CPU or its
+  // performance monitoring unit is not supported (e.g. in a virtual machine),
+  // only the events added by name can be used.
+  LibPfmCounterBackend();
+  ~LibPfmCounterBackend() override;
+
+  string Info() const override;
+  const MicroArchitecture* microarchitecture() const override {
+    return microarchitecture_;
+  }
+  // One counter is left to the NMI watchdog of the kernel when it is enabled.
+  PerfCounterCapacity GetCounterCapacity() const override;
+  void ListEvents() const override;
+  void AddCounter(const string& event_name) override;
+  void RemoveCounters() override;
+  void StartCounters() override;
+  void StopCounters() override;
+  // Reads the counters with rdpmc when they are running and the kernel allows
+  // it, and with the read() system call otherwise.
+  void ReadCounters(std::vector<TimingInfo>* timings) override;
+  // This requires a hardware PMU, and a kernel that allows rdpmc
+  // (/sys/bus/event_source/devices/cpu/rdpmc).
+  bool CanReadCountersInUserSpace() const override;
+
+ private:
+  // Reads all the counters of the group to read_buffer_ with one system call.
+  void ReadGroup();
+
+  // Returns the timing of 'counter' from the data read by ReadGroup.
+  TimingInfo GetGroupTiming(int counter) const;
+
+  // Reads 'counter' from its mapped page with rdpmc. Returns false when the
+  // kernel does not allow reading the counter in user space.
+  bool ReadCounterInUserSpace(int counter, TimingInfo* timing) const;
+
+  // This interface can handle at most kMaxNumCounters counters at the same
+  // time.
+  static constexpr const int kMaxNumCounters = 128;
+  // The number of values that precede the counter values in the data read
+  // from the group leader: the number of counters, the time enabled and the
+  // time running.
+  static constexpr const int kGroupReadHeaderSize = 3;
+  // The host microarchitecture, or nullptr when its performance monitoring
+  // unit is not supported.
+  const MicroArchitecture* microarchitecture_ = nullptr;
+  // File descriptor for each counter. The first one is the group leader.
+  std::vector<int> counter_fds_;
+  // The mapped perf_event_mmap_page of each counter, or nullptr when the
+  // kernel did not allow the mapping.
+  std::vector<const perf_event_mmap_page*> counter_pages_;
+  // Used to store the result of the profiling, as read from the group leader.
+  // Allocated in advance to keep the allocation out of the measurements.
+  std::vector<uint64_t> read_buffer_;
+  // True between StartCounters and StopCounters.
+  bool running_ = false;
+};
+
+// All the events added to a PerfSubsystem are counted as a single group by its
+// PerfCounterBackend: they are started, stopped and read together, so that the
+// counters measure exactly the same instructions.
 // Not thread safe.
 class PerfSubsystem {
  public:
@@ -96,9 +296,13 @@ class PerfSubsystem {
   using EventCategory = const ::google::protobuf::RepeatedPtrField<string>& (
       PerfEventsProto::*)() const;
 
-  // Creates a perf subsystem for the host microarchitecture.
+  // Creates a perf subsystem that uses the counters of the host, with a
+  // LibPfmCounterBackend.
   PerfSubsystem();
 
+  // Creates a perf subsystem that uses the counters of 'backend'.
+  explicit PerfSubsystem(std::unique_ptr<PerfCounterBackend> backend);
+
   ~PerfSubsystem();
 
   // Cleans up the used counters. This is useful for preparing the object
@@ -107,64 +311,96 @@ class PerfSubsystem {
 
   // Returns a string indicating which performance monitoring unit is
   // supported by the running system.
-  string Info() const;
+  string Info() const { return backend_->Info(); }
 
   // Lists all the events supported by the running platform.
-  void ListEvents();
+  void ListEvents() { backend_->ListEvents(); }
+
+  // Returns the number of hardware counters available to one thread, as
+  // reported by the backend.
+  PerfCounterCapacity GetCounterCapacity() const {
+    return backend_->GetCounterCapacity();
+  }
+
+  // Returns the events of all categories of the microarchitecture of the
+  // backend. They usually do not fit in the counters at the same time; use
+  // SchedulePerfEvents to split them into groups.
+  std::vector<string> GetHostEvents() const;
 
   // Adds an event to be measured by the current object. Returns the index of
-  // the newly added event.
+  // the newly added event. The first event is the leader of the group.
   int AddEvent(const string& event_name);
 
   // Starts collecting data, i.e. hardware counters will be updated from here.
   void StartCollecting();
 
-  // A short-cut that adds the events in 'category' and starts collecting.
+  // Stops collecting data, i.e. hardware counters will be stop being updated
+  // from here. The counters stay open; StartCollecting resumes them.
+  void StopCollecting();
+
+  // A short-cut that adds the events in 'category' and starts collecting. The
+  // events must fit in the counters of the host.
   void StartCollectingEvents(EventCategory category);
 
+  // A short-cut that replaces the current events by 'events', and starts
+  // collecting. Use the groups returned by SchedulePerfEvents to avoid
+  // multiplexing.
+  void StartCollectingEventGroup(const std::vector<string>& events);
+
   // A short-cut that stops collecting and reads the counters.
   PerfResult StopAndReadCounters() {
     StopCollecting();
     return ReadCounters();
   }
 
- private:
-  // Stops collecting data, i.e. hardware counters will be stop being updated
-  // from here.
-  void StopCollecting();
+  // Returns true if the counters can be read in user space with rdpmc, without
+  // a system call.
+  bool CanReadCountersInUserSpace() const {
+    return !event_ids_.empty() && backend_->CanReadCountersInUserSpace();
+  }
+
+  // Reads the counters without stopping them, or while they are stopped, and
+  // stores one TimingInfo per counter to 'timings', in the order in which the
+  // counters were added. The counts are cumulative since the first time the
+  // counters were started; use SnapshotDifference to measure the code between
+  // two snapshots. 'timings' is resized to the number of counters; reuse it to
+  // keep the allocation out of the measurements.
+  void SnapshotCounters(std::vector<TimingInfo>* timings);
+
+  // Returns the counts between two snapshots taken by SnapshotCounters.
+  PerfResult SnapshotDifference(const std::vector<TimingInfo>& before,
+                                const std::vector<TimingInfo>& after) const;
 
+ private:
   // Reads the hardware counters and returns a PerfResult that contains all the
   // useful information, independently of the PerfSubsystem.
   PerfResult ReadCounters();
 
-  // This interface can handle at most kMaxNumCounters counters at the same
-  // time.
-  static constexpr const int kMaxNumCounters = 128;
-  const MicroArchitecture& microarchitecture_;
-  // File descriptor for each counter.
-  std::vector<int> counter_fds_;
-  // Name as given by libpfm4, of the event for each counter.
-  std::vector<string> event_names_;
-  // Used to store the result of the profiling.
-  std::vector<TimingInfo> timers_;
+  // The number of events for which memory is reserved in advance.
+  static constexpr const int kMaxNumEvents = 128;
+  const std::unique_ptr<PerfCounterBackend> backend_;
+  // The ID of the event of each counter, as interned by InternPerfEvent.
+  std::vector<PerfEventId> event_ids_;
+  // The values read by ReadCounters. Allocated in advance to keep the
+  // allocation out of the measurements.
+  std::vector<TimingInfo> timings_buffer_;
 };
 
 }  // namespace cpu_instructions
 
-#define CPU_INSTRUCTIONS_MEASURE_LOOP(result, num_iter, s, events)          \
-  perf.StartCollectingEvents(&::cpu_instructions::PerfEventsProto::events); \
-  for (int i = 0; i < num_iter; ++i) {                                      \
-    s;                                                                      \
-  }                                                                         \
-  (result)->Accumulate(perf.StopAndReadCounters());
-
-// A basic macro that measures a code snippet s.
+// A basic macro that measures a code snippet s. Runs the snippet once for each
+// group of the events of the host that fits in the counters.
 #define CPU_INSTRUCTIONS_RUN_UNDER_PERF(result, num_iter, s)                \
   {                                                                         \
     ::cpu_instructions::PerfSubsystem perf;                                 \
-    CPU_INSTRUCTIONS_MEASURE_LOOP(result, num_iter, s, computation_events); \
-    CPU_INSTRUCTIONS_MEASURE_LOOP(result, num_iter, s, memory_events);      \
-    CPU_INSTRUCTIONS_MEASURE_LOOP(result, num_iter, s, cycle_events);       \
+    for (const auto& events : ::cpu_instructions::SchedulePerfEvents(       \
+             perf.GetHostEvents(), perf.GetCounterCapacity())) {            \
+      perf.StartCollectingEventGroup(events);                               \
+      for (int i = 0; i < num_iter; ++i) {                                  \
+        s;                                                                  \
+      }                                                                     \
+      (result)->Accumulate(perf.StopAndReadCounters());                     \
+    }                                                                       \
     (result)->SetScaleFactor(num_iter);                                     \
   }
 
@@ -15,6 +15,7 @@
 #include "cpu_instructions/itineraries/perf_subsystem.h"
 
 #include <cstdint>
+#include <vector>
 
 #include "glog/logging.h"
 #include "gtest/gtest.h"
@@ -43,6 +44,67 @@ TEST(PerfSubsystemTest, Accumulate) {
   EXPECT_EQ(r1_string, r.ToString());
 }
 
+TEST(PerfSubsystemTest, PageBacking) {
+  PerfResult r1({{"a", TimingInfo(1, 2, 3)}});
+  EXPECT_FALSE(r1.has_code_page_backing());
+  r1.SetCodePageBacking(HUGETLB_PAGES);
+  EXPECT_EQ("a: 1.50, (num_times: 1, code_pages: hugetlb)", r1.ToString());
+  r1.SetDataPageBacking(REGULAR_PAGES);
+  EXPECT_EQ("a: 1.50, (num_times: 1, code_pages: hugetlb, data_pages: regular)",
+            r1.ToString());
+  PerfResult r2;
+  r2.Accumulate(r1);
+  ASSERT_TRUE(r2.has_code_page_backing());
+  EXPECT_EQ(r2.code_page_backing(), HUGETLB_PAGES);
+  ASSERT_TRUE(r2.has_data_page_backing());
+  EXPECT_EQ(r2.data_page_backing(), REGULAR_PAGES);
+}
+
+TEST(PerfSubsystemTest, SubtractBaseline) {
+  PerfResult result({{"a", TimingInfo(30, 1, 1)}, {"b", TimingInfo(10, 1, 1)},
+                     {"c", TimingInfo(10, 1, 1)}});
+  result.SetScaleFactor(10);
+  PerfResult baseline(
+      {{"a", TimingInfo(5, 1, 1)}, {"b", TimingInfo(20, 1, 1)}});
+  baseline.SetScaleFactor(10);
+  result.SubtractBaseline(baseline);
+  EXPECT_TRUE(result.HasBaseline("a"));
+  EXPECT_DOUBLE_EQ(result.GetScaledOrDie("a"), 2.5);
+  // The differences are clamped at zero.
+  EXPECT_DOUBLE_EQ(result.GetScaledOrDie("b"), 0.0);
+  EXPECT_FALSE(result.HasBaseline("c"));
+  EXPECT_DOUBLE_EQ(result.GetScaledOrDie("c"), 1.0);
+  EXPECT_EQ("a: 2.50, b: 0.00, c: 1.00, (num_times: 10)", result.ToString());
+}
+
+TEST(PerfSubsystemTest, EventIds) {
+  // The IDs are assigned in the order in which the names are interned.
+  const PerfEventId second_id = InternPerfEvent("event_ids_test:second");
+  const PerfEventId first_id = InternPerfEvent("event_ids_test:first");
+  const PerfResult result({{"event_ids_test:first", TimingInfo(1, 1, 1)},
+                           {"event_ids_test:second", TimingInfo(2, 1, 1)}});
+  EXPECT_EQ(result.EventIds(), std::vector<PerfEventId>({second_id, first_id}));
+  EXPECT_EQ(result.EventIdsByName(),
+            std::vector<PerfEventId>({first_id, second_id}));
+  EXPECT_EQ(result.Keys(), std::vector<string>({"event_ids_test:first",
+                                                "event_ids_test:second"}));
+}
+
+TEST(PerfSubsystemTest, SerializeToString) {
+  PerfResult result({{"a", TimingInfo(1, 2, 3)}, {"b:c", TimingInfo(4, 5, 6)}});
+  result.SetScaleFactor(10);
+  PerfResult parsed;
+  ASSERT_TRUE(PerfResult::ParseFromString(result.SerializeToString(), &parsed));
+  EXPECT_EQ(result.ToString(), parsed.ToString());
+  EXPECT_FALSE(PerfResult::ParseFromString("1\na 1 2", &parsed));
+  // A record cut off at the end of the data is not a complete record.
+  const string serialized = result.SerializeToString();
+  EXPECT_FALSE(PerfResult::ParseFromString(
+      serialized.substr(0, serialized.size() - 3), &parsed));
+  EXPECT_FALSE(PerfResult::ParseFromString("1\na 1 2 3\nb 4 5", &parsed));
+  EXPECT_FALSE(PerfResult::ParseFromString("", &parsed));
+}
+
 namespace {
 int Fib(int n) {
   if (n < 2) return 1;
@@ -58,6 +120,59 @@ TEST(PerfSubsystemTest, Collect) {
   LOG(INFO) << result.ToString();
 }
 
+// Uses software events, which are available also on hosts without a
+// performance monitoring unit.
+TEST(PerfSubsystemTest, EventGroup) {
+  constexpr char kTaskClock[] = "perf::PERF_COUNT_SW_TASK_CLOCK";
+  constexpr char kContextSwitches[] = "perf::PERF_COUNT_SW_CONTEXT_SWITCHES";
+  PerfSubsystem perf_subsystem;
+  EXPECT_EQ(0, perf_subsystem.AddEvent(kTaskClock));
+  EXPECT_EQ(1, perf_subsystem.AddEvent(kContextSwitches));
+  perf_subsystem.StartCollecting();
+  const int k = Fib(25);
+  const PerfResult result = perf_subsystem.StopAndReadCounters();
+  EXPECT_EQ(121393, k);
+  ASSERT_TRUE(result.HasTiming(kTaskClock));
+  ASSERT_TRUE(result.HasTiming(kContextSwitches));
+  EXPECT_GT(result.GetScaledOrDie(kTaskClock), 0);
+  LOG(INFO) << result.ToString();
+
+  // The counters are not reset between two collections.
+  perf_subsystem.StartCollecting();
+  const PerfResult second_result = perf_subsystem.StopAndReadCounters();
+  EXPECT_GE(second_result.GetScaledOrDie(kTaskClock),
+            result.GetScaledOrDie(kTaskClock));
+}
+
+TEST(PerfSubsystemTest, GetCounterCapacity) {
+  PerfSubsystem perf_subsystem;
+  const PerfCounterCapacity capacity = perf_subsystem.GetCounterCapacity();
+  EXPECT_GT(capacity.num_general_counters, 0);
+  EXPECT_GE(capacity.num_fixed_counters, 0);
+}
+
+// Software events are read with the read() system call.
+TEST(PerfSubsystemTest, SnapshotCounters) {
+  constexpr char kTaskClock[] = "perf::PERF_COUNT_SW_TASK_CLOCK";
+  PerfSubsystem perf_subsystem;
+  perf_subsystem.AddEvent(kTaskClock);
+  EXPECT_FALSE(perf_subsystem.CanReadCountersInUserSpace());
+  perf_subsystem.StartCollecting();
+  std::vector<TimingInfo> before;
+  std::vector<TimingInfo> after;
+  perf_subsystem.SnapshotCounters(&before);
+  const int k = Fib(25);
+  perf_subsystem.SnapshotCounters(&after);
+  perf_subsystem.StopAndReadCounters();
+  EXPECT_EQ(121393, k);
+  ASSERT_EQ(1, before.size());
+  ASSERT_EQ(1, after.size());
+  EXPECT_GT(after[0].raw_count, before[0].raw_count);
+  const PerfResult result = perf_subsystem.SnapshotDifference(before, after);
+  EXPECT_GT(result.GetScaledOrDie(kTaskClock), 0);
+  LOG(INFO) << result.ToString();
+}
+
 TEST(PerfSubsystemTest, BasicInlineAsmSyntax) {
   asm volatile(NL "movl %0,%%eax"
                :        /* output" */
@@ -0,0 +1,144 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/simulated_counter_backend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include "strings/string.h"
+
+#include "glog/logging.h"
+#include "re2/re2.h"
+#include "strings/case.h"
+#include "strings/str_cat.h"
+#include "strings/string_view_utils.h"
+
+namespace cpu_instructions {
+
+namespace {
+
+// Returns the expected number of micro-operations of 'itinerary' executed on
+// each port, assuming that each micro-operation is spread evenly over the
+// ports of its port mask.
+std::map<int, double> GetPortLoads(const ItineraryProto& itinerary) {
+  std::map<int, double> loads;
+  for (const MicroOperationProto& micro_op : itinerary.micro_ops()) {
+    const auto& ports = micro_op.port_mask().port_numbers();
+    for (const int port : ports) {
+      loads[port] += 1.0 / ports.size();
+    }
+  }
+  return loads;
+}
+
+}  // namespace
+
+double GetSimulatedCountPerExecution(const ItineraryProto& itinerary,
+                                     const string& event_name) {
+  string lower_case = event_name;
+  LowerString(&lower_case);
+  const std::map<int, double> port_loads = GetPortLoads(itinerary);
+  int port = 0;
+  if (RE2::PartialMatch(lower_case, R"(port_?(\d)$)", &port)) {
+    const auto it = port_loads.find(port);
+    return it == port_loads.end() ? 0.0 : it->second;
+  }
+  switch (GetFixedCounterIndex(lower_case)) {
+    case 0:
+      return 1.0;
+    case 1:
+    case 2: {
+      double cycles = itinerary.max_throughput();
+      for (const auto& port_load : port_loads) {
+        cycles = std::max(cycles, port_load.second);
+      }
+      return cycles;
+    }
+    default:
+      break;
+  }
+  if (strings::StartsWith(lower_case, "uops_issued")) {
+    return itinerary.has_num_uops_fused_domain()
+               ? itinerary.num_uops_fused_domain()
+               : itinerary.micro_ops_size();
+  }
+  if (strings::StartsWith(lower_case, "uops_retired")) {
+    return itinerary.has_num_uops_unfused_domain()
+               ? itinerary.num_uops_unfused_domain()
+               : itinerary.micro_ops_size();
+  }
+  return 0.0;
+}
+
+SimulatedCounterBackend::SimulatedCounterBackend(
+    const MicroArchitecture& microarchitecture, const ItineraryProto& itinerary,
+    int64_t num_executions_per_run)
+    : microarchitecture_(microarchitecture),
+      itinerary_(itinerary),
+      num_executions_per_run_(num_executions_per_run) {
+  CHECK_GT(num_executions_per_run_, 0);
+}
+
+string SimulatedCounterBackend::Info() const {
+  return StrCat("simulated ", microarchitecture_.proto().id());
+}
+
+void SimulatedCounterBackend::ListEvents() const {
+  const PerfEventsProto& perf_events =
+      microarchitecture_.proto().perf_events();
+  for (const auto* const category :
+       {&perf_events.cycle_events(), &perf_events.computation_events(),
+        &perf_events.memory_events(), &perf_events.uops_events()}) {
+    for (const string& event : *category) {
+      LOG(INFO) << "Simulated Event: " << event;
+    }
+  }
+}
+
+void SimulatedCounterBackend::AddCounter(const string& event_name) {
+  CHECK(!running_);
+  counts_per_execution_.push_back(
+      GetSimulatedCountPerExecution(itinerary_, event_name));
+  timings_.emplace_back();
+}
+
+void SimulatedCounterBackend::RemoveCounters() {
+  counts_per_execution_.clear();
+  timings_.clear();
+  running_ = false;
+}
+
+void SimulatedCounterBackend::StartCounters() {
+  CHECK(!running_);
+  running_ = true;
+}
+
+void SimulatedCounterBackend::StopCounters() {
+  CHECK(running_);
+  running_ = false;
+  ++num_runs_;
+  for (int i = 0; i < timings_.size(); ++i) {
+    timings_[i].Accumulate(TimingInfo(
+        std::llround(counts_per_execution_[i] * num_executions_per_run_),
+        num_executions_per_run_, num_executions_per_run_));
+  }
+}
+
+void SimulatedCounterBackend::ReadCounters(std::vector<TimingInfo>* timings) {
+  CHECK_EQ(timings_.size(), timings->size());
+  std::copy(timings_.begin(), timings_.end(), timings->begin());
+}
+
+}  // namespace cpu_instructions
@@ -0,0 +1,103 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A deterministic PerfCounterBackend that does not use the hardware. The
+// counts are derived from the itinerary of an instruction, as if the
+// instruction was executed a fixed number of times while the counters run.
+// This lets the code that consumes the counters (the measurement engine, the
+// statistics, the event scheduling and the decomposition into micro-operations)
+// be tested and benchmarked on machines without a usable PMU, e.g. in virtual
+// machines.
+
+#ifndef CPU_INSTRUCTIONS_ITINERARIES_SIMULATED_COUNTER_BACKEND_H_
+#define CPU_INSTRUCTIONS_ITINERARIES_SIMULATED_COUNTER_BACKEND_H_
+
+#include <cstdint>
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/base/cpu_model.h"
+#include "cpu_instructions/itineraries/perf_event_scheduler.h"
+#include "cpu_instructions/itineraries/perf_subsystem.h"
+#include "cpu_instructions/proto/instructions.pb.h"
+
+namespace cpu_instructions {
+
+// Returns the value of the counter 'event_name' for one execution of an
+// instruction with the given itinerary:
+// * the events of an execution port ("uops_executed_port:port_1",
+//   "uops_dispatched:port_1", "uops_executed:port1", ...) count the micro-
+//   operations that may run on the port, each one spread evenly over the ports
+//   of its port mask;
+// * the events of the fixed instruction counter (see GetFixedCounterIndex)
+//   count 1;
+// * the "uops_issued" events count the micro-operations in the fused domain,
+//   and the "uops_retired" events those in the unfused domain; both default to
+//   the number of micro-operations of the itinerary;
+// * the events of the fixed cycle counters count the inverse throughput: the
+//   maximal throughput of the itinerary, or the load of the busiest port when
+//   it is larger;
+// * all other events count 0.
+double GetSimulatedCountPerExecution(const ItineraryProto& itinerary,
+                                     const string& event_name);
+
+// Each time the counters are started and stopped, they count
+// 'num_executions_per_run' executions of the instruction. The time enabled and
+// the time running of the counters are both equal to the number of executions,
+// so the counters are never scaled for multiplexing.
+class SimulatedCounterBackend : public PerfCounterBackend {
+ public:
+  // 'microarchitecture' is used to get the events of the simulated host; it
+  // must outlive the backend.
+  SimulatedCounterBackend(const MicroArchitecture& microarchitecture,
+                          const ItineraryProto& itinerary,
+                          int64_t num_executions_per_run);
+
+  // Changes the number of counters reported by GetCounterCapacity.
+  void SetCounterCapacity(const PerfCounterCapacity& capacity) {
+    capacity_ = capacity;
+  }
+
+  // Returns the number of times the counters were started and stopped.
+  int num_runs() const { return num_runs_; }
+
+  string Info() const override;
+  const MicroArchitecture* microarchitecture() const override {
+    return &microarchitecture_;
+  }
+  PerfCounterCapacity GetCounterCapacity() const override { return capacity_; }
+  void ListEvents() const override;
+  void AddCounter(const string& event_name) override;
+  void RemoveCounters() override;
+  void StartCounters() override;
+  void StopCounters() override;
+  void ReadCounters(std::vector<TimingInfo>* timings) override;
+  bool CanReadCountersInUserSpace() const override { return false; }
+
+ private:
+  const MicroArchitecture& microarchitecture_;
+  const ItineraryProto itinerary_;
+  const int64_t num_executions_per_run_;
+  PerfCounterCapacity capacity_;
+  // The count of each counter for one execution, and the accumulated values
+  // of the counters.
+  std::vector<double> counts_per_execution_;
+  std::vector<TimingInfo> timings_;
+  bool running_ = false;
+  int num_runs_ = 0;
+};
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_ITINERARIES_SIMULATED_COUNTER_BACKEND_H_
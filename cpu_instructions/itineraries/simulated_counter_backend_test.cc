@@ -0,0 +1,153 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/simulated_counter_backend.h"
+
+#include <memory>
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/itineraries/adaptive_measurement.h"
+#include "cpu_instructions/itineraries/decomposition.h"
+#include "cpu_instructions/itineraries/perf_event_scheduler.h"
+#include "cpu_instructions/itineraries/perf_subsystem.h"
+#include "cpu_instructions/x86/microarchitectures.h"
+#include "gtest/gtest.h"
+#include "src/google/protobuf/text_format.h"
+#include "util/gtl/ptr_util.h"
+#include "util/task/status.h"
+
+namespace cpu_instructions {
+namespace {
+
+using ::cpu_instructions::x86::HaswellMicroArchitecture;
+
+constexpr int kNumExecutions = 1000;
+
+// The itinerary of a store with an address computation, e.g. ADD [RSI], 1.
+ItineraryProto MakeItinerary() {
+  constexpr char kItinerary[] = R"(
+      num_uops_fused_domain: 2
+      micro_ops { port_mask { port_numbers: [2, 3] } }
+      micro_ops { port_mask { port_numbers: [0, 1, 5, 6] } }
+      micro_ops { port_mask { port_numbers: 4 } }
+  )";
+  ItineraryProto itinerary;
+  CHECK(google::protobuf::TextFormat::ParseFromString(kItinerary, &itinerary));
+  return itinerary;
+}
+
+std::unique_ptr<SimulatedCounterBackend> MakeBackend() {
+  return gtl::MakeUnique<SimulatedCounterBackend>(
+      HaswellMicroArchitecture(), MakeItinerary(), kNumExecutions);
+}
+
+// Measures all the events of the simulated host, as MeasureFunction does.
+PerfResult MeasureAllEvents(PerfSubsystem* perf_subsystem) {
+  PerfResult result;
+  for (const std::vector<string>& events :
+       SchedulePerfEvents(perf_subsystem->GetHostEvents(),
+                          perf_subsystem->GetCounterCapacity())) {
+    perf_subsystem->StartCollectingEventGroup(events);
+    result.Accumulate(perf_subsystem->StopAndReadCounters());
+  }
+  result.SetScaleFactor(kNumExecutions);
+  return result;
+}
+
+TEST(SimulatedCounterBackendTest, CountsPerExecution) {
+  const ItineraryProto itinerary = MakeItinerary();
+  EXPECT_DOUBLE_EQ(
+      GetSimulatedCountPerExecution(itinerary, "uops_executed_port:port_0"),
+      0.25);
+  EXPECT_DOUBLE_EQ(
+      GetSimulatedCountPerExecution(itinerary, "uops_dispatched:port_2"), 0.5);
+  EXPECT_DOUBLE_EQ(
+      GetSimulatedCountPerExecution(itinerary, "uops_executed:port4"), 1.0);
+  EXPECT_DOUBLE_EQ(
+      GetSimulatedCountPerExecution(itinerary, "uops_executed_port:port_7"),
+      0.0);
+  EXPECT_DOUBLE_EQ(GetSimulatedCountPerExecution(itinerary, "instructions"),
+                   1.0);
+  EXPECT_DOUBLE_EQ(GetSimulatedCountPerExecution(itinerary, "cycles"), 1.0);
+  EXPECT_DOUBLE_EQ(GetSimulatedCountPerExecution(itinerary, "uops_issued:any"),
+                   2.0);
+  EXPECT_DOUBLE_EQ(
+      GetSimulatedCountPerExecution(itinerary, "uops_retired:all"), 3.0);
+  EXPECT_DOUBLE_EQ(GetSimulatedCountPerExecution(itinerary, "ild_stall.lcp"),
+                   0.0);
+}
+
+TEST(SimulatedCounterBackendTest, MeasuresWithPerfSubsystem) {
+  std::unique_ptr<SimulatedCounterBackend> backend = MakeBackend();
+  const SimulatedCounterBackend* const backend_ptr = backend.get();
+  PerfSubsystem perf_subsystem(std::move(backend));
+  const PerfResult result = MeasureAllEvents(&perf_subsystem);
+  // The events of Haswell need several groups of four counters.
+  EXPECT_GT(backend_ptr->num_runs(), 1);
+  EXPECT_DOUBLE_EQ(result.GetScaledOrDie("uops_executed_port:port_1"), 0.25);
+  EXPECT_DOUBLE_EQ(result.GetScaledOrDie("uops_executed_port:port_3"), 0.5);
+  EXPECT_DOUBLE_EQ(result.GetScaledOrDie("uops_executed_port:port_4"), 1.0);
+  EXPECT_DOUBLE_EQ(result.GetScaledOrDie("uops_retired:all"), 3.0);
+  EXPECT_DOUBLE_EQ(result.GetScaledOrDie("cycles"), 1.0);
+}
+
+TEST(SimulatedCounterBackendTest, SnapshotsAreDeterministic) {
+  PerfSubsystem perf_subsystem(MakeBackend());
+  perf_subsystem.StartCollectingEventGroup({"instructions"});
+  std::vector<TimingInfo> before;
+  perf_subsystem.SnapshotCounters(&before);
+  const PerfResult first = perf_subsystem.StopAndReadCounters();
+  EXPECT_EQ(before[0].raw_count, 0);
+  EXPECT_DOUBLE_EQ(first.GetScaledOrDie("instructions"), kNumExecutions);
+  // The counts are cumulative until the counters are replaced.
+  perf_subsystem.StartCollecting();
+  EXPECT_DOUBLE_EQ(
+      perf_subsystem.StopAndReadCounters().GetScaledOrDie("instructions"),
+      2 * kNumExecutions);
+}
+
+TEST(SimulatedCounterBackendTest, AdaptiveMeasurementConverges) {
+  PerfSubsystem perf_subsystem(MakeBackend());
+  AdaptiveMeasurementOptions options;
+  int num_runs = 0;
+  PerfResult result;
+  ASSERT_TRUE(MeasureAdaptively(
+                  options,
+                  [&perf_subsystem, &num_runs](PerfResult* run_result) {
+                    ++num_runs;
+                    *run_result = MeasureAllEvents(&perf_subsystem);
+                    return util::OkStatus();
+                  },
+                  &result)
+                  .ok());
+  // The simulated counters have no noise.
+  EXPECT_EQ(num_runs, options.num_warmup_runs + options.min_num_runs);
+  EXPECT_DOUBLE_EQ(
+      result.GetStatisticsOrDie("uops_issued:any").median_absolute_deviation,
+      0.0);
+  EXPECT_DOUBLE_EQ(result.GetScaledOrDie("uops_issued:any"), 2.0);
+}
+
+TEST(SimulatedCounterBackendTest, DecomposesSimulatedCounters) {
+  PerfSubsystem perf_subsystem(MakeBackend());
+  ObservationVector observations;
+  AddObservations(MeasureAllEvents(&perf_subsystem), &observations);
+  itineraries::DecompositionSolver solver(HaswellMicroArchitecture());
+  ASSERT_TRUE(solver.Run(observations).ok());
+  EXPECT_EQ(solver.GetMicroOps().size(), 3);
+}
+
+}  // namespace
+}  // namespace cpu_instructions
@@ -0,0 +1,122 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/snippet_batch.h"
+
+#include <memory>
+#include <utility>
+
+#include "cpu_instructions/itineraries/jit_perf_evaluator.h"
+#include "glog/logging.h"
+
+namespace cpu_instructions {
+
+AssemblySnippet MakeAssemblySnippet(const SnippetBatchOptions& options,
+                                    const SnippetCode& code,
+                                    const MappedMemory* scratch_memory) {
+  AssemblySnippet snippet;
+  snippet.num_outer_iterations = options.num_outer_iterations;
+  snippet.num_inner_iterations = options.num_inner_iterations;
+  bool uses_memory = false;
+  for (const SnippetInstruction& instruction : code) {
+    uses_memory |= UsesMemory(instruction);
+    if (!snippet.measured_code.empty()) snippet.measured_code += "\n";
+    snippet.measured_code += ToCodeString(instruction);
+  }
+  if (uses_memory) {
+    CHECK(scratch_memory != nullptr);
+    snippet.init_code = MakeScratchMemoryInitCode(*scratch_memory);
+  }
+  snippet.constraints = MakeClobberConstraints(code);
+  return snippet;
+}
+
+void MeasureSnippetBatch(
+    const SnippetBatchOptions& options,
+    const InstructionSetProto& instruction_set, ParallelMeasurementPool* pool,
+    const std::function<StatusOr<std::vector<SnippetCode>>(int index)>&
+        make_snippets,
+    const std::function<void(int index,
+                             const std::vector<StatusOr<PerfResult>>& results,
+                             ItineraryProto* itinerary)>& add_results,
+    const std::function<void(int index, const Status& status)>&
+        report_unmeasurable,
+    InstructionSetItinerariesProto* itineraries) {
+  CHECK(pool != nullptr);
+  CHECK(itineraries != nullptr);
+  const HostCpuInfo& host_cpu =
+      options.host_cpu != nullptr ? *options.host_cpu : HostCpuInfo::Get();
+  const int num_instructions = instruction_set.instructions_size();
+  // The snippets of each instruction, or an error when it can't be measured.
+  std::vector<StatusOr<std::vector<SnippetCode>>> instruction_snippets;
+  instruction_snippets.reserve(num_instructions);
+  bool uses_memory = false;
+  for (int i = 0; i < num_instructions; ++i) {
+    const Status supported =
+        CheckHostSupportsInstruction(host_cpu, instruction_set.instructions(i));
+    if (!supported.ok()) {
+      instruction_snippets.push_back(supported);
+      continue;
+    }
+    instruction_snippets.push_back(make_snippets(i));
+    if (!instruction_snippets.back().ok()) continue;
+    for (const SnippetCode& code : instruction_snippets.back().ValueOrDie()) {
+      for (const SnippetInstruction& instruction : code) {
+        uses_memory |= UsesMemory(instruction);
+      }
+    }
+  }
+  std::unique_ptr<MappedMemory> owned_scratch_memory;
+  const MappedMemory* scratch_memory = options.scratch_memory;
+  if (uses_memory && scratch_memory == nullptr) {
+    owned_scratch_memory = AllocateScratchMemory(kScratchMemoryBytes);
+    scratch_memory = owned_scratch_memory.get();
+  }
+
+  std::vector<AssemblySnippet> snippets;
+  for (const StatusOr<std::vector<SnippetCode>>& codes : instruction_snippets) {
+    if (!codes.ok()) continue;
+    for (const SnippetCode& code : codes.ValueOrDie()) {
+      snippets.push_back(MakeAssemblySnippet(options, code, scratch_memory));
+    }
+  }
+  LOG(INFO) << "Measuring " << snippets.size() << " snippets of "
+            << num_instructions << " instructions";
+  const std::vector<StatusOr<PerfResult>> results =
+      pool->EvaluateAssemblyStrings(snippets);
+
+  while (itineraries->itineraries_size() < num_instructions) {
+    itineraries->add_itineraries();
+  }
+  auto result_it = results.begin();
+  for (int i = 0; i < num_instructions; ++i) {
+    const InstructionProto& instruction = instruction_set.instructions(i);
+    ItineraryProto* const itinerary = itineraries->mutable_itineraries(i);
+    if (!itinerary->has_llvm_mnemonic()) {
+      itinerary->set_llvm_mnemonic(instruction.llvm_mnemonic());
+    }
+    const StatusOr<std::vector<SnippetCode>>& codes = instruction_snippets[i];
+    if (!codes.ok()) {
+      report_unmeasurable(i, codes.status());
+      continue;
+    }
+    const int num_snippets = codes.ValueOrDie().size();
+    const std::vector<StatusOr<PerfResult>> instruction_results(
+        result_it, result_it + num_snippets);
+    result_it += num_snippets;
+    add_results(i, instruction_results, itinerary);
+  }
+}
+
+}  // namespace cpu_instructions
@@ -0,0 +1,95 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the snippets created by the generators (latency chains, throughput
+// snippets) for a whole instruction set in one batch. The generators only
+// create the code of the snippets of each instruction, and interpret the
+// results; the batch takes care of the CPU features, of the scratch memory,
+// of the assembly snippets and of the itineraries.
+
+#ifndef CPU_INSTRUCTIONS_ITINERARIES_SNIPPET_BATCH_H_
+#define CPU_INSTRUCTIONS_ITINERARIES_SNIPPET_BATCH_H_
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include "cpu_instructions/base/host_cpu.h"
+#include "cpu_instructions/itineraries/instruction_snippets.h"
+#include "cpu_instructions/itineraries/parallel_measurement.h"
+#include "cpu_instructions/itineraries/perf_subsystem.h"
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "cpu_instructions/util/mapped_memory.h"
+#include "util/task/status.h"
+#include "util/task/statusor.h"
+
+namespace cpu_instructions {
+
+// The event that gives the number of cycles taken by a snippet.
+constexpr const char kCyclesEvent[] = "cycles";
+
+// The size of the scratch buffer allocated by MeasureSnippetBatch. It is
+// larger than the largest memory operand (the state saved by XSAVE), and than
+// one cache line per instance of a throughput snippet.
+constexpr size_t kScratchMemoryBytes = 64 << 10;
+
+struct SnippetBatchOptions {
+  int num_outer_iterations = 10;
+  int num_inner_iterations = 100;
+  // The buffer accessed by the memory operands. When nullptr, a buffer of
+  // kScratchMemoryBytes is allocated by MeasureSnippetBatch when needed. Not
+  // owned.
+  const MappedMemory* scratch_memory = nullptr;
+  // The CPU whose features are checked before the measurement; the
+  // instructions that it does not support are reported as unmeasurable. When
+  // nullptr, the host CPU is used. Not owned.
+  const HostCpuInfo* host_cpu = nullptr;
+};
+
+// The code of a snippet: the instructions that are repeated by the harness.
+using SnippetCode = std::vector<SnippetInstruction>;
+
+// Returns the snippet for ParallelMeasurementPool that runs 'code'.
+// 'scratch_memory' must not be nullptr when the code uses memory.
+AssemblySnippet MakeAssemblySnippet(const SnippetBatchOptions& options,
+                                    const SnippetCode& code,
+                                    const MappedMemory* scratch_memory);
+
+// Creates the snippets of all instructions of 'instruction_set', measures all
+// of them in one batch with 'pool', and passes the results of
+// instruction_set.instructions(i) to the generator together with
+// itineraries->itineraries(i). The itineraries are added when needed, and
+// their llvm_mnemonic is set when it is missing. 'pool' must use the Intel
+// dialect.
+// For each instruction i supported by the CPU, 'make_snippets(i)' returns the
+// code of the snippets that measure it, or an error when it can't be
+// measured. 'add_results(i, results, itinerary)' then receives the results of
+// these snippets, in the same order. The instructions that are not supported,
+// or for which 'make_snippets' failed, are passed to 'report_unmeasurable'
+// instead.
+void MeasureSnippetBatch(
+    const SnippetBatchOptions& options,
+    const InstructionSetProto& instruction_set, ParallelMeasurementPool* pool,
+    const std::function<StatusOr<std::vector<SnippetCode>>(int index)>&
+        make_snippets,
+    const std::function<void(int index,
+                             const std::vector<StatusOr<PerfResult>>& results,
+                             ItineraryProto* itinerary)>& add_results,
+    const std::function<void(int index, const Status& status)>&
+        report_unmeasurable,
+    InstructionSetItinerariesProto* itineraries);
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_ITINERARIES_SNIPPET_BATCH_H_
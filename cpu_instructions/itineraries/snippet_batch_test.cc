@@ -0,0 +1,59 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/snippet_batch.h"
+
+#include <memory>
+
+#include "cpu_instructions/util/proto_util.h"
+#include "gtest/gtest.h"
+
+namespace cpu_instructions {
+namespace {
+
+TEST(SnippetBatchTest, MakeAssemblySnippet) {
+  const SnippetInstruction add =
+      InstantiateSnippetInstruction(
+          ParseProtoFromStringOrDie<InstructionProto>(R"(
+              vendor_syntax {
+                mnemonic: "ADD"
+                operands { addressing_mode: DIRECT_ADDRESSING
+                           encoding: MODRM_REG_ENCODING value_size_bits: 32
+                           name: "r32" usage: USAGE_READ_WRITE }
+                operands { addressing_mode: INDIRECT_ADDRESSING
+                           encoding: MODRM_RM_ENCODING value_size_bits: 32
+                           name: "m32" usage: USAGE_READ }
+              }
+              implicit_output_operands: "EFLAGS")"))
+          .ValueOrDie();
+  SnippetInstruction renamed = add;
+  ASSERT_TRUE(RenameRegister(2, &renamed.operands[0]));
+  const std::unique_ptr<MappedMemory> scratch_memory =
+      MappedMemory::Create(1000, REGULAR_PAGES_ONLY, /*executable=*/false);
+  SnippetBatchOptions options;
+  options.num_inner_iterations = 7;
+
+  const AssemblySnippet snippet =
+      MakeAssemblySnippet(options, {add, renamed}, scratch_memory.get());
+  EXPECT_EQ(snippet.num_outer_iterations, options.num_outer_iterations);
+  EXPECT_EQ(snippet.num_inner_iterations, 7);
+  EXPECT_EQ(snippet.measured_code,
+            "ADD ecx,dword ptr[RSI]\nADD edx,dword ptr[RSI]");
+  EXPECT_EQ(snippet.init_code, MakeScratchMemoryInitCode(*scratch_memory));
+  EXPECT_EQ(snippet.constraints,
+            "~{rcx},~{rdx},~{rsi},~{dirflag},~{fpsr},~{flags}");
+}
+
+}  // namespace
+}  // namespace cpu_instructions
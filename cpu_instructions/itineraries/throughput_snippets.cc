@@ -0,0 +1,375 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/throughput_snippets.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+#include <utility>
+#include "strings/string.h"
+
+#include "cpu_instructions/itineraries/adaptive_measurement.h"
+#include "glog/logging.h"
+#include "strings/str_cat.h"
+#include "util/gtl/map_util.h"
+#include "util/task/canonical_errors.h"
+#include "util/task/status.h"
+
+namespace cpu_instructions {
+
+namespace {
+
+using x86::RegisterClass;
+
+// The distance between the memory operands of consecutive instances. Each
+// instance uses its own cache line.
+constexpr int kMemoryOperandStrideBytes = 64;
+
+// The number of cycles per instance is reported as an integer when it is at
+// most this far from one.
+constexpr double kIntegerThroughputTolerance = 0.05;
+
+string GetRegisterClassName(RegisterClass register_class) {
+  switch (register_class) {
+    case RegisterClass::kGeneralPurpose:
+      return "general purpose";
+    case RegisterClass::kMmx:
+      return "MMX";
+    case RegisterClass::kVector:
+      return "vector";
+    case RegisterClass::kOpmask:
+      return "opmask";
+    case RegisterClass::kFlags:
+      return "flags";
+    case RegisterClass::kNone:
+      break;
+  }
+  return "unknown";
+}
+
+// Returns the zero idiom "XOR r32, r32" on the general purpose register with
+// the given index. It writes the register and the flags.
+SnippetInstruction MakeZeroIdiom(int index) {
+  SnippetOperand operand;
+  operand.name = "r32";
+  operand.operand_index = 0;
+  operand.kind = SnippetOperand::kRegister;
+  operand.is_input = true;
+  operand.is_output = true;
+  operand.code =
+      x86::GetRegisterName(RegisterClass::kGeneralPurpose, index, 32);
+  operand.register_info = x86::GetRegisterInfo(operand.code);
+  SnippetInstruction idiom;
+  idiom.mnemonic = "XOR";
+  idiom.operands = {operand, operand};
+  idiom.operands[1].operand_index = 1;
+  idiom.operands[1].is_output = false;
+  return idiom;
+}
+
+// Makes the memory operand of 'operand' address the scratch memory at
+// 'offset_bytes' instead of its beginning.
+void OffsetMemoryOperand(int offset_bytes, SnippetOperand* operand) {
+  static constexpr char kBase[] = "[RSI]";
+  const size_t position = operand->code.find(kBase);
+  if (offset_bytes == 0 || position == string::npos) return;
+  operand->code.replace(position, sizeof(kBase) - 1,
+                        StrCat("[RSI+", offset_bytes, "]"));
+}
+
+// Returns 'value' rounded to the nearest integer when it is close to one,
+// and rounded up or down otherwise.
+int RoundThroughput(double value, bool round_up) {
+  const double nearest = std::round(value);
+  if (std::abs(value - nearest) <= kIntegerThroughputTolerance) {
+    return static_cast<int>(nearest);
+  }
+  return static_cast<int>(round_up ? std::ceil(value) : std::floor(value));
+}
+
+// Returns the number of cycles of 'result' per instance of 'snippet', or
+// false when the result has no cycles.
+bool GetCyclesPerInstance(const ThroughputSnippet& snippet,
+                          const PerfResult& result, double* cycles) {
+  if (!result.HasTiming(kCyclesEvent)) return false;
+  *cycles = result.GetScaledOrDie(kCyclesEvent) / snippet.num_instances;
+  return true;
+}
+
+// Divides all the values of 'observations' by 'divisor'.
+void DivideObservations(double divisor, ObservationVector* observations) {
+  for (ObservationVector::Observation& observation :
+       *observations->mutable_observations()) {
+    observation.set_measurement(observation.measurement() / divisor);
+    if (!observation.has_distribution()) continue;
+    ObservationVector::Observation::Distribution* const distribution =
+        observation.mutable_distribution();
+    distribution->set_min(distribution->min() / divisor);
+    distribution->set_max(distribution->max() / divisor);
+    distribution->set_median(distribution->median() / divisor);
+    distribution->set_median_absolute_deviation(
+        distribution->median_absolute_deviation() / divisor);
+    distribution->set_trimmed_mean(distribution->trimmed_mean() / divisor);
+    distribution->set_confidence_interval_half_width(
+        distribution->confidence_interval_half_width() / divisor);
+  }
+}
+
+}  // namespace
+
+StatusOr<ThroughputSnippet> MakeThroughputSnippet(
+    const ThroughputMeasurementOptions& options,
+    const InstructionProto& instruction) {
+  CHECK_GE(options.max_num_instances, 1);
+  const StatusOr<SnippetInstruction> instance_or_status =
+      InstantiateSnippetInstruction(instruction);
+  if (!instance_or_status.ok()) return instance_or_status.status();
+  const SnippetInstruction& instance = instance_or_status.ValueOrDie();
+  const int num_operands = instance.operands.size();
+
+  // The registers that can't be renamed, and the dependencies that go through
+  // them from one instance to the next.
+  std::set<std::pair<RegisterClass, int>> fixed_registers;
+  std::set<int> chained_general_purpose_registers;
+  bool flags_are_chained = false;
+  for (const SnippetOperand& input : instance.operands) {
+    if (input.kind != SnippetOperand::kRegister || input.is_renameable) {
+      continue;
+    }
+    const x86::RegisterInfo& input_register = input.register_info;
+    fixed_registers.emplace(input_register.register_class,
+                            input_register.index);
+    if (!input.is_input) continue;
+    for (const SnippetOperand& output : instance.operands) {
+      if (output.kind != SnippetOperand::kRegister || output.is_renameable ||
+          !output.is_output ||
+          !x86::RegistersAlias(input_register, output.register_info)) {
+        continue;
+      }
+      switch (input_register.register_class) {
+        case RegisterClass::kGeneralPurpose:
+          chained_general_purpose_registers.insert(input_register.index);
+          break;
+        case RegisterClass::kFlags:
+          flags_are_chained = true;
+          break;
+        default:
+          return util::InvalidArgumentError(
+              StrCat("The dependency through ", input.name,
+                     " can't be broken"));
+      }
+    }
+  }
+
+  // The registers available for renaming, by class.
+  std::map<RegisterClass, std::vector<int>> pools;
+  const auto get_pool = [&pools, &fixed_registers](
+                            RegisterClass register_class) -> std::vector<int>* {
+    const auto inserted = pools.emplace(register_class, std::vector<int>());
+    std::vector<int>& pool = inserted.first->second;
+    if (inserted.second) {
+      x86::RegisterInfo info;
+      info.register_class = register_class;
+      for (info.index = 0; info.index < x86::GetNumRegisters(register_class);
+           ++info.index) {
+        if (!IsReservedRegister(info) &&
+            !ContainsKey(fixed_registers,
+                         std::make_pair(register_class, info.index))) {
+          pool.push_back(info.index);
+        }
+      }
+    }
+    return &pool;
+  };
+  const auto take_register = [&get_pool](RegisterClass register_class,
+                                         int* index) -> Status {
+    std::vector<int>* const pool = get_pool(register_class);
+    if (pool->empty()) {
+      return util::InvalidArgumentError(
+          StrCat("Not enough ", GetRegisterClassName(register_class),
+                 " registers"));
+    }
+    *index = pool->front();
+    pool->erase(pool->begin());
+    return util::OkStatus();
+  };
+
+  // The input-only registers are shared by all instances, and never written.
+  std::vector<int> source_registers(num_operands, -1);
+  for (int i = 0; i < num_operands; ++i) {
+    const SnippetOperand& operand = instance.operands[i];
+    if (!operand.is_renameable || !operand.is_input || operand.is_output) {
+      continue;
+    }
+    const Status status = take_register(operand.register_info.register_class,
+                                        &source_registers[i]);
+    if (!status.ok()) return status;
+  }
+  // The flags are reset by the zero idioms of the fixed registers when there
+  // are some, otherwise a register is set aside for a zero idiom.
+  int flags_helper_register = -1;
+  if (flags_are_chained && chained_general_purpose_registers.empty()) {
+    const Status status = take_register(RegisterClass::kGeneralPurpose,
+                                        &flags_helper_register);
+    if (!status.ok()) return status;
+  }
+
+  // The remaining registers are the destinations; the operands that are
+  // written, or whose usage is not known, rotate through them.
+  int num_instances = options.max_num_instances;
+  bool has_renameable_output = false;
+  size_t largest_pool_size = 0;
+  for (int i = 0; i < num_operands; ++i) {
+    const SnippetOperand& operand = instance.operands[i];
+    if (!operand.is_renameable || source_registers[i] >= 0) continue;
+    const RegisterClass register_class = operand.register_info.register_class;
+    const std::vector<int>& pool = *get_pool(register_class);
+    if (pool.empty()) {
+      return util::InvalidArgumentError(
+          StrCat("Not enough ", GetRegisterClassName(register_class),
+                 " registers"));
+    }
+    has_renameable_output = true;
+    largest_pool_size = std::max(largest_pool_size, pool.size());
+  }
+  if (has_renameable_output) {
+    num_instances = std::min<int>(num_instances, largest_pool_size);
+  }
+
+  ThroughputSnippet snippet;
+  snippet.instruction = GetInstructionName(instruction);
+  snippet.num_instances = num_instances;
+  std::map<RegisterClass, int> next_destinations;
+  for (int instance_index = 0; instance_index < num_instances;
+       ++instance_index) {
+    SnippetInstruction renamed = instance;
+    for (int i = 0; i < num_operands; ++i) {
+      SnippetOperand& operand = renamed.operands[i];
+      if (operand.kind == SnippetOperand::kMemory) {
+        OffsetMemoryOperand(instance_index * kMemoryOperandStrideBytes,
+                            &operand);
+      }
+      if (!operand.is_renameable) continue;
+      int index = source_registers[i];
+      if (index < 0) {
+        const RegisterClass register_class =
+            operand.register_info.register_class;
+        const std::vector<int>& pool = *get_pool(register_class);
+        index = pool[next_destinations[register_class]++ % pool.size()];
+      }
+      if (!RenameRegister(index, &operand)) {
+        return util::InvalidArgumentError(
+            StrCat("Can't rename ", operand.name, " to register ", index));
+      }
+    }
+    for (const int index : chained_general_purpose_registers) {
+      snippet.helper_code.push_back(MakeZeroIdiom(index));
+      snippet.code.push_back(snippet.helper_code.back());
+    }
+    if (flags_helper_register >= 0) {
+      snippet.helper_code.push_back(MakeZeroIdiom(flags_helper_register));
+      snippet.code.push_back(snippet.helper_code.back());
+    }
+    snippet.code.push_back(std::move(renamed));
+  }
+  return snippet;
+}
+
+void AddThroughput(const ThroughputSnippet& snippet,
+                   const std::vector<StatusOr<PerfResult>>& results,
+                   ItineraryProto* itinerary,
+                   std::vector<UnmeasurableThroughput>* unmeasurable) {
+  CHECK(itinerary != nullptr);
+  CHECK(unmeasurable != nullptr);
+  CHECK_GT(snippet.num_instances, 0);
+  CHECK_EQ(results.size(), snippet.helper_code.empty() ? 1 : 2);
+  const StatusOr<PerfResult>& result = results[0];
+  if (!result.ok()) {
+    unmeasurable->push_back(
+        {snippet.instruction, result.status().error_message()});
+    return;
+  }
+  const PerfResult& perf_result = result.ValueOrDie();
+  double max_cycles_per_instance = 0.0;
+  if (!GetCyclesPerInstance(snippet, perf_result, &max_cycles_per_instance)) {
+    unmeasurable->push_back(
+        {snippet.instruction, "The cycles were not measured"});
+    return;
+  }
+  double min_cycles_per_instance = snippet.helper_code.empty()
+                                       ? max_cycles_per_instance
+                                       : 0.0;
+  double helper_cycles_per_instance = 0.0;
+  if (!snippet.helper_code.empty() && results[1].ok() &&
+      GetCyclesPerInstance(snippet, results[1].ValueOrDie(),
+                           &helper_cycles_per_instance)) {
+    min_cycles_per_instance = std::max(
+        0.0, max_cycles_per_instance - helper_cycles_per_instance);
+  }
+  if (max_cycles_per_instance < 1.0 - kIntegerThroughputTolerance) {
+    itinerary->clear_min_throughput();
+    itinerary->clear_max_throughput();
+  } else {
+    itinerary->set_min_throughput(
+        std::max(1, RoundThroughput(min_cycles_per_instance,
+                                    /*round_up=*/false)));
+    itinerary->set_max_throughput(
+        RoundThroughput(max_cycles_per_instance, /*round_up=*/true));
+  }
+  itinerary->clear_throughput_observation();
+  ObservationVector* const observations =
+      itinerary->mutable_throughput_observation();
+  AddObservations(perf_result, observations);
+  DivideObservations(snippet.num_instances, observations);
+}
+
+void MeasureThroughputs(const ThroughputMeasurementOptions& options,
+                        const InstructionSetProto& instruction_set,
+                        ParallelMeasurementPool* pool,
+                        InstructionSetItinerariesProto* itineraries,
+                        std::vector<UnmeasurableThroughput>* unmeasurable) {
+  CHECK(unmeasurable != nullptr);
+  std::vector<ThroughputSnippet> snippets(instruction_set.instructions_size());
+  const auto make_snippets =
+      [&options, &instruction_set, &snippets](
+          int index) -> StatusOr<std::vector<SnippetCode>> {
+    const StatusOr<ThroughputSnippet> snippet_or_status =
+        MakeThroughputSnippet(options, instruction_set.instructions(index));
+    if (!snippet_or_status.ok()) return snippet_or_status.status();
+    snippets[index] = snippet_or_status.ValueOrDie();
+    std::vector<SnippetCode> codes = {snippets[index].code};
+    if (!snippets[index].helper_code.empty()) {
+      codes.push_back(snippets[index].helper_code);
+    }
+    return codes;
+  };
+  const auto add_results = [&snippets, unmeasurable](
+                               int index,
+                               const std::vector<StatusOr<PerfResult>>& results,
+                               ItineraryProto* itinerary) {
+    AddThroughput(snippets[index], results, itinerary, unmeasurable);
+  };
+  const auto report_unmeasurable = [&instruction_set, unmeasurable](
+                                       int index, const Status& status) {
+    unmeasurable->push_back(
+        {GetInstructionName(instruction_set.instructions(index)),
+         status.error_message()});
+  };
+  MeasureSnippetBatch(options, instruction_set, pool, make_snippets,
+                      add_results, report_unmeasurable, itineraries);
+}
+
+}  // namespace cpu_instructions
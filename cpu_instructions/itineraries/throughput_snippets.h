@@ -0,0 +1,116 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Generates and measures the snippets that give the reciprocal throughput of
+// an instruction. A snippet contains several instances of the instruction that
+// do not depend on each other:
+// * the renameable output registers rotate through a pool of registers of their
+//   class, so that an instance depends on an earlier one only through a
+//   read-write register, and only at the distance of the size of the pool;
+// * the renameable input-only registers use registers that are never written
+//   by the snippet;
+// * the memory operands of the instances use different cache lines;
+// * the dependencies through a fixed general purpose register (e.g. EAX for
+//   MUL) and through the flags are broken by a zero idiom (XOR r32, r32)
+//   before each instance. Zero idioms are handled by the register renamer and
+//   do not use an execution port, but they do use issue slots. The helper
+//   instructions are also measured alone, to bound their share of the cycles
+//   of the snippet.
+// Instructions with dependencies that can't be broken this way are reported
+// as unmeasurable.
+
+#ifndef CPU_INSTRUCTIONS_ITINERARIES_THROUGHPUT_SNIPPETS_H_
+#define CPU_INSTRUCTIONS_ITINERARIES_THROUGHPUT_SNIPPETS_H_
+
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/itineraries/instruction_snippets.h"
+#include "cpu_instructions/itineraries/parallel_measurement.h"
+#include "cpu_instructions/itineraries/perf_subsystem.h"
+#include "cpu_instructions/itineraries/snippet_batch.h"
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "util/task/statusor.h"
+
+namespace cpu_instructions {
+
+// The snippet of code that measures the throughput of an instruction.
+struct ThroughputSnippet {
+  // The LLVM mnemonic of the instruction, or its vendor mnemonic if the LLVM
+  // mnemonic is not known.
+  string instruction;
+  // The measured code: the instances of the instruction, each one preceded by
+  // the zero idioms that break its dependencies.
+  std::vector<SnippetInstruction> code;
+  int num_instances = 0;
+  // The zero idioms of 'code' without the instances of the instruction, or
+  // empty when the instruction needs no helper instructions.
+  std::vector<SnippetInstruction> helper_code;
+};
+
+// An instruction whose throughput can't be measured.
+struct UnmeasurableThroughput {
+  // The name of the instruction, as in ThroughputSnippet.
+  string instruction;
+  string reason;
+};
+
+// The options of MeasureThroughputs. The scratch memory must have room for one
+// cache line per instance.
+struct ThroughputMeasurementOptions : public SnippetBatchOptions {
+  // The maximal number of instances of the instruction in a snippet. The
+  // actual number is the size of the largest pool of output registers, or
+  // this number when the instruction has no renameable output.
+  int max_num_instances = 16;
+};
+
+// Creates the throughput snippet of 'instruction'. Returns an error when the
+// instruction can't be measured.
+StatusOr<ThroughputSnippet> MakeThroughputSnippet(
+    const ThroughputMeasurementOptions& options,
+    const InstructionProto& instruction);
+
+// Stores the reciprocal throughput measured for 'snippet' into 'itinerary'.
+// 'results' contains the result of snippet.code, followed by the result of
+// snippet.helper_code when it is not empty.
+// The helper instructions may or may not overlap with the instances of the
+// instruction, so the number of cycles per instance is only bracketed: it is
+// at most the cycles of the snippet per instance, and at least this value
+// minus the cycles of the helpers alone per instance. min_throughput and
+// max_throughput are these bounds, rounded to the nearest integer when they
+// are close to one, or else down (resp. up). The integer fields can't describe
+// less than one cycle: min_throughput is at least one, and both are cleared
+// when the snippet takes less than one cycle per instance. The
+// throughput_observation of the itinerary is the upper bound, i.e. the
+// measurement of the whole snippet normalized to one instance. A failed
+// measurement of the snippet is added to 'unmeasurable'; when the helpers
+// could not be measured, the lower bound is zero.
+void AddThroughput(const ThroughputSnippet& snippet,
+                   const std::vector<StatusOr<PerfResult>>& results,
+                   ItineraryProto* itinerary,
+                   std::vector<UnmeasurableThroughput>* unmeasurable);
+
+// Measures the throughputs of all instructions of 'instruction_set' with
+// MeasureSnippetBatch, and stores them into the itineraries with
+// AddThroughput. The instructions that can't be measured, including the failed
+// measurements, are stored in 'unmeasurable'.
+void MeasureThroughputs(const ThroughputMeasurementOptions& options,
+                        const InstructionSetProto& instruction_set,
+                        ParallelMeasurementPool* pool,
+                        InstructionSetItinerariesProto* itineraries,
+                        std::vector<UnmeasurableThroughput>* unmeasurable);
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_ITINERARIES_THROUGHPUT_SNIPPETS_H_
@@ -0,0 +1,275 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/itineraries/throughput_snippets.h"
+
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/util/proto_util.h"
+#include "gtest/gtest.h"
+#include "util/task/canonical_errors.h"
+
+namespace cpu_instructions {
+namespace {
+
+// Returns the code of the instructions of 'snippet'.
+std::vector<string> GetCode(const ThroughputSnippet& snippet) {
+  std::vector<string> code;
+  for (const SnippetInstruction& instruction : snippet.code) {
+    code.push_back(ToCodeString(instruction));
+  }
+  return code;
+}
+
+TEST(ThroughputSnippetsTest, RotatesTheDestinations) {
+  ThroughputMeasurementOptions options;
+  options.max_num_instances = 4;
+  const StatusOr<ThroughputSnippet> snippet_or_status =
+      MakeThroughputSnippet(options,
+                            ParseProtoFromStringOrDie<InstructionProto>(R"(
+          llvm_mnemonic: "ADD32rr"
+          vendor_syntax {
+            mnemonic: "ADD"
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: MODRM_RM_ENCODING value_size_bits: 32
+                       name: "r32" usage: USAGE_READ_WRITE }
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: MODRM_REG_ENCODING value_size_bits: 32
+                       name: "r32" usage: USAGE_READ }
+          }
+          implicit_output_operands: "EFLAGS")"));
+  ASSERT_TRUE(snippet_or_status.ok());
+  const ThroughputSnippet& snippet = snippet_or_status.ValueOrDie();
+  EXPECT_EQ(snippet.instruction, "ADD32rr");
+  EXPECT_EQ(snippet.num_instances, 4);
+  EXPECT_TRUE(snippet.helper_code.empty());
+  EXPECT_EQ(GetCode(snippet),
+            std::vector<string>({"ADD ecx,eax", "ADD edx,eax", "ADD ebx,eax",
+                                 "ADD r8d,eax"}));
+
+  // The number of instances is limited by the number of registers.
+  options.max_num_instances = 100;
+  const StatusOr<ThroughputSnippet> large_snippet =
+      MakeThroughputSnippet(options,
+                            ParseProtoFromStringOrDie<InstructionProto>(R"(
+          vendor_syntax {
+            mnemonic: "VADDPS"
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: MODRM_REG_ENCODING value_size_bits: 128
+                       name: "xmm1" usage: USAGE_WRITE }
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: VEX_V_ENCODING value_size_bits: 128
+                       name: "xmm2" usage: USAGE_READ }
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: MODRM_RM_ENCODING value_size_bits: 128
+                       name: "xmm3" usage: USAGE_READ }
+          })"));
+  ASSERT_TRUE(large_snippet.ok());
+  EXPECT_EQ(large_snippet.ValueOrDie().num_instances, 14);
+  EXPECT_EQ(ToCodeString(large_snippet.ValueOrDie().code.back()),
+            "VADDPS xmm15,xmm0,xmm1");
+}
+
+TEST(ThroughputSnippetsTest, BreaksImplicitDependencies) {
+  ThroughputMeasurementOptions options;
+  options.max_num_instances = 2;
+  const StatusOr<ThroughputSnippet> multiplication =
+      MakeThroughputSnippet(options,
+                            ParseProtoFromStringOrDie<InstructionProto>(R"(
+          vendor_syntax {
+            mnemonic: "MUL"
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: MODRM_RM_ENCODING value_size_bits: 32
+                       name: "r32" usage: USAGE_READ }
+          }
+          implicit_input_operands: "EAX"
+          implicit_output_operands: "EAX"
+          implicit_output_operands: "EDX"
+          implicit_output_operands: "EFLAGS")"));
+  ASSERT_TRUE(multiplication.ok());
+  EXPECT_EQ(multiplication.ValueOrDie().num_instances, 2);
+  EXPECT_EQ(multiplication.ValueOrDie().helper_code.size(), 2);
+  EXPECT_EQ(GetCode(multiplication.ValueOrDie()),
+            std::vector<string>(
+                {"XOR eax,eax", "MUL ecx", "XOR eax,eax", "MUL ecx"}));
+
+  const StatusOr<ThroughputSnippet> add_with_carry =
+      MakeThroughputSnippet(options,
+                            ParseProtoFromStringOrDie<InstructionProto>(R"(
+          vendor_syntax {
+            mnemonic: "ADC"
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: MODRM_RM_ENCODING value_size_bits: 32
+                       name: "r32" usage: USAGE_READ_WRITE }
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: MODRM_REG_ENCODING value_size_bits: 32
+                       name: "r32" usage: USAGE_READ }
+          }
+          implicit_input_operands: "EFLAGS"
+          implicit_output_operands: "EFLAGS")"));
+  ASSERT_TRUE(add_with_carry.ok());
+  EXPECT_EQ(GetCode(add_with_carry.ValueOrDie()),
+            std::vector<string>({"XOR ecx,ecx", "ADC edx,eax", "XOR ecx,ecx",
+                                 "ADC ebx,eax"}));
+  EXPECT_EQ(MakeAssemblySnippet(options, add_with_carry.ValueOrDie().code,
+                                nullptr)
+                .constraints,
+            "~{rax},~{rbx},~{rcx},~{rdx},~{dirflag},~{fpsr},~{flags}");
+}
+
+TEST(ThroughputSnippetsTest, UsesOneCacheLinePerInstance) {
+  ThroughputMeasurementOptions options;
+  options.max_num_instances = 3;
+  const StatusOr<ThroughputSnippet> snippet =
+      MakeThroughputSnippet(options,
+                            ParseProtoFromStringOrDie<InstructionProto>(R"(
+          vendor_syntax {
+            mnemonic: "MOV"
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: MODRM_REG_ENCODING value_size_bits: 32
+                       name: "r32" usage: USAGE_WRITE }
+            operands { addressing_mode: INDIRECT_ADDRESSING
+                       encoding: MODRM_RM_ENCODING value_size_bits: 32
+                       name: "m32" usage: USAGE_READ }
+          })"));
+  ASSERT_TRUE(snippet.ok());
+  EXPECT_EQ(GetCode(snippet.ValueOrDie()),
+            std::vector<string>({"MOV eax,dword ptr[RSI]",
+                                 "MOV ecx,dword ptr[RSI+64]",
+                                 "MOV edx,dword ptr[RSI+128]"}));
+}
+
+TEST(ThroughputSnippetsTest, ReportsUnmeasurableInstructions) {
+  const ThroughputMeasurementOptions options;
+  EXPECT_FALSE(MakeThroughputSnippet(
+                   options, ParseProtoFromStringOrDie<InstructionProto>(R"(
+                       vendor_syntax {
+                         mnemonic: "JMP"
+                         operands { addressing_mode: NO_ADDRESSING
+                                    name: "rel8" usage: USAGE_READ }
+                       })"))
+                   .ok());
+  // The dependency through XMM0 can't be broken with a zero idiom on a
+  // general purpose register.
+  EXPECT_FALSE(MakeThroughputSnippet(
+                   options, ParseProtoFromStringOrDie<InstructionProto>(R"(
+                       vendor_syntax { mnemonic: "PBLENDVB" }
+                       implicit_input_operands: "XMM0"
+                       implicit_output_operands: "XMM0")"))
+                   .ok());
+}
+
+TEST(ThroughputSnippetsTest, AddThroughput) {
+  ThroughputSnippet snippet;
+  snippet.instruction = "ADD32rr";
+  snippet.num_instances = 4;
+  ItineraryProto itinerary;
+  std::vector<UnmeasurableThroughput> unmeasurable;
+
+  PerfResult one_cycle({{"cycles", TimingInfo(404, 1, 1)}});
+  one_cycle.SetScaleFactor(100);
+  AddThroughput(snippet, {one_cycle}, &itinerary, &unmeasurable);
+  EXPECT_EQ(itinerary.min_throughput(), 1);
+  EXPECT_EQ(itinerary.max_throughput(), 1);
+  const ObservationVector& observation = itinerary.throughput_observation();
+  ASSERT_EQ(observation.observations_size(), 1);
+  EXPECT_DOUBLE_EQ(observation.observations(0).measurement(), 1.01);
+
+  PerfResult fractional({{"cycles", TimingInfo(600, 1, 1)}});
+  fractional.SetScaleFactor(100);
+  AddThroughput(snippet, {fractional}, &itinerary, &unmeasurable);
+  EXPECT_EQ(itinerary.min_throughput(), 1);
+  EXPECT_EQ(itinerary.max_throughput(), 2);
+  EXPECT_EQ(itinerary.throughput_observation().observations_size(), 1);
+  EXPECT_TRUE(unmeasurable.empty());
+
+  AddThroughput(snippet, {util::InternalError("Failed to compile")},
+                &itinerary, &unmeasurable);
+  ASSERT_EQ(unmeasurable.size(), 1);
+  EXPECT_EQ(unmeasurable[0].instruction, "ADD32rr");
+  EXPECT_EQ(itinerary.min_throughput(), 1);
+
+  // Less than one cycle per instance can't be stored in the integer fields.
+  PerfResult fast({{"cycles", TimingInfo(100, 1, 1)}});
+  fast.SetScaleFactor(100);
+  AddThroughput(snippet, {fast}, &itinerary, &unmeasurable);
+  EXPECT_FALSE(itinerary.has_min_throughput());
+  EXPECT_FALSE(itinerary.has_max_throughput());
+  EXPECT_DOUBLE_EQ(
+      itinerary.throughput_observation().observations(0).measurement(), 0.25);
+}
+
+TEST(ThroughputSnippetsTest, AddThroughputWithHelperInstructions) {
+  ThroughputMeasurementOptions options;
+  options.max_num_instances = 4;
+  const StatusOr<ThroughputSnippet> snippet_or_status =
+      MakeThroughputSnippet(options,
+                            ParseProtoFromStringOrDie<InstructionProto>(R"(
+          llvm_mnemonic: "MUL32r"
+          vendor_syntax {
+            mnemonic: "MUL"
+            operands { addressing_mode: DIRECT_ADDRESSING
+                       encoding: MODRM_RM_ENCODING value_size_bits: 32
+                       name: "r32" usage: USAGE_READ }
+          }
+          implicit_input_operands: "EAX"
+          implicit_output_operands: "EAX"
+          implicit_output_operands: "EDX"
+          implicit_output_operands: "EFLAGS")"));
+  ASSERT_TRUE(snippet_or_status.ok());
+  const ThroughputSnippet& snippet = snippet_or_status.ValueOrDie();
+  ASSERT_EQ(snippet.num_instances, 4);
+  ASSERT_EQ(snippet.helper_code.size(), 4);
+  EXPECT_EQ(ToCodeString(snippet.helper_code[0]), "XOR eax,eax");
+  ItineraryProto itinerary;
+  std::vector<UnmeasurableThroughput> unmeasurable;
+  const auto make_result = [](double cycles_per_iteration) {
+    PerfResult result(
+        {{"cycles", TimingInfo(cycles_per_iteration * 100, 1, 1)}});
+    result.SetScaleFactor(100);
+    return result;
+  };
+
+  // The multiplications take one cycle each, and hide the zero idioms that
+  // take a quarter of a cycle each.
+  AddThroughput(snippet, {make_result(4.0), make_result(1.0)}, &itinerary,
+                &unmeasurable);
+  EXPECT_EQ(itinerary.min_throughput(), 1);
+  EXPECT_EQ(itinerary.max_throughput(), 1);
+
+  // Without the zero idioms, the instruction would take between 1.5 and 3
+  // cycles per instance.
+  AddThroughput(snippet, {make_result(12.0), make_result(6.0)}, &itinerary,
+                &unmeasurable);
+  EXPECT_EQ(itinerary.min_throughput(), 1);
+  EXPECT_EQ(itinerary.max_throughput(), 3);
+  AddThroughput(snippet, {make_result(12.0), make_result(2.0)}, &itinerary,
+                &unmeasurable);
+  EXPECT_EQ(itinerary.min_throughput(), 2);
+  EXPECT_EQ(itinerary.max_throughput(), 3);
+  EXPECT_DOUBLE_EQ(
+      itinerary.throughput_observation().observations(0).measurement(), 3.0);
+
+  // When the helpers were not measured, only the upper bound is known.
+  AddThroughput(snippet,
+                {make_result(12.0), util::InternalError("Failed to compile")},
+                &itinerary, &unmeasurable);
+  EXPECT_EQ(itinerary.min_throughput(), 1);
+  EXPECT_EQ(itinerary.max_throughput(), 3);
+  EXPECT_TRUE(unmeasurable.empty());
+}
+
+}  // namespace
+}  // namespace cpu_instructions
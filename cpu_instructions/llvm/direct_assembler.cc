@@ -0,0 +1,405 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/llvm/direct_assembler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <system_error>
+#include "strings/string.h"
+
+#include "cpu_instructions/llvm/llvm_utils.h"
+#include "cpu_instructions/util/mapped_memory.h"
+#include "glog/logging.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/MC/MCAsmBackend.h"
+#include "llvm/MC/MCCodeEmitter.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCObjectFileInfo.h"
+#include "llvm/MC/MCParser/MCAsmParser.h"
+#include "llvm/MC/MCParser/MCTargetAsmParser.h"
+#include "llvm/MC/MCStreamer.h"
+#include "llvm/MC/MCTargetOptions.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#include "strings/str_cat.h"
+#include "util/gtl/ptr_util.h"
+#include "util/task/canonical_errors.h"
+
+namespace cpu_instructions {
+
+using ::cpu_instructions::util::InternalError;
+using ::cpu_instructions::util::InvalidArgumentError;
+
+namespace {
+
+constexpr char kIntelSyntaxDirective[] = ".intel_syntax noprefix\n";
+constexpr char kAttSyntaxDirective[] = ".att_syntax prefix\n";
+
+// The prologue and the epilogue of the functions created by the assembler. They
+// save and restore all callee-saved general-purpose registers, and reserve a
+// stack slot for the loop counter; the stack stays aligned to 16 bytes.
+constexpr char kFunctionPrologue[] = R"(
+    push rbx
+    push rbp
+    push r12
+    push r13
+    push r14
+    push r15
+    sub rsp, 8
+)";
+constexpr char kFunctionEpilogue[] = R"(
+    add rsp, 8
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbp
+    pop rbx
+    ret
+)";
+constexpr char kLoopLabel[] = ".Lcpu_instructions_loop";
+
+// The size of the longest NOP instruction used for padding.
+constexpr int kMaxNopSize = 9;
+
+// The alignment of the functions allocated from the huge page arena. This is
+// the alignment guaranteed by llvm::sys::Memory for the other functions.
+constexpr size_t kFunctionAlignmentBytes = 4096;
+
+// Collects the diagnostics reported by the assembler.
+void CollectDiagnostic(const llvm::SMDiagnostic& diagnostic, void* context) {
+  string* const errors = static_cast<string*>(context);
+  llvm::raw_string_ostream errors_stream(*errors);
+  diagnostic.print(nullptr, errors_stream, /*ShowColors=*/false);
+}
+
+}  // namespace
+
+DirectAssembler::DirectAssembler(llvm::InlineAsm::AsmDialect dialect,
+                                 const string& mcpu)
+    : dialect_(dialect), mcpu_(mcpu) {
+  EnsureLLVMWasInitialized();
+  const StatusOr<const llvm::Target*> target_or_status = GetLLVMTarget();
+  CHECK(target_or_status.ok()) << target_or_status.status();
+  target_ = target_or_status.ValueOrDie();
+  triple_name_ = GetNormalizedLLVMTripleName();
+  register_info_.reset(target_->createMCRegInfo(triple_name_));
+  CHECK(register_info_ != nullptr);
+  asm_info_.reset(target_->createMCAsmInfo(*register_info_, triple_name_));
+  CHECK(asm_info_ != nullptr);
+  instr_info_.reset(target_->createMCInstrInfo());
+  CHECK(instr_info_ != nullptr);
+  subtarget_info_.reset(
+      target_->createMCSubtargetInfo(triple_name_, MakeStringRef(mcpu_), ""));
+  CHECK(subtarget_info_ != nullptr);
+}
+
+DirectAssembler::~DirectAssembler() {
+  for (llvm::sys::MemoryBlock& block : code_blocks_) {
+    llvm::sys::Memory::releaseMappedMemory(block);
+  }
+}
+
+bool DirectAssembler::IsKnownCpu() const {
+  return subtarget_info_->isCPUStringValid(MakeStringRef(mcpu_));
+}
+
+bool DirectAssembler::HasCpuFeature(const string& feature) const {
+  // The feature is present if enabling it does not change the subtarget.
+  const std::unique_ptr<llvm::MCSubtargetInfo> with_feature(
+      target_->createMCSubtargetInfo(triple_name_, MakeStringRef(mcpu_),
+                                     MakeStringRef(StrCat("+", feature))));
+  CHECK(with_feature != nullptr);
+  return with_feature->getFeatureBits() == subtarget_info_->getFeatureBits();
+}
+
+StatusOr<std::vector<uint8_t>> DirectAssembler::AssembleToBytes(
+    const string& code) {
+  return AssembleTextSection(WithDialectDirective(code));
+}
+
+VoidFunction DirectAssembler::AssembleToFunction(int num_iterations,
+                                                 const string& init_code,
+                                                 const string& loop_code,
+                                                 const string& cleanup_code) {
+  CHECK_GE(num_iterations, 1);
+  string code = StrCat(kIntelSyntaxDirective, kFunctionPrologue);
+  if (!init_code.empty()) {
+    StrAppend(&code, WithDialectDirective(init_code), "\n");
+  }
+  if (num_iterations == 1) {
+    StrAppend(&code, WithDialectDirective(loop_code), "\n");
+  } else {
+    StrAppend(&code, kIntelSyntaxDirective, "mov qword ptr [rsp], ",
+              num_iterations);
+    StrAppend(&code, "\n", kLoopLabel, ":\n");
+    StrAppend(&code, WithDialectDirective(loop_code), "\n");
+    StrAppend(&code, kIntelSyntaxDirective, "dec qword ptr [rsp]\njnz ",
+              kLoopLabel, "\n");
+  }
+  if (!cleanup_code.empty()) {
+    StrAppend(&code, WithDialectDirective(cleanup_code), "\n");
+  }
+  StrAppend(&code, kIntelSyntaxDirective, kFunctionEpilogue);
+
+  const StatusOr<std::vector<uint8_t>> machine_code_or_status =
+      AssembleTextSection(code);
+  if (!machine_code_or_status.ok()) {
+    LOG(ERROR) << machine_code_or_status.status();
+    return VoidFunction::Undefined();
+  }
+  return CreateFunctionFromBytes(machine_code_or_status.ValueOrDie());
+}
+
+VoidFunction DirectAssembler::AssembleUnrolledLoop(
+    const UnrolledLoopCode& code) {
+  CHECK_GE(code.num_iterations, 1);
+  CHECK_GE(code.unroll_factor, 1);
+  CHECK_GE(code.loop_offset_bytes, 0);
+  // Each piece of code is assembled separately, and the pieces are then
+  // concatenated. The loop body is assembled only once.
+  const auto assemble_intel_code = [this](const string& code) {
+    return AssembleTextSection(StrCat(kIntelSyntaxDirective, code));
+  };
+  const auto assemble_optional_code = [this](const string& code) {
+    return code.empty() ? StatusOr<std::vector<uint8_t>>(std::vector<uint8_t>())
+                        : AssembleToBytes(code);
+  };
+  const StatusOr<std::vector<uint8_t>> pieces[] = {
+      assemble_intel_code(kFunctionPrologue),
+      assemble_optional_code(code.init_code),
+      assemble_intel_code(
+          StrCat("mov qword ptr [rsp], ", code.num_iterations)),
+      assemble_optional_code(code.prefix_code),
+      AssembleToBytes(code.body_code),
+      assemble_optional_code(code.suffix_code),
+      assemble_intel_code("dec qword ptr [rsp]"),
+      assemble_optional_code(code.cleanup_code),
+      assemble_intel_code(kFunctionEpilogue)};
+  for (const StatusOr<std::vector<uint8_t>>& piece : pieces) {
+    if (!piece.ok()) {
+      LOG(ERROR) << piece.status();
+      return VoidFunction::Undefined();
+    }
+  }
+  const std::vector<uint8_t>& prologue = pieces[0].ValueOrDie();
+  const std::vector<uint8_t>& init = pieces[1].ValueOrDie();
+  const std::vector<uint8_t>& set_counter = pieces[2].ValueOrDie();
+  const std::vector<uint8_t>& prefix = pieces[3].ValueOrDie();
+  const std::vector<uint8_t>& body = pieces[4].ValueOrDie();
+  const std::vector<uint8_t>& suffix = pieces[5].ValueOrDie();
+  const std::vector<uint8_t>& decrement_counter = pieces[6].ValueOrDie();
+  const std::vector<uint8_t>& cleanup = pieces[7].ValueOrDie();
+  const std::vector<uint8_t>& epilogue = pieces[8].ValueOrDie();
+
+  std::vector<uint8_t> machine_code;
+  const auto append = [&machine_code](const std::vector<uint8_t>& bytes) {
+    machine_code.insert(machine_code.end(), bytes.begin(), bytes.end());
+  };
+  append(prologue);
+  append(init);
+  const bool has_loop = code.num_iterations > 1;
+  if (has_loop) append(set_counter);
+  AppendNopPadding(code.loop_alignment_bytes, &machine_code);
+  AppendNops(code.loop_offset_bytes, &machine_code);
+  const int loop_start = machine_code.size();
+  append(prefix);
+  for (int i = 0; i < code.unroll_factor; ++i) {
+    AppendNopPadding(code.body_alignment_bytes, &machine_code);
+    append(body);
+  }
+  append(suffix);
+  if (has_loop) {
+    append(decrement_counter);
+    // jnz rel32 back to the beginning of the loop.
+    constexpr int kJnzRel32Size = 6;
+    const int32_t offset = loop_start - (machine_code.size() + kJnzRel32Size);
+    machine_code.push_back(0x0f);
+    machine_code.push_back(0x85);
+    for (int i = 0; i < 4; ++i) {
+      machine_code.push_back(static_cast<uint32_t>(offset) >> (8 * i));
+    }
+  }
+  append(cleanup);
+  append(epilogue);
+  return CreateFunctionFromBytes(machine_code);
+}
+
+void DirectAssembler::AppendNopPadding(int alignment_bytes,
+                                       std::vector<uint8_t>* code) {
+  CHECK(code != nullptr);
+  CHECK_GT(alignment_bytes, 0);
+  AppendNops(
+      (alignment_bytes - code->size() % alignment_bytes) % alignment_bytes,
+      code);
+}
+
+void DirectAssembler::AppendNops(int num_bytes, std::vector<uint8_t>* code) {
+  CHECK(code != nullptr);
+  CHECK_GE(num_bytes, 0);
+  // The multi-byte NOP sequences recommended in the Intel 64 and IA-32
+  // Architectures Software Developer's Manual, Vol. 2B, NOP instruction. The
+  // NOP at index i has i + 1 bytes.
+  static constexpr uint8_t kNops[kMaxNopSize][kMaxNopSize] = {
+      {0x90},
+      {0x66, 0x90},
+      {0x0f, 0x1f, 0x00},
+      {0x0f, 0x1f, 0x40, 0x00},
+      {0x0f, 0x1f, 0x44, 0x00, 0x00},
+      {0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00},
+      {0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00},
+      {0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+      {0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00}};
+  while (num_bytes > 0) {
+    const int nop_size = std::min<int>(num_bytes, kMaxNopSize);
+    const uint8_t* const nop = kNops[nop_size - 1];
+    code->insert(code->end(), nop, nop + nop_size);
+    num_bytes -= nop_size;
+  }
+}
+
+void DirectAssembler::SetHugePagePolicy(HugePagePolicy policy) {
+  if (policy == REGULAR_PAGES_ONLY) {
+    code_arena_.reset();
+  } else {
+    code_arena_ = gtl::MakeUnique<MappedMemoryArena>(policy,
+                                                     /*executable=*/true);
+  }
+}
+
+PageBacking DirectAssembler::code_page_backing() const {
+  if (code_arena_ != nullptr) return code_arena_->backing();
+  return REGULAR_PAGES;
+}
+
+VoidFunction DirectAssembler::CreateFunctionFromBytes(
+    const std::vector<uint8_t>& machine_code) {
+  if (code_arena_ != nullptr) {
+    uint8_t* const function =
+        code_arena_->Allocate(machine_code.size(), kFunctionAlignmentBytes);
+    memcpy(function, machine_code.data(), machine_code.size());
+    return VoidFunction(reinterpret_cast<VoidFunction::Pointer>(function),
+                        machine_code.size());
+  }
+  // Copy the code to a new block of memory, and make it executable. The block
+  // is aligned to a page boundary, so the alignment of the code is preserved.
+  std::error_code error;
+  llvm::sys::MemoryBlock block = llvm::sys::Memory::allocateMappedMemory(
+      machine_code.size(), nullptr,
+      llvm::sys::Memory::MF_READ | llvm::sys::Memory::MF_WRITE, error);
+  if (error) {
+    LOG(ERROR) << "Could not allocate memory for the code: "
+               << error.message();
+    return VoidFunction::Undefined();
+  }
+  memcpy(block.base(), machine_code.data(), machine_code.size());
+  error = llvm::sys::Memory::protectMappedMemory(
+      block, llvm::sys::Memory::MF_READ | llvm::sys::Memory::MF_EXEC);
+  if (error) {
+    llvm::sys::Memory::releaseMappedMemory(block);
+    LOG(ERROR) << "Could not make the code executable: " << error.message();
+    return VoidFunction::Undefined();
+  }
+  llvm::sys::Memory::InvalidateInstructionCache(block.base(),
+                                                machine_code.size());
+  code_blocks_.push_back(block);
+  return VoidFunction(reinterpret_cast<VoidFunction::Pointer>(block.base()),
+                      machine_code.size());
+}
+
+StatusOr<std::vector<uint8_t>> DirectAssembler::AssembleTextSection(
+    const string& code) {
+  // All the MC objects that hold the state of the assembly are created for
+  // each piece of code; only the description of the target is shared.
+  string errors;
+  llvm::SourceMgr source_manager;
+  source_manager.setDiagHandler(&CollectDiagnostic, &errors);
+  source_manager.AddNewSourceBuffer(
+      llvm::MemoryBuffer::getMemBufferCopy(MakeStringRef(code)),
+      llvm::SMLoc());
+  const llvm::Triple triple(triple_name_);
+  llvm::MCObjectFileInfo object_file_info;
+  llvm::MCContext context(asm_info_.get(), register_info_.get(),
+                          &object_file_info, &source_manager);
+  object_file_info.InitMCObjectFileInfo(triple, /*PIC=*/false, context);
+
+  llvm::SmallVector<char, 4096> object;
+  llvm::raw_svector_ostream object_stream(object);
+  const llvm::MCTargetOptions target_options;
+  // The streamer takes the ownership of the code emitter and the backend.
+  llvm::MCCodeEmitter* const code_emitter =
+      target_->createMCCodeEmitter(*instr_info_, *register_info_, context);
+  llvm::MCAsmBackend* const asm_backend = target_->createMCAsmBackend(
+      *register_info_, triple_name_, MakeStringRef(mcpu_), target_options);
+  std::unique_ptr<llvm::MCStreamer> streamer(target_->createMCObjectStreamer(
+      triple, context, *asm_backend, object_stream, code_emitter,
+      *subtarget_info_, /*RelaxAll=*/false,
+      /*IncrementalLinkerCompatible=*/false,
+      /*DWARFMustBeAtTheEnd=*/false));
+  streamer->InitSections(/*NoExecStack=*/false);
+
+  std::unique_ptr<llvm::MCAsmParser> parser(llvm::createMCAsmParser(
+      source_manager, context, *streamer, *asm_info_));
+  std::unique_ptr<llvm::MCTargetAsmParser> target_parser(
+      target_->createMCAsmParser(*subtarget_info_, *parser, *instr_info_,
+                                 target_options));
+  CHECK(target_parser != nullptr);
+  parser->setTargetParser(*target_parser);
+  if (parser->Run(/*NoInitialTextSection=*/false) || !errors.empty()) {
+    return InvalidArgumentError(
+        StrCat("Could not assemble the code:\n", errors));
+  }
+
+  // Extract the contents of the .text section from the object file.
+  llvm::Expected<std::unique_ptr<llvm::object::ObjectFile>> object_file =
+      llvm::object::ObjectFile::createObjectFile(llvm::MemoryBufferRef(
+          llvm::StringRef(object.data(), object.size()), "code"));
+  if (!object_file) {
+    return InternalError(
+        StrCat("Could not read the object file: ",
+               llvm::toString(object_file.takeError())));
+  }
+  std::vector<uint8_t> machine_code;
+  for (const llvm::object::SectionRef& section : (*object_file)->sections()) {
+    llvm::StringRef section_name;
+    if (section.getName(section_name)) continue;
+    if (section_name == ".text") {
+      llvm::StringRef contents;
+      if (section.getContents(contents)) {
+        return InternalError("Could not read the .text section");
+      }
+      machine_code.assign(contents.begin(), contents.end());
+    } else if (section_name.startswith(".rel")) {
+      // The code is copied to a different location, and it can't be linked
+      // with anything else.
+      return InvalidArgumentError(
+          StrCat("The code requires relocations (", section_name.str(),
+                 "), this is not supported"));
+    }
+  }
+  return machine_code;
+}
+
+string DirectAssembler::WithDialectDirective(const string& code) const {
+  return StrCat(dialect_ == llvm::InlineAsm::AD_Intel ? kIntelSyntaxDirective
+                                                      : kAttSyntaxDirective,
+                code);
+}
+
+}  // namespace cpu_instructions
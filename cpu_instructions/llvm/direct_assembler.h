@@ -0,0 +1,177 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An assembler that translates x86-64 assembly code directly to machine code
+// using the LLVM MC layer. Unlike JitCompiler, it does not build LLVM IR and it
+// does not run the code generator, which makes it much faster for code that is
+// written entirely in assembly.
+
+#ifndef CPU_INSTRUCTIONS_LLVM_DIRECT_ASSEMBLER_H_
+#define CPU_INSTRUCTIONS_LLVM_DIRECT_ASSEMBLER_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/llvm/inline_asm.h"
+#include "cpu_instructions/util/mapped_memory.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/MC/MCRegisterInfo.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/Support/Memory.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "util/task/statusor.h"
+
+namespace cpu_instructions {
+
+using ::cpu_instructions::util::StatusOr;
+
+// The code of a function built by DirectAssembler::AssembleUnrolledLoop. The
+// function looks like:
+//     init_code
+//     loop num_iterations:
+//       prefix_code
+//       body_code   ; 'unroll_factor' copies.
+//       suffix_code
+//     cleanup_code
+// The body must not contain the loop control.
+struct UnrolledLoopCode {
+  int num_iterations = 1;
+  int unroll_factor = 1;
+  // The alignment of the beginning of the loop (i.e. of 'prefix_code') and of
+  // each copy of 'body_code' in bytes. The code is padded with multi-byte
+  // NOPs. One means no alignment.
+  int loop_alignment_bytes = 1;
+  int body_alignment_bytes = 1;
+  // The offset of the beginning of the loop from the alignment boundary given
+  // by 'loop_alignment_bytes', in bytes. The loop is moved by inserting NOPs
+  // before it. Used to measure the sensitivity of the code to its placement.
+  int loop_offset_bytes = 0;
+  string init_code;
+  string prefix_code;
+  string body_code;
+  string suffix_code;
+  string cleanup_code;
+};
+
+// Assembles code in the given dialect for the CPU 'mcpu'. The functions
+// created by the assembler are owned by the object and they remain valid until
+// it is destroyed. Not thread-safe.
+class DirectAssembler {
+ public:
+  // Creates an assembler for the assembly dialect 'dialect'. 'mcpu' is the LLVM
+  // name of the CPU model; see JitCompiler::JitCompiler for more details.
+  DirectAssembler(llvm::InlineAsm::AsmDialect dialect, const string& mcpu);
+  ~DirectAssembler();
+
+  DirectAssembler(const DirectAssembler&) = delete;
+  DirectAssembler& operator=(const DirectAssembler&) = delete;
+
+  // Returns true if 'mcpu' is a CPU model known to LLVM. When it is not, LLVM
+  // uses a generic CPU model without any optional features.
+  bool IsKnownCpu() const;
+
+  // Returns true if the CPU model has the LLVM subtarget feature 'feature',
+  // e.g. "avx2" or "sse4.1". 'feature' must be known to LLVM. The assembler
+  // does not check the features of the CPU model, so this is the way to find
+  // out whether an instruction is available on it.
+  bool HasCpuFeature(const string& feature) const;
+
+  // Assembles 'code' and returns the machine code. The code must be
+  // position-independent and it must not refer to other sections or to
+  // undefined symbols, i.e. it must not require relocations.
+  StatusOr<std::vector<uint8_t>> AssembleToBytes(const string& code);
+
+  // Assembles a void() function that executes 'init_code' once, then runs
+  // 'loop_code' in a loop of 'num_iterations' iterations, then executes
+  // 'cleanup_code' and returns. Any of 'init_code' and 'cleanup_code' may be
+  // empty.
+  //
+  // The function has a fixed prologue and epilogue that save and restore all
+  // callee-saved general-purpose registers, so the code may modify any of them
+  // except for RSP. The loop counter is kept in a stack slot, and it is
+  // decremented and tested after each iteration. Unlike in the functions
+  // created by JitCompiler, there are no constraints: the code is used exactly
+  // as given.
+  // Returns VoidFunction::Undefined() and logs the error message if the code
+  // could not be assembled.
+  VoidFunction AssembleToFunction(int num_iterations, const string& init_code,
+                                  const string& loop_code,
+                                  const string& cleanup_code);
+
+  // Assembles a function with an unrolled loop; see UnrolledLoopCode for the
+  // structure of the function. Unlike AssembleToFunction with a '.rept'
+  // directive, the body of the loop is assembled only once, and its machine
+  // code is replicated 'unroll_factor' times, so the cost of the assembly does
+  // not depend on the unroll factor. The body must be position-independent.
+  // The prologue and the epilogue are the same as in AssembleToFunction.
+  // Returns VoidFunction::Undefined() and logs the error message if the code
+  // could not be assembled.
+  VoidFunction AssembleUnrolledLoop(const UnrolledLoopCode& code);
+
+  // Sets the kind of pages used for the assembled functions. With
+  // PREFER_HUGE_PAGES, the functions are placed in a read-write-execute arena
+  // of huge pages; each function still starts at a page boundary. Affects only
+  // the functions assembled after the call. The default is REGULAR_PAGES_ONLY.
+  void SetHugePagePolicy(HugePagePolicy policy);
+
+  // Returns the smallest kind of pages used for the functions assembled since
+  // the last call to SetHugePagePolicy.
+  PageBacking code_page_backing() const;
+
+  // Appends multi-byte NOPs to 'code' until its size is a multiple of
+  // 'alignment_bytes'.
+  static void AppendNopPadding(int alignment_bytes, std::vector<uint8_t>* code);
+
+  // Appends 'num_bytes' bytes of multi-byte NOPs to 'code'.
+  static void AppendNops(int num_bytes, std::vector<uint8_t>* code);
+
+ private:
+  // Copies 'machine_code' to a new block of executable memory owned by the
+  // assembler, and returns it as a function.
+  VoidFunction CreateFunctionFromBytes(
+      const std::vector<uint8_t>& machine_code);
+
+  // Assembles 'code' into the .text section of an object file, and returns the
+  // contents of the section. 'code' is already wrapped in the dialect
+  // directives.
+  StatusOr<std::vector<uint8_t>> AssembleTextSection(const string& code);
+
+  // Returns 'code' prefixed with the assembler directive that selects
+  // 'dialect_'.
+  string WithDialectDirective(const string& code) const;
+
+  const llvm::InlineAsm::AsmDialect dialect_;
+  const string mcpu_;
+  string triple_name_;
+
+  const llvm::Target* target_ = nullptr;
+  std::unique_ptr<llvm::MCRegisterInfo> register_info_;
+  std::unique_ptr<llvm::MCAsmInfo> asm_info_;
+  std::unique_ptr<llvm::MCInstrInfo> instr_info_;
+  std::unique_ptr<llvm::MCSubtargetInfo> subtarget_info_;
+
+  // The executable memory blocks that contain the assembled functions.
+  std::vector<llvm::sys::MemoryBlock> code_blocks_;
+  // The arena used for the assembled functions with PREFER_HUGE_PAGES, or
+  // nullptr when the functions are placed in 'code_blocks_'.
+  std::unique_ptr<MappedMemoryArena> code_arena_;
+};
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_LLVM_DIRECT_ASSEMBLER_H_
@@ -0,0 +1,177 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/llvm/direct_assembler.h"
+
+#include <cstdint>
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/util/strings.h"
+#include "gtest/gtest.h"
+#include "llvm/IR/InlineAsm.h"
+
+namespace cpu_instructions {
+namespace {
+
+constexpr const char kGenericMcpu[] = "generic";
+
+TEST(DirectAssemblerTest, AssembleToBytesAtt) {
+  DirectAssembler assembler(llvm::InlineAsm::AD_ATT, kGenericMcpu);
+  const auto bytes_or_status = assembler.AssembleToBytes("mov %ebx, %eax");
+  ASSERT_TRUE(bytes_or_status.ok()) << bytes_or_status.status();
+  EXPECT_EQ(bytes_or_status.ValueOrDie(), std::vector<uint8_t>({0x89, 0xd8}));
+}
+
+TEST(DirectAssemblerTest, AssembleToBytesIntel) {
+  DirectAssembler assembler(llvm::InlineAsm::AD_Intel, kGenericMcpu);
+  const auto bytes_or_status =
+      assembler.AssembleToBytes("mov eax, ebx\nadd rax, 1");
+  ASSERT_TRUE(bytes_or_status.ok()) << bytes_or_status.status();
+  EXPECT_EQ(bytes_or_status.ValueOrDie(),
+            std::vector<uint8_t>({0x89, 0xd8, 0x48, 0x83, 0xc0, 0x01}));
+}
+
+TEST(DirectAssemblerTest, AssembleInvalidCode) {
+  DirectAssembler assembler(llvm::InlineAsm::AD_Intel, kGenericMcpu);
+  EXPECT_FALSE(assembler.AssembleToBytes("this is not an instruction").ok());
+}
+
+TEST(DirectAssemblerTest, AssembleCodeWithRelocations) {
+  DirectAssembler assembler(llvm::InlineAsm::AD_Intel, kGenericMcpu);
+  EXPECT_FALSE(assembler.AssembleToBytes("call some_function").ok());
+}
+
+TEST(DirectAssemblerTest, HasCpuFeature) {
+  const DirectAssembler haswell(llvm::InlineAsm::AD_Intel, "haswell");
+  EXPECT_TRUE(haswell.HasCpuFeature("avx2"));
+  EXPECT_TRUE(haswell.HasCpuFeature("sse4.1"));
+  EXPECT_FALSE(haswell.HasCpuFeature("avx512f"));
+  const DirectAssembler sandybridge(llvm::InlineAsm::AD_Intel, "sandybridge");
+  EXPECT_TRUE(sandybridge.HasCpuFeature("avx"));
+  EXPECT_FALSE(sandybridge.HasCpuFeature("avx2"));
+}
+
+TEST(DirectAssemblerTest, AssembleToFunction) {
+  DirectAssembler assembler(llvm::InlineAsm::AD_ATT, kGenericMcpu);
+  // The function clobbers callee-saved registers; the prologue and the
+  // epilogue of the function must restore them.
+  const VoidFunction function = assembler.AssembleToFunction(
+      100, "mov $1, %rbx", "add %rbx, %r12\nmov %rbx, %rbp", "xor %r15, %r15");
+  ASSERT_TRUE(function.IsValid());
+  const string code(reinterpret_cast<const char*>(function.ptr),
+                    function.size);
+  // add %rbx, %r12
+  EXPECT_NE(code.find("\x49\x01\xdc"), string::npos)
+      << ToHumanReadableHexString(code);
+  function.CallOrDie();
+}
+
+TEST(DirectAssemblerTest, AssembleToFunctionWithError) {
+  DirectAssembler assembler(llvm::InlineAsm::AD_Intel, kGenericMcpu);
+  const VoidFunction function =
+      assembler.AssembleToFunction(1, "", "this is not an instruction", "");
+  EXPECT_FALSE(function.IsValid());
+}
+
+TEST(DirectAssemblerTest, AppendNopPadding) {
+  std::vector<uint8_t> code = {0xc3};
+  DirectAssembler::AppendNopPadding(1, &code);
+  EXPECT_EQ(code, std::vector<uint8_t>({0xc3}));
+  DirectAssembler::AppendNopPadding(4, &code);
+  EXPECT_EQ(code, std::vector<uint8_t>({0xc3, 0x0f, 0x1f, 0x00}));
+  DirectAssembler::AppendNopPadding(4, &code);
+  EXPECT_EQ(code.size(), 4);
+  DirectAssembler::AppendNopPadding(32, &code);
+  EXPECT_EQ(code.size(), 32);
+  // 28 bytes of padding: three 9-byte NOPs and one single-byte NOP.
+  EXPECT_EQ(code[4], 0x66);
+  EXPECT_EQ(code[31], 0x90);
+}
+
+TEST(DirectAssemblerTest, AppendNops) {
+  std::vector<uint8_t> code;
+  DirectAssembler::AppendNops(0, &code);
+  EXPECT_TRUE(code.empty());
+  DirectAssembler::AppendNops(2, &code);
+  EXPECT_EQ(code, std::vector<uint8_t>({0x66, 0x90}));
+  DirectAssembler::AppendNops(10, &code);
+  EXPECT_EQ(code.size(), 12);
+}
+
+TEST(DirectAssemblerTest, AssembleUnrolledLoop) {
+  constexpr int kUnrollFactor = 50;
+  constexpr int kBodyAlignment = 8;
+  DirectAssembler assembler(llvm::InlineAsm::AD_ATT, kGenericMcpu);
+  UnrolledLoopCode code;
+  code.num_iterations = 100;
+  code.unroll_factor = kUnrollFactor;
+  code.loop_alignment_bytes = 64;
+  code.body_alignment_bytes = kBodyAlignment;
+  code.init_code = "mov $1, %rbx";
+  code.prefix_code = "xor %r12, %r12";
+  code.body_code = "add %rbx, %r12";
+  code.suffix_code = "mov %r12, %rbp";
+  const VoidFunction function = assembler.AssembleUnrolledLoop(code);
+  ASSERT_TRUE(function.IsValid());
+  const string machine_code(reinterpret_cast<const char*>(function.ptr),
+                            function.size);
+  // add %rbx, %r12
+  constexpr char kBody[] = "\x49\x01\xdc";
+  int num_copies = 0;
+  for (size_t pos = machine_code.find(kBody); pos != string::npos;
+       pos = machine_code.find(kBody, pos + 1)) {
+    EXPECT_EQ(pos % kBodyAlignment, 0) << pos;
+    ++num_copies;
+  }
+  EXPECT_EQ(num_copies, kUnrollFactor);
+  function.CallOrDie();
+}
+
+TEST(DirectAssemblerTest, AssembleUnrolledLoopWithOffset) {
+  constexpr int kLoopAlignment = 64;
+  DirectAssembler assembler(llvm::InlineAsm::AD_ATT, kGenericMcpu);
+  UnrolledLoopCode code;
+  code.num_iterations = 10;
+  code.loop_alignment_bytes = kLoopAlignment;
+  code.body_code = "add %rbx, %r12";
+  for (const int offset : {0, 5, 17, 63}) {
+    code.loop_offset_bytes = offset;
+    const VoidFunction function = assembler.AssembleUnrolledLoop(code);
+    ASSERT_TRUE(function.IsValid());
+    const string machine_code(reinterpret_cast<const char*>(function.ptr),
+                              function.size);
+    const size_t body_start = machine_code.find("\x49\x01\xdc");
+    ASSERT_NE(body_start, string::npos);
+    EXPECT_EQ(body_start % kLoopAlignment, offset);
+    function.CallOrDie();
+  }
+}
+
+TEST(DirectAssemblerTest, AssembleToHugePages) {
+  DirectAssembler assembler(llvm::InlineAsm::AD_ATT, kGenericMcpu);
+  EXPECT_EQ(assembler.code_page_backing(), REGULAR_PAGES);
+  assembler.SetHugePagePolicy(PREFER_HUGE_PAGES);
+  for (int i = 0; i < 3; ++i) {
+    const VoidFunction function =
+        assembler.AssembleToFunction(10, "", "add %rbx, %r12", "");
+    ASSERT_TRUE(function.IsValid());
+    // The functions are still aligned to a page boundary.
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(function.ptr) % 4096, 0);
+    function.CallOrDie();
+  }
+}
+
+}  // namespace
+}  // namespace cpu_instructions
@@ -3,8 +3,11 @@
 #include <unordered_map>
 
 #include "cpu_instructions/llvm/llvm_utils.h"
+#include "cpu_instructions/util/mapped_memory.h"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/MCJIT.h"  // IWYU pragma: keep
@@ -18,37 +21,121 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InlineAsm.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Target/TargetOptions.h"
 #include "strings/str_cat.h"
 #include "util/gtl/map_util.h"
 #include "util/gtl/ptr_util.h"
 
 namespace cpu_instructions {
+namespace {
+
+// Returns a hash of the contents of a looping function; the arguments are
+// those of JitCompiler::AddLoopingFunctionToModule.
+string HashLoopingFunction(int num_iterations,
+                           const llvm::Value* init_inline_asm,
+                           const llvm::Value* loop_inline_asm,
+                           const llvm::Value* cleanup_inline_asm,
+                           unsigned loc_cookie) {
+  llvm::MD5 hash;
+  // The fields are separated by a zero byte to avoid collisions between
+  // different splits of the same string.
+  constexpr uint8_t kSeparator = 0;
+  const auto add_field = [&hash, &kSeparator](llvm::StringRef field) {
+    hash.update(field);
+    hash.update(llvm::makeArrayRef(&kSeparator, 1));
+  };
+  add_field(StrCat(num_iterations, ",", loc_cookie));
+  for (const llvm::Value* const value :
+       {init_inline_asm, loop_inline_asm, cleanup_inline_asm}) {
+    if (value == nullptr) {
+      add_field("none");
+      continue;
+    }
+    const llvm::InlineAsm* const inline_asm =
+        llvm::cast<llvm::InlineAsm>(value);
+    add_field(inline_asm->getAsmString());
+    add_field(inline_asm->getConstraintString());
+    add_field(StrCat(inline_asm->hasSideEffects(), ",",
+                     inline_asm->isAlignStack(), ",",
+                     inline_asm->getDialect()));
+  }
+  llvm::MD5::MD5Result result;
+  hash.final(result);
+  llvm::SmallString<32> hex_hash;
+  llvm::MD5::stringifyResult(result, hex_hash);
+  return hex_hash.str().str();
+}
+
+}  // namespace
 
 // A memory manager that stores the size of the blocks it allocates. This is
-// used to retrieve get the size of generated code.
+// used to retrieve get the size of generated code. With PREFER_HUGE_PAGES, the
+// sections are allocated from arenas of huge pages instead of the page-sized
+// blocks of SectionMemoryManager.
 class JitCompiler::StoreSizeMemoryManager : public llvm::SectionMemoryManager {
  public:
+  explicit StoreSizeMemoryManager(HugePagePolicy huge_page_policy)
+      : use_arenas_(huge_page_policy != REGULAR_PAGES_ONLY),
+        code_arena_(huge_page_policy, /*executable=*/true),
+        data_arena_(huge_page_policy, /*executable=*/false) {}
+
   // Returns the size of the section starting at `address`.
   int GetSectionSize(const uint8_t* const address) const {
     return FindOrDieNoPrint(address_to_size_, address);
   }
 
+  // Returns the total size of the code and data sections allocated by the
+  // memory manager.
+  int64_t allocated_size_bytes() const { return allocated_size_bytes_; }
+
+  // Returns the smallest kind of pages used for the code sections.
+  PageBacking code_page_backing() const {
+    return use_arenas_ ? code_arena_.backing() : REGULAR_PAGES;
+  }
+
  private:
   uint8_t* allocateCodeSection(uintptr_t size, unsigned alignment,
                                unsigned section_id,
                                llvm::StringRef section_name) override {
-    uint8_t* const result = llvm::SectionMemoryManager::allocateCodeSection(
-        size, alignment, section_id, section_name);
+    uint8_t* const result =
+        use_arenas_ ? code_arena_.Allocate(size, alignment)
+                    : llvm::SectionMemoryManager::allocateCodeSection(
+                          size, alignment, section_id, section_name);
     // We should never allocate a block of memory twice.
     InsertOrDieNoPrint(&address_to_size_, result, size);
+    allocated_size_bytes_ += size;
     return result;
   }
 
+  uint8_t* allocateDataSection(uintptr_t size, unsigned alignment,
+                               unsigned section_id,
+                               llvm::StringRef section_name,
+                               bool is_read_only) override {
+    allocated_size_bytes_ += size;
+    if (use_arenas_) return data_arena_.Allocate(size, alignment);
+    return llvm::SectionMemoryManager::allocateDataSection(
+        size, alignment, section_id, section_name, is_read_only);
+  }
+
+  bool finalizeMemory(std::string* error_message) override {
+    // The arenas are mapped with their final protection, and x86 keeps the
+    // instruction cache coherent with the data written to memory.
+    if (use_arenas_) return false;
+    return llvm::SectionMemoryManager::finalizeMemory(error_message);
+  }
+
+  const bool use_arenas_;
+  MappedMemoryArena code_arena_;
+  MappedMemoryArena data_arena_;
   std::unordered_map<const uint8_t*, int> address_to_size_;
+  int64_t allocated_size_bytes_ = 0;
 };
 
 JitCompiler::JitCompiler(llvm::InlineAsm::AsmDialect dialect,
@@ -67,24 +154,82 @@ void JitCompiler::Init() {
   }
   module_ = new llvm::Module("Temp Module for JIT", *context_);
   CHECK(module_ != nullptr);
-  auto memory_manager = gtl::MakeUnique<StoreSizeMemoryManager>();
+  auto memory_manager =
+      gtl::MakeUnique<StoreSizeMemoryManager>(huge_page_policy_);
   memory_manager_ = memory_manager.get();
+  // Each function is emitted to its own section, so that the memory manager
+  // knows the size of each function even when several functions are compiled
+  // in the same module.
+  llvm::TargetOptions target_options;
+  target_options.FunctionSections = true;
   execution_engine_.reset(
       llvm::EngineBuilder(std::unique_ptr<llvm::Module>(module_))
           .setMCPU(MakeStringRef(mcpu_))
+          .setTargetOptions(target_options)
           .setMCJITMemoryManager(std::move(memory_manager))
           .create());
   CHECK(execution_engine_ != nullptr);
+  if (object_cache_ != nullptr) {
+    execution_engine_->setObjectCache(object_cache_.get());
+  }
   llvm::Type* const void_type = llvm::Type::getVoidTy(*context_);
   CHECK(void_type != nullptr);
   function_type_ = llvm::FunctionType::get(void_type, false);
   CHECK(function_type_ != nullptr);
 }
 
+void JitCompiler::SetCodeSizeBudget(int64_t max_code_size_bytes) {
+  CHECK_GE(max_code_size_bytes, 0);
+  max_code_size_bytes_ = max_code_size_bytes;
+}
+
+int64_t JitCompiler::allocated_code_size_bytes() const {
+  return initialized_ ? memory_manager_->allocated_size_bytes() : 0;
+}
+
+void JitCompiler::SetHugePagePolicy(HugePagePolicy policy) {
+  CHECK(!initialized_)
+      << "The huge page policy must be set before the first compilation";
+  huge_page_policy_ = policy;
+}
+
+PageBacking JitCompiler::code_page_backing() const {
+  return initialized_ ? memory_manager_->code_page_backing() : REGULAR_PAGES;
+}
+
+void JitCompiler::ResetIfCodeSizeBudgetExceeded() {
+  if (!initialized_ || max_code_size_bytes_ == 0 ||
+      memory_manager_->allocated_size_bytes() < max_code_size_bytes_) {
+    return;
+  }
+  VLOG(1) << "Resetting the execution engine, "
+          << memory_manager_->allocated_size_bytes() << " bytes allocated";
+  // The execution engine owns the modules and the memory manager, and it
+  // releases all the memory allocated for the code. The modules must be
+  // destroyed before the context that owns their types and constants.
+  execution_engine_.reset();
+  memory_manager_ = nullptr;
+  module_ = nullptr;
+  context_.reset();
+  if (object_cache_ != nullptr) object_cache_->ForgetAllModules();
+  function_name_counts_.clear();
+  ++num_engine_resets_;
+  Init();
+}
+
+void JitCompiler::EnableObjectCache(const string& cache_directory) {
+  // The dialect of the inline assembly is a part of the IR; the CPU model is
+  // passed only to the code generator.
+  object_cache_ = gtl::MakeUnique<ObjectFileCache>(cache_directory,
+                                                   StrCat("mcpu=", mcpu_));
+  if (initialized_) execution_engine_->setObjectCache(object_cache_.get());
+}
+
 VoidFunction JitCompiler::CompileInlineAssemblyToFunction(
     int num_iterations, const std::string& loop_code,
     const std::string& loop_constraints) {
   if (!initialized_) Init();
+  ResetIfCodeSizeBudgetExceeded();
   llvm::Value* loop_inline_asm =
       AssembleInlineNativeCode(true, loop_code, loop_constraints);
   CHECK(loop_inline_asm != nullptr);
@@ -100,6 +245,7 @@ VoidFunction JitCompiler::CompileInlineAssemblyToFunction(
     const std::string& loop_constraints, const std::string& cleanup_code,
     const std::string& cleanup_constraints) {
   if (!initialized_) Init();
+  ResetIfCodeSizeBudgetExceeded();
   llvm::Value* const init_inline_asm =
       AssembleInlineNativeCode(true, init_code, init_constraints);
   CHECK(init_inline_asm != nullptr);
@@ -116,8 +262,69 @@ VoidFunction JitCompiler::CompileInlineAssemblyToFunction(
   return CreatePointerToInlineAssemblyFunction(loop);
 }
 
+std::vector<VoidFunction> JitCompiler::CompileInlineAssemblyToFunctions(
+    const std::vector<InlineAsmFunctionCode>& functions) {
+  if (!initialized_) Init();
+  ResetIfCodeSizeBudgetExceeded();
+  compile_errors_.clear();
+  compile_error_loc_cookies_.clear();
+  constexpr char kModuleNameBase[] = "inline_assembly_batch_module_";
+  llvm::Module* const module =
+      new llvm::Module(StrCat(kModuleNameBase, function_id_), *context_);
+  std::vector<llvm::Function*> llvm_functions;
+  llvm_functions.reserve(functions.size());
+  for (int i = 0; i < functions.size(); ++i) {
+    const InlineAsmFunctionCode& code = functions[i];
+    llvm::Value* const init_inline_asm =
+        code.init_code.empty()
+            ? nullptr
+            : AssembleInlineNativeCode(true, code.init_code,
+                                       code.init_constraints);
+    llvm::Value* const loop_inline_asm =
+        AssembleInlineNativeCode(true, code.loop_code, code.loop_constraints);
+    CHECK(loop_inline_asm != nullptr);
+    llvm::Value* const cleanup_inline_asm =
+        code.cleanup_code.empty()
+            ? nullptr
+            : AssembleInlineNativeCode(true, code.cleanup_code,
+                                       code.cleanup_constraints);
+    // The location cookies of the functions start at one; zero is used for
+    // errors that do not belong to any of them.
+    llvm::Function* const function = AddLoopingFunctionToModule(
+        code.num_iterations, init_inline_asm, loop_inline_asm,
+        cleanup_inline_asm, i + 1, module);
+    CHECK(function != nullptr);
+    llvm_functions.push_back(function);
+  }
+
+  // Compile all the functions at once.
+  execution_engine_->addModule(std::unique_ptr<llvm::Module>(module));
+  execution_engine_->finalizeObject();
+
+  for (const string& error : compile_errors_) {
+    LOG(ERROR) << error;
+  }
+  if (!compile_errors_.empty() && object_cache_ != nullptr) {
+    object_cache_->RemoveObject(module);
+  }
+  const bool all_functions_failed =
+      ContainsKey(compile_error_loc_cookies_, 0);
+  std::vector<VoidFunction> compiled_functions;
+  compiled_functions.reserve(functions.size());
+  for (int i = 0; i < llvm_functions.size(); ++i) {
+    if (all_functions_failed ||
+        ContainsKey(compile_error_loc_cookies_, i + 1)) {
+      compiled_functions.push_back(VoidFunction::Undefined());
+    } else {
+      compiled_functions.push_back(GetCompiledFunction(llvm_functions[i]));
+    }
+  }
+  return compiled_functions;
+}
+
 uint8_t* JitCompiler::CompileInlineAssemblyFragment(const std::string& code) {
   if (!initialized_) Init();
+  ResetIfCodeSizeBudgetExceeded();
   llvm::Value* inline_asm = AssembleInlineNativeCode(false, code, "");
   CHECK(inline_asm != nullptr);
   llvm::Function* loop =
@@ -139,13 +346,32 @@ llvm::Function* JitCompiler::WarpInlineAsmInLoopingFunction(
     int num_iterations, llvm::Value* init_inline_asm,
     llvm::Value* loop_inline_asm, llvm::Value* cleanup_inline_asm) {
   if (!initialized_) Init();
-  CHECK_GE(num_iterations, 1);
   constexpr char kModuleNameBase[] = "inline_assembly_module_";
+  llvm::Module* const module =
+      new llvm::Module(StrCat(kModuleNameBase, function_id_), *context_);
+  return AddLoopingFunctionToModule(num_iterations, init_inline_asm,
+                                    loop_inline_asm, cleanup_inline_asm,
+                                    /*loc_cookie=*/0, module);
+}
+
+llvm::Function* JitCompiler::AddLoopingFunctionToModule(
+    int num_iterations, llvm::Value* init_inline_asm,
+    llvm::Value* loop_inline_asm, llvm::Value* cleanup_inline_asm,
+    unsigned loc_cookie, llvm::Module* module) {
+  CHECK_GE(num_iterations, 1);
+  CHECK(module != nullptr);
+  // The functions are named after their contents rather than numbered, so
+  // that a snippet gets the same IR, and thus the same key in the object cache,
+  // regardless of the snippets compiled before it. The suffix tells apart the
+  // copies of the same function compiled by the current execution engine.
   constexpr char kFunctionNameBase[] = "inline_assembly_";
-  const std::string module_name = StrCat(kModuleNameBase, function_id_);
-  const std::string function_name = StrCat(kFunctionNameBase, function_id_);
+  const string content_hash =
+      HashLoopingFunction(num_iterations, init_inline_asm, loop_inline_asm,
+                          cleanup_inline_asm, loc_cookie);
+  const std::string function_name =
+      StrCat(kFunctionNameBase, content_hash, "_",
+             function_name_counts_[content_hash]++);
   ++function_id_;
-  llvm::Module* module = new llvm::Module(module_name, *context_);
   llvm::Function* function = llvm::Function::Create(
       function_type_, llvm::Function::ExternalLinkage, function_name, module);
   if (function == nullptr) {
@@ -157,12 +383,26 @@ llvm::Function* JitCompiler::WarpInlineAsmInLoopingFunction(
 
   llvm::IRBuilder<> builder(*context_);
 
+  // The location cookie is attached to the calls as the "srcloc" metadata; the
+  // code generator then passes it to the inline assembly diagnostic handler.
+  llvm::MDNode* const loc_cookie_metadata =
+      loc_cookie == 0 ? nullptr
+                      : llvm::MDNode::get(
+                            *context_, llvm::ConstantAsMetadata::get(
+                                           builder.getInt32(loc_cookie)));
+  const auto create_inline_asm_call = [&](llvm::Value* inline_asm) {
+    llvm::CallInst* const call = builder.CreateCall(inline_asm, {});
+    if (loc_cookie_metadata != nullptr) {
+      call->setMetadata("srcloc", loc_cookie_metadata);
+    }
+  };
+
   builder.SetInsertPoint(function_basic_block);
   if (init_inline_asm != nullptr) {
-    builder.CreateCall(init_inline_asm);
+    create_inline_asm_call(init_inline_asm);
   }
   if (num_iterations == 1) {
-    builder.CreateCall(loop_inline_asm, {});
+    create_inline_asm_call(loop_inline_asm);
   } else {
     llvm::BasicBlock* const loop_body =
         llvm::BasicBlock::Create(*context_, "loop", function);
@@ -178,7 +418,7 @@ llvm::Function* JitCompiler::WarpInlineAsmInLoopingFunction(
     llvm::PHINode* const counter_phi =
         builder.CreatePHI(int_type, 2, "counter");
 
-    builder.CreateCall(loop_inline_asm, {});
+    create_inline_asm_call(loop_inline_asm);
 
     // Create a constant equal to one.
     llvm::Value* const const_one = llvm::ConstantInt::getSigned(int_type, 1);
@@ -203,7 +443,7 @@ llvm::Function* JitCompiler::WarpInlineAsmInLoopingFunction(
     builder.SetInsertPoint(loop_end);
   }
   if (cleanup_inline_asm != nullptr) {
-    builder.CreateCall(cleanup_inline_asm);
+    create_inline_asm_call(cleanup_inline_asm);
   }
   builder.CreateRetVoid();
   llvm::verifyFunction(*function);
@@ -214,6 +454,7 @@ llvm::Function* JitCompiler::WarpInlineAsmInLoopingFunction(
 VoidFunction JitCompiler::CreatePointerToInlineAssemblyFunction(
     llvm::Function* function) {
   compile_errors_.clear();
+  compile_error_loc_cookies_.clear();
   if (!initialized_) Init();
   llvm::Module* const module = function->getParent();
   if (module == nullptr) {
@@ -225,20 +466,29 @@ VoidFunction JitCompiler::CreatePointerToInlineAssemblyFunction(
   // Find the function by name (it was added to the new module when it was
   // created, and adding the module to the execution engine is enough to get it
   // here), and compile it at the same time.
-  //
+  const VoidFunction compiled_function = GetCompiledFunction(function);
+  if (!compile_errors_.empty()) {
+    for (const string& error : compile_errors_) {
+      LOG(ERROR) << error;
+    }
+    // A cached object would hide the errors from the next compilation.
+    if (object_cache_ != nullptr) object_cache_->RemoveObject(module);
+    return VoidFunction::Undefined();
+  }
+  return compiled_function;
+}
+
+VoidFunction JitCompiler::GetCompiledFunction(
+    const llvm::Function* function) const {
   // NOTE(ondrasej): getFunctionAddress only works with MCJIT (and not with JIT
   // or the interpreter), but we don't care, because JIT and the interpreter
   // cannot execute inline assembly anyway.
-  const std::string function_name = function->getName();
-  uint64_t function_ptr = execution_engine_->getFunctionAddress(function_name);
+  const std::string function_name = function->getName().str();
+  const uint64_t function_ptr =
+      execution_engine_->getFunctionAddress(function_name);
   if (function_ptr == 0) {
     LOG(DFATAL)
         << "getFunctionAddress returned nullptr. Are you sure you use MCJIT?";
-  }
-  if (!compile_errors_.empty()) {
-    for (const string& error : compile_errors_) {
-      LOG(ERROR) << error;
-    }
     return VoidFunction::Undefined();
   }
   return VoidFunction(reinterpret_cast<void (*)()>(function_ptr),
@@ -254,7 +504,20 @@ void JitCompiler::HandleDiagnostic(const llvm::DiagnosticInfo& diagnostic,
   llvm::DiagnosticPrinterRawOStream error_message_printer(
       error_message_ostream);
   diagnostic.print(error_message_printer);
-  self->compile_errors_.push_back(error_message);
+  // Only the errors make the compilation fail; the warnings and the remarks
+  // are just logged.
+  switch (diagnostic.getSeverity()) {
+    case llvm::DS_Error:
+      self->compile_errors_.push_back(error_message_ostream.str());
+      self->compile_error_loc_cookies_.insert(0);
+      break;
+    case llvm::DS_Warning:
+      LOG(WARNING) << error_message_ostream.str();
+      break;
+    default:
+      VLOG(1) << error_message_ostream.str();
+      break;
+  }
 }
 
 void JitCompiler::HandleInlineAsmDiagnostic(
@@ -263,7 +526,18 @@ void JitCompiler::HandleInlineAsmDiagnostic(
   std::string error_message;
   llvm::raw_string_ostream error_message_ostream(error_message);
   diagnostic.print(nullptr, error_message_ostream);
-  self->compile_errors_.push_back(error_message_ostream.str());
+  switch (diagnostic.getKind()) {
+    case llvm::SourceMgr::DK_Error:
+      self->compile_errors_.push_back(error_message_ostream.str());
+      self->compile_error_loc_cookies_.insert(loc_cookie);
+      break;
+    case llvm::SourceMgr::DK_Warning:
+      LOG(WARNING) << error_message_ostream.str();
+      break;
+    default:
+      VLOG(1) << error_message_ostream.str();
+      break;
+  }
 }
 
 }  // namespace cpu_instructions
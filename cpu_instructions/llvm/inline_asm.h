@@ -3,9 +3,13 @@
 
 #include <stdint.h>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include "strings/string.h"
 
+#include "cpu_instructions/llvm/object_cache.h"
+#include "cpu_instructions/util/mapped_memory.h"
 #include "glog/logging.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/IR/DerivedTypes.h"
@@ -36,6 +40,21 @@ struct VoidFunction {
   const int size;
 };
 
+// The code of a function compiled by JitCompiler: a block of inline assembly
+// executed once at the beginning of the function, a block executed in a loop of
+// 'num_iterations' iterations, and a block executed once at the end. Each block
+// comes with its constraints. The init and cleanup blocks are optional; they
+// are omitted from the function when their code is empty.
+struct InlineAsmFunctionCode {
+  int num_iterations = 1;
+  std::string init_code;
+  std::string init_constraints;
+  std::string loop_code;
+  std::string loop_constraints;
+  std::string cleanup_code;
+  std::string cleanup_constraints;
+};
+
 // A simple JIT compiler class that enables to assemble code at run time,
 // encapsulate it into a loop, compile it and get a pointer to the corresponding
 // function.
@@ -63,6 +82,51 @@ class JitCompiler {
   JitCompiler(llvm::InlineAsm::AsmDialect dialect, const string& mcpu,
               ErrorHandlingMode error_mode);
 
+  // Enables the persistent object cache for the code compiled by this object.
+  // The object code is stored in 'cache_directory', and it is reused when the
+  // same module is compiled again for the same CPU, even in a different
+  // process; see ObjectFileCache for the details. Modules whose compilation
+  // produced errors are never stored in the cache.
+  void EnableObjectCache(const string& cache_directory);
+
+  // Returns the object cache, or nullptr if the object cache is not enabled.
+  const ObjectFileCache* object_cache() const { return object_cache_.get(); }
+
+  // Limits the memory used by the compiled code. When the code and data
+  // sections allocated by the current execution engine reach
+  // 'max_code_size_bytes', the next call to CompileInlineAssemblyToFunction(s)
+  // or CompileInlineAssemblyFragment first destroys the execution engine, the
+  // LLVM context and all modules compiled so far, and releases their memory.
+  // The compilation then continues with a new engine. As a consequence, the
+  // functions returned before the reset become invalid; a function is
+  // guaranteed to stay valid only until the next call to one of these methods.
+  // The LLVM objects returned by AssembleInlineNativeCode and
+  // WarpInlineAsmInLoopingFunction are owned by the LLVM context, and they are
+  // invalidated by the same call.
+  // When 'max_code_size_bytes' is zero (the default), the memory is never
+  // released.
+  void SetCodeSizeBudget(int64_t max_code_size_bytes);
+
+  // Returns the number of bytes of code and data allocated by the current
+  // execution engine.
+  int64_t allocated_code_size_bytes() const;
+
+  // Returns the number of times the execution engine was reset because the
+  // code size budget was exceeded.
+  int num_engine_resets() const { return num_engine_resets_; }
+
+  // Sets the kind of pages used for the compiled code and its data. With
+  // PREFER_HUGE_PAGES, the sections are allocated from huge page arenas, so
+  // that large unrolled loops do not cause iTLB misses during measurements.
+  // The arenas are mapped read-write-execute, because their memory protection
+  // can't be changed for individual sections. Must be called before the first
+  // compilation. The default is REGULAR_PAGES_ONLY.
+  void SetHugePagePolicy(HugePagePolicy policy);
+
+  // Returns the smallest kind of pages used for the code compiled by the
+  // current execution engine.
+  PageBacking code_page_backing() const;
+
   // Builds, compiles and returns a pointer to a void() function that executes
   // a loop of 'num_iterations' around 'loop_code'. Registers touched by
   // 'constraints' are saved, and the compiler assumes that the function does
@@ -86,6 +150,16 @@ class JitCompiler {
       const std::string& loop_constraints, const std::string& cleanup_code,
       const std::string& cleanup_constraints);
 
+  // Builds and compiles a batch of functions. All the functions are added to a
+  // single LLVM module that is compiled and finalized only once, which is much
+  // faster than compiling them one by one. Returns the compiled functions in
+  // the order of 'functions', with their sizes. When the compiler runs in the
+  // RETURN_NULLPTR_ON_ERROR mode, the functions whose code could not be
+  // compiled are returned as VoidFunction::Undefined(); the other functions of
+  // the batch are still valid.
+  std::vector<VoidFunction> CompileInlineAssemblyToFunctions(
+      const std::vector<InlineAsmFunctionCode>& functions);
+
   // Builds, compiles and returns a pointer to the assembled code of
   // 'code'. This is not a function, and it should not be cast and
   // called: Registers are not saved, and the compiler assumes that
@@ -127,10 +201,28 @@ class JitCompiler {
  private:
   class StoreSizeMemoryManager;
 
+  // Adds to 'module' a function that loops over 'loop_inline_asm'; see
+  // WarpInlineAsmInLoopingFunction for the description of the arguments. When
+  // 'loc_cookie' is not zero, it is attached to the inline assembly calls, and
+  // the diagnostics for the inline assembly are reported with it.
+  llvm::Function* AddLoopingFunctionToModule(
+      int num_iterations, llvm::Value* init_inline_asm,
+      llvm::Value* loop_inline_asm, llvm::Value* cleanup_inline_asm,
+      unsigned loc_cookie, llvm::Module* module);
+
+  // Returns the compiled function 'function' from 'execution_engine_', or
+  // VoidFunction::Undefined() if its address can't be found.
+  VoidFunction GetCompiledFunction(const llvm::Function* function) const;
+
   // Initializes the JitCompiler. Must be done before doing anything. Called
   // automatically by each of the member functions if necessary.
   void Init();
 
+  // Resets the execution engine and the LLVM context if the code size budget
+  // was exceeded. Must be called only at the beginning of a compilation, when
+  // the client code does not hold any LLVM objects owned by the compiler.
+  void ResetIfCodeSizeBudgetExceeded();
+
   static void HandleDiagnostic(const llvm::DiagnosticInfo& diagnostic,
                                void* context);
   static void HandleInlineAsmDiagnostic(const llvm::SMDiagnostic& diagnostic,
@@ -154,11 +246,24 @@ class JitCompiler {
   // The memory manager for execution_engine_.
   const StoreSizeMemoryManager* memory_manager_;
 
+  // The persistent object cache used by 'execution_engine_', or nullptr if the
+  // cache is disabled.
+  std::unique_ptr<ObjectFileCache> object_cache_;
+
   // This is a place-holder for the void function type.
   llvm::FunctionType* function_type_;
 
-  // Class JitCompiler numbers the functions one after the other.
+  // Class JitCompiler numbers the modules one after the other.
   int function_id_ = 0;
+  // The number of functions with the given content hash compiled by the
+  // current execution engine; see AddLoopingFunctionToModule.
+  std::unordered_map<string, int> function_name_counts_;
+
+  // The code size budget; zero if there is no budget. See SetCodeSizeBudget.
+  int64_t max_code_size_bytes_ = 0;
+  int num_engine_resets_ = 0;
+
+  HugePagePolicy huge_page_policy_ = REGULAR_PAGES_ONLY;
 
   // Holds whether the object was initialized.
   bool initialized_ = false;
@@ -166,6 +271,11 @@ class JitCompiler {
   // The list of compiler error messages from inline assembly collected during
   // the build.
   std::vector<string> compile_errors_;
+
+  // The location cookies of the inline assembly calls that caused the errors in
+  // 'compile_errors_'. Zero is used for errors that can't be attributed to a
+  // single call.
+  std::unordered_set<unsigned> compile_error_loc_cookies_;
 };
 
 }  // namespace cpu_instructions
@@ -1,5 +1,8 @@
 #include "cpu_instructions/llvm/inline_asm.h"
 
+#include <vector>
+#include "strings/string.h"
+
 #include "base/stringprintf.h"
 #include "cpu_instructions/llvm/llvm_utils.h"
 #include "cpu_instructions/util/strings.h"
@@ -14,7 +17,7 @@ constexpr const char kGenericMcpu[] = "generic";
 TEST(JitCompilerTest, CreateAFunctionWithoutLoop) {
   constexpr char kExpectedIR[] =
       "\n"
-      "define void @inline_assembly_0() {\n"
+      "define void @%s() {\n"
       "entry:\n"
       "  call void asm \"mov %ebx, %ecx\", \"~{ebx},~{ecx}\"()\n"
       "  ret void\n"
@@ -30,13 +33,14 @@ TEST(JitCompilerTest, CreateAFunctionWithoutLoop) {
       jit.WarpInlineAsmInLoopingFunction(1, nullptr, inline_asm, nullptr);
   ASSERT_NE(nullptr, function);
   const std::string function_ir = DumpIRToString(function);
-  EXPECT_EQ(kExpectedIR, function_ir);
+  EXPECT_EQ(StringPrintf(kExpectedIR, function->getName().str().c_str()),
+            function_ir);
 }
 
 TEST(JitCompilerTest, CreateAFunctionWithoutLoopWithInitBlock) {
   constexpr char kExpectedIR[] =
       "\n"
-      "define void @inline_assembly_0() {\n"
+      "define void @%s() {\n"
       "entry:\n"
       "  call void asm \"mov %ebx, 0x1234\", \"~{ebx}\"()\n"
       "  call void asm \"mov %ecx, %ebx\", \"~{ebx},~{ecx}\"()\n"
@@ -64,13 +68,14 @@ TEST(JitCompilerTest, CreateAFunctionWithoutLoopWithInitBlock) {
       1, init_inline_asm, loop_inline_asm, cleanup_inline_asm);
   ASSERT_NE(function, nullptr);
   const std::string function_ir = DumpIRToString(function);
-  EXPECT_EQ(kExpectedIR, function_ir);
+  EXPECT_EQ(StringPrintf(kExpectedIR, function->getName().str().c_str()),
+            function_ir);
 }
 
 TEST(JitCompilerTest, CreateAFunctionWithLoop) {
   constexpr char kExpectedIR[] =
       "\n"
-      "define void @inline_assembly_0() {\n"
+      "define void @%s() {\n"
       "entry:\n"
       "  br label %loop\n"
       "\n"
@@ -96,7 +101,37 @@ TEST(JitCompilerTest, CreateAFunctionWithLoop) {
       jit.WarpInlineAsmInLoopingFunction(10, nullptr, inline_asm, nullptr);
   ASSERT_NE(nullptr, function);
   const std::string function_ir = DumpIRToString(function);
-  EXPECT_EQ(kExpectedIR, function_ir);
+  EXPECT_EQ(StringPrintf(kExpectedIR, function->getName().str().c_str()),
+            function_ir);
+}
+
+TEST(JitCompilerTest, NamesFunctionsAfterTheirContents) {
+  JitCompiler jit(llvm::InlineAsm::AD_ATT, kGenericMcpu,
+                  JitCompiler::EXIT_ON_ERROR);
+  const auto make_function = [&jit](const char* code) {
+    return jit.WarpInlineAsmInLoopingFunction(
+        10, nullptr, jit.AssembleInlineNativeCode(false, code, ""), nullptr);
+  };
+  const string first_name = make_function("nop")->getName().str();
+  const string other_name = make_function("pause")->getName().str();
+  const string copy_name = make_function("nop")->getName().str();
+  EXPECT_EQ(first_name.find("inline_assembly_"), 0);
+  EXPECT_NE(first_name, other_name);
+  // A copy of a function gets the same name with a different suffix.
+  EXPECT_NE(first_name, copy_name);
+  EXPECT_EQ(first_name.substr(0, first_name.rfind('_')),
+            copy_name.substr(0, copy_name.rfind('_')));
+
+  JitCompiler other_jit(llvm::InlineAsm::AD_ATT, kGenericMcpu,
+                        JitCompiler::EXIT_ON_ERROR);
+  EXPECT_EQ(other_jit
+                .WarpInlineAsmInLoopingFunction(
+                    10, nullptr,
+                    other_jit.AssembleInlineNativeCode(false, "nop", ""),
+                    nullptr)
+                ->getName()
+                .str(),
+            first_name);
 }
 
 TEST(JitCompilerTest, CreateAFunctionAndRunItInJIT) {
@@ -123,5 +158,129 @@ TEST(JitCompilerTest, CreateAFunctionAndRunItInJIT) {
   LOG(INFO) << "Function called";
 }
 
+TEST(JitCompilerTest, CompileABatchOfFunctions) {
+  std::vector<InlineAsmFunctionCode> functions(3);
+  functions[0].num_iterations = 10;
+  functions[0].loop_code = "mov %ebx, %eax";
+  functions[0].loop_constraints = "~{ebx},~{eax}";
+  functions[1].num_iterations = 1;
+  functions[1].init_code = "mov $0x1234, %ebx";
+  functions[1].init_constraints = "~{ebx}";
+  functions[1].loop_code = ".rept 3\nmov %ebx, %ecx\n.endr";
+  functions[1].loop_constraints = "~{ebx},~{ecx}";
+  functions[2].num_iterations = 5;
+  functions[2].loop_code = "add %eax, %eax";
+  functions[2].loop_constraints = "~{eax}";
+  JitCompiler jit(llvm::InlineAsm::AD_ATT, kGenericMcpu,
+                  JitCompiler::EXIT_ON_ERROR);
+  const std::vector<VoidFunction> compiled_functions =
+      jit.CompileInlineAssemblyToFunctions(functions);
+  ASSERT_EQ(compiled_functions.size(), functions.size());
+
+  const string kExpectedEncodings[] = {"\x89\xd8", "\x89\xd9\x89\xd9\x89\xd9",
+                                       "\x01\xc0"};
+  for (int i = 0; i < compiled_functions.size(); ++i) {
+    SCOPED_TRACE(i);
+    const VoidFunction& function = compiled_functions[i];
+    ASSERT_TRUE(function.IsValid());
+    // Each function has its own section, and thus its own size.
+    const string compiled_function(reinterpret_cast<const char*>(function.ptr),
+                                   function.size);
+    EXPECT_NE(compiled_function.find(kExpectedEncodings[i]), string::npos)
+        << ToHumanReadableHexString(compiled_function);
+    function.CallOrDie();
+  }
+  EXPECT_NE(compiled_functions[0].ptr, compiled_functions[1].ptr);
+}
+
+TEST(JitCompilerTest, CompileABatchWithAnInvalidFunction) {
+  std::vector<InlineAsmFunctionCode> functions(2);
+  functions[0].loop_code = "mov %ebx, %eax";
+  functions[0].loop_constraints = "~{ebx},~{eax}";
+  functions[1].loop_code = "this is not an instruction";
+  JitCompiler jit(llvm::InlineAsm::AD_ATT, kGenericMcpu,
+                  JitCompiler::RETURN_NULLPTR_ON_ERROR);
+  const std::vector<VoidFunction> compiled_functions =
+      jit.CompileInlineAssemblyToFunctions(functions);
+  ASSERT_EQ(compiled_functions.size(), functions.size());
+  EXPECT_TRUE(compiled_functions[0].IsValid());
+  EXPECT_FALSE(compiled_functions[1].IsValid());
+}
+
+TEST(JitCompilerTest, WarningsDoNotFailTheCompilation) {
+  constexpr char kLoopCode[] = "mov %ebx, %eax\n.warning \"a warning\"";
+  constexpr char kLoopConstraints[] = "~{ebx},~{eax}";
+  JitCompiler jit(llvm::InlineAsm::AD_ATT, kGenericMcpu,
+                  JitCompiler::RETURN_NULLPTR_ON_ERROR);
+  EXPECT_TRUE(
+      jit.CompileInlineAssemblyToFunction(1, kLoopCode, kLoopConstraints)
+          .IsValid());
+
+  std::vector<InlineAsmFunctionCode> functions(2);
+  functions[0].loop_code = kLoopCode;
+  functions[0].loop_constraints = kLoopConstraints;
+  functions[1].loop_code = "add %eax, %eax";
+  functions[1].loop_constraints = "~{eax}";
+  const std::vector<VoidFunction> compiled_functions =
+      jit.CompileInlineAssemblyToFunctions(functions);
+  ASSERT_EQ(compiled_functions.size(), functions.size());
+  EXPECT_TRUE(compiled_functions[0].IsValid());
+  EXPECT_TRUE(compiled_functions[1].IsValid());
+}
+
+TEST(JitCompilerTest, ResetsTheEngineWhenCodeSizeBudgetIsExceeded) {
+  constexpr char kLoopCode[] = "mov %ebx, %eax";
+  constexpr char kLoopConstraints[] = "~{ebx},~{eax}";
+  constexpr int kNumFunctions = 5;
+  JitCompiler jit(llvm::InlineAsm::AD_ATT, kGenericMcpu,
+                  JitCompiler::EXIT_ON_ERROR);
+  // Each function is larger than the budget, so the engine is reset before
+  // each compilation except for the first one.
+  jit.SetCodeSizeBudget(1);
+  for (int i = 0; i < kNumFunctions; ++i) {
+    const VoidFunction function =
+        jit.CompileInlineAssemblyToFunction(10, kLoopCode, kLoopConstraints);
+    ASSERT_TRUE(function.IsValid());
+    EXPECT_GE(jit.allocated_code_size_bytes(), function.size);
+    function.CallOrDie();
+  }
+  EXPECT_EQ(jit.num_engine_resets(), kNumFunctions - 1);
+}
+
+TEST(JitCompilerTest, DoesNotResetTheEngineWithoutBudget) {
+  JitCompiler jit(llvm::InlineAsm::AD_ATT, kGenericMcpu,
+                  JitCompiler::EXIT_ON_ERROR);
+  int64_t total_size = 0;
+  for (int i = 0; i < 3; ++i) {
+    const VoidFunction function = jit.CompileInlineAssemblyToFunction(
+        10, "mov %ebx, %eax", "~{ebx},~{eax}");
+    ASSERT_TRUE(function.IsValid());
+    total_size += function.size;
+  }
+  EXPECT_EQ(jit.num_engine_resets(), 0);
+  EXPECT_GE(jit.allocated_code_size_bytes(), total_size);
+}
+
+TEST(JitCompilerTest, CompilesToHugePages) {
+  JitCompiler jit(llvm::InlineAsm::AD_ATT, kGenericMcpu,
+                  JitCompiler::EXIT_ON_ERROR);
+  EXPECT_EQ(jit.code_page_backing(), REGULAR_PAGES);
+  jit.SetHugePagePolicy(PREFER_HUGE_PAGES);
+  // The batch API compiles several functions into the same arena.
+  InlineAsmFunctionCode code;
+  code.num_iterations = 10;
+  code.loop_code = "mov %ebx, %eax";
+  code.loop_constraints = "~{ebx},~{eax}";
+  const std::vector<VoidFunction> functions =
+      jit.CompileInlineAssemblyToFunctions({code, code});
+  ASSERT_EQ(functions.size(), 2);
+  for (const VoidFunction& function : functions) {
+    ASSERT_TRUE(function.IsValid());
+    function.CallOrDie();
+  }
+  // The backing depends on the configuration of the host.
+  LOG(INFO) << "Code pages: " << PageBackingName(jit.code_page_backing());
+}
+
 }  // namespace
 }  // namespace cpu_instructions
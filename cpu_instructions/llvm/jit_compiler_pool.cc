@@ -0,0 +1,74 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/llvm/jit_compiler_pool.h"
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include "cpu_instructions/llvm/llvm_utils.h"
+#include "glog/logging.h"
+
+namespace cpu_instructions {
+
+JitCompilerPool::JitCompilerPool(llvm::InlineAsm::AsmDialect dialect,
+                                 const string& mcpu,
+                                 JitCompiler::ErrorHandlingMode error_mode,
+                                 int num_threads)
+    : dialect_(dialect), mcpu_(mcpu), error_mode_(error_mode) {
+  CHECK_GE(num_threads, 0);
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  // The global initialization of LLVM is the only step shared by all the
+  // compilers; do it before starting the workers.
+  EnsureLLVMWasInitialized();
+  workers_.reserve(num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(&JitCompilerPool::RunWorker, this);
+  }
+}
+
+JitCompilerPool::~JitCompilerPool() {
+  queue_.Stop();
+  for (std::thread& worker : workers_) worker.join();
+}
+
+std::future<VoidFunction> JitCompilerPool::CompileInlineAssemblyToFunction(
+    const InlineAsmFunctionCode& code) {
+  return queue_.SubmitWithResult<VoidFunction>([code](JitCompiler* jit) {
+    return jit->CompileInlineAssemblyToFunctions({code}).front();
+  });
+}
+
+std::future<std::vector<VoidFunction>>
+JitCompilerPool::CompileInlineAssemblyToFunctions(
+    std::vector<InlineAsmFunctionCode> functions) {
+  const auto shared_functions =
+      std::make_shared<std::vector<InlineAsmFunctionCode>>(
+          std::move(functions));
+  return queue_.SubmitWithResult<std::vector<VoidFunction>>(
+      [shared_functions](JitCompiler* jit) {
+        return jit->CompileInlineAssemblyToFunctions(*shared_functions);
+      });
+}
+
+void JitCompilerPool::RunWorker() {
+  // The compiler is created and used only by this thread.
+  JitCompiler jit(dialect_, mcpu_, error_mode_);
+  queue_.Run(&jit);
+}
+
+}  // namespace cpu_instructions
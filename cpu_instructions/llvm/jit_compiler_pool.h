@@ -0,0 +1,90 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A pool of worker threads that compile inline assembly in the background.
+// Each worker owns its own JitCompiler, and thus its own LLVM context and
+// execution engine, so the workers never share any mutable LLVM state. A
+// measurement driver can use the pool to compile the next batch of code while
+// the current batch is being measured.
+
+#ifndef CPU_INSTRUCTIONS_LLVM_JIT_COMPILER_POOL_H_
+#define CPU_INSTRUCTIONS_LLVM_JIT_COMPILER_POOL_H_
+
+#include <future>
+#include <thread>
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/llvm/inline_asm.h"
+#include "cpu_instructions/util/work_queue.h"
+#include "llvm/IR/InlineAsm.h"
+
+namespace cpu_instructions {
+
+// The compilation requests are processed in the order in which they were
+// submitted, by the first available worker. The compiled functions are owned
+// by the JitCompiler of the worker that compiled them, and they remain valid
+// until the pool is destroyed. The functions may be called from any thread.
+// All public methods are thread-safe.
+class JitCompilerPool {
+ public:
+  // Creates a pool with 'num_threads' workers; when 'num_threads' is zero, the
+  // number of hardware threads is used. The JitCompiler of each worker is
+  // created with 'dialect', 'mcpu' and 'error_mode'; see the documentation of
+  // JitCompiler for their meaning.
+  JitCompilerPool(llvm::InlineAsm::AsmDialect dialect, const string& mcpu,
+                  JitCompiler::ErrorHandlingMode error_mode, int num_threads);
+
+  // Waits until all submitted requests are compiled, and stops the workers.
+  // Invalidates all functions compiled by the pool.
+  ~JitCompilerPool();
+
+  JitCompilerPool(const JitCompilerPool&) = delete;
+  JitCompilerPool& operator=(const JitCompilerPool&) = delete;
+
+  // Submits the function 'code' for compilation. The returned future becomes
+  // ready when the function is compiled. If the code could not be compiled and
+  // the pool uses RETURN_NULLPTR_ON_ERROR, the value of the future is
+  // VoidFunction::Undefined().
+  std::future<VoidFunction> CompileInlineAssemblyToFunction(
+      const InlineAsmFunctionCode& code);
+
+  // Submits a batch of functions for compilation. The batch is compiled by a
+  // single worker using JitCompiler::CompileInlineAssemblyToFunctions.
+  std::future<std::vector<VoidFunction>> CompileInlineAssemblyToFunctions(
+      std::vector<InlineAsmFunctionCode> functions);
+
+  // Returns the number of worker threads.
+  int num_threads() const { return workers_.size(); }
+
+ private:
+  // The main loop of a worker thread. Creates the JitCompiler of the worker,
+  // and runs the tasks from the queue until the pool is stopped and the queue
+  // is empty.
+  void RunWorker();
+
+  const llvm::InlineAsm::AsmDialect dialect_;
+  const string mcpu_;
+  const JitCompiler::ErrorHandlingMode error_mode_;
+
+  // The compilation requests. The workers pass their JitCompiler to the
+  // tasks.
+  WorkQueue<JitCompiler*> queue_;
+
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_LLVM_JIT_COMPILER_POOL_H_
@@ -0,0 +1,78 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/llvm/jit_compiler_pool.h"
+
+#include <future>
+#include <vector>
+#include "strings/string.h"
+
+#include "gtest/gtest.h"
+#include "llvm/IR/InlineAsm.h"
+
+namespace cpu_instructions {
+namespace {
+
+constexpr const char kGenericMcpu[] = "generic";
+
+InlineAsmFunctionCode MakeFunctionCode(const string& loop_code) {
+  InlineAsmFunctionCode code;
+  code.num_iterations = 10;
+  code.loop_code = loop_code;
+  code.loop_constraints = "~{eax},~{ebx}";
+  return code;
+}
+
+TEST(JitCompilerPoolTest, CompilesFunctionsConcurrently) {
+  constexpr int kNumFunctions = 20;
+  JitCompilerPool pool(llvm::InlineAsm::AD_ATT, kGenericMcpu,
+                       JitCompiler::EXIT_ON_ERROR, 4);
+  EXPECT_EQ(pool.num_threads(), 4);
+  std::vector<std::future<VoidFunction>> futures;
+  for (int i = 0; i < kNumFunctions; ++i) {
+    futures.push_back(pool.CompileInlineAssemblyToFunction(
+        MakeFunctionCode(i % 2 == 0 ? "mov %ebx, %eax" : "add %ebx, %eax")));
+  }
+  for (std::future<VoidFunction>& future : futures) {
+    const VoidFunction function = future.get();
+    ASSERT_TRUE(function.IsValid());
+    EXPECT_GT(function.size, 0);
+    function.CallOrDie();
+  }
+}
+
+TEST(JitCompilerPoolTest, CompilesBatches) {
+  JitCompilerPool pool(llvm::InlineAsm::AD_ATT, kGenericMcpu,
+                       JitCompiler::RETURN_NULLPTR_ON_ERROR, 2);
+  std::future<std::vector<VoidFunction>> valid_batch =
+      pool.CompileInlineAssemblyToFunctions(
+          {MakeFunctionCode("mov %ebx, %eax"),
+           MakeFunctionCode("add %ebx, %eax")});
+  std::future<std::vector<VoidFunction>> invalid_batch =
+      pool.CompileInlineAssemblyToFunctions(
+          {MakeFunctionCode("this is not an instruction")});
+
+  const std::vector<VoidFunction> valid_functions = valid_batch.get();
+  ASSERT_EQ(valid_functions.size(), 2);
+  for (const VoidFunction& function : valid_functions) {
+    ASSERT_TRUE(function.IsValid());
+    function.CallOrDie();
+  }
+  const std::vector<VoidFunction> invalid_functions = invalid_batch.get();
+  ASSERT_EQ(invalid_functions.size(), 1);
+  EXPECT_FALSE(invalid_functions[0].IsValid());
+}
+
+}  // namespace
+}  // namespace cpu_instructions
@@ -0,0 +1,156 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/llvm/object_cache.h"
+
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <system_error>
+#include <unordered_map>
+#include "strings/string.h"
+
+#include "glog/logging.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/ErrorOr.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/raw_ostream.h"
+#include "strings/str_cat.h"
+
+namespace cpu_instructions {
+namespace {
+
+// The version of the format of the cache. Must be incremented whenever the
+// computation of the keys or the contents of the files change.
+constexpr char kCacheFormatVersion[] = "1";
+
+// Returns the IR of 'module' in the text format, without the lines that depend
+// on the identifier of the module.
+string GetModuleIRWithoutIdentifier(const llvm::Module* module) {
+  string ir;
+  llvm::raw_string_ostream ir_stream(ir);
+  module->print(ir_stream, nullptr);
+  ir_stream.flush();
+  string result;
+  result.reserve(ir.size());
+  size_t line_start = 0;
+  while (line_start < ir.size()) {
+    size_t line_end = ir.find('\n', line_start);
+    line_end = line_end == string::npos ? ir.size() : line_end + 1;
+    const llvm::StringRef line(ir.data() + line_start, line_end - line_start);
+    if (!line.startswith("; ModuleID") && !line.startswith("source_filename")) {
+      result.append(line.data(), line.size());
+    }
+    line_start = line_end;
+  }
+  return result;
+}
+
+}  // namespace
+
+ObjectFileCache::ObjectFileCache(const string& directory,
+                                 const string& key_prefix)
+    : directory_(directory), key_prefix_(key_prefix) {
+  const std::error_code error = llvm::sys::fs::create_directories(directory_);
+  if (error) {
+    LOG(WARNING) << "Could not create the object cache directory '"
+                 << directory_ << "': " << error.message()
+                 << ". The object cache is disabled.";
+    enabled_ = false;
+  }
+}
+
+string ObjectFileCache::GetModuleKey(const llvm::Module* module) const {
+  CHECK(module != nullptr);
+  llvm::MD5 hash;
+  // The fields are separated by a zero byte to avoid collisions between
+  // different splits of the same string.
+  constexpr uint8_t kSeparator = 0;
+  const auto add_field = [&hash, &kSeparator](const string& field) {
+    hash.update(field);
+    hash.update(llvm::makeArrayRef(&kSeparator, 1));
+  };
+  add_field(kCacheFormatVersion);
+  add_field(LLVM_VERSION_STRING);
+  add_field(llvm::sys::getProcessTriple());
+  add_field(key_prefix_);
+  add_field(GetModuleIRWithoutIdentifier(module));
+  llvm::MD5::MD5Result result;
+  hash.final(result);
+  llvm::SmallString<32> key;
+  llvm::MD5::stringifyResult(result, key);
+  return key.str().str();
+}
+
+string ObjectFileCache::GetObjectFilePath(const llvm::Module* module) {
+  // MCJIT runs the code generation passes between the calls to getObject and
+  // notifyObjectCompiled, and these passes modify the IR of the module. The key
+  // is computed only once, before the module is compiled.
+  string& key = module_keys_[module];
+  if (key.empty()) key = GetModuleKey(module);
+  return StrCat(directory_, "/", key, ".o");
+}
+
+void ObjectFileCache::RemoveObject(const llvm::Module* module) {
+  if (!enabled_) return;
+  std::remove(GetObjectFilePath(module).c_str());
+}
+
+void ObjectFileCache::notifyObjectCompiled(const llvm::Module* module,
+                                           llvm::MemoryBufferRef object) {
+  if (!enabled_) return;
+  const string path = GetObjectFilePath(module);
+  // Write the object to a temporary file first, and then move it to its final
+  // location. Another process reading the cache at the same time thus never
+  // sees an incomplete file.
+  const string temp_path =
+      StrCat(path, ".tmp.", getpid(), ".", reinterpret_cast<uintptr_t>(this));
+  FILE* const output_file = fopen(temp_path.c_str(), "wb");
+  if (output_file == nullptr) {
+    LOG(WARNING) << "Could not open '" << temp_path << "' for writing";
+    return;
+  }
+  const size_t object_size = object.getBufferSize();
+  const bool write_succeeded =
+      fwrite(object.getBufferStart(), 1, object_size, output_file) ==
+      object_size;
+  if (fclose(output_file) != 0 || !write_succeeded ||
+      std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    LOG(WARNING) << "Could not write the object to '" << path << "'";
+    std::remove(temp_path.c_str());
+  }
+}
+
+std::unique_ptr<llvm::MemoryBuffer> ObjectFileCache::getObject(
+    const llvm::Module* module) {
+  if (!enabled_) return nullptr;
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> object =
+      llvm::MemoryBuffer::getFile(GetObjectFilePath(module));
+  if (!object) {
+    ++num_misses_;
+    return nullptr;
+  }
+  ++num_hits_;
+  // MCJIT takes the ownership of the buffer, and it might keep it after the
+  // file is removed; copy the contents rather than keeping the file mapped.
+  return llvm::MemoryBuffer::getMemBufferCopy((*object)->getBuffer(),
+                                              module->getModuleIdentifier());
+}
+
+}  // namespace cpu_instructions
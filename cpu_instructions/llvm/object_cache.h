@@ -0,0 +1,94 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An implementation of llvm::ObjectCache that stores the object code compiled
+// by MCJIT in files on the disk, so that it can be reused by later runs of the
+// same program.
+
+#ifndef CPU_INSTRUCTIONS_LLVM_OBJECT_CACHE_H_
+#define CPU_INSTRUCTIONS_LLVM_OBJECT_CACHE_H_
+
+#include <memory>
+#include <unordered_map>
+#include "strings/string.h"
+
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace cpu_instructions {
+
+// An object cache that stores the compiled modules in the directory
+// 'directory'. The objects are keyed by a hash of the textual LLVM IR of the
+// module, of 'key_prefix' and of the version of LLVM. The identifier of the
+// module is not a part of the key. The key prefix must contain everything that
+// affects code generation but is not stored in the IR, e.g. the CPU model
+// used by the code generator.
+//
+// Note that the names of the functions in the module are a part of the IR, and
+// thus of the key. JitCompiler names the functions after their contents, so
+// the cached objects are reused whenever the program compiles the same
+// snippets, regardless of their order.
+//
+// The files are written atomically, so the directory can be shared by several
+// processes running at the same time. The class is not thread-safe; use one
+// instance per JitCompiler.
+class ObjectFileCache : public llvm::ObjectCache {
+ public:
+  // Creates the cache. Creates 'directory' if it does not exist; if this is
+  // not possible, the cache is disabled and all lookups are misses.
+  ObjectFileCache(const string& directory, const string& key_prefix);
+
+  // Returns the key used for 'module' in the cache.
+  string GetModuleKey(const llvm::Module* module) const;
+
+  // Removes the object for 'module' from the cache. Used when the compilation
+  // of the module failed, e.g. because of an error in the inline assembly. The
+  // module must have been seen by getObject before.
+  void RemoveObject(const llvm::Module* module);
+
+  // Forgets the keys of all modules seen by the cache. Must be called when the
+  // modules are destroyed, so that their addresses can be reused by new
+  // modules.
+  void ForgetAllModules() { module_keys_.clear(); }
+
+  // The number of calls to getObject that found (resp. did not find) the
+  // object in the cache.
+  int num_hits() const { return num_hits_; }
+  int num_misses() const { return num_misses_; }
+
+  // llvm::ObjectCache implementation.
+  void notifyObjectCompiled(const llvm::Module* module,
+                            llvm::MemoryBufferRef object) override;
+  std::unique_ptr<llvm::MemoryBuffer> getObject(
+      const llvm::Module* module) override;
+
+ private:
+  // Returns the path of the file that stores the object for 'module'.
+  string GetObjectFilePath(const llvm::Module* module);
+
+  const string directory_;
+  const string key_prefix_;
+  bool enabled_ = true;
+
+  // The keys of the modules seen by the cache.
+  std::unordered_map<const llvm::Module*, string> module_keys_;
+
+  int num_hits_ = 0;
+  int num_misses_ = 0;
+};
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_LLVM_OBJECT_CACHE_H_
@@ -0,0 +1,141 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/llvm/object_cache.h"
+
+#include <cstdlib>
+#include "strings/string.h"
+
+#include "cpu_instructions/llvm/inline_asm.h"
+#include "gtest/gtest.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+#include "strings/str_cat.h"
+
+namespace cpu_instructions {
+namespace {
+
+constexpr const char kGenericMcpu[] = "generic";
+
+string GetCacheDirectory(const string& test_name) {
+  return StrCat(getenv("TEST_TMPDIR"), "/object_cache_", test_name);
+}
+
+TEST(ObjectFileCacheTest, KeyDoesNotDependOnModuleIdentifier) {
+  llvm::LLVMContext context;
+  llvm::Module module_a("module_a", context);
+  llvm::Module module_b("module_b", context);
+  llvm::FunctionType* const function_type =
+      llvm::FunctionType::get(llvm::Type::getVoidTy(context), false);
+  llvm::Function::Create(function_type, llvm::Function::ExternalLinkage,
+                         "function", &module_a);
+  llvm::Function::Create(function_type, llvm::Function::ExternalLinkage,
+                         "function", &module_b);
+  llvm::Module module_c("module_c", context);
+  llvm::Function::Create(function_type, llvm::Function::ExternalLinkage,
+                         "another_function", &module_c);
+
+  const ObjectFileCache cache(GetCacheDirectory("keys"), "mcpu=generic");
+  const ObjectFileCache other_cpu_cache(GetCacheDirectory("keys"),
+                                        "mcpu=haswell");
+  EXPECT_EQ(cache.GetModuleKey(&module_a), cache.GetModuleKey(&module_b));
+  EXPECT_NE(cache.GetModuleKey(&module_a), cache.GetModuleKey(&module_c));
+  EXPECT_NE(cache.GetModuleKey(&module_a),
+            other_cpu_cache.GetModuleKey(&module_a));
+}
+
+TEST(ObjectFileCacheTest, ReusesObjectsAcrossCompilers) {
+  constexpr char kLoopCode[] = "mov %ebx, %eax";
+  constexpr char kLoopConstraints[] = "~{ebx},~{eax}";
+  const string cache_directory = GetCacheDirectory("reuse");
+
+  JitCompiler first_jit(llvm::InlineAsm::AD_ATT, kGenericMcpu,
+                        JitCompiler::EXIT_ON_ERROR);
+  first_jit.EnableObjectCache(cache_directory);
+  const VoidFunction first_function = first_jit.CompileInlineAssemblyToFunction(
+      10, kLoopCode, kLoopConstraints);
+  ASSERT_TRUE(first_function.IsValid());
+  EXPECT_EQ(first_jit.object_cache()->num_hits(), 0);
+  EXPECT_EQ(first_jit.object_cache()->num_misses(), 1);
+
+  // A new compiler compiles the same code into the same module, and it gets
+  // the object from the cache.
+  JitCompiler second_jit(llvm::InlineAsm::AD_ATT, kGenericMcpu,
+                         JitCompiler::EXIT_ON_ERROR);
+  second_jit.EnableObjectCache(cache_directory);
+  const VoidFunction second_function =
+      second_jit.CompileInlineAssemblyToFunction(10, kLoopCode,
+                                                 kLoopConstraints);
+  ASSERT_TRUE(second_function.IsValid());
+  EXPECT_EQ(second_jit.object_cache()->num_hits(), 1);
+  EXPECT_EQ(second_jit.object_cache()->num_misses(), 0);
+  ASSERT_EQ(first_function.size, second_function.size);
+  EXPECT_EQ(string(reinterpret_cast<const char*>(first_function.ptr),
+                   first_function.size),
+            string(reinterpret_cast<const char*>(second_function.ptr),
+                   second_function.size));
+  second_function.CallOrDie();
+}
+
+TEST(ObjectFileCacheTest, KeyDoesNotDependOnTheOrderOfCompilation) {
+  constexpr char kFirstLoopCode[] = "mov %ebx, %eax";
+  constexpr char kSecondLoopCode[] = "mov %ecx, %eax";
+  constexpr char kLoopConstraints[] = "~{ebx},~{ecx},~{eax}";
+  const string cache_directory = GetCacheDirectory("order");
+
+  JitCompiler first_jit(llvm::InlineAsm::AD_ATT, kGenericMcpu,
+                        JitCompiler::EXIT_ON_ERROR);
+  first_jit.EnableObjectCache(cache_directory);
+  ASSERT_TRUE(first_jit
+                  .CompileInlineAssemblyToFunction(10, kFirstLoopCode,
+                                                   kLoopConstraints)
+                  .IsValid());
+  ASSERT_TRUE(first_jit
+                  .CompileInlineAssemblyToFunction(10, kSecondLoopCode,
+                                                   kLoopConstraints)
+                  .IsValid());
+  EXPECT_EQ(first_jit.object_cache()->num_misses(), 2);
+
+  // The second snippet is now the first function compiled by the compiler, but
+  // it still gets the object from the cache.
+  JitCompiler second_jit(llvm::InlineAsm::AD_ATT, kGenericMcpu,
+                         JitCompiler::EXIT_ON_ERROR);
+  second_jit.EnableObjectCache(cache_directory);
+  const VoidFunction function = second_jit.CompileInlineAssemblyToFunction(
+      10, kSecondLoopCode, kLoopConstraints);
+  ASSERT_TRUE(function.IsValid());
+  EXPECT_EQ(second_jit.object_cache()->num_hits(), 1);
+  EXPECT_EQ(second_jit.object_cache()->num_misses(), 0);
+  function.CallOrDie();
+}
+
+TEST(ObjectFileCacheTest, DoesNotStoreFailedCompilations) {
+  constexpr char kInvalidCode[] = "this is not an instruction";
+  const string cache_directory = GetCacheDirectory("failures");
+  for (int i = 0; i < 2; ++i) {
+    JitCompiler jit(llvm::InlineAsm::AD_ATT, kGenericMcpu,
+                    JitCompiler::RETURN_NULLPTR_ON_ERROR);
+    jit.EnableObjectCache(cache_directory);
+    const VoidFunction function =
+        jit.CompileInlineAssemblyToFunction(1, kInvalidCode, "");
+    EXPECT_FALSE(function.IsValid());
+    EXPECT_EQ(jit.object_cache()->num_hits(), 0);
+  }
+}
+
+}  // namespace
+}  // namespace cpu_instructions
@@ -0,0 +1,152 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the latency of compiling measurement snippets with JitCompiler
+// (LLVM IR with inline assembly, compiled by MCJIT) and with DirectAssembler
+// (assembly parsed and encoded directly by the LLVM MC layer).
+//
+// Each instruction from the instruction set is instantiated with
+// x86::InstantiateOperands and repeated in a loop, and the loop is compiled by
+// both paths. The tool reports the distribution of the per-snippet compilation
+// latencies, computed only from the snippets accepted by both paths.
+// Usage:
+// bazel run -c opt \
+// cpu_instructions/tools:assembler_latency_benchmark -- \
+// --cpu_instructions_input_file=/path/to/instructions.pbtxt
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "strings/string.h"
+
+#include "gflags/gflags.h"
+
+#include "cpu_instructions/llvm/direct_assembler.h"
+#include "cpu_instructions/llvm/inline_asm.h"
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "cpu_instructions/util/instruction_syntax.h"
+#include "cpu_instructions/util/proto_util.h"
+#include "cpu_instructions/x86/operand_translator.h"
+#include "glog/logging.h"
+#include "llvm/IR/InlineAsm.h"
+#include "strings/str_cat.h"
+
+DEFINE_string(cpu_instructions_input_file, "",
+              "The instruction set in the text format.");
+DEFINE_string(cpu_instructions_mcpu, "skylake-avx512",
+              "The CPU model used by LLVM when assembling the instructions.");
+DEFINE_int32(cpu_instructions_num_repetitions, 100,
+             "The number of copies of the instruction in the loop body.");
+DEFINE_int32(cpu_instructions_max_snippets, 0,
+             "The maximal number of snippets compiled by each path. When "
+             "zero, all instructions from the instruction set are used.");
+
+namespace cpu_instructions {
+namespace x86 {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kNumLoopIterations = 10;
+
+double MicrosecondsSince(const Clock::time_point& start_time) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start_time)
+      .count();
+}
+
+// Prints the statistics of 'latencies' (in microseconds) under 'name'.
+void PrintLatencies(const char* name, std::vector<double> latencies) {
+  CHECK(!latencies.empty());
+  std::sort(latencies.begin(), latencies.end());
+  double total = 0.0;
+  for (const double latency : latencies) total += latency;
+  const auto percentile = [&latencies](double fraction) {
+    return latencies[static_cast<size_t>(fraction * (latencies.size() - 1))];
+  };
+  printf("%-18s mean %9.1f us  median %9.1f us  p90 %9.1f us  max %9.1f us\n",
+         name, total / latencies.size(), percentile(0.5), percentile(0.9),
+         latencies.back());
+}
+
+void Main() {
+  CHECK(!FLAGS_cpu_instructions_input_file.empty())
+      << "missing --cpu_instructions_input_file";
+  const InstructionSetProto instruction_set =
+      ReadTextProtoOrDie<InstructionSetProto>(
+          FLAGS_cpu_instructions_input_file);
+
+  JitCompiler jit(llvm::InlineAsm::AD_Intel, FLAGS_cpu_instructions_mcpu,
+                  JitCompiler::RETURN_NULLPTR_ON_ERROR);
+  DirectAssembler assembler(llvm::InlineAsm::AD_Intel,
+                            FLAGS_cpu_instructions_mcpu);
+
+  std::vector<double> jit_latencies;
+  std::vector<double> direct_latencies;
+  int num_snippets = 0;
+  int num_jit_failures = 0;
+  int num_direct_failures = 0;
+  for (const InstructionProto& instruction : instruction_set.instructions()) {
+    if (FLAGS_cpu_instructions_max_snippets > 0 &&
+        num_snippets >= FLAGS_cpu_instructions_max_snippets) {
+      break;
+    }
+    ++num_snippets;
+    const string code = StrCat(
+        ".rept ", FLAGS_cpu_instructions_num_repetitions, "\n",
+        ConvertToCodeString(InstantiateOperands(instruction)), "\n.endr");
+
+    const Clock::time_point jit_start_time = Clock::now();
+    const VoidFunction jit_function =
+        jit.CompileInlineAssemblyToFunction(kNumLoopIterations, code, "");
+    const double jit_latency = MicrosecondsSince(jit_start_time);
+
+    const Clock::time_point direct_start_time = Clock::now();
+    const VoidFunction direct_function =
+        assembler.AssembleToFunction(kNumLoopIterations, "", code, "");
+    const double direct_latency = MicrosecondsSince(direct_start_time);
+
+    if (!jit_function.IsValid()) ++num_jit_failures;
+    if (!direct_function.IsValid()) ++num_direct_failures;
+    if (jit_function.IsValid() && direct_function.IsValid()) {
+      jit_latencies.push_back(jit_latency);
+      direct_latencies.push_back(direct_latency);
+    }
+  }
+
+  printf("Snippets:                     %d\n", num_snippets);
+  printf("Failed (JitCompiler):         %d\n", num_jit_failures);
+  printf("Failed (DirectAssembler):     %d\n", num_direct_failures);
+  printf("Compiled by both:             %zu\n", jit_latencies.size());
+  if (jit_latencies.empty()) return;
+  PrintLatencies("JitCompiler", jit_latencies);
+  PrintLatencies("DirectAssembler", direct_latencies);
+  double jit_total = 0.0;
+  double direct_total = 0.0;
+  for (int i = 0; i < jit_latencies.size(); ++i) {
+    jit_total += jit_latencies[i];
+    direct_total += direct_latencies[i];
+  }
+  printf("Speedup:                      %.2fx\n", jit_total / direct_total);
+}
+
+}  // namespace
+}  // namespace x86
+}  // namespace cpu_instructions
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  ::cpu_instructions::x86::Main();
+  return 0;
+}
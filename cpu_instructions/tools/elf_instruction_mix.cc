@@ -0,0 +1,323 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Disassembles the executable sections of an x86-64 ELF file using the
+// instruction database, and prints the histograms of the instructions by their
+// mnemonic, feature name and encoding scheme.
+// Usage:
+// bazel run -c opt \
+// cpu_instructions/tools:elf_instruction_mix -- \
+// --cpu_instructions_input_file=/path/to/instructions.pbtxt \
+// --cpu_instructions_elf_file=/path/to/binary
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "strings/string.h"
+
+#include "gflags/gflags.h"
+
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "cpu_instructions/util/proto_util.h"
+#include "cpu_instructions/x86/instruction_decoder.h"
+#include "glog/logging.h"
+
+DEFINE_string(cpu_instructions_input_file, "",
+              "The instruction set in the text format, with the x86 encoding "
+              "specifications already parsed.");
+DEFINE_string(cpu_instructions_elf_file, "",
+              "The x86-64 ELF file to disassemble.");
+DEFINE_int32(cpu_instructions_num_threads, 0,
+             "The number of decoding threads. When zero, the number of "
+             "hardware threads is used.");
+DEFINE_int32(cpu_instructions_min_chunk_size_bytes, 64 * 1024,
+             "The minimal size of a chunk of code decoded by one thread. The "
+             "chunks are split only at the beginnings of functions.");
+
+namespace cpu_instructions {
+namespace x86 {
+namespace {
+
+// A read-only memory mapping of a file.
+class MappedFile {
+ public:
+  explicit MappedFile(const string& filename) {
+    const int fd = open(filename.c_str(), O_RDONLY);
+    PCHECK(fd >= 0) << "Could not open '" << filename << "'";
+    struct stat file_stat;
+    PCHECK(fstat(fd, &file_stat) == 0);
+    size_ = file_stat.st_size;
+    CHECK_GT(size_, 0) << "The file '" << filename << "' is empty";
+    void* const data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    PCHECK(data != MAP_FAILED) << "Could not map '" << filename << "'";
+    close(fd);
+    data_ = static_cast<const uint8_t*>(data);
+  }
+  ~MappedFile() { munmap(const_cast<uint8_t*>(data_), size_); }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// A contiguous block of code that is decoded by a single thread. All chunks
+// start at an instruction boundary: the beginning of a section or of a
+// function.
+struct CodeChunk {
+  const uint8_t* begin;
+  size_t size;
+};
+
+// Returns the section headers of the ELF file; checks that the file is a
+// 64-bit little-endian x86-64 ELF file.
+const Elf64_Shdr* GetSectionHeaders(const MappedFile& file,
+                                    int* num_sections) {
+  CHECK_GE(file.size(), sizeof(Elf64_Ehdr)) << "The file is not an ELF file";
+  const Elf64_Ehdr* const header =
+      reinterpret_cast<const Elf64_Ehdr*>(file.data());
+  CHECK(std::equal(header->e_ident, header->e_ident + SELFMAG, ELFMAG))
+      << "The file is not an ELF file";
+  CHECK_EQ(header->e_ident[EI_CLASS], ELFCLASS64)
+      << "Only 64-bit ELF files are supported";
+  CHECK_EQ(header->e_ident[EI_DATA], ELFDATA2LSB)
+      << "Only little-endian ELF files are supported";
+  CHECK_EQ(header->e_machine, EM_X86_64) << "The file is not an x86-64 file";
+  CHECK_EQ(header->e_shentsize, sizeof(Elf64_Shdr));
+  CHECK_LE(header->e_shoff + header->e_shnum * sizeof(Elf64_Shdr),
+           file.size());
+  *num_sections = header->e_shnum;
+  return reinterpret_cast<const Elf64_Shdr*>(file.data() + header->e_shoff);
+}
+
+// Splits the executable sections of the ELF file into chunks of at least
+// 'min_chunk_size' bytes. The chunks are split at the addresses of the function
+// symbols from the static and the dynamic symbol tables; sections without any
+// function symbols are decoded as a single chunk.
+std::vector<CodeChunk> GetCodeChunks(const MappedFile& file,
+                                     size_t min_chunk_size) {
+  int num_sections = 0;
+  const Elf64_Shdr* const sections = GetSectionHeaders(file, &num_sections);
+
+  // Collect the function start addresses by section.
+  std::map<int, std::vector<Elf64_Addr>> function_addresses;
+  for (int i = 0; i < num_sections; ++i) {
+    const Elf64_Shdr& section = sections[i];
+    if (section.sh_type != SHT_SYMTAB && section.sh_type != SHT_DYNSYM) {
+      continue;
+    }
+    CHECK_LE(section.sh_offset + section.sh_size, file.size());
+    const Elf64_Sym* const symbols =
+        reinterpret_cast<const Elf64_Sym*>(file.data() + section.sh_offset);
+    const int num_symbols = section.sh_size / sizeof(Elf64_Sym);
+    for (int symbol = 0; symbol < num_symbols; ++symbol) {
+      const Elf64_Sym& elf_symbol = symbols[symbol];
+      if (ELF64_ST_TYPE(elf_symbol.st_info) != STT_FUNC) continue;
+      if (elf_symbol.st_shndx == SHN_UNDEF ||
+          elf_symbol.st_shndx >= num_sections) {
+        continue;
+      }
+      function_addresses[elf_symbol.st_shndx].push_back(elf_symbol.st_value);
+    }
+  }
+
+  std::vector<CodeChunk> chunks;
+  for (int i = 0; i < num_sections; ++i) {
+    const Elf64_Shdr& section = sections[i];
+    if (section.sh_type != SHT_PROGBITS || !(section.sh_flags & SHF_EXECINSTR))
+      continue;
+    CHECK_LE(section.sh_offset + section.sh_size, file.size());
+    const uint8_t* const section_data = file.data() + section.sh_offset;
+
+    // The offsets of the instruction boundaries in the section.
+    std::vector<size_t> boundaries = {0};
+    for (const Elf64_Addr address : function_addresses[i]) {
+      if (address > section.sh_addr &&
+          address < section.sh_addr + section.sh_size) {
+        boundaries.push_back(address - section.sh_addr);
+      }
+    }
+    std::sort(boundaries.begin(), boundaries.end());
+    boundaries.erase(std::unique(boundaries.begin(), boundaries.end()),
+                     boundaries.end());
+    boundaries.push_back(section.sh_size);
+
+    size_t chunk_begin = 0;
+    for (int boundary = 1; boundary < boundaries.size(); ++boundary) {
+      const size_t chunk_end = boundaries[boundary];
+      if (chunk_end - chunk_begin >= min_chunk_size ||
+          boundary == boundaries.size() - 1) {
+        chunks.push_back({section_data + chunk_begin, chunk_end - chunk_begin});
+        chunk_begin = chunk_end;
+      }
+    }
+  }
+  return chunks;
+}
+
+// Decoding statistics collected by a single thread.
+struct DecodingStats {
+  explicit DecodingStats(int num_instructions)
+      : instruction_counts(num_instructions, 0) {}
+
+  void Accumulate(const DecodingStats& other) {
+    for (int i = 0; i < instruction_counts.size(); ++i) {
+      instruction_counts[i] += other.instruction_counts[i];
+    }
+    num_decoded_bytes += other.num_decoded_bytes;
+    num_undecoded_bytes += other.num_undecoded_bytes;
+  }
+
+  // The number of occurrences of each instruction of the instruction set.
+  std::vector<int64_t> instruction_counts;
+  int64_t num_decoded_bytes = 0;
+  // Bytes that could not be decoded are skipped one by one. These are typically
+  // padding between functions, data in the code sections or instructions that
+  // are not in the database.
+  int64_t num_undecoded_bytes = 0;
+};
+
+void DecodeChunk(const InstructionDecoder& decoder, const CodeChunk& chunk,
+                 DecodingStats* stats) {
+  size_t position = 0;
+  DecodedInstruction instruction;
+  while (position < chunk.size) {
+    if (decoder.DecodeInstruction(chunk.begin + position,
+                                  chunk.size - position, &instruction)) {
+      ++stats->instruction_counts[instruction.instruction_index];
+      stats->num_decoded_bytes += instruction.length_bytes;
+      position += instruction.length_bytes;
+    } else {
+      ++stats->num_undecoded_bytes;
+      ++position;
+    }
+  }
+}
+
+void PrintHistogram(const string& title,
+                    const std::map<string, int64_t>& histogram) {
+  std::vector<std::pair<int64_t, string>> sorted_histogram;
+  int64_t total = 0;
+  for (const auto& bucket : histogram) {
+    sorted_histogram.emplace_back(bucket.second, bucket.first);
+    total += bucket.second;
+  }
+  std::sort(sorted_histogram.rbegin(), sorted_histogram.rend());
+  printf("%s:\n", title.c_str());
+  for (const auto& bucket : sorted_histogram) {
+    printf("  %-24s %12lld %6.2f%%\n",
+           bucket.second.empty() ? "<none>" : bucket.second.c_str(),
+           static_cast<long long>(bucket.first),
+           total > 0 ? 100.0 * bucket.first / total : 0.0);
+  }
+}
+
+void Main() {
+  CHECK(!FLAGS_cpu_instructions_input_file.empty())
+      << "missing --cpu_instructions_input_file";
+  CHECK(!FLAGS_cpu_instructions_elf_file.empty())
+      << "missing --cpu_instructions_elf_file";
+  CHECK_GT(FLAGS_cpu_instructions_min_chunk_size_bytes, 0);
+  const InstructionSetProto instruction_set =
+      ReadTextProtoOrDie<InstructionSetProto>(
+          FLAGS_cpu_instructions_input_file);
+  const InstructionDecoder decoder(instruction_set);
+
+  const MappedFile file(FLAGS_cpu_instructions_elf_file);
+  const std::vector<CodeChunk> chunks =
+      GetCodeChunks(file, FLAGS_cpu_instructions_min_chunk_size_bytes);
+  int64_t num_code_bytes = 0;
+  for (const CodeChunk& chunk : chunks) num_code_bytes += chunk.size;
+
+  int num_threads = FLAGS_cpu_instructions_num_threads;
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  num_threads = std::min<int>(num_threads, std::max<size_t>(1, chunks.size()));
+  LOG(INFO) << "Decoding " << num_code_bytes << " bytes in " << chunks.size()
+            << " chunks using " << num_threads << " threads";
+
+  // The threads take the chunks from a shared counter, so that a few large
+  // functions do not leave the other threads idle.
+  std::vector<DecodingStats> thread_stats(
+      num_threads, DecodingStats(instruction_set.instructions_size()));
+  std::atomic<int> next_chunk(0);
+  const auto start_time = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < num_threads; ++thread) {
+    threads.emplace_back([&, thread]() {
+      for (int chunk = next_chunk++; chunk < chunks.size();
+           chunk = next_chunk++) {
+        DecodeChunk(decoder, chunks[chunk], &thread_stats[thread]);
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start_time)
+                             .count();
+
+  DecodingStats stats(instruction_set.instructions_size());
+  for (const DecodingStats& single_thread_stats : thread_stats) {
+    stats.Accumulate(single_thread_stats);
+  }
+  std::map<string, int64_t> mnemonics;
+  std::map<string, int64_t> feature_names;
+  std::map<string, int64_t> encoding_schemes;
+  int64_t num_instructions = 0;
+  for (int i = 0; i < instruction_set.instructions_size(); ++i) {
+    const int64_t count = stats.instruction_counts[i];
+    if (count == 0) continue;
+    const InstructionProto& instruction = instruction_set.instructions(i);
+    mnemonics[instruction.vendor_syntax().mnemonic()] += count;
+    feature_names[instruction.feature_name()] += count;
+    encoding_schemes[instruction.encoding_scheme()] += count;
+    num_instructions += count;
+  }
+  PrintHistogram("Mnemonics", mnemonics);
+  PrintHistogram("Feature names", feature_names);
+  PrintHistogram("Encoding schemes", encoding_schemes);
+  printf("Decoded %lld instructions (%lld bytes), %lld bytes not decoded\n",
+         static_cast<long long>(num_instructions),
+         static_cast<long long>(stats.num_decoded_bytes),
+         static_cast<long long>(stats.num_undecoded_bytes));
+  printf("Throughput: %.2f MB/s\n",
+         seconds > 0 ? num_code_bytes / seconds / 1e6 : 0.0);
+}
+
+}  // namespace
+}  // namespace x86
+}  // namespace cpu_instructions
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  ::cpu_instructions::x86::Main();
+  return 0;
+}
@@ -0,0 +1,306 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Validates x86::InstructionLengthDecoder and x86::InstructionDecoder on all
+// instructions from the instruction database, and compares their speed.
+//
+// For each instruction, the tool synthesizes its binary encoding in several
+// addressing forms directly from the encoding specification, and checks that
+// both decoders find the correct length. The encodings are then concatenated
+// into a buffer that is decoded repeatedly by both decoders.
+// Usage:
+// bazel run -c opt \
+// cpu_instructions/tools:instruction_length_benchmark -- \
+// --cpu_instructions_input_file=/path/to/instructions.pbtxt
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include "strings/string.h"
+
+#include "gflags/gflags.h"
+
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "cpu_instructions/proto/x86/encoding_specification.pb.h"
+#include "cpu_instructions/util/proto_util.h"
+#include "cpu_instructions/x86/encoding_specification.h"
+#include "cpu_instructions/x86/instruction_decoder.h"
+#include "cpu_instructions/x86/instruction_length_decoder.h"
+#include "cpu_instructions/x86/opcode_index.h"
+#include "glog/logging.h"
+
+DEFINE_string(cpu_instructions_input_file, "",
+              "The instruction set in the text format, with the x86 encoding "
+              "specifications already parsed.");
+DEFINE_int32(cpu_instructions_min_buffer_size_bytes, 16 << 20,
+             "The minimal size of the buffer decoded in the benchmark. The "
+             "synthesized instructions are repeated to reach this size.");
+DEFINE_int32(cpu_instructions_num_rounds, 10,
+             "The number of times the buffer is decoded by each decoder.");
+DEFINE_int32(cpu_instructions_max_reported_errors, 20,
+             "The maximal number of validation errors printed per decoder.");
+
+namespace cpu_instructions {
+namespace x86 {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// The addressing forms used when synthesizing instructions with a ModR/M byte.
+enum ModRmForm {
+  REGISTER_OPERAND,
+  INDIRECT_OPERAND,
+  DISPLACEMENT_8_OPERAND,
+  SIB_DISPLACEMENT_32_OPERAND,
+  RIP_RELATIVE_OPERAND,
+  NUM_MODRM_FORMS
+};
+
+// Appends the ModR/M byte with modrm.reg = 'reg' and the SIB byte and the
+// displacement of the given form to 'code'.
+void AppendModRm(ModRmForm form, int reg, std::vector<uint8_t>* code) {
+  switch (form) {
+    case REGISTER_OPERAND:
+      code->push_back(0xc0 | (reg << 3) | 1);
+      break;
+    case INDIRECT_OPERAND:
+      code->push_back(reg << 3);
+      break;
+    case DISPLACEMENT_8_OPERAND:
+      code->insert(code->end(),
+                   {static_cast<uint8_t>(0x40 | (reg << 3)), 0x10});
+      break;
+    case SIB_DISPLACEMENT_32_OPERAND:
+      code->insert(code->end(), {static_cast<uint8_t>(0x84 | (reg << 3)), 0x24,
+                                 0x00, 0x01, 0x00, 0x00});
+      break;
+    case RIP_RELATIVE_OPERAND:
+      code->insert(code->end(), {static_cast<uint8_t>(0x05 | (reg << 3)), 0x00,
+                                 0x01, 0x00, 0x00});
+      break;
+    default:
+      LOG(FATAL) << "Unexpected ModR/M form: " << form;
+  }
+}
+
+// Synthesizes the binary encoding of 'instruction' using the given ModR/M
+// form. The immediate values, displacements and offsets are filled with
+// arbitrary values; the length of the returned encoding is the expected
+// length of the instruction.
+std::vector<uint8_t> SynthesizeEncoding(const InstructionProto& instruction,
+                                        ModRmForm modrm_form) {
+  const EncodingSpecification& specification =
+      instruction.x86_encoding_specification();
+  std::vector<uint8_t> code;
+  OpcodeIndex::Key key;
+  GetOpcodeIndexKey(specification, &key);
+
+  if (specification.has_vex_prefix()) {
+    const VexPrefixEncodingSpecification& vex_prefix =
+        specification.vex_prefix();
+    const int w_bit =
+        vex_prefix.vex_w_usage() == VexPrefixEncodingSpecification::VEX_W_IS_ONE
+            ? 1
+            : 0;
+    int vector_length = 0;
+    switch (vex_prefix.vector_size()) {
+      case VEX_VECTOR_SIZE_BIT_IS_ONE:
+      case VEX_VECTOR_SIZE_256_BIT:
+        vector_length = 1;
+        break;
+      case VEX_VECTOR_SIZE_512_BIT:
+        vector_length = 2;
+        break;
+      default:
+        break;
+    }
+    const int map_select = vex_prefix.map_select();
+    const int pp = vex_prefix.mandatory_prefix();
+    if (vex_prefix.prefix_type() == EVEX_PREFIX) {
+      code.insert(code.end(),
+                  {0x62, static_cast<uint8_t>(0xf0 | map_select),
+                   static_cast<uint8_t>((w_bit << 7) | 0x7c | pp),
+                   static_cast<uint8_t>((vector_length << 5) | 0x08)});
+    } else {
+      code.insert(code.end(),
+                  {0xc4, static_cast<uint8_t>(0xe0 | map_select),
+                   static_cast<uint8_t>((w_bit << 7) | 0x78 |
+                                        (vector_length << 2) | pp)});
+    }
+    code.push_back(key.opcode);
+  } else {
+    const LegacyPrefixEncodingSpecification& prefixes =
+        specification.legacy_prefixes();
+    if (prefixes.has_mandatory_address_size_override_prefix()) {
+      code.push_back(0x67);
+    }
+    if (prefixes.has_mandatory_operand_size_override_prefix()) {
+      code.push_back(0x66);
+    }
+    if (prefixes.has_mandatory_repne_prefix()) code.push_back(0xf2);
+    if (prefixes.has_mandatory_repe_prefix()) code.push_back(0xf3);
+    if (prefixes.has_mandatory_rex_w_prefix()) code.push_back(0x48);
+    // Emit all opcode bytes, including the opcode map escape bytes.
+    const uint32_t opcode = specification.opcode();
+    int num_opcode_bytes = 1;
+    while (num_opcode_bytes < 4 && (opcode >> (8 * num_opcode_bytes)) != 0) {
+      ++num_opcode_bytes;
+    }
+    for (int i = num_opcode_bytes - 1; i >= 0; --i) {
+      code.push_back((opcode >> (8 * i)) & 0xff);
+    }
+  }
+  // Registers encoded in the opcode use the three least significant bits of
+  // the last opcode byte.
+  if (specification.operand_in_opcode() !=
+      EncodingSpecification::NO_OPERAND_IN_OPCODE) {
+    code.back() |= 1;
+  }
+  if (specification.modrm_usage() != EncodingSpecification::NO_MODRM_USAGE) {
+    const int reg = specification.modrm_usage() ==
+                            EncodingSpecification::OPCODE_EXTENSION_IN_MODRM
+                        ? specification.modrm_opcode_extension()
+                        : 2;
+    AppendModRm(modrm_form, reg, &code);
+  }
+  if (HasUnencodedMemoryOffset(instruction)) {
+    code.insert(code.end(), 8, 0x10);
+  }
+  int num_immediate_bytes = specification.code_offset_bytes();
+  for (const uint32_t immediate_value_bytes :
+       specification.immediate_value_bytes()) {
+    num_immediate_bytes += immediate_value_bytes;
+  }
+  if (specification.vex_prefix().has_vex_operand_suffix()) {
+    ++num_immediate_bytes;
+  }
+  code.insert(code.end(), num_immediate_bytes, 0x01);
+  return code;
+}
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void Main() {
+  CHECK(!FLAGS_cpu_instructions_input_file.empty())
+      << "missing --cpu_instructions_input_file";
+  const InstructionSetProto instruction_set =
+      ReadTextProtoOrDie<InstructionSetProto>(
+          FLAGS_cpu_instructions_input_file);
+  const InstructionLengthDecoder length_decoder(instruction_set);
+  const InstructionDecoder full_decoder(instruction_set);
+  LOG(INFO) << "Ambiguous opcodes: " << length_decoder.num_ambiguous_opcodes();
+  LOG(INFO) << "The length decoder uses "
+            << (length_decoder.uses_avx2() ? "AVX2" : "SSE2");
+
+  // Validate both decoders on all instructions and all addressing forms.
+  std::vector<uint8_t> all_instructions;
+  int num_encodings = 0;
+  int num_length_decoder_errors = 0;
+  int num_full_decoder_errors = 0;
+  for (const InstructionProto& instruction : instruction_set.instructions()) {
+    if (!instruction.has_x86_encoding_specification()) continue;
+    const bool has_modrm = instruction.x86_encoding_specification()
+                               .modrm_usage() !=
+                           EncodingSpecification::NO_MODRM_USAGE;
+    const int num_forms = has_modrm ? NUM_MODRM_FORMS : 1;
+    for (int form = 0; form < num_forms; ++form) {
+      const std::vector<uint8_t> code =
+          SynthesizeEncoding(instruction, static_cast<ModRmForm>(form));
+      ++num_encodings;
+      all_instructions.insert(all_instructions.end(), code.begin(),
+                              code.end());
+
+      const int length =
+          length_decoder.GetInstructionLength(code.data(), code.size());
+      if (length != code.size()) {
+        LOG_IF(WARNING, ++num_length_decoder_errors <=
+                            FLAGS_cpu_instructions_max_reported_errors)
+            << "Length decoder: " << instruction.raw_encoding_specification()
+            << ", form " << form << ": expected " << code.size() << ", got "
+            << length;
+      }
+      DecodedInstruction decoded;
+      if (!full_decoder.DecodeInstruction(code.data(), code.size(),
+                                          &decoded) ||
+          decoded.length_bytes != code.size()) {
+        LOG_IF(WARNING, ++num_full_decoder_errors <=
+                            FLAGS_cpu_instructions_max_reported_errors)
+            << "Full decoder: " << instruction.raw_encoding_specification()
+            << ", form " << form << ": expected " << code.size() << ", got "
+            << decoded.length_bytes;
+      }
+    }
+  }
+  LOG(INFO) << "Validated " << num_encodings << " encodings: "
+            << num_length_decoder_errors << " length decoder errors, "
+            << num_full_decoder_errors << " full decoder errors";
+  CHECK(!all_instructions.empty());
+
+  // Build the benchmark buffer.
+  std::vector<uint8_t> buffer;
+  while (buffer.size() < FLAGS_cpu_instructions_min_buffer_size_bytes) {
+    buffer.insert(buffer.end(), all_instructions.begin(),
+                  all_instructions.end());
+  }
+  const double buffer_megabytes =
+      static_cast<double>(buffer.size()) * FLAGS_cpu_instructions_num_rounds /
+      1e6;
+
+  std::vector<uint32_t> offsets;
+  offsets.reserve(buffer.size());
+  size_t num_length_decoder_instructions = 0;
+  const Clock::time_point length_start = Clock::now();
+  for (int round = 0; round < FLAGS_cpu_instructions_num_rounds; ++round) {
+    offsets.clear();
+    length_decoder.GetInstructionBoundaries(buffer.data(), buffer.size(),
+                                            &offsets);
+    num_length_decoder_instructions += offsets.size();
+  }
+  const double length_seconds = SecondsSince(length_start);
+
+  size_t num_full_decoder_instructions = 0;
+  const Clock::time_point full_start = Clock::now();
+  for (int round = 0; round < FLAGS_cpu_instructions_num_rounds; ++round) {
+    size_t position = 0;
+    DecodedInstruction decoded;
+    while (position < buffer.size()) {
+      if (full_decoder.DecodeInstruction(buffer.data() + position,
+                                         buffer.size() - position, &decoded)) {
+        position += decoded.length_bytes;
+        ++num_full_decoder_instructions;
+      } else {
+        ++position;
+      }
+    }
+  }
+  const double full_seconds = SecondsSince(full_start);
+
+  LOG(INFO) << "Length decoder: " << buffer_megabytes / length_seconds
+            << " MB/s, " << num_length_decoder_instructions << " instructions";
+  LOG(INFO) << "Full decoder: " << buffer_megabytes / full_seconds << " MB/s, "
+            << num_full_decoder_instructions << " instructions";
+  LOG(INFO) << "Speedup: " << full_seconds / length_seconds;
+}
+
+}  // namespace
+}  // namespace x86
+}  // namespace cpu_instructions
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  ::cpu_instructions::x86::Main();
+  return 0;
+}
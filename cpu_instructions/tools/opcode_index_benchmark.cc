@@ -0,0 +1,148 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the speed of building an OpcodeIndex and of the lookups in it, and
+// compares the lookups with a linear scan of the instruction set.
+// Usage:
+// bazel run -c opt \
+// cpu_instructions/tools:opcode_index_benchmark -- \
+// --cpu_instructions_input_file=/path/to/instructions.pbtxt
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include "strings/string.h"
+
+#include "gflags/gflags.h"
+
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "cpu_instructions/util/proto_util.h"
+#include "cpu_instructions/x86/opcode_index.h"
+#include "glog/logging.h"
+
+DEFINE_string(cpu_instructions_input_file, "",
+              "The instruction set in the text format, with the x86 encoding "
+              "specifications already parsed.");
+DEFINE_int32(cpu_instructions_num_rounds, 1000,
+             "The number of times the lookup of all instructions is repeated.");
+DEFINE_int32(cpu_instructions_num_linear_scan_rounds, 10,
+             "The number of times the lookup of all instructions is repeated "
+             "with the linear scan.");
+
+namespace cpu_instructions {
+namespace x86 {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Returns true if 'encoding_specification' matches 'key'. This is the
+// reference implementation of the lookup used for the comparison.
+bool MatchesKey(const EncodingSpecification& encoding_specification,
+                const OpcodeIndex::Key& key) {
+  OpcodeIndex::Key instruction_key;
+  GetOpcodeIndexKey(encoding_specification, &instruction_key);
+  if (instruction_key.encoding_space != key.encoding_space ||
+      instruction_key.map_select != key.map_select ||
+      instruction_key.mandatory_prefix != key.mandatory_prefix ||
+      instruction_key.opcode != key.opcode) {
+    return false;
+  }
+  return key.modrm_digit == OpcodeIndex::kAny ||
+         encoding_specification.modrm_usage() !=
+             EncodingSpecification::OPCODE_EXTENSION_IN_MODRM ||
+         encoding_specification.modrm_opcode_extension() == key.modrm_digit;
+}
+
+void Main() {
+  CHECK(!FLAGS_cpu_instructions_input_file.empty())
+      << "missing --cpu_instructions_input_file";
+  const InstructionSetProto instruction_set =
+      ReadTextProtoOrDie<InstructionSetProto>(
+          FLAGS_cpu_instructions_input_file);
+
+  const Clock::time_point build_start = Clock::now();
+  const OpcodeIndex index(instruction_set);
+  const double build_seconds = SecondsSince(build_start);
+  LOG(INFO) << "Indexed " << index.num_instructions() << " instructions in "
+            << build_seconds * 1e3 << " ms";
+
+  std::vector<OpcodeIndex::Key> keys;
+  for (const InstructionProto& instruction : instruction_set.instructions()) {
+    if (!instruction.has_x86_encoding_specification()) continue;
+    const EncodingSpecification& encoding_specification =
+        instruction.x86_encoding_specification();
+    OpcodeIndex::Key key;
+    GetOpcodeIndexKey(encoding_specification, &key);
+    if (encoding_specification.modrm_usage() ==
+        EncodingSpecification::OPCODE_EXTENSION_IN_MODRM) {
+      key.modrm_digit = encoding_specification.modrm_opcode_extension();
+    }
+    keys.push_back(key);
+  }
+  CHECK(!keys.empty()) << "The instruction set has no encoded instructions";
+
+  // The sums are printed so that the compiler can't optimize the lookups out.
+  int64_t index_sum = 0;
+  const Clock::time_point index_start = Clock::now();
+  for (int round = 0; round < FLAGS_cpu_instructions_num_rounds; ++round) {
+    for (const OpcodeIndex::Key& key : keys) {
+      for (const int instruction_index : index.Lookup(key)) {
+        index_sum += instruction_index;
+      }
+    }
+  }
+  const double index_seconds = SecondsSince(index_start);
+  const double index_lookups_per_second =
+      keys.size() * FLAGS_cpu_instructions_num_rounds / index_seconds;
+
+  int64_t linear_scan_sum = 0;
+  const Clock::time_point linear_scan_start = Clock::now();
+  for (int round = 0; round < FLAGS_cpu_instructions_num_linear_scan_rounds;
+       ++round) {
+    for (const OpcodeIndex::Key& key : keys) {
+      for (int i = 0; i < instruction_set.instructions_size(); ++i) {
+        const InstructionProto& instruction = instruction_set.instructions(i);
+        if (instruction.has_x86_encoding_specification() &&
+            MatchesKey(instruction.x86_encoding_specification(), key)) {
+          linear_scan_sum += i;
+        }
+      }
+    }
+  }
+  const double linear_scan_seconds = SecondsSince(linear_scan_start);
+  const double linear_scan_lookups_per_second =
+      keys.size() * FLAGS_cpu_instructions_num_linear_scan_rounds /
+      linear_scan_seconds;
+
+  LOG(INFO) << "OpcodeIndex: " << index_lookups_per_second
+            << " lookups/s (checksum " << index_sum << ")";
+  LOG(INFO) << "Linear scan: " << linear_scan_lookups_per_second
+            << " lookups/s (checksum " << linear_scan_sum << ")";
+  LOG(INFO) << "Speedup: "
+            << index_lookups_per_second / linear_scan_lookups_per_second;
+}
+
+}  // namespace
+}  // namespace x86
+}  // namespace cpu_instructions
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  ::cpu_instructions::x86::Main();
+  return 0;
+}
@@ -0,0 +1,270 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Cross-validates the x86 encoding specifications of an instruction set against
+// the LLVM assembler. Each instruction is instantiated with
+// x86::InstantiateOperands, assembled by LLVM, and the bytes produced by LLVM
+// are compared with the prefixes, the opcode and the ModR/M byte predicted by
+// the encoding specification. The instructions are split among several
+// threads; each thread uses its own JitCompiler, and thus its own LLVM context.
+// Usage:
+// bazel run -c opt \
+// cpu_instructions/tools:validate_encodings_with_llvm -- \
+// --cpu_instructions_input_file=/path/to/instructions.pbtxt
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "strings/string.h"
+
+#include "gflags/gflags.h"
+
+#include "base/stringprintf.h"
+#include "cpu_instructions/llvm/inline_asm.h"
+#include "cpu_instructions/llvm/llvm_utils.h"
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "cpu_instructions/proto/x86/encoding_specification.pb.h"
+#include "cpu_instructions/util/instruction_syntax.h"
+#include "cpu_instructions/util/proto_util.h"
+#include "cpu_instructions/x86/encoding_validator.h"
+#include "cpu_instructions/x86/operand_translator.h"
+#include "glog/logging.h"
+#include "llvm/IR/InlineAsm.h"
+#include "strings/str_cat.h"
+
+DEFINE_string(cpu_instructions_input_file, "",
+              "The instruction set in the text format, with the x86 encoding "
+              "specifications already parsed.");
+DEFINE_string(cpu_instructions_mcpu, "skylake-avx512",
+              "The CPU model used by LLVM when assembling the instructions. It "
+              "must support all instructions from the instruction set.");
+DEFINE_int32(cpu_instructions_num_threads, 0,
+             "The number of threads. When zero, the number of hardware "
+             "threads is used.");
+DEFINE_int32(cpu_instructions_max_reported_mismatches, 100,
+             "The maximal number of mismatches printed in the report.");
+
+namespace cpu_instructions {
+namespace x86 {
+namespace {
+
+// The ret instruction emitted by LLVM at the end of each function, and the NOP
+// instruction used by InstantiateOperands to create code offset operands.
+constexpr uint8_t kRetOpcode = 0xc3;
+constexpr uint8_t kNopOpcode = 0x90;
+
+// The code size after which the JIT compiler of each thread releases the code
+// compiled so far.
+constexpr int64_t kJitCodeSizeBudgetBytes = 1 << 20;
+
+// The result of the validation of a single instruction that did not match its
+// encoding specification.
+struct InstructionMismatch {
+  int instruction_index = -1;
+  EncodingMismatch mismatch = NO_MISMATCH;
+  string message;
+  // The bytes produced by LLVM, including the trailing instructions.
+  std::vector<uint8_t> code;
+};
+
+// Validation statistics collected by a single thread.
+struct ValidationStats {
+  int num_instructions = 0;
+  int num_assembly_failures = 0;
+  std::vector<int> assembly_failures;
+  std::vector<InstructionMismatch> mismatches;
+
+  void Accumulate(const ValidationStats& other) {
+    num_instructions += other.num_instructions;
+    num_assembly_failures += other.num_assembly_failures;
+    assembly_failures.insert(assembly_failures.end(),
+                             other.assembly_failures.begin(),
+                             other.assembly_failures.end());
+    mismatches.insert(mismatches.end(), other.mismatches.begin(),
+                      other.mismatches.end());
+  }
+};
+
+string GetAssemblyCode(const InstructionProto& instruction) {
+  return ConvertToCodeString(InstantiateOperands(instruction));
+}
+
+// Assembles the instruction 'instruction_index' of 'instruction_set' using
+// 'jit' and validates the bytes against its encoding specification. Updates
+// 'stats' with the results.
+void ValidateInstruction(const InstructionSetProto& instruction_set,
+                         int instruction_index, JitCompiler* jit,
+                         ValidationStats* stats) {
+  const InstructionProto& instruction =
+      instruction_set.instructions(instruction_index);
+  ++stats->num_instructions;
+  // Wrap the instruction in a function: LLVM then takes care of allocating the
+  // memory for the code and reports its size.
+  const VoidFunction compiled_function = jit->CompileInlineAssemblyToFunction(
+      1, GetAssemblyCode(instruction), "");
+  if (!compiled_function.IsValid()) {
+    ++stats->num_assembly_failures;
+    stats->assembly_failures.push_back(instruction_index);
+    return;
+  }
+  const uint8_t* const code =
+      reinterpret_cast<const uint8_t*>(compiled_function.ptr);
+  const size_t size = compiled_function.size;
+  EncodingValidationResult result =
+      ValidateEncoding(instruction, code, size);
+  if (result.mismatch == NO_MISMATCH) {
+    // LLVM might produce a longer encoding than the specification predicts,
+    // e.g. with a different operand size. The instruction must be followed by
+    // the return from the function, or by the padding of a code offset.
+    const size_t length = result.length_bytes;
+    if (length >= size ||
+        (code[length] != kRetOpcode && code[length] != kNopOpcode)) {
+      result.mismatch = LENGTH_MISMATCH;
+      result.message = StrCat("The instruction is longer than the predicted ",
+                              length, " bytes");
+    }
+  }
+  if (result.mismatch != NO_MISMATCH) {
+    InstructionMismatch mismatch;
+    mismatch.instruction_index = instruction_index;
+    mismatch.mismatch = result.mismatch;
+    mismatch.message = result.message;
+    mismatch.code.assign(code, code + std::min<size_t>(size, 16));
+    stats->mismatches.push_back(std::move(mismatch));
+  }
+}
+
+string FormatBytes(const std::vector<uint8_t>& bytes) {
+  string result;
+  for (const uint8_t byte : bytes) {
+    StringAppendF(&result, "%s%02X", result.empty() ? "" : " ", byte);
+  }
+  return result;
+}
+
+void Main() {
+  CHECK(!FLAGS_cpu_instructions_input_file.empty())
+      << "missing --cpu_instructions_input_file";
+  const InstructionSetProto instruction_set =
+      ReadTextProtoOrDie<InstructionSetProto>(
+          FLAGS_cpu_instructions_input_file);
+  std::vector<int> instruction_indices;
+  for (int i = 0; i < instruction_set.instructions_size(); ++i) {
+    if (instruction_set.instructions(i).has_x86_encoding_specification()) {
+      instruction_indices.push_back(i);
+    }
+  }
+
+  // The LLVM targets are initialized only once for all threads; everything
+  // else is owned by the JitCompiler of each thread.
+  EnsureLLVMWasInitialized();
+  int num_threads = FLAGS_cpu_instructions_num_threads;
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  num_threads = std::min<int>(
+      num_threads, std::max<size_t>(1, instruction_indices.size()));
+  LOG(INFO) << "Validating " << instruction_indices.size()
+            << " instructions using " << num_threads << " threads";
+
+  std::vector<ValidationStats> thread_stats(num_threads);
+  std::atomic<int> next_instruction(0);
+  const auto start_time = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < num_threads; ++thread) {
+    threads.emplace_back([&, thread]() {
+      JitCompiler jit(llvm::InlineAsm::AD_Intel, FLAGS_cpu_instructions_mcpu,
+                      JitCompiler::RETURN_NULLPTR_ON_ERROR);
+      // The code of each instruction is needed only until the next one is
+      // compiled; keep the memory used by the compiler bounded.
+      jit.SetCodeSizeBudget(kJitCodeSizeBudgetBytes);
+      for (int i = next_instruction++; i < instruction_indices.size();
+           i = next_instruction++) {
+        ValidateInstruction(instruction_set, instruction_indices[i], &jit,
+                            &thread_stats[thread]);
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start_time)
+                             .count();
+
+  ValidationStats stats;
+  for (const ValidationStats& single_thread_stats : thread_stats) {
+    stats.Accumulate(single_thread_stats);
+  }
+  std::sort(stats.mismatches.begin(), stats.mismatches.end(),
+            [](const InstructionMismatch& a, const InstructionMismatch& b) {
+              return a.instruction_index < b.instruction_index;
+            });
+  std::sort(stats.assembly_failures.begin(), stats.assembly_failures.end());
+
+  int num_mismatches_by_type[LENGTH_MISMATCH + 1] = {};
+  for (const InstructionMismatch& mismatch : stats.mismatches) {
+    ++num_mismatches_by_type[mismatch.mismatch];
+  }
+  int num_reported = 0;
+  for (const InstructionMismatch& mismatch : stats.mismatches) {
+    if (num_reported++ >= FLAGS_cpu_instructions_max_reported_mismatches) {
+      break;
+    }
+    const InstructionProto& instruction =
+        instruction_set.instructions(mismatch.instruction_index);
+    printf("%-7s %-40s %-32s %s\n        %s\n",
+           GetEncodingMismatchName(mismatch.mismatch),
+           GetAssemblyCode(instruction).c_str(),
+           instruction.raw_encoding_specification().c_str(),
+           FormatBytes(mismatch.code).c_str(), mismatch.message.c_str());
+  }
+  for (const int instruction_index : stats.assembly_failures) {
+    if (num_reported++ >= FLAGS_cpu_instructions_max_reported_mismatches) {
+      break;
+    }
+    const InstructionProto& instruction =
+        instruction_set.instructions(instruction_index);
+    printf("%-7s %-40s %s\n", "failed",
+           GetAssemblyCode(instruction).c_str(),
+           instruction.raw_encoding_specification().c_str());
+  }
+
+  printf("\nInstructions:          %d\n", stats.num_instructions);
+  printf("Matching:              %d\n",
+         stats.num_instructions - stats.num_assembly_failures -
+             static_cast<int>(stats.mismatches.size()));
+  printf("Not assembled by LLVM: %d\n", stats.num_assembly_failures);
+  for (int type = PREFIX_MISMATCH; type <= LENGTH_MISMATCH; ++type) {
+    printf("Mismatches (%s): %d\n",
+           GetEncodingMismatchName(static_cast<EncodingMismatch>(type)),
+           num_mismatches_by_type[type]);
+  }
+  printf("Time:                  %.2f s\n", seconds);
+  printf("Throughput:            %.1f instructions/s\n",
+         stats.num_instructions / seconds);
+}
+
+}  // namespace
+}  // namespace x86
+}  // namespace cpu_instructions
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  ::cpu_instructions::x86::Main();
+  return 0;
+}
@@ -0,0 +1,137 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/util/mapped_memory.h"
+
+#include <sys/mman.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "glog/logging.h"
+
+namespace cpu_instructions {
+
+namespace {
+
+uintptr_t RoundUp(uintptr_t value, uintptr_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+}  // namespace
+
+constexpr size_t MappedMemory::kHugePageSizeBytes;
+
+const char* PageBackingName(PageBacking backing) {
+  switch (backing) {
+    case REGULAR_PAGES:
+      return "regular";
+    case TRANSPARENT_HUGE_PAGES:
+      return "transparent_huge";
+    case HUGETLB_PAGES:
+      return "hugetlb";
+  }
+  LOG(FATAL) << "Unknown page backing " << backing;
+  return "";
+}
+
+std::unique_ptr<MappedMemory> MappedMemory::Create(size_t size_bytes,
+                                                   HugePagePolicy policy,
+                                                   bool executable) {
+  CHECK_GT(size_bytes, 0);
+  const int protection =
+      PROT_READ | PROT_WRITE | (executable ? PROT_EXEC : PROT_NONE);
+  constexpr int kFlags = MAP_PRIVATE | MAP_ANONYMOUS;
+  if (policy == REGULAR_PAGES_ONLY) {
+    void* const data = mmap(nullptr, size_bytes, protection, kFlags, -1, 0);
+    CHECK(data != MAP_FAILED) << "mmap failed: " << strerror(errno);
+    return std::unique_ptr<MappedMemory>(new MappedMemory(
+        static_cast<uint8_t*>(data), size_bytes, REGULAR_PAGES));
+  }
+
+  const size_t huge_size_bytes = RoundUp(size_bytes, kHugePageSizeBytes);
+  // MAP_HUGETLB fails unless the system administrator reserved enough huge
+  // pages, e.g. through /proc/sys/vm/nr_hugepages.
+  void* const hugetlb_data = mmap(nullptr, huge_size_bytes, protection,
+                                  kFlags | MAP_HUGETLB, -1, 0);
+  if (hugetlb_data != MAP_FAILED) {
+    return std::unique_ptr<MappedMemory>(
+        new MappedMemory(static_cast<uint8_t*>(hugetlb_data), huge_size_bytes,
+                         HUGETLB_PAGES));
+  }
+  VLOG(1) << "MAP_HUGETLB failed: " << strerror(errno);
+
+  // The kernel can back only the huge-page-aligned parts of the block by
+  // transparent huge pages. Map one extra huge page, and unmap the unaligned
+  // head and tail of the block.
+  const size_t mapped_size_bytes = huge_size_bytes + kHugePageSizeBytes;
+  void* const mapped_data =
+      mmap(nullptr, mapped_size_bytes, protection, kFlags, -1, 0);
+  CHECK(mapped_data != MAP_FAILED) << "mmap failed: " << strerror(errno);
+  uint8_t* const mapped_begin = static_cast<uint8_t*>(mapped_data);
+  uint8_t* const data = reinterpret_cast<uint8_t*>(
+      RoundUp(reinterpret_cast<uintptr_t>(mapped_begin), kHugePageSizeBytes));
+  uint8_t* const data_end = data + huge_size_bytes;
+  if (data > mapped_begin) {
+    CHECK_EQ(0, munmap(mapped_begin, data - mapped_begin));
+  }
+  CHECK_EQ(0, munmap(data_end, mapped_begin + mapped_size_bytes - data_end));
+  if (madvise(data, huge_size_bytes, MADV_HUGEPAGE) != 0) {
+    VLOG(1) << "madvise(MADV_HUGEPAGE) failed: " << strerror(errno);
+    return std::unique_ptr<MappedMemory>(
+        new MappedMemory(data, huge_size_bytes, REGULAR_PAGES));
+  }
+  return std::unique_ptr<MappedMemory>(
+      new MappedMemory(data, huge_size_bytes, TRANSPARENT_HUGE_PAGES));
+}
+
+MappedMemory::~MappedMemory() { CHECK_EQ(0, munmap(data_, size_)); }
+
+uint8_t* MappedMemoryArena::Allocate(size_t size_bytes,
+                                     size_t alignment_bytes) {
+  if (alignment_bytes == 0) alignment_bytes = 1;
+  CHECK_EQ(0, alignment_bytes & (alignment_bytes - 1))
+      << "The alignment must be a power of two: " << alignment_bytes;
+  if (!blocks_.empty()) {
+    const MappedMemory& block = *blocks_.back();
+    const uintptr_t block_begin = reinterpret_cast<uintptr_t>(block.data());
+    const uintptr_t begin =
+        RoundUp(block_begin + last_block_used_bytes_, alignment_bytes);
+    if (begin + size_bytes <= block_begin + block.size()) {
+      last_block_used_bytes_ = begin + size_bytes - block_begin;
+      return reinterpret_cast<uint8_t*>(begin);
+    }
+  }
+  // The blocks are aligned only to a page boundary; reserve space for aligning
+  // the allocation to a larger boundary.
+  blocks_.push_back(MappedMemory::Create(
+      std::max(size_bytes + alignment_bytes, MappedMemory::kHugePageSizeBytes),
+      policy_, executable_));
+  const MappedMemory& block = *blocks_.back();
+  const uintptr_t block_begin = reinterpret_cast<uintptr_t>(block.data());
+  const uintptr_t begin = RoundUp(block_begin, alignment_bytes);
+  last_block_used_bytes_ = begin + size_bytes - block_begin;
+  return reinterpret_cast<uint8_t*>(begin);
+}
+
+PageBacking MappedMemoryArena::backing() const {
+  if (blocks_.empty()) return REGULAR_PAGES;
+  PageBacking backing = HUGETLB_PAGES;
+  for (const auto& block : blocks_) {
+    backing = std::min(backing, block->backing());
+  }
+  return backing;
+}
+
+}  // namespace cpu_instructions
@@ -0,0 +1,115 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Anonymous memory mappings backed by huge pages when possible. They are used
+// for the measured code and for the buffers accessed by memory operands of
+// the measured code, so that misses in the instruction and data TLBs do not
+// add noise to the performance counters.
+
+#ifndef CPU_INSTRUCTIONS_UTIL_MAPPED_MEMORY_H_
+#define CPU_INSTRUCTIONS_UTIL_MAPPED_MEMORY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace cpu_instructions {
+
+// The kind of pages that back a block of memory. The values are ordered from
+// the smallest pages to the largest.
+enum PageBacking {
+  // Regular 4 KiB pages.
+  REGULAR_PAGES,
+  // Transparent huge pages requested with madvise(MADV_HUGEPAGE). The kernel
+  // may still use regular pages for some parts of the block, e.g. when it
+  // can't find enough contiguous physical memory.
+  TRANSPARENT_HUGE_PAGES,
+  // Huge pages from the hugetlbfs pool, allocated with MAP_HUGETLB.
+  HUGETLB_PAGES,
+};
+
+// Returns a short human-readable name of 'backing'.
+const char* PageBackingName(PageBacking backing);
+
+// Specifies how memory for measurements is allocated.
+enum HugePagePolicy {
+  // Use only regular pages.
+  REGULAR_PAGES_ONLY,
+  // Try MAP_HUGETLB first, then transparent huge pages, and fall back to
+  // regular pages if neither is available.
+  PREFER_HUGE_PAGES,
+};
+
+// A block of anonymous private memory, unmapped when the object is destroyed.
+class MappedMemory {
+ public:
+  // The size of the huge pages used by the class.
+  static constexpr size_t kHugePageSizeBytes = 2 << 20;
+
+  // Maps a read-write block of at least 'size_bytes' bytes. The block is also
+  // executable when 'executable' is true. When huge pages are used, the size
+  // is rounded up to a multiple of kHugePageSizeBytes. The block is always
+  // aligned to a page boundary. Dies if the memory can't be mapped at all.
+  static std::unique_ptr<MappedMemory> Create(size_t size_bytes,
+                                              HugePagePolicy policy,
+                                              bool executable);
+
+  ~MappedMemory();
+
+  MappedMemory(const MappedMemory&) = delete;
+  MappedMemory& operator=(const MappedMemory&) = delete;
+
+  uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+  PageBacking backing() const { return backing_; }
+
+ private:
+  MappedMemory(uint8_t* data, size_t size, PageBacking backing)
+      : data_(data), size_(size), backing_(backing) {}
+
+  uint8_t* const data_;
+  const size_t size_;
+  const PageBacking backing_;
+};
+
+// A bump allocator on top of MappedMemory blocks. The memory is released only
+// when the arena is destroyed. Not thread-safe.
+class MappedMemoryArena {
+ public:
+  MappedMemoryArena(HugePagePolicy policy, bool executable)
+      : policy_(policy), executable_(executable) {}
+
+  MappedMemoryArena(const MappedMemoryArena&) = delete;
+  MappedMemoryArena& operator=(const MappedMemoryArena&) = delete;
+
+  // Returns a block of 'size_bytes' bytes aligned to 'alignment_bytes', which
+  // must be a power of two. Zero means no alignment requirement.
+  uint8_t* Allocate(size_t size_bytes, size_t alignment_bytes);
+
+  // Returns the smallest pages used by any block of the arena, or
+  // REGULAR_PAGES if the arena is empty.
+  PageBacking backing() const;
+
+ private:
+  const HugePagePolicy policy_;
+  const bool executable_;
+  std::vector<std::unique_ptr<MappedMemory>> blocks_;
+  // The number of bytes used in the last block of 'blocks_'.
+  size_t last_block_used_bytes_ = 0;
+};
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_UTIL_MAPPED_MEMORY_H_
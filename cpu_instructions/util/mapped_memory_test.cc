@@ -0,0 +1,74 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/util/mapped_memory.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "gtest/gtest.h"
+
+namespace cpu_instructions {
+namespace {
+
+TEST(MappedMemoryTest, RegularPages) {
+  const std::unique_ptr<MappedMemory> memory =
+      MappedMemory::Create(1000, REGULAR_PAGES_ONLY, /*executable=*/false);
+  ASSERT_NE(memory, nullptr);
+  EXPECT_EQ(memory->size(), 1000);
+  EXPECT_EQ(memory->backing(), REGULAR_PAGES);
+  memset(memory->data(), 0xff, memory->size());
+}
+
+TEST(MappedMemoryTest, PreferHugePages) {
+  // The backing depends on the configuration of the host; the block must be
+  // usable and rounded up to the huge page size in all cases.
+  const std::unique_ptr<MappedMemory> memory =
+      MappedMemory::Create(1000, PREFER_HUGE_PAGES, /*executable=*/false);
+  ASSERT_NE(memory, nullptr);
+  EXPECT_EQ(memory->size(), MappedMemory::kHugePageSizeBytes);
+  EXPECT_EQ(
+      reinterpret_cast<uintptr_t>(memory->data()) %
+          MappedMemory::kHugePageSizeBytes,
+      0);
+  memset(memory->data(), 0xff, memory->size());
+}
+
+TEST(MappedMemoryTest, PageBackingName) {
+  EXPECT_STREQ(PageBackingName(REGULAR_PAGES), "regular");
+  EXPECT_STREQ(PageBackingName(TRANSPARENT_HUGE_PAGES), "transparent_huge");
+  EXPECT_STREQ(PageBackingName(HUGETLB_PAGES), "hugetlb");
+}
+
+TEST(MappedMemoryArenaTest, Allocate) {
+  MappedMemoryArena arena(REGULAR_PAGES_ONLY, /*executable=*/false);
+  EXPECT_EQ(arena.backing(), REGULAR_PAGES);
+  uint8_t* const first = arena.Allocate(10, 0);
+  uint8_t* const second = arena.Allocate(100, 64);
+  ASSERT_NE(first, nullptr);
+  ASSERT_NE(second, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(second) % 64, 0);
+  EXPECT_GE(second, first + 10);
+  // Larger than a block; requires a new one.
+  uint8_t* const large =
+      arena.Allocate(3 * MappedMemory::kHugePageSizeBytes, 4096);
+  ASSERT_NE(large, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(large) % 4096, 0);
+  memset(large, 0xff, 3 * MappedMemory::kHugePageSizeBytes);
+  EXPECT_EQ(arena.backing(), REGULAR_PAGES);
+}
+
+}  // namespace
+}  // namespace cpu_instructions
@@ -0,0 +1,82 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/util/sample_statistics.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "glog/logging.h"
+
+namespace cpu_instructions {
+
+namespace {
+
+// The ratio between the standard deviation of a normal distribution and its
+// median absolute deviation.
+constexpr double kMadToStandardDeviation = 1.4826;
+
+// The ratio between the standard error of the median and the standard error
+// of the mean of a normally distributed sample, i.e. sqrt(pi / 2).
+constexpr double kMedianStandardErrorFactor = 1.2533;
+
+// Returns the median of 'sorted_values', that must be sorted.
+double SortedMedian(const std::vector<double>& sorted_values) {
+  const size_t size = sorted_values.size();
+  const size_t middle = size / 2;
+  return size % 2 == 1
+             ? sorted_values[middle]
+             : (sorted_values[middle - 1] + sorted_values[middle]) / 2.0;
+}
+
+}  // namespace
+
+SampleStatistics ComputeSampleStatistics(std::vector<double> samples,
+                                         double trim_fraction,
+                                         double confidence_z) {
+  CHECK(!samples.empty());
+  CHECK_GE(trim_fraction, 0.0);
+  CHECK_LT(trim_fraction, 0.5);
+  std::sort(samples.begin(), samples.end());
+  SampleStatistics statistics;
+  const int num_samples = samples.size();
+  statistics.num_samples = num_samples;
+  statistics.min = samples.front();
+  statistics.max = samples.back();
+  statistics.median = SortedMedian(samples);
+
+  const int num_trimmed = static_cast<int>(num_samples * trim_fraction);
+  double sum = 0.0;
+  for (int i = num_trimmed; i < num_samples - num_trimmed; ++i) {
+    sum += samples[i];
+  }
+  statistics.trimmed_mean = sum / (num_samples - 2 * num_trimmed);
+
+  std::vector<double> deviations;
+  deviations.reserve(num_samples);
+  for (const double sample : samples) {
+    deviations.push_back(std::abs(sample - statistics.median));
+  }
+  std::sort(deviations.begin(), deviations.end());
+  statistics.median_absolute_deviation = SortedMedian(deviations);
+
+  const double standard_deviation =
+      kMadToStandardDeviation * statistics.median_absolute_deviation;
+  statistics.confidence_interval_half_width =
+      confidence_z * kMedianStandardErrorFactor * standard_deviation /
+      std::sqrt(static_cast<double>(num_samples));
+  return statistics;
+}
+
+}  // namespace cpu_instructions
@@ -0,0 +1,54 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Robust summary statistics of a sample of measurements. The measurements of
+// the performance counters have a long tail to the right (interrupts, context
+// switches, cache pollution by other processes), so the summary is based on
+// the median and on the median absolute deviation rather than on the mean and
+// the standard deviation.
+
+#ifndef CPU_INSTRUCTIONS_UTIL_SAMPLE_STATISTICS_H_
+#define CPU_INSTRUCTIONS_UTIL_SAMPLE_STATISTICS_H_
+
+#include <vector>
+
+namespace cpu_instructions {
+
+// The summary of a sample of measurements.
+struct SampleStatistics {
+  int num_samples = 0;
+  double min = 0.0;
+  double max = 0.0;
+  double median = 0.0;
+  // The median of the absolute deviations from the median.
+  double median_absolute_deviation = 0.0;
+  // The mean of the sample without its lowest and highest values.
+  double trimmed_mean = 0.0;
+  // The half-width of the confidence interval of the median.
+  double confidence_interval_half_width = 0.0;
+};
+
+// Computes the summary of 'samples'. 'trim_fraction' is the fraction of the
+// samples removed at each end for the trimmed mean, in [0, 0.5). The
+// confidence interval of the median is estimated from the median absolute
+// deviation assuming that the bulk of the sample is normally distributed;
+// 'confidence_z' is the number of standard errors in the interval, e.g. 1.96
+// for 95%. 'samples' must not be empty.
+SampleStatistics ComputeSampleStatistics(std::vector<double> samples,
+                                         double trim_fraction,
+                                         double confidence_z);
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_UTIL_SAMPLE_STATISTICS_H_
@@ -0,0 +1,60 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/util/sample_statistics.h"
+
+#include <cmath>
+
+#include "gtest/gtest.h"
+
+namespace cpu_instructions {
+namespace {
+
+TEST(SampleStatisticsTest, SingleSample) {
+  const SampleStatistics statistics = ComputeSampleStatistics({3.0}, 0.1, 2.0);
+  EXPECT_EQ(statistics.num_samples, 1);
+  EXPECT_DOUBLE_EQ(statistics.min, 3.0);
+  EXPECT_DOUBLE_EQ(statistics.max, 3.0);
+  EXPECT_DOUBLE_EQ(statistics.median, 3.0);
+  EXPECT_DOUBLE_EQ(statistics.median_absolute_deviation, 0.0);
+  EXPECT_DOUBLE_EQ(statistics.trimmed_mean, 3.0);
+  EXPECT_DOUBLE_EQ(statistics.confidence_interval_half_width, 0.0);
+}
+
+TEST(SampleStatisticsTest, Outlier) {
+  // The outlier moves the mean, but not the median nor the trimmed mean.
+  const SampleStatistics statistics = ComputeSampleStatistics(
+      {1.0, 2.0, 3.0, 4.0, 5.0, 1000.0, 6.0, 7.0, 8.0, 9.0}, 0.1, 2.0);
+  EXPECT_EQ(statistics.num_samples, 10);
+  EXPECT_DOUBLE_EQ(statistics.min, 1.0);
+  EXPECT_DOUBLE_EQ(statistics.max, 1000.0);
+  EXPECT_DOUBLE_EQ(statistics.median, 5.5);
+  // The deviations are 0.5, 0.5, 1.5, 1.5, ..., 994.5.
+  EXPECT_DOUBLE_EQ(statistics.median_absolute_deviation, 2.5);
+  // The mean of 2..9.
+  EXPECT_DOUBLE_EQ(statistics.trimmed_mean, 5.5);
+  EXPECT_NEAR(statistics.confidence_interval_half_width,
+              2.0 * 1.2533 * 1.4826 * 2.5 / std::sqrt(10.0), 1e-9);
+}
+
+TEST(SampleStatisticsTest, NoTrimming) {
+  const SampleStatistics statistics =
+      ComputeSampleStatistics({1.0, 2.0, 6.0}, 0.0, 2.0);
+  EXPECT_DOUBLE_EQ(statistics.median, 2.0);
+  EXPECT_DOUBLE_EQ(statistics.trimmed_mean, 3.0);
+  EXPECT_DOUBLE_EQ(statistics.median_absolute_deviation, 1.0);
+}
+
+}  // namespace
+}  // namespace cpu_instructions
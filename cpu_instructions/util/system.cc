@@ -15,11 +15,29 @@
 #include "cpu_instructions/util/system.h"
 
 #include <sched.h>
+#include <fstream>
+#include <set>
+#include <vector>
+#include "strings/string.h"
 
 #include "glog/logging.h"
+#include "re2/re2.h"
+#include "strings/str_cat.h"
+#include "strings/str_split.h"
+#include "strings/strip.h"
+#include "util/task/canonical_errors.h"
 
 namespace cpu_instructions {
 
+namespace {
+
+constexpr int kMaxCores = 4096;  // "Ought to be enough for anybody".
+
+// The directory where the kernel describes the CPU topology.
+constexpr char kSysfsCpuDirectory[] = "/sys/devices/system/cpu";
+
+}  // namespace
+
 void SetCoreAffinity(int core_id) {
   cpu_set_t affinity;
   CPU_ZERO(&affinity);
@@ -31,7 +49,6 @@ void PinCoreAffinity() {
   cpu_set_t affinity;
   CPU_ZERO(&affinity);
   CHECK_EQ(0, sched_getaffinity(0, sizeof(affinity), &affinity));
-  constexpr int kMaxCores = 4096;  // "Ought to be enough for anybody".
   for (int core_id = 0; core_id < kMaxCores; ++core_id) {
     if (CPU_ISSET(core_id, &affinity)) {
       LOG(INFO) << "Selected core " << core_id;
@@ -41,4 +58,75 @@ void PinCoreAffinity() {
   }
 }
 
+std::vector<int> GetAllowedCores() {
+  cpu_set_t affinity;
+  CPU_ZERO(&affinity);
+  CHECK_EQ(0, sched_getaffinity(0, sizeof(affinity), &affinity));
+  std::vector<int> cores;
+  for (int core_id = 0; core_id < kMaxCores && core_id < CPU_SETSIZE;
+       ++core_id) {
+    if (CPU_ISSET(core_id, &affinity)) cores.push_back(core_id);
+  }
+  return cores;
+}
+
+StatusOr<std::vector<int>> ParseCpuList(const string& cpu_list) {
+  string stripped_list = cpu_list;
+  StripWhitespace(&stripped_list);
+  std::set<int> cores;
+  for (const string& range : strings::Split(stripped_list, ",")) {
+    int first = 0;
+    int last = 0;
+    if (RE2::FullMatch(range, R"((\d+))", &first)) {
+      last = first;
+    } else if (!RE2::FullMatch(range, R"((\d+)-(\d+))", &first, &last) ||
+               first > last) {
+      return util::InvalidArgumentError(
+          StrCat("Invalid range '", range, "' in '", cpu_list, "'"));
+    }
+    for (int core_id = first; core_id <= last; ++core_id) {
+      cores.insert(core_id);
+    }
+  }
+  return std::vector<int>(cores.begin(), cores.end());
+}
+
+std::vector<int> GetPhysicalCores(const string& cpu_directory,
+                                  const std::vector<int>& allowed_cores) {
+  const std::set<int> allowed(allowed_cores.begin(), allowed_cores.end());
+  std::set<int> physical_cores;
+  for (const int core_id : allowed) {
+    const string siblings_file = StrCat(cpu_directory, "/cpu", core_id,
+                                        "/topology/thread_siblings_list");
+    std::ifstream file(siblings_file);
+    string siblings_list;
+    if (!file || !std::getline(file, siblings_list)) {
+      VLOG(1) << "Could not read " << siblings_file;
+      physical_cores.insert(core_id);
+      continue;
+    }
+    const StatusOr<std::vector<int>> siblings = ParseCpuList(siblings_list);
+    if (!siblings.ok()) {
+      LOG(WARNING) << siblings_file << ": "
+                   << siblings.status().error_message();
+      physical_cores.insert(core_id);
+      continue;
+    }
+    // The core represents its physical core if none of its allowed siblings
+    // has a smaller id. A core is listed among its own siblings.
+    int representative = core_id;
+    for (const int sibling : siblings.ValueOrDie()) {
+      if (sibling < representative && allowed.count(sibling) > 0) {
+        representative = sibling;
+      }
+    }
+    physical_cores.insert(representative);
+  }
+  return std::vector<int>(physical_cores.begin(), physical_cores.end());
+}
+
+std::vector<int> GetPhysicalCores() {
+  return GetPhysicalCores(kSysfsCpuDirectory, GetAllowedCores());
+}
+
 }  // namespace cpu_instructions
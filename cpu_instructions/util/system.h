@@ -17,8 +17,15 @@
 #ifndef CPU_INSTRUCTIONS_UTIL_SYSTEM_H_
 #define CPU_INSTRUCTIONS_UTIL_SYSTEM_H_
 
+#include <vector>
+#include "strings/string.h"
+
+#include "util/task/statusor.h"
+
 namespace cpu_instructions {
 
+using ::cpu_instructions::util::StatusOr;
+
 // Assigns the current thread to core 'core_id'. Dies if the core cannot be
 // bound to.
 void SetCoreAffinity(int core_id);
@@ -29,6 +36,29 @@ void SetCoreAffinity(int core_id);
 // MOE: end_strip
 void PinCoreAffinity();
 
+// Returns the ids of the cores on which the current thread is allowed to run,
+// in increasing order.
+std::vector<int> GetAllowedCores();
+
+// Parses a list of core ids in the format used by the kernel in
+// /sys/devices/system/cpu, e.g. "0-3,8,10-11". Returns the ids in increasing
+// order, without duplicates.
+StatusOr<std::vector<int>> ParseCpuList(const string& cpu_list);
+
+// Returns one logical core for each physical core among 'allowed_cores': the
+// core with the smallest id among its SMT siblings in 'allowed_cores'. The
+// siblings are read from cpuN/topology/thread_siblings_list in
+// 'cpu_directory'; a core whose topology is not available is considered to be
+// a physical core of its own. The ids are returned in increasing order.
+std::vector<int> GetPhysicalCores(const string& cpu_directory,
+                                  const std::vector<int>& allowed_cores);
+
+// Same as above, for the cores on which the current thread is allowed to run,
+// using the topology in /sys/devices/system/cpu. Code running on the returned
+// cores does not share the execution units of a core with another returned
+// core.
+std::vector<int> GetPhysicalCores();
+
 }  // namespace cpu_instructions
 
 #endif  // CPU_INSTRUCTIONS_UTIL_SYSTEM_H_
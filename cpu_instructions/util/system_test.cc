@@ -0,0 +1,100 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/util/system.h"
+
+#include <sched.h>
+#include <sys/stat.h>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+#include "strings/string.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "strings/str_cat.h"
+
+namespace cpu_instructions {
+namespace {
+
+using ::testing::Contains;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+TEST(ParseCpuListTest, ParsesRangesAndSingleCores) {
+  const StatusOr<std::vector<int>> cores = ParseCpuList("8,0-3,10-11\n");
+  ASSERT_TRUE(cores.ok());
+  EXPECT_THAT(cores.ValueOrDie(), ElementsAre(0, 1, 2, 3, 8, 10, 11));
+}
+
+TEST(ParseCpuListTest, EmptyList) {
+  const StatusOr<std::vector<int>> cores = ParseCpuList("");
+  ASSERT_TRUE(cores.ok());
+  EXPECT_THAT(cores.ValueOrDie(), IsEmpty());
+}
+
+TEST(ParseCpuListTest, RejectsInvalidRanges) {
+  EXPECT_FALSE(ParseCpuList("0-").ok());
+  EXPECT_FALSE(ParseCpuList("3-1").ok());
+  EXPECT_FALSE(ParseCpuList("a").ok());
+}
+
+// Creates a fake /sys/devices/system/cpu directory in which the core 'core_id'
+// has the given SMT siblings.
+void WriteSiblings(const string& cpu_directory, int core_id,
+                   const string& siblings) {
+  const string core_directory = StrCat(cpu_directory, "/cpu", core_id);
+  mkdir(cpu_directory.c_str(), 0755);
+  mkdir(core_directory.c_str(), 0755);
+  mkdir(StrCat(core_directory, "/topology").c_str(), 0755);
+  std::ofstream file(
+      StrCat(core_directory, "/topology/thread_siblings_list"));
+  file << siblings << "\n";
+}
+
+TEST(GetPhysicalCoresTest, KeepsOneCorePerSiblingGroup) {
+  const string cpu_directory = StrCat(getenv("TEST_TMPDIR"), "/cpu_smt");
+  // Two physical cores with two hardware threads each, numbered like Intel
+  // CPUs do: the siblings of core 0 are 0 and 2.
+  WriteSiblings(cpu_directory, 0, "0,2");
+  WriteSiblings(cpu_directory, 1, "1,3");
+  WriteSiblings(cpu_directory, 2, "0,2");
+  WriteSiblings(cpu_directory, 3, "1,3");
+  EXPECT_THAT(GetPhysicalCores(cpu_directory, {0, 1, 2, 3}),
+              ElementsAre(0, 1));
+  // When the thread can't run on core 0, its sibling represents the core.
+  EXPECT_THAT(GetPhysicalCores(cpu_directory, {1, 2, 3}), ElementsAre(1, 2));
+}
+
+TEST(GetPhysicalCoresTest, MissingTopology) {
+  const string cpu_directory = StrCat(getenv("TEST_TMPDIR"), "/cpu_none");
+  EXPECT_THAT(GetPhysicalCores(cpu_directory, {0, 1}), ElementsAre(0, 1));
+}
+
+TEST(GetPhysicalCoresTest, HostCores) {
+  const std::vector<int> physical_cores = GetPhysicalCores();
+  EXPECT_FALSE(physical_cores.empty());
+  for (const int core_id : physical_cores) {
+    EXPECT_THAT(GetAllowedCores(), Contains(core_id));
+  }
+}
+
+TEST(SetCoreAffinityTest, RunsOnCore) {
+  const int core_id = GetPhysicalCores().back();
+  SetCoreAffinity(core_id);
+  EXPECT_EQ(sched_getcpu(), core_id);
+}
+
+}  // namespace
+}  // namespace cpu_instructions
@@ -0,0 +1,142 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A queue of tasks shared by a fixed set of worker threads. Each worker passes
+// its own resources to the tasks it runs, e.g. a JitCompiler that it created
+// and that no other thread may use. The threads are owned by the user of the
+// queue: each of them sets up its resources, and then calls WorkQueue::Run.
+
+#ifndef CPU_INSTRUCTIONS_UTIL_WORK_QUEUE_H_
+#define CPU_INSTRUCTIONS_UTIL_WORK_QUEUE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "glog/logging.h"
+
+namespace cpu_instructions {
+
+// The tasks are processed in the order in which they were submitted, by the
+// first available worker. 'Resources' is the type of the value that the workers
+// pass to the tasks. All public methods are thread-safe.
+template <typename Resources>
+class WorkQueue {
+ public:
+  using Task = std::function<void(const Resources& resources)>;
+
+  WorkQueue() = default;
+
+  WorkQueue(const WorkQueue&) = delete;
+  WorkQueue& operator=(const WorkQueue&) = delete;
+
+  // Adds 'task' to the queue, and wakes up one of the workers. Must not be
+  // called after Stop().
+  void Submit(Task task);
+
+  // Submits 'function' as a task. The returned future becomes ready with the
+  // value returned by 'function' when the task is done.
+  template <typename Result>
+  std::future<Result> SubmitWithResult(
+      std::function<Result(const Resources& resources)> function);
+
+  // The main loop of a worker thread. Runs the tasks from the queue with
+  // 'resources' until the queue is stopped and empty.
+  void Run(const Resources& resources);
+
+  // Makes the workers return from Run() once all submitted tasks are done.
+  void Stop();
+
+  // Blocks until the queue is empty and no task is running.
+  void WaitUntilIdle();
+
+ private:
+  // Protects 'tasks_', 'num_running_tasks_' and 'stopping_'.
+  std::mutex mutex_;
+  std::condition_variable tasks_available_;
+  std::condition_variable idle_;
+  std::deque<Task> tasks_;
+  int num_running_tasks_ = 0;
+  bool stopping_ = false;
+};
+
+template <typename Resources>
+void WorkQueue<Resources>::Submit(Task task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CHECK(!stopping_);
+    tasks_.push_back(std::move(task));
+  }
+  tasks_available_.notify_one();
+}
+
+template <typename Resources>
+template <typename Result>
+std::future<Result> WorkQueue<Resources>::SubmitWithResult(
+    std::function<Result(const Resources& resources)> function) {
+  // std::function requires a copyable function object, so the promise is held
+  // by a shared pointer.
+  const auto promise = std::make_shared<std::promise<Result>>();
+  std::future<Result> result = promise->get_future();
+  Submit([promise, function](const Resources& resources) {
+    promise->set_value(function(resources));
+  });
+  return result;
+}
+
+template <typename Resources>
+void WorkQueue<Resources>::Run(const Resources& resources) {
+  while (true) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      tasks_available_.wait(lock,
+                            [this]() { return stopping_ || !tasks_.empty(); });
+      if (tasks_.empty()) return;
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+      ++num_running_tasks_;
+    }
+    task(resources);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --num_running_tasks_;
+    }
+    idle_.notify_all();
+  }
+}
+
+template <typename Resources>
+void WorkQueue<Resources>::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  tasks_available_.notify_all();
+}
+
+template <typename Resources>
+void WorkQueue<Resources>::WaitUntilIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock,
+             [this]() { return tasks_.empty() && num_running_tasks_ == 0; });
+}
+
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_UTIL_WORK_QUEUE_H_
@@ -0,0 +1,68 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/util/work_queue.h"
+
+#include <atomic>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace cpu_instructions {
+namespace {
+
+TEST(WorkQueueTest, RunsTasksWithTheResourcesOfTheWorker) {
+  constexpr int kNumWorkers = 4;
+  constexpr int kNumTasks = 100;
+  WorkQueue<int> queue;
+  std::vector<std::thread> workers;
+  for (int i = 0; i < kNumWorkers; ++i) {
+    workers.emplace_back([&queue, i]() { queue.Run(i); });
+  }
+  std::atomic<int> num_tasks(0);
+  std::vector<std::future<int>> results;
+  for (int i = 0; i < kNumTasks; ++i) {
+    queue.Submit([&num_tasks](const int& worker) { ++num_tasks; });
+    results.push_back(queue.SubmitWithResult<int>(
+        [](const int& worker) { return worker; }));
+  }
+  for (std::future<int>& result : results) {
+    const int worker = result.get();
+    EXPECT_GE(worker, 0);
+    EXPECT_LT(worker, kNumWorkers);
+  }
+  queue.WaitUntilIdle();
+  EXPECT_EQ(num_tasks, kNumTasks);
+  queue.Stop();
+  for (std::thread& worker : workers) worker.join();
+}
+
+TEST(WorkQueueTest, FinishesTheQueuedTasksWhenStopped) {
+  constexpr int kNumTasks = 10;
+  WorkQueue<int> queue;
+  std::atomic<int> num_tasks(0);
+  for (int i = 0; i < kNumTasks; ++i) {
+    queue.Submit([&num_tasks](const int& worker) { ++num_tasks; });
+  }
+  queue.Stop();
+  // The tasks submitted before Stop() are still run.
+  std::thread worker([&queue]() { queue.Run(0); });
+  worker.join();
+  EXPECT_EQ(num_tasks, kNumTasks);
+}
+
+}  // namespace
+}  // namespace cpu_instructions
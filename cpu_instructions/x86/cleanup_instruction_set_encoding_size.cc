@@ -0,0 +1,195 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/x86/cleanup_instruction_set_encoding_size.h"
+
+#include <cstdint>
+#include "strings/string.h"
+
+#include "cpu_instructions/base/cleanup_instruction_set.h"
+#include "cpu_instructions/proto/x86/encoding_specification.pb.h"
+#include "cpu_instructions/proto/x86/instruction_encoding.pb.h"
+#include "cpu_instructions/x86/encoding_specification.h"
+#include "glog/logging.h"
+
+namespace cpu_instructions {
+namespace x86 {
+namespace {
+
+using ::cpu_instructions::util::OkStatus;
+using ::cpu_instructions::util::Status;
+
+// The size of the SIB byte followed by a 32-bit displacement; this is the
+// longest addressing form that can follow the ModR/M byte.
+constexpr int kMaxSibAndDisplacementBytes = 5;
+
+void AddBytes(int min_bytes, int typical_bytes, int max_bytes,
+              EncodingSizes* sizes) {
+  sizes->min_bytes += min_bytes;
+  sizes->typical_bytes += typical_bytes;
+  sizes->max_bytes += max_bytes;
+}
+
+// Returns the number of bytes of 'opcode'. The opcode of legacy instructions
+// includes the opcode map escape bytes.
+int GetNumOpcodeBytes(uint32_t opcode) {
+  if (opcode > 0xffff) return 3;
+  if (opcode > 0xff) return 2;
+  return 1;
+}
+
+// Adds the sizes of the legacy and REX prefixes of the instruction.
+void AddLegacyPrefixSizes(const EncodingSpecification& specification,
+                          EncodingSizes* sizes) {
+  const LegacyPrefixEncodingSpecification& prefixes =
+      specification.legacy_prefixes();
+  const int num_mandatory_prefixes =
+      prefixes.has_mandatory_repe_prefix() +
+      prefixes.has_mandatory_repne_prefix() +
+      prefixes.has_mandatory_operand_size_override_prefix() +
+      prefixes.has_mandatory_address_size_override_prefix();
+  AddBytes(num_mandatory_prefixes, num_mandatory_prefixes,
+           num_mandatory_prefixes, sizes);
+  if (prefixes.has_mandatory_rex_w_prefix()) {
+    AddBytes(1, 1, 1, sizes);
+  } else if (specification.modrm_usage() !=
+                 EncodingSpecification::NO_MODRM_USAGE ||
+             specification.operand_in_opcode() ==
+                 EncodingSpecification::GENERAL_PURPOSE_REGISTER_IN_OPCODE) {
+    // The REX prefix is needed only to access the extended registers.
+    AddBytes(0, 0, 1, sizes);
+  }
+}
+
+// Adds the size of the VEX or EVEX prefix of the instruction.
+void AddVexPrefixSizes(const EncodingSpecification& specification,
+                       EncodingSizes* sizes) {
+  const VexPrefixEncodingSpecification& vex_prefix =
+      specification.vex_prefix();
+  if (vex_prefix.prefix_type() == EVEX_PREFIX) {
+    AddBytes(4, 4, 4, sizes);
+    return;
+  }
+  // The two-byte VEX prefix can encode only the 0F map, and it does not have
+  // the VEX.W, VEX.X and VEX.B bits. The latter two are needed only when the
+  // ModR/M byte addresses an extended register.
+  const bool can_use_two_byte_prefix =
+      vex_prefix.map_select() == VexEncoding::MAP_SELECT_0F &&
+      vex_prefix.vex_w_usage() != VexPrefixEncodingSpecification::VEX_W_IS_ONE;
+  if (!can_use_two_byte_prefix) {
+    AddBytes(3, 3, 3, sizes);
+  } else if (specification.modrm_usage() !=
+             EncodingSpecification::NO_MODRM_USAGE) {
+    AddBytes(2, 2, 3, sizes);
+  } else {
+    AddBytes(2, 2, 2, sizes);
+  }
+}
+
+// Adds the sizes of the SIB byte and the displacement that follow the ModR/M
+// byte, based on the addressing mode of the operand encoded in modrm.rm.
+void AddSibAndDisplacementSizes(const InstructionProto& instruction,
+                                EncodingSizes* sizes) {
+  const EncodingSpecification& specification =
+      instruction.x86_encoding_specification();
+  if (specification.vex_prefix().vsib_usage() ==
+      VexPrefixEncodingSpecification::VSIB_USED) {
+    // VSIB always uses the SIB byte.
+    AddBytes(1, 1, kMaxSibAndDisplacementBytes, sizes);
+    return;
+  }
+  for (const InstructionOperand& operand :
+       instruction.vendor_syntax().operands()) {
+    if (operand.encoding() == InstructionOperand::VSIB_ENCODING) {
+      AddBytes(1, 1, kMaxSibAndDisplacementBytes, sizes);
+      return;
+    }
+    if (operand.encoding() == InstructionOperand::MODRM_RM_ENCODING) {
+      if (operand.addressing_mode() == InstructionOperand::DIRECT_ADDRESSING) {
+        return;
+      }
+      break;
+    }
+  }
+  // The operand may be in memory, or its addressing mode is not known. The
+  // shortest and the typical form address the memory through a base register
+  // without a displacement.
+  AddBytes(0, 0, kMaxSibAndDisplacementBytes, sizes);
+}
+
+}  // namespace
+
+EncodingSizes GetEncodingSizes(const InstructionProto& instruction) {
+  CHECK(instruction.has_x86_encoding_specification());
+  const EncodingSpecification& specification =
+      instruction.x86_encoding_specification();
+  EncodingSizes sizes;
+  if (specification.has_vex_prefix()) {
+    AddVexPrefixSizes(specification, &sizes);
+    // The opcode map is encoded in the prefix, so there is only one opcode
+    // byte.
+    AddBytes(1, 1, 1, &sizes);
+  } else {
+    AddLegacyPrefixSizes(specification, &sizes);
+    const int num_opcode_bytes = GetNumOpcodeBytes(specification.opcode());
+    AddBytes(num_opcode_bytes, num_opcode_bytes, num_opcode_bytes, &sizes);
+  }
+  if (specification.modrm_usage() != EncodingSpecification::NO_MODRM_USAGE) {
+    AddBytes(1, 1, 1, &sizes);
+    AddSibAndDisplacementSizes(instruction, &sizes);
+  }
+  int num_immediate_bytes = specification.code_offset_bytes();
+  for (const uint32_t immediate_value_bytes :
+       specification.immediate_value_bytes()) {
+    num_immediate_bytes += immediate_value_bytes;
+  }
+  if (specification.vex_prefix().has_vex_operand_suffix()) {
+    ++num_immediate_bytes;
+  }
+  AddBytes(num_immediate_bytes, num_immediate_bytes, num_immediate_bytes,
+           &sizes);
+  if (HasUnencodedMemoryOffset(instruction)) {
+    // The offset has 64 bits by default; the address size override prefix
+    // reduces it to 32 bits.
+    AddBytes(1 + 4, 8, 8, &sizes);
+  }
+  return sizes;
+}
+
+Status AddBinaryEncodingSizes(InstructionSetProto* instruction_set) {
+  CHECK(instruction_set != nullptr);
+  for (InstructionProto& instruction :
+       *instruction_set->mutable_instructions()) {
+    if (!instruction.has_x86_encoding_specification()) continue;
+    const EncodingSizes sizes = GetEncodingSizes(instruction);
+    instruction.set_min_binary_encoding_size_bytes(sizes.min_bytes);
+    instruction.set_max_binary_encoding_size_bytes(sizes.max_bytes);
+    if (!instruction.has_binary_encoding_size_bytes()) {
+      instruction.set_binary_encoding_size_bytes(sizes.typical_bytes);
+    } else {
+      const int size_bytes = instruction.binary_encoding_size_bytes();
+      LOG_IF(WARNING,
+             size_bytes < sizes.min_bytes || size_bytes > sizes.max_bytes)
+          << "The encoding size " << size_bytes << " of "
+          << instruction.raw_encoding_specification() << " is outside of the "
+          << "computed range [" << sizes.min_bytes << ", " << sizes.max_bytes
+          << "]";
+    }
+  }
+  return OkStatus();
+}
+REGISTER_INSTRUCTION_SET_TRANSFORM(AddBinaryEncodingSizes, 8000);
+
+}  // namespace x86
+}  // namespace cpu_instructions
@@ -0,0 +1,64 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains an instruction set transform that computes the sizes of the binary
+// encodings of the instructions from their encoding specifications.
+
+#ifndef CPU_INSTRUCTIONS_X86_CLEANUP_INSTRUCTION_SET_ENCODING_SIZE_H_
+#define CPU_INSTRUCTIONS_X86_CLEANUP_INSTRUCTION_SET_ENCODING_SIZE_H_
+
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "util/task/status.h"
+
+namespace cpu_instructions {
+namespace x86 {
+
+using ::cpu_instructions::util::Status;
+
+// The sizes of the binary encoding of an instruction in bytes.
+struct EncodingSizes {
+  // The size of the shortest encoding of the instruction.
+  int min_bytes = 0;
+  // The size of the encoding using register operands where possible, and
+  // addressing memory through a base register without a displacement.
+  int typical_bytes = 0;
+  // The size of the longest encoding of the instruction.
+  int max_bytes = 0;
+};
+
+// Computes the sizes of the binary encoding of 'instruction' from its x86
+// encoding specification and from the addressing modes of its operands. The
+// sizes account for:
+// * the mandatory legacy prefixes, the optional REX prefix for instructions
+//   that have register operands, and the two- and three-byte VEX prefixes,
+// * the opcode bytes, the ModR/M byte, the SIB byte and the displacement
+//   allowed by the addressing mode of the operand encoded in modrm.rm,
+// * the immediate values, the code offset, the memory offset and the VEX
+//   operand suffix.
+// Assumes that 'instruction' has an x86 encoding specification.
+EncodingSizes GetEncodingSizes(const InstructionProto& instruction);
+
+// Fills in min_binary_encoding_size_bytes and max_binary_encoding_size_bytes
+// of all instructions that have an x86 encoding specification, and sets
+// binary_encoding_size_bytes to the typical size if it is not set yet. When
+// binary_encoding_size_bytes is already set, e.g. because it was measured by
+// assembling the instruction, it is kept, and a warning is logged if it is not
+// within the computed bounds. Does not need to assemble the instructions, and
+// it can thus be used without LLVM.
+Status AddBinaryEncodingSizes(InstructionSetProto* instruction_set);
+
+}  // namespace x86
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_X86_CLEANUP_INSTRUCTION_SET_ENCODING_SIZE_H_
@@ -0,0 +1,210 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/x86/cleanup_instruction_set_encoding_size.h"
+
+#include "strings/string.h"
+
+#include "cpu_instructions/base/cleanup_instruction_set_test_utils.h"
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "cpu_instructions/util/proto_util.h"
+#include "gtest/gtest.h"
+
+namespace cpu_instructions {
+namespace x86 {
+namespace {
+
+void ExpectEncodingSizes(const string& instruction_proto, int min_bytes,
+                         int typical_bytes, int max_bytes) {
+  SCOPED_TRACE(instruction_proto);
+  const EncodingSizes sizes = GetEncodingSizes(
+      ParseProtoFromStringOrDie<InstructionProto>(instruction_proto));
+  EXPECT_EQ(sizes.min_bytes, min_bytes);
+  EXPECT_EQ(sizes.typical_bytes, typical_bytes);
+  EXPECT_EQ(sizes.max_bytes, max_bytes);
+}
+
+TEST(GetEncodingSizesTest, LegacyInstructions) {
+  // ADC r/m8, r8: REX, opcode, ModR/M, SIB and disp32.
+  ExpectEncodingSizes(R"(
+      vendor_syntax {
+        mnemonic: 'ADC'
+        operands { addressing_mode: ANY_ADDRESSING_WITH_FLEXIBLE_REGISTERS
+                   encoding: MODRM_RM_ENCODING name: 'r/m8' }
+        operands { addressing_mode: DIRECT_ADDRESSING
+                   encoding: MODRM_REG_ENCODING name: 'r8' }}
+      x86_encoding_specification {
+        legacy_prefixes {} opcode: 0x10 modrm_usage: FULL_MODRM })",
+                      2, 2, 8);
+  // ADD r16, r16: the operand size override prefix is mandatory, and there is
+  // no memory operand.
+  ExpectEncodingSizes(R"(
+      vendor_syntax {
+        mnemonic: 'ADD'
+        operands { addressing_mode: DIRECT_ADDRESSING
+                   encoding: MODRM_RM_ENCODING name: 'r16' }
+        operands { addressing_mode: DIRECT_ADDRESSING
+                   encoding: MODRM_REG_ENCODING name: 'r16' }}
+      x86_encoding_specification {
+        legacy_prefixes { has_mandatory_operand_size_override_prefix: true }
+        opcode: 0x01 modrm_usage: FULL_MODRM })",
+                      3, 3, 4);
+  // MOV r64, imm64.
+  ExpectEncodingSizes(R"(
+      x86_encoding_specification {
+        legacy_prefixes { has_mandatory_rex_w_prefix: true } opcode: 0xb8
+        operand_in_opcode: GENERAL_PURPOSE_REGISTER_IN_OPCODE
+        immediate_value_bytes: 8 })",
+                      10, 10, 10);
+  // XGETBV.
+  ExpectEncodingSizes(R"(
+      x86_encoding_specification { legacy_prefixes {} opcode: 0x0f01d0 })", 3,
+                      3, 3);
+  // CALL rel32.
+  ExpectEncodingSizes(R"(
+      x86_encoding_specification {
+        legacy_prefixes {} opcode: 0xe8 code_offset_bytes: 4 })",
+                      5, 5, 5);
+  // MOV AL, moffs8 without an explicit immediate value.
+  ExpectEncodingSizes(R"(
+      vendor_syntax { mnemonic: 'MOV' operands { name: 'AL' }
+                      operands { name: 'moffs8' }}
+      x86_encoding_specification { legacy_prefixes {} opcode: 0xa0 })", 6, 9,
+                      9);
+}
+
+TEST(GetEncodingSizesTest, VexInstructions) {
+  // VADDPS ymm1, ymm2, ymm3/m256 can use the two-byte VEX prefix unless the
+  // memory operand uses extended base or index registers.
+  ExpectEncodingSizes(R"(
+      vendor_syntax {
+        mnemonic: 'VADDPS'
+        operands { addressing_mode: DIRECT_ADDRESSING
+                   encoding: MODRM_REG_ENCODING name: 'ymm1' }
+        operands { addressing_mode: DIRECT_ADDRESSING
+                   encoding: VEX_V_ENCODING name: 'ymm2' }
+        operands { addressing_mode: ANY_ADDRESSING_WITH_FLEXIBLE_REGISTERS
+                   encoding: MODRM_RM_ENCODING name: 'ymm3/m256' }}
+      x86_encoding_specification {
+        opcode: 0x0f58 modrm_usage: FULL_MODRM
+        vex_prefix {
+          prefix_type: VEX_PREFIX map_select: MAP_SELECT_0F
+          vector_size: VEX_VECTOR_SIZE_256_BIT
+          vex_w_usage: VEX_W_IS_IGNORED }})",
+                      4, 4, 10);
+  // VBLENDVPS xmm1, xmm2, xmm3, xmm4 needs the three-byte VEX prefix and has
+  // the operand suffix.
+  ExpectEncodingSizes(R"(
+      vendor_syntax {
+        mnemonic: 'VBLENDVPS'
+        operands { addressing_mode: DIRECT_ADDRESSING
+                   encoding: MODRM_REG_ENCODING name: 'xmm1' }
+        operands { addressing_mode: DIRECT_ADDRESSING
+                   encoding: VEX_V_ENCODING name: 'xmm2' }
+        operands { addressing_mode: DIRECT_ADDRESSING
+                   encoding: MODRM_RM_ENCODING name: 'xmm3' }
+        operands { addressing_mode: DIRECT_ADDRESSING
+                   encoding: VEX_SUFFIX_ENCODING name: 'xmm4' }}
+      x86_encoding_specification {
+        opcode: 0x0f3a4a modrm_usage: FULL_MODRM
+        vex_prefix {
+          prefix_type: VEX_PREFIX map_select: MAP_SELECT_0F3A
+          mandatory_prefix: MANDATORY_PREFIX_OPERAND_SIZE_OVERRIDE
+          vector_size: VEX_VECTOR_SIZE_128_BIT vex_w_usage: VEX_W_IS_ZERO
+          has_vex_operand_suffix: true }})",
+                      6, 6, 6);
+  // VGATHERDPD ymm1, vm32x, ymm2 always uses the SIB byte.
+  ExpectEncodingSizes(R"(
+      x86_encoding_specification {
+        opcode: 0x0f3892 modrm_usage: FULL_MODRM
+        vex_prefix {
+          prefix_type: VEX_PREFIX map_select: MAP_SELECT_0F38
+          mandatory_prefix: MANDATORY_PREFIX_OPERAND_SIZE_OVERRIDE
+          vector_size: VEX_VECTOR_SIZE_256_BIT vex_w_usage: VEX_W_IS_ONE
+          vsib_usage: VSIB_USED }})",
+                      6, 6, 10);
+  // VZEROUPPER.
+  ExpectEncodingSizes(R"(
+      x86_encoding_specification {
+        opcode: 0x0f77
+        vex_prefix {
+          prefix_type: VEX_PREFIX map_select: MAP_SELECT_0F
+          vector_size: VEX_VECTOR_SIZE_128_BIT
+          vex_w_usage: VEX_W_IS_IGNORED }})",
+                      3, 3, 3);
+  // VADDPS zmm1, zmm2, zmm3/m512.
+  ExpectEncodingSizes(R"(
+      x86_encoding_specification {
+        opcode: 0x0f58 modrm_usage: FULL_MODRM
+        vex_prefix {
+          prefix_type: EVEX_PREFIX map_select: MAP_SELECT_0F
+          vector_size: VEX_VECTOR_SIZE_512_BIT vex_w_usage: VEX_W_IS_ZERO }})",
+                      6, 6, 11);
+}
+
+TEST(AddBinaryEncodingSizesTest, AddsSizes) {
+  constexpr char kInstructionSetProto[] = R"(
+      instructions {
+        vendor_syntax { mnemonic: 'XGETBV' }
+        raw_encoding_specification: '0F 01 D0'
+        x86_encoding_specification { legacy_prefixes {} opcode: 0x0f01d0 }}
+      instructions {
+        vendor_syntax { mnemonic: 'VBROADCASTF128'
+                        operands { name: 'ymm1' } operands { name: 'm128' }}
+        binary_encoding_size_bytes: 5
+        raw_encoding_specification: 'VEX.256.66.0F38.W0 1A /r'
+        x86_encoding_specification {
+          opcode: 0x0f381a modrm_usage: FULL_MODRM
+          vex_prefix {
+            prefix_type: VEX_PREFIX
+            vector_size: VEX_VECTOR_SIZE_256_BIT
+            mandatory_prefix: MANDATORY_PREFIX_OPERAND_SIZE_OVERRIDE
+            map_select: MAP_SELECT_0F38
+            vex_w_usage: VEX_W_IS_ZERO }}}
+      instructions {
+        vendor_syntax { mnemonic: 'FOO' }
+        raw_encoding_specification: 'FOO' })";
+  constexpr char kExpectedInstructionSetProto[] = R"(
+      instructions {
+        vendor_syntax { mnemonic: 'XGETBV' }
+        binary_encoding_size_bytes: 3
+        raw_encoding_specification: '0F 01 D0'
+        x86_encoding_specification { legacy_prefixes {} opcode: 0x0f01d0 }
+        min_binary_encoding_size_bytes: 3
+        max_binary_encoding_size_bytes: 3 }
+      instructions {
+        vendor_syntax { mnemonic: 'VBROADCASTF128'
+                        operands { name: 'ymm1' } operands { name: 'm128' }}
+        binary_encoding_size_bytes: 5
+        raw_encoding_specification: 'VEX.256.66.0F38.W0 1A /r'
+        x86_encoding_specification {
+          opcode: 0x0f381a modrm_usage: FULL_MODRM
+          vex_prefix {
+            prefix_type: VEX_PREFIX
+            vector_size: VEX_VECTOR_SIZE_256_BIT
+            mandatory_prefix: MANDATORY_PREFIX_OPERAND_SIZE_OVERRIDE
+            map_select: MAP_SELECT_0F38
+            vex_w_usage: VEX_W_IS_ZERO }}
+        min_binary_encoding_size_bytes: 5
+        max_binary_encoding_size_bytes: 10 }
+      instructions {
+        vendor_syntax { mnemonic: 'FOO' }
+        raw_encoding_specification: 'FOO' })";
+  TestTransform(AddBinaryEncodingSizes, kInstructionSetProto,
+                kExpectedInstructionSetProto);
+}
+
+}  // namespace
+}  // namespace x86
+}  // namespace cpu_instructions
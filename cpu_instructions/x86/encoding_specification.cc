@@ -30,6 +30,7 @@
 #include "re2/re2.h"
 #include "strings/str_cat.h"
 #include "strings/string_view.h"
+#include "strings/string_view_utils.h"
 #include "util/gtl/map_util.h"
 #include "util/task/canonical_errors.h"
 #include "util/task/status_macros.h"
@@ -531,5 +532,19 @@ InstructionOperandEncodingMultiset GetAvailableEncodings(
   return available_encodings;
 }
 
+bool HasMemoryOffsetOperand(const InstructionProto& instruction) {
+  for (const InstructionOperand& operand :
+       instruction.vendor_syntax().operands()) {
+    if (strings::StartsWith(operand.name(), "moffs")) return true;
+  }
+  return false;
+}
+
+bool HasUnencodedMemoryOffset(const InstructionProto& instruction) {
+  return instruction.x86_encoding_specification()
+                 .immediate_value_bytes_size() == 0 &&
+         HasMemoryOffsetOperand(instruction);
+}
+
 }  // namespace x86
 }  // namespace cpu_instructions
@@ -62,6 +62,17 @@ using InstructionOperandEncodingMultiset =
 InstructionOperandEncodingMultiset GetAvailableEncodings(
     const EncodingSpecification& specification);
 
+// Returns true if 'instruction' has a memory offset operand (moffs). The
+// address is encoded after the opcode, and its size depends on the address
+// size override prefix.
+bool HasMemoryOffsetOperand(const InstructionProto& instruction);
+
+// Returns true if the instruction has a memory offset operand (moffs) whose
+// value is not listed among the immediate values of the instruction. The
+// cleanup of the instruction set encodes the offset as an immediate value, e.g.
+// 'A0 io' and '67 A0 id'; only the instructions from the manual are affected.
+bool HasUnencodedMemoryOffset(const InstructionProto& instruction);
+
 }  // namespace x86
 }  // namespace cpu_instructions
 
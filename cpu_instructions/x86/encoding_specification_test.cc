@@ -402,6 +402,23 @@ TEST(GetAvailableEncodingsTest, GetEncodings) {
   }
 }
 
+TEST(MemoryOffsetTest, HasMemoryOffset) {
+  InstructionProto instruction;
+  instruction.mutable_vendor_syntax()->add_operands()->set_name("AL");
+  EXPECT_FALSE(HasMemoryOffsetOperand(instruction));
+  EXPECT_FALSE(HasUnencodedMemoryOffset(instruction));
+
+  instruction.mutable_vendor_syntax()->add_operands()->set_name("moffs8");
+  EXPECT_TRUE(HasMemoryOffsetOperand(instruction));
+  EXPECT_TRUE(HasUnencodedMemoryOffset(instruction));
+
+  // After the cleanup, the offset is an immediate value ('A0 io').
+  instruction.mutable_x86_encoding_specification()->add_immediate_value_bytes(
+      8);
+  EXPECT_TRUE(HasMemoryOffsetOperand(instruction));
+  EXPECT_FALSE(HasUnencodedMemoryOffset(instruction));
+}
+
 }  // namespace
 }  // namespace x86
 }  // namespace cpu_instructions
@@ -0,0 +1,339 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/x86/encoding_validator.h"
+
+#include "strings/string.h"
+
+#include "base/stringprintf.h"
+#include "cpu_instructions/proto/x86/encoding_specification.pb.h"
+#include "cpu_instructions/proto/x86/instruction_encoding.pb.h"
+#include "cpu_instructions/x86/encoding_specification.h"
+#include "cpu_instructions/x86/instruction_length_decoder.h"
+#include "glog/logging.h"
+#include "strings/str_cat.h"
+
+namespace cpu_instructions {
+namespace x86 {
+namespace {
+
+// Returns true if 'byte' is a prefix that is allowed but not described by the
+// encoding specifications: the LOCK prefix and the segment override prefixes.
+bool IsIgnoredPrefix(uint8_t byte) {
+  switch (byte) {
+    case 0xf0:
+    case 0x2e:
+    case 0x36:
+    case 0x3e:
+    case 0x26:
+    case 0x64:
+    case 0x65:
+      return true;
+    default:
+      return false;
+  }
+}
+
+EncodingValidationResult Mismatch(EncodingMismatch mismatch,
+                                  const string& message) {
+  EncodingValidationResult result;
+  result.mismatch = mismatch;
+  result.message = message;
+  return result;
+}
+
+// The values of the VEX and EVEX prefix fields checked by the validator.
+struct VexFields {
+  VexPrefixType prefix_type = UNDEFINED_VEX_PREFIX;
+  int map_select = 0;
+  int mandatory_prefix = 0;
+  int w = 0;
+  // The vector length; VEX.L for VEX, EVEX.L'L for EVEX.
+  int vector_length = 0;
+  bool is_evex_b_set = false;
+  int num_prefix_bytes = 0;
+};
+
+// Parses the VEX or EVEX prefix at 'code'. Returns false if 'code' is too short
+// to contain the prefix.
+bool ParseVexPrefix(const uint8_t* code, size_t size, VexFields* fields) {
+  switch (code[0]) {
+    case 0xc5:
+      if (size < 2) return false;
+      fields->prefix_type = VEX_PREFIX;
+      fields->map_select = VexEncoding::MAP_SELECT_0F;
+      fields->mandatory_prefix = code[1] & 0x3;
+      fields->vector_length = (code[1] >> 2) & 0x1;
+      fields->num_prefix_bytes = 2;
+      return true;
+    case 0xc4:
+      if (size < 3) return false;
+      fields->prefix_type = VEX_PREFIX;
+      fields->map_select = code[1] & 0x1f;
+      fields->w = code[2] >> 7;
+      fields->mandatory_prefix = code[2] & 0x3;
+      fields->vector_length = (code[2] >> 2) & 0x1;
+      fields->num_prefix_bytes = 3;
+      return true;
+    case 0x62:
+      if (size < 4) return false;
+      fields->prefix_type = EVEX_PREFIX;
+      fields->map_select = code[1] & 0x3;
+      fields->w = code[2] >> 7;
+      fields->mandatory_prefix = code[2] & 0x3;
+      fields->vector_length = (code[3] >> 5) & 0x3;
+      fields->is_evex_b_set = (code[3] & 0x10) != 0;
+      fields->num_prefix_bytes = 4;
+      return true;
+    default:
+      LOG(FATAL) << "Not a VEX prefix: " << static_cast<int>(code[0]);
+  }
+  return false;
+}
+
+// Returns the value of VEX.L or EVEX.L'L required by 'vector_size', or -1 if
+// the vector length is not restricted.
+int GetRequiredVectorLength(VexVectorSize vector_size) {
+  switch (vector_size) {
+    case VEX_VECTOR_SIZE_BIT_IS_ZERO:
+    case VEX_VECTOR_SIZE_128_BIT:
+      return 0;
+    case VEX_VECTOR_SIZE_BIT_IS_ONE:
+    case VEX_VECTOR_SIZE_256_BIT:
+      return 1;
+    case VEX_VECTOR_SIZE_512_BIT:
+      return 2;
+    default:
+      return -1;
+  }
+}
+
+// Checks the fields of the VEX prefix 'fields' against 'specification'. Returns
+// an empty string if they match, or a description of the first difference.
+string CheckVexPrefix(const VexPrefixEncodingSpecification& specification,
+                      const VexFields& fields, bool has_register_only_modrm) {
+  if (fields.prefix_type != specification.prefix_type()) {
+    return StrCat("Expected ", VexPrefixType_Name(specification.prefix_type()),
+                  ", found ", VexPrefixType_Name(fields.prefix_type));
+  }
+  if (fields.map_select != specification.map_select()) {
+    return StrCat("Expected map ",
+                  VexEncoding::MapSelect_Name(specification.map_select()),
+                  ", found ", fields.map_select);
+  }
+  if (fields.mandatory_prefix != specification.mandatory_prefix()) {
+    return StrCat(
+        "Expected ",
+        VexEncoding::MandatoryPrefix_Name(specification.mandatory_prefix()),
+        ", found pp = ", fields.mandatory_prefix);
+  }
+  if ((specification.vex_w_usage() ==
+           VexPrefixEncodingSpecification::VEX_W_IS_ZERO &&
+       fields.w != 0) ||
+      (specification.vex_w_usage() ==
+           VexPrefixEncodingSpecification::VEX_W_IS_ONE &&
+       fields.w != 1)) {
+    return StrCat("Unexpected value of the W bit: ", fields.w);
+  }
+  // With EVEX.b set on a register-only instruction, EVEX.L'L encodes the static
+  // rounding mode instead of the vector length.
+  const bool vector_length_is_rounding_mode =
+      fields.is_evex_b_set && has_register_only_modrm;
+  const int required_vector_length =
+      GetRequiredVectorLength(specification.vector_size());
+  if (!vector_length_is_rounding_mode && required_vector_length >= 0 &&
+      fields.vector_length != required_vector_length) {
+    return StrCat("Expected vector length ", required_vector_length,
+                  ", found ", fields.vector_length);
+  }
+  return "";
+}
+
+}  // namespace
+
+const char* GetEncodingMismatchName(EncodingMismatch mismatch) {
+  switch (mismatch) {
+    case NO_MISMATCH:
+      return "none";
+    case PREFIX_MISMATCH:
+      return "prefix";
+    case OPCODE_MISMATCH:
+      return "opcode";
+    case MODRM_MISMATCH:
+      return "modrm";
+    case LENGTH_MISMATCH:
+      return "length";
+  }
+  return "unknown";
+}
+
+EncodingValidationResult ValidateEncoding(const InstructionProto& instruction,
+                                          const uint8_t* code, size_t size) {
+  CHECK(code != nullptr);
+  if (!instruction.has_x86_encoding_specification()) {
+    return Mismatch(PREFIX_MISMATCH, "No x86 encoding specification");
+  }
+  const EncodingSpecification& specification =
+      instruction.x86_encoding_specification();
+
+  // Legacy prefixes.
+  size_t position = 0;
+  bool has_operand_size_override = false;
+  bool has_address_size_override = false;
+  bool has_repe = false;
+  bool has_repne = false;
+  for (; position < size && position < kMaxInstructionLengthBytes;
+       ++position) {
+    const uint8_t byte = code[position];
+    if (byte == 0x66) {
+      has_operand_size_override = true;
+    } else if (byte == 0x67) {
+      has_address_size_override = true;
+    } else if (byte == 0xf3) {
+      has_repe = true;
+    } else if (byte == 0xf2) {
+      has_repne = true;
+    } else if (!IsIgnoredPrefix(byte)) {
+      break;
+    }
+  }
+  if (position == size) {
+    return Mismatch(LENGTH_MISMATCH, "The code contains only prefixes");
+  }
+
+  // The REX prefix or the VEX/EVEX prefix.
+  const uint8_t first_byte = code[position];
+  const int num_opcode_bytes = specification.opcode() > 0xffff
+                                   ? 3
+                                   : (specification.opcode() > 0xff ? 2 : 1);
+  int num_expected_opcode_bytes = num_opcode_bytes;
+  if (specification.has_vex_prefix()) {
+    if (first_byte != 0xc4 && first_byte != 0xc5 && first_byte != 0x62) {
+      return Mismatch(PREFIX_MISMATCH, "Expected a VEX or EVEX prefix");
+    }
+    if (has_operand_size_override || has_repe || has_repne) {
+      return Mismatch(PREFIX_MISMATCH,
+                      "Mandatory legacy prefixes used with a VEX prefix");
+    }
+    VexFields fields;
+    if (!ParseVexPrefix(code + position, size - position, &fields)) {
+      return Mismatch(LENGTH_MISMATCH, "Incomplete VEX prefix");
+    }
+    position += fields.num_prefix_bytes;
+    // The opcode map is encoded in the prefix; only the last byte of the opcode
+    // follows it.
+    num_expected_opcode_bytes = 1;
+    const bool has_register_only_modrm =
+        specification.modrm_usage() != EncodingSpecification::NO_MODRM_USAGE &&
+        position + 1 < size && (code[position + 1] >> 6) == 3;
+    const string error = CheckVexPrefix(specification.vex_prefix(), fields,
+                                        has_register_only_modrm);
+    if (!error.empty()) return Mismatch(PREFIX_MISMATCH, error);
+  } else {
+    const LegacyPrefixEncodingSpecification& prefixes =
+        specification.legacy_prefixes();
+    if (has_operand_size_override !=
+        prefixes.has_mandatory_operand_size_override_prefix()) {
+      return Mismatch(PREFIX_MISMATCH, "Operand size override prefix mismatch");
+    }
+    if (has_repe != prefixes.has_mandatory_repe_prefix() ||
+        has_repne != prefixes.has_mandatory_repne_prefix()) {
+      return Mismatch(PREFIX_MISMATCH, "REP/REPNE prefix mismatch");
+    }
+    if (prefixes.has_mandatory_address_size_override_prefix() &&
+        !has_address_size_override) {
+      return Mismatch(PREFIX_MISMATCH, "Missing address size override prefix");
+    }
+    bool has_rex_w = false;
+    if ((first_byte & 0xf0) == 0x40) {
+      has_rex_w = (first_byte & 0x08) != 0;
+      ++position;
+    }
+    if (has_rex_w != prefixes.has_mandatory_rex_w_prefix()) {
+      return Mismatch(PREFIX_MISMATCH, "REX.W prefix mismatch");
+    }
+  }
+
+  // The opcode.
+  if (position + num_expected_opcode_bytes > size) {
+    return Mismatch(LENGTH_MISMATCH, "The opcode is incomplete");
+  }
+  for (int i = 0; i < num_expected_opcode_bytes; ++i) {
+    const int shift = 8 * (num_expected_opcode_bytes - i - 1);
+    uint8_t expected_byte = (specification.opcode() >> shift) & 0xff;
+    uint8_t actual_byte = code[position + i];
+    if (i == num_expected_opcode_bytes - 1 &&
+        specification.operand_in_opcode() !=
+            EncodingSpecification::NO_OPERAND_IN_OPCODE) {
+      expected_byte &= 0xf8;
+      actual_byte &= 0xf8;
+    }
+    if (expected_byte != actual_byte) {
+      return Mismatch(
+          OPCODE_MISMATCH,
+          StringPrintf("Expected opcode byte %02X at offset %d, found %02X",
+                       expected_byte, static_cast<int>(position + i),
+                       code[position + i]));
+    }
+  }
+  position += num_expected_opcode_bytes;
+
+  // The ModR/M byte, the SIB byte and the displacement.
+  if (specification.modrm_usage() != EncodingSpecification::NO_MODRM_USAGE) {
+    if (position >= size) {
+      return Mismatch(MODRM_MISMATCH, "Missing the ModR/M byte");
+    }
+    const int modrm_reg = (code[position] >> 3) & 0x7;
+    if (specification.modrm_usage() ==
+            EncodingSpecification::OPCODE_EXTENSION_IN_MODRM &&
+        modrm_reg != specification.modrm_opcode_extension()) {
+      return Mismatch(MODRM_MISMATCH,
+                      StrCat("Expected opcode extension /",
+                             specification.modrm_opcode_extension(),
+                             ", found /", modrm_reg));
+    }
+    const int modrm_length =
+        GetModRmAndSibLength(code + position, size - position);
+    if (modrm_length < 0) {
+      return Mismatch(LENGTH_MISMATCH, "Incomplete SIB or displacement");
+    }
+    position += modrm_length;
+  }
+
+  // Immediate values, code offset and memory offset.
+  int num_trailing_bytes = specification.code_offset_bytes();
+  for (const uint32_t immediate_value_bytes :
+       specification.immediate_value_bytes()) {
+    num_trailing_bytes += immediate_value_bytes;
+  }
+  if (specification.vex_prefix().has_vex_operand_suffix()) {
+    ++num_trailing_bytes;
+  }
+  if (HasUnencodedMemoryOffset(instruction)) {
+    num_trailing_bytes += has_address_size_override ? 4 : 8;
+  }
+  position += num_trailing_bytes;
+  if (position > size) {
+    return Mismatch(LENGTH_MISMATCH,
+                    StrCat("The encoding needs ", position,
+                           " bytes, but the code has only ", size));
+  }
+
+  EncodingValidationResult result;
+  result.length_bytes = position;
+  return result;
+}
+
+}  // namespace x86
+}  // namespace cpu_instructions
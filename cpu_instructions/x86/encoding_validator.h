@@ -0,0 +1,73 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains a function that checks machine code produced by an assembler
+// against the parsed binary encoding specification of the instruction. It is
+// used to validate the encoding specifications in the instruction database
+// against a real assembler.
+
+#ifndef CPU_INSTRUCTIONS_X86_ENCODING_VALIDATOR_H_
+#define CPU_INSTRUCTIONS_X86_ENCODING_VALIDATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include "strings/string.h"
+
+#include "cpu_instructions/proto/instructions.pb.h"
+
+namespace cpu_instructions {
+namespace x86 {
+
+// The parts of the binary encoding that are checked by ValidateEncoding. The
+// values are used to categorize the mismatches in reports.
+enum EncodingMismatch {
+  NO_MISMATCH,
+  // The legacy, REX or VEX prefixes differ from the specification.
+  PREFIX_MISMATCH,
+  // The opcode bytes differ from the specification.
+  OPCODE_MISMATCH,
+  // The ModR/M byte is missing, or it has a wrong opcode extension.
+  MODRM_MISMATCH,
+  // The code is shorter than the encoding predicted by the specification.
+  LENGTH_MISMATCH,
+};
+
+// Returns a human-readable name of 'mismatch'.
+const char* GetEncodingMismatchName(EncodingMismatch mismatch);
+
+// The result of the validation of a single instruction.
+struct EncodingValidationResult {
+  EncodingMismatch mismatch = NO_MISMATCH;
+  // A human-readable description of the mismatch; empty if there is none.
+  string message;
+  // The length of the instruction predicted by the encoding specification, in
+  // bytes. Valid only when there is no mismatch.
+  int length_bytes = 0;
+};
+
+// Checks that the first instruction in 'code' matches the x86 encoding
+// specification of 'instruction': the mandatory legacy and REX prefixes or the
+// fields of the VEX/EVEX prefix, the opcode, the presence of the ModR/M byte
+// and the opcode extension in modrm.reg, and that 'code' is long enough to
+// contain the SIB byte, the displacement and the immediate values. Segment
+// override and LOCK prefixes are skipped. 'size' is the number of bytes
+// available at 'code'; the caller can use 'length_bytes' of the result to
+// check what follows the instruction.
+EncodingValidationResult ValidateEncoding(const InstructionProto& instruction,
+                                          const uint8_t* code, size_t size);
+
+}  // namespace x86
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_X86_ENCODING_VALIDATOR_H_
@@ -0,0 +1,152 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/x86/encoding_validator.h"
+
+#include <cstdint>
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "cpu_instructions/util/proto_util.h"
+#include "gtest/gtest.h"
+
+namespace cpu_instructions {
+namespace x86 {
+namespace {
+
+struct ValidationTestCase {
+  const char* instruction_proto;
+  std::vector<uint8_t> code;
+  EncodingMismatch expected_mismatch;
+  int expected_length_bytes;
+};
+
+void RunTestCases(const std::vector<ValidationTestCase>& test_cases) {
+  for (const ValidationTestCase& test_case : test_cases) {
+    SCOPED_TRACE(test_case.instruction_proto);
+    const InstructionProto instruction =
+        ParseProtoFromStringOrDie<InstructionProto>(
+            test_case.instruction_proto);
+    const EncodingValidationResult result = ValidateEncoding(
+        instruction, test_case.code.data(), test_case.code.size());
+    EXPECT_EQ(result.mismatch, test_case.expected_mismatch) << result.message;
+    if (test_case.expected_mismatch == NO_MISMATCH) {
+      EXPECT_EQ(result.length_bytes, test_case.expected_length_bytes);
+    }
+  }
+}
+
+constexpr char kTestByteExtension[] = R"(
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0xf6 modrm_usage: OPCODE_EXTENSION_IN_MODRM
+      modrm_opcode_extension: 0 immediate_value_bytes: 1 })";
+constexpr char kPopcnt[] = R"(
+    x86_encoding_specification {
+      legacy_prefixes { has_mandatory_repe_prefix: true
+                        has_mandatory_rex_w_prefix: true }
+      opcode: 0x0fb8 modrm_usage: FULL_MODRM })";
+constexpr char kMovImm64[] = R"(
+    x86_encoding_specification {
+      legacy_prefixes { has_mandatory_rex_w_prefix: true } opcode: 0xb8
+      operand_in_opcode: GENERAL_PURPOSE_REGISTER_IN_OPCODE
+      immediate_value_bytes: 8 })";
+constexpr char kMovMoffs[] = R"(
+    vendor_syntax { mnemonic: 'MOV' operands { name: 'AL' }
+                    operands { name: 'moffs8' }}
+    x86_encoding_specification { legacy_prefixes {} opcode: 0xa0 })";
+
+TEST(ValidateEncodingTest, LegacyInstructions) {
+  RunTestCases({
+      // test byte ptr [rax + rbx*8 + 0x10], 1; the trailing C3 is not a part of
+      // the instruction.
+      {kTestByteExtension, {0xf6, 0x44, 0xd8, 0x10, 0x01, 0xc3}, NO_MISMATCH,
+       5},
+      // Wrong opcode extension.
+      {kTestByteExtension, {0xf6, 0x10, 0x01}, MODRM_MISMATCH, 0},
+      // Missing immediate value.
+      {kTestByteExtension, {0xf6, 0x00}, LENGTH_MISMATCH, 0},
+      // popcnt rax, qword ptr fs:[rax]
+      {kPopcnt, {0x64, 0xf3, 0x48, 0x0f, 0xb8, 0x00}, NO_MISMATCH, 6},
+      // Missing REX.W.
+      {kPopcnt, {0xf3, 0x0f, 0xb8, 0x00}, PREFIX_MISMATCH, 0},
+      // Missing REPE.
+      {kPopcnt, {0x48, 0x0f, 0xb8, 0x00}, PREFIX_MISMATCH, 0},
+      // A different opcode.
+      {kPopcnt, {0xf3, 0x48, 0x0f, 0xbc, 0x00}, OPCODE_MISMATCH, 0},
+      // movabs r9, 1
+      {kMovImm64,
+       {0x49, 0xb9, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+       NO_MISMATCH,
+       10},
+      // mov al, [0x1122334455667788]
+      {kMovMoffs,
+       {0xa0, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11},
+       NO_MISMATCH,
+       9},
+      // mov al, [0x11223344]
+      {kMovMoffs, {0x67, 0xa0, 0x44, 0x33, 0x22, 0x11}, NO_MISMATCH, 6},
+  });
+}
+
+constexpr char kVblendvps[] = R"(
+    x86_encoding_specification {
+      opcode: 0x0f3a4a modrm_usage: FULL_MODRM
+      vex_prefix {
+        prefix_type: VEX_PREFIX map_select: MAP_SELECT_0F3A
+        mandatory_prefix: MANDATORY_PREFIX_OPERAND_SIZE_OVERRIDE
+        vector_size: VEX_VECTOR_SIZE_128_BIT vex_w_usage: VEX_W_IS_ZERO
+        has_vex_operand_suffix: true }})";
+constexpr char kVaddpsYmm[] = R"(
+    x86_encoding_specification {
+      opcode: 0x0f58 modrm_usage: FULL_MODRM
+      vex_prefix {
+        prefix_type: VEX_PREFIX map_select: MAP_SELECT_0F
+        vector_size: VEX_VECTOR_SIZE_256_BIT vex_w_usage: VEX_W_IS_IGNORED }})";
+constexpr char kVaddpsZmm[] = R"(
+    x86_encoding_specification {
+      opcode: 0x0f58 modrm_usage: FULL_MODRM
+      vex_prefix {
+        prefix_type: EVEX_PREFIX map_select: MAP_SELECT_0F
+        vector_size: VEX_VECTOR_SIZE_512_BIT vex_w_usage: VEX_W_IS_ZERO }})";
+
+TEST(ValidateEncodingTest, VexInstructions) {
+  RunTestCases({
+      // vblendvps xmm0, xmm1, xmm2, xmm3
+      {kVblendvps, {0xc4, 0xe3, 0x71, 0x4a, 0xc2, 0x30}, NO_MISMATCH, 6},
+      // VEX.W1 instead of VEX.W0.
+      {kVblendvps, {0xc4, 0xe3, 0xf1, 0x4a, 0xc2, 0x30}, PREFIX_MISMATCH, 0},
+      // vaddps ymm0, ymm1, ymmword ptr [rax + 0x100]
+      {kVaddpsYmm,
+       {0xc5, 0xf4, 0x58, 0x80, 0x00, 0x01, 0x00, 0x00},
+       NO_MISMATCH,
+       8},
+      // The same instruction with the three-byte VEX prefix.
+      {kVaddpsYmm, {0xc4, 0xe1, 0x74, 0x58, 0xc2}, NO_MISMATCH, 5},
+      // vaddps xmm0, xmm1, xmm2 uses a different vector length.
+      {kVaddpsYmm, {0xc5, 0xf0, 0x58, 0xc2}, PREFIX_MISMATCH, 0},
+      // A legacy encoding of addps.
+      {kVaddpsYmm, {0x0f, 0x58, 0xc2}, PREFIX_MISMATCH, 0},
+      // vaddps zmm0, zmm1, zmmword ptr [rax + 0x40]
+      {kVaddpsZmm, {0x62, 0xf1, 0x74, 0x48, 0x58, 0x40, 0x01}, NO_MISMATCH, 7},
+      // vaddps zmm0, zmm1, zmm2, {rn-sae}: EVEX.L'L is the rounding mode.
+      {kVaddpsZmm, {0x62, 0xf1, 0x74, 0x18, 0x58, 0xc2}, NO_MISMATCH, 6},
+      // A VEX encoding of an EVEX instruction.
+      {kVaddpsZmm, {0xc5, 0xf4, 0x58, 0xc2}, PREFIX_MISMATCH, 0},
+  });
+}
+
+}  // namespace
+}  // namespace x86
+}  // namespace cpu_instructions
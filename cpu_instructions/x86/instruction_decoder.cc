@@ -0,0 +1,307 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/x86/instruction_decoder.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "cpu_instructions/proto/x86/instruction_encoding.pb.h"
+#include "cpu_instructions/x86/encoding_specification.h"
+#include "glog/logging.h"
+
+namespace cpu_instructions {
+namespace x86 {
+namespace {
+
+// Returns true if 'byte' is a legacy prefix other than the operand size
+// override, address size override and the REP prefixes.
+bool IsOtherLegacyPrefix(uint8_t byte) {
+  switch (byte) {
+    case 0xf0:  // LOCK
+    case 0x2e:  // CS override/branch not taken.
+    case 0x36:  // SS override.
+    case 0x3e:  // DS override/branch taken.
+    case 0x26:  // ES override.
+    case 0x64:  // FS override.
+    case 0x65:  // GS override.
+      return true;
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+InstructionDecoder::InstructionDecoder(
+    const InstructionSetProto& instruction_set)
+    : index_(instruction_set),
+      instructions_(instruction_set.instructions_size()) {
+  for (int i = 0; i < instruction_set.instructions_size(); ++i) {
+    const InstructionProto& instruction = instruction_set.instructions(i);
+    if (!instruction.has_x86_encoding_specification()) continue;
+    const EncodingSpecification& encoding_specification =
+        instruction.x86_encoding_specification();
+    InstructionInfo& info = instructions_[i];
+
+    info.num_trailing_opcode_bytes =
+        GetNumTrailingOpcodeBytes(encoding_specification);
+    CHECK_LE(info.num_trailing_opcode_bytes, 2)
+        << instruction.raw_encoding_specification();
+    for (int byte = 0; byte < info.num_trailing_opcode_bytes; ++byte) {
+      const int shift = 8 * (info.num_trailing_opcode_bytes - byte - 1);
+      info.trailing_opcode_bytes[byte] =
+          (encoding_specification.opcode() >> shift) & 0xff;
+    }
+    if (info.num_trailing_opcode_bytes > 0 &&
+        encoding_specification.operand_in_opcode() !=
+            EncodingSpecification::NO_OPERAND_IN_OPCODE) {
+      info.last_trailing_opcode_byte_mask = 0xf8;
+    }
+
+    info.has_modrm = encoding_specification.modrm_usage() !=
+                     EncodingSpecification::NO_MODRM_USAGE;
+    if (encoding_specification.modrm_usage() ==
+        EncodingSpecification::OPCODE_EXTENSION_IN_MODRM) {
+      info.modrm_opcode_extension =
+          encoding_specification.modrm_opcode_extension();
+    }
+    info.has_mandatory_operand_size_override =
+        encoding_specification.legacy_prefixes()
+            .has_mandatory_operand_size_override_prefix();
+    info.has_mandatory_address_size_override =
+        encoding_specification.legacy_prefixes()
+            .has_mandatory_address_size_override_prefix();
+
+    for (const uint32_t immediate_value_bytes :
+         encoding_specification.immediate_value_bytes()) {
+      info.num_immediate_bytes += immediate_value_bytes;
+    }
+    info.num_immediate_bytes += encoding_specification.code_offset_bytes();
+    if (encoding_specification.vex_prefix().has_vex_operand_suffix()) {
+      // The register operand encoded in imm8[7:4].
+      ++info.num_immediate_bytes;
+    }
+    info.has_memory_offset = HasUnencodedMemoryOffset(instruction);
+  }
+}
+
+bool InstructionDecoder::DecodeInstruction(
+    const uint8_t* code, size_t size, DecodedInstruction* instruction) const {
+  CHECK(code != nullptr);
+  CHECK(instruction != nullptr);
+  size = std::min<size_t>(size, kMaxInstructionLengthBytes);
+
+  // Legacy prefixes. When there are multiple REP prefixes, the last one wins.
+  size_t position = 0;
+  bool has_operand_size_override = false;
+  bool has_address_size_override = false;
+  VexEncoding::MandatoryPrefix rep_prefix = VexEncoding::NO_MANDATORY_PREFIX;
+  for (; position < size; ++position) {
+    const uint8_t byte = code[position];
+    if (byte == 0x66) {
+      has_operand_size_override = true;
+    } else if (byte == 0x67) {
+      has_address_size_override = true;
+    } else if (byte == 0xf2) {
+      rep_prefix = VexEncoding::MANDATORY_PREFIX_REPNE;
+    } else if (byte == 0xf3) {
+      rep_prefix = VexEncoding::MANDATORY_PREFIX_REPE;
+    } else if (!IsOtherLegacyPrefix(byte)) {
+      break;
+    }
+  }
+  if (position >= size) return false;
+
+  // The REX prefix.
+  OpcodeIndex::Key key;
+  bool has_rex_prefix = false;
+  key.w_bit = 0;
+  if ((code[position] & 0xf0) == 0x40) {
+    has_rex_prefix = true;
+    key.w_bit = (code[position] >> 3) & 1;
+    ++position;
+    if (position >= size) return false;
+  }
+
+  // The VEX and EVEX prefixes, or the opcode map escape bytes. In the 64-bit
+  // mode, C4, C5 and 62 are always the VEX and EVEX prefixes.
+  VexEncoding::MandatoryPrefix mandatory_prefixes[3];
+  int num_mandatory_prefixes = 0;
+  bool is_evex_with_embedded_rounding = false;
+  const uint8_t first_byte = code[position];
+  if (first_byte == 0xc4 || first_byte == 0xc5 || first_byte == 0x62) {
+    // The VEX and EVEX prefixes can't be combined with REX and the mandatory
+    // prefixes.
+    if (has_rex_prefix || has_operand_size_override ||
+        rep_prefix != VexEncoding::NO_MANDATORY_PREFIX) {
+      return false;
+    }
+    int payload_bits = 0;
+    if (first_byte == 0xc5) {
+      if (position + 2 > size) return false;
+      const uint8_t payload = code[position + 1];
+      key.encoding_space = OpcodeIndex::VEX_ENCODING;
+      key.map_select = VexEncoding::MAP_SELECT_0F;
+      key.w_bit = 0;
+      key.vector_length = (payload >> 2) & 1;
+      payload_bits = payload & 3;
+      position += 2;
+    } else if (first_byte == 0xc4) {
+      if (position + 3 > size) return false;
+      const uint8_t map_select = code[position + 1] & 0x1f;
+      const uint8_t payload = code[position + 2];
+      if (map_select < 1 || map_select > 3) return false;
+      key.encoding_space = OpcodeIndex::VEX_ENCODING;
+      key.map_select = static_cast<VexEncoding::MapSelect>(map_select);
+      key.w_bit = payload >> 7;
+      key.vector_length = (payload >> 2) & 1;
+      payload_bits = payload & 3;
+      position += 3;
+    } else {
+      if (position + 4 > size) return false;
+      const uint8_t map_select = code[position + 1] & 0x03;
+      const uint8_t payload = code[position + 2];
+      const uint8_t last_payload = code[position + 3];
+      if (map_select == 0) return false;
+      key.encoding_space = OpcodeIndex::EVEX_ENCODING;
+      key.map_select = static_cast<VexEncoding::MapSelect>(map_select);
+      key.w_bit = payload >> 7;
+      key.vector_length = (last_payload >> 5) & 3;
+      // With EVEX.b set on a register-only instruction, EVEX.L'L is the static
+      // rounding control; this is checked once the ModR/M byte is known.
+      is_evex_with_embedded_rounding = (last_payload & 0x10) != 0;
+      payload_bits = payload & 3;
+      position += 4;
+    }
+    // The values of VEX.pp use the same order as VexEncoding::MandatoryPrefix.
+    mandatory_prefixes[num_mandatory_prefixes++] =
+        static_cast<VexEncoding::MandatoryPrefix>(payload_bits);
+  } else {
+    key.encoding_space = OpcodeIndex::LEGACY_ENCODING;
+    key.map_select = VexEncoding::UNDEFINED_OPERAND_MAP;
+    if (first_byte == 0x0f) {
+      key.map_select = VexEncoding::MAP_SELECT_0F;
+      ++position;
+      if (position < size && code[position] == 0x38) {
+        key.map_select = VexEncoding::MAP_SELECT_0F38;
+        ++position;
+      } else if (position < size && code[position] == 0x3a) {
+        key.map_select = VexEncoding::MAP_SELECT_0F3A;
+        ++position;
+      }
+    }
+    // A prefix is mandatory only if there is an instruction that requires it;
+    // otherwise it is a modifier of an instruction without mandatory prefixes.
+    if (rep_prefix != VexEncoding::NO_MANDATORY_PREFIX) {
+      mandatory_prefixes[num_mandatory_prefixes++] = rep_prefix;
+    }
+    if (has_operand_size_override) {
+      mandatory_prefixes[num_mandatory_prefixes++] =
+          VexEncoding::MANDATORY_PREFIX_OPERAND_SIZE_OVERRIDE;
+    }
+    mandatory_prefixes[num_mandatory_prefixes++] =
+        VexEncoding::NO_MANDATORY_PREFIX;
+  }
+  if (position >= size) return false;
+  key.opcode = code[position++];
+  if (is_evex_with_embedded_rounding && position < size &&
+      (code[position] >> 6) == 3) {
+    key.vector_length = OpcodeIndex::kAny;
+  }
+
+  const uint8_t* const trailing_bytes = code + position;
+  const size_t trailing_size = size - position;
+  for (int i = 0; i < num_mandatory_prefixes; ++i) {
+    key.mandatory_prefix = mandatory_prefixes[i];
+    OpcodeIndex::InstructionRange candidates = index_.Lookup(key);
+    if (candidates.empty() && key.encoding_space == OpcodeIndex::LEGACY_ENCODING
+        && key.w_bit == 1) {
+      // Most legacy instructions ignore REX.W; they are indexed under W = 0.
+      OpcodeIndex::Key key_without_rex_w = key;
+      key_without_rex_w.w_bit = 0;
+      candidates = index_.Lookup(key_without_rex_w);
+    }
+
+    // Prefer the instructions that fix more of the bytes following the opcode
+    // byte, and then the instructions that agree with the presence of the
+    // operand size and the address size override prefixes. The latter tells
+    // apart the two forms of the instructions with a memory offset, e.g.
+    // 'A0 io' and '67 A0 id'.
+    int best_candidate = -1;
+    int best_score = -1;
+    for (const int candidate : candidates) {
+      const InstructionInfo& info = instructions_[candidate];
+      if (!MatchesTrailingBytes(info, trailing_bytes, trailing_size)) continue;
+      int score = 4 * info.num_trailing_opcode_bytes;
+      if (info.modrm_opcode_extension >= 0) score += 2;
+      if (key.encoding_space != OpcodeIndex::LEGACY_ENCODING ||
+          info.has_mandatory_operand_size_override ==
+              has_operand_size_override) {
+        ++score;
+      }
+      if (info.has_mandatory_address_size_override ==
+          has_address_size_override) {
+        ++score;
+      }
+      if (score > best_score) {
+        best_candidate = candidate;
+        best_score = score;
+      }
+    }
+    if (best_candidate < 0) continue;
+
+    const InstructionInfo& info = instructions_[best_candidate];
+    size_t length = position + info.num_trailing_opcode_bytes;
+    if (info.has_modrm) {
+      const int modrm_length =
+          GetModRmAndSibLength(code + length, size - length);
+      if (modrm_length < 0) return false;
+      length += modrm_length;
+    }
+    if (info.has_memory_offset) {
+      length += has_address_size_override ? 4 : 8;
+    }
+    length += info.num_immediate_bytes;
+    if (length > size) return false;
+
+    instruction->instruction_index = best_candidate;
+    instruction->length_bytes = length;
+    return true;
+  }
+  return false;
+}
+
+bool InstructionDecoder::MatchesTrailingBytes(const InstructionInfo& info,
+                                              const uint8_t* code,
+                                              size_t size) {
+  const size_t num_fixed_bytes =
+      info.num_trailing_opcode_bytes + (info.has_modrm ? 1 : 0);
+  if (size < num_fixed_bytes) return false;
+  for (int i = 0; i < info.num_trailing_opcode_bytes; ++i) {
+    const uint8_t mask = i == info.num_trailing_opcode_bytes - 1
+                             ? info.last_trailing_opcode_byte_mask
+                             : 0xff;
+    if ((code[i] & mask) != info.trailing_opcode_bytes[i]) return false;
+  }
+  if (info.modrm_opcode_extension >= 0) {
+    const uint8_t modrm = code[info.num_trailing_opcode_bytes];
+    if (((modrm >> 3) & 7) != info.modrm_opcode_extension) return false;
+  }
+  return true;
+}
+
+}  // namespace x86
+}  // namespace cpu_instructions
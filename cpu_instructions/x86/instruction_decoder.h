@@ -0,0 +1,99 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains a table-driven decoder of x86-64 machine code. The decoder matches
+// the bytes against the encoding specifications of the instructions of an
+// InstructionSetProto, and returns the instruction and the length of its
+// encoding. It does not decode the operands.
+
+#ifndef CPU_INSTRUCTIONS_X86_INSTRUCTION_DECODER_H_
+#define CPU_INSTRUCTIONS_X86_INSTRUCTION_DECODER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "cpu_instructions/proto/x86/encoding_specification.pb.h"
+#include "cpu_instructions/x86/instruction_length_decoder.h"
+#include "cpu_instructions/x86/opcode_index.h"
+
+namespace cpu_instructions {
+namespace x86 {
+
+// The result of decoding a single instruction.
+struct DecodedInstruction {
+  // The index of the instruction in the instruction set used by the decoder.
+  int instruction_index = -1;
+  // The length of the binary encoding of the instruction in bytes.
+  int length_bytes = 0;
+};
+
+// Decodes machine code in the 64-bit mode. The decoder is immutable after
+// construction, and it can be used from multiple threads at the same time.
+class InstructionDecoder {
+ public:
+  // Creates a decoder for the instructions in 'instruction_set'. The decoder
+  // uses only the instructions that have a parsed x86 encoding specification.
+  // It does not keep a reference to 'instruction_set'.
+  explicit InstructionDecoder(const InstructionSetProto& instruction_set);
+
+  InstructionDecoder(const InstructionDecoder&) = delete;
+  InstructionDecoder& operator=(const InstructionDecoder&) = delete;
+
+  // Decodes the instruction at the beginning of 'code'; 'size' is the number
+  // of bytes available at 'code'. Returns true and fills 'instruction' when the
+  // bytes are a valid encoding of one of the instructions of the instruction
+  // set; otherwise, returns false and leaves 'instruction' unchanged.
+  bool DecodeInstruction(const uint8_t* code, size_t size,
+                         DecodedInstruction* instruction) const;
+
+ private:
+  // Information about an instruction that is needed by the decoder,
+  // precomputed from its encoding specification.
+  struct InstructionInfo {
+    // The opcode bytes that follow the opcode byte used in the opcode index,
+    // e.g. the fixed ModR/M byte in "0F 01 D0".
+    uint8_t trailing_opcode_bytes[2] = {0, 0};
+    int num_trailing_opcode_bytes = 0;
+    // The mask applied to the last trailing opcode byte before comparing it;
+    // used when the last opcode byte also encodes an operand.
+    uint8_t last_trailing_opcode_byte_mask = 0xff;
+    bool has_modrm = false;
+    // The value of modrm.reg, or -1 if it is not fixed by the instruction.
+    int modrm_opcode_extension = -1;
+    bool has_mandatory_operand_size_override = false;
+    bool has_mandatory_address_size_override = false;
+    // The number of bytes following the ModR/M byte and the displacement;
+    // these include the immediate values, the code offset and the VEX operand
+    // suffix.
+    int num_immediate_bytes = 0;
+    // Instructions using a memory offset operand (moffs) have an absolute
+    // address encoded after the opcode. Its size depends on the address size.
+    bool has_memory_offset = false;
+  };
+
+  // Returns true if the instruction 'info' matches the bytes following the
+  // opcode byte at 'code'.
+  static bool MatchesTrailingBytes(const InstructionInfo& info,
+                                   const uint8_t* code, size_t size);
+
+  OpcodeIndex index_;
+  std::vector<InstructionInfo> instructions_;
+};
+
+}  // namespace x86
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_X86_INSTRUCTION_DECODER_H_
@@ -0,0 +1,237 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/x86/instruction_decoder.h"
+
+#include <cstdint>
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "cpu_instructions/util/proto_util.h"
+#include "gtest/gtest.h"
+
+namespace cpu_instructions {
+namespace x86 {
+namespace {
+
+// The indices of the instructions are referenced by the tests below.
+constexpr char kInstructionSet[] = R"(
+  instructions {  # 0
+    vendor_syntax { mnemonic: 'ADD' operands { name: 'r/m32' }
+                    operands { name: 'imm8' }}
+    raw_encoding_specification: '83 /0 ib'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0x83 modrm_usage: OPCODE_EXTENSION_IN_MODRM
+      modrm_opcode_extension: 0 immediate_value_bytes: 1 }}
+  instructions {  # 1
+    vendor_syntax { mnemonic: 'ADD' operands { name: 'r/m64' }
+                    operands { name: 'imm8' }}
+    raw_encoding_specification: 'REX.W + 83 /0 ib'
+    x86_encoding_specification {
+      legacy_prefixes { has_mandatory_rex_w_prefix: true } opcode: 0x83
+      modrm_usage: OPCODE_EXTENSION_IN_MODRM modrm_opcode_extension: 0
+      immediate_value_bytes: 1 }}
+  instructions {  # 2
+    vendor_syntax { mnemonic: 'ADD' operands { name: 'r/m16' }
+                    operands { name: 'imm8' }}
+    raw_encoding_specification: '66 83 /0 ib'
+    x86_encoding_specification {
+      legacy_prefixes { has_mandatory_operand_size_override_prefix: true }
+      opcode: 0x83 modrm_usage: OPCODE_EXTENSION_IN_MODRM
+      modrm_opcode_extension: 0 immediate_value_bytes: 1 }}
+  instructions {  # 3
+    vendor_syntax { mnemonic: 'ADDPS' }
+    raw_encoding_specification: '0F 58 /r'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0x0f58 modrm_usage: FULL_MODRM }}
+  instructions {  # 4
+    vendor_syntax { mnemonic: 'ADDSD' }
+    raw_encoding_specification: 'F2 0F 58 /r'
+    x86_encoding_specification {
+      legacy_prefixes { has_mandatory_repne_prefix: true }
+      opcode: 0x0f58 modrm_usage: FULL_MODRM }}
+  instructions {  # 5
+    vendor_syntax { mnemonic: 'XGETBV' }
+    raw_encoding_specification: '0F 01 D0'
+    x86_encoding_specification { legacy_prefixes {} opcode: 0x0f01d0 }}
+  instructions {  # 6
+    vendor_syntax { mnemonic: 'LGDT' operands { name: 'm16&64' }}
+    raw_encoding_specification: '0F 01 /2'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0x0f01 modrm_usage: OPCODE_EXTENSION_IN_MODRM
+      modrm_opcode_extension: 2 }}
+  instructions {  # 7
+    vendor_syntax { mnemonic: 'VADDPS' }
+    raw_encoding_specification: 'VEX.NDS.256.0F.WIG 58 /r'
+    x86_encoding_specification {
+      opcode: 0x0f58 modrm_usage: FULL_MODRM
+      vex_prefix {
+        prefix_type: VEX_PREFIX map_select: MAP_SELECT_0F
+        vector_size: VEX_VECTOR_SIZE_256_BIT vex_w_usage: VEX_W_IS_IGNORED }}}
+  instructions {  # 8
+    vendor_syntax { mnemonic: 'VBLENDVPS' }
+    raw_encoding_specification: 'VEX.NDS.128.66.0F3A.W0 4A /r /is4'
+    x86_encoding_specification {
+      opcode: 0x0f3a4a modrm_usage: FULL_MODRM
+      vex_prefix {
+        prefix_type: VEX_PREFIX map_select: MAP_SELECT_0F3A
+        mandatory_prefix: MANDATORY_PREFIX_OPERAND_SIZE_OVERRIDE
+        vector_size: VEX_VECTOR_SIZE_128_BIT vex_w_usage: VEX_W_IS_ZERO
+        has_vex_operand_suffix: true }}}
+  instructions {  # 9
+    vendor_syntax { mnemonic: 'MOV' operands { name: 'AL' }
+                    operands { name: 'moffs8' }}
+    raw_encoding_specification: 'A0'
+    x86_encoding_specification { legacy_prefixes {} opcode: 0xa0 }}
+  instructions {  # 10
+    vendor_syntax { mnemonic: 'CALL' operands { name: 'rel32' }}
+    raw_encoding_specification: 'E8 cd'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0xe8 code_offset_bytes: 4 }}
+  instructions {  # 11
+    vendor_syntax { mnemonic: 'PUSH' operands { name: 'r64' }}
+    raw_encoding_specification: '50+rd'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0x50
+      operand_in_opcode: GENERAL_PURPOSE_REGISTER_IN_OPCODE }}
+  instructions {  # 12
+    vendor_syntax { mnemonic: 'VADDPS' }
+    raw_encoding_specification: 'EVEX.NDS.512.0F.W0 58 /r'
+    x86_encoding_specification {
+      opcode: 0x0f58 modrm_usage: FULL_MODRM
+      vex_prefix {
+        prefix_type: EVEX_PREFIX map_select: MAP_SELECT_0F
+        vector_size: VEX_VECTOR_SIZE_512_BIT vex_w_usage: VEX_W_IS_ZERO }}}
+  instructions {  # 13
+    vendor_syntax { mnemonic: 'MOV' operands { name: 'EAX' }
+                    operands { name: 'moffs32' }}
+    raw_encoding_specification: 'A1 io'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0xa1 immediate_value_bytes: 8 }}
+  instructions {  # 14
+    vendor_syntax { mnemonic: 'MOV' operands { name: 'EAX' }
+                    operands { name: 'moffs32' }}
+    raw_encoding_specification: '67 A1 id'
+    x86_encoding_specification {
+      legacy_prefixes { has_mandatory_address_size_override_prefix: true }
+      opcode: 0xa1 immediate_value_bytes: 4 }})";
+
+class InstructionDecoderTest : public ::testing::Test {
+ protected:
+  InstructionDecoderTest()
+      : decoder_(
+            ParseProtoFromStringOrDie<InstructionSetProto>(kInstructionSet)) {}
+
+  // Decodes 'code' and checks that it is decoded as the instruction with index
+  // 'expected_instruction_index' that spans all bytes of 'code'.
+  void CheckDecode(const std::vector<uint8_t>& code,
+                   int expected_instruction_index) {
+    DecodedInstruction instruction;
+    ASSERT_TRUE(decoder_.DecodeInstruction(code.data(), code.size(),
+                                           &instruction));
+    EXPECT_EQ(instruction.instruction_index, expected_instruction_index);
+    EXPECT_EQ(instruction.length_bytes, code.size());
+
+    // The instruction must not be decoded when it is truncated.
+    DecodedInstruction truncated_instruction;
+    EXPECT_FALSE(decoder_.DecodeInstruction(code.data(), code.size() - 1,
+                                            &truncated_instruction));
+  }
+
+  const InstructionDecoder decoder_;
+};
+
+TEST_F(InstructionDecoderTest, LegacyInstructions) {
+  // add eax, 1
+  CheckDecode({0x83, 0xc0, 0x01}, 0);
+  // add rax, 1
+  CheckDecode({0x48, 0x83, 0xc0, 0x01}, 1);
+  // add ax, 1
+  CheckDecode({0x66, 0x83, 0xc0, 0x01}, 2);
+  // addps xmm0, xmm1
+  CheckDecode({0x0f, 0x58, 0xc1}, 3);
+  // addsd xmm0, xmm1
+  CheckDecode({0xf2, 0x0f, 0x58, 0xc1}, 4);
+  // xgetbv
+  CheckDecode({0x0f, 0x01, 0xd0}, 5);
+  // lgdt [rax]
+  CheckDecode({0x0f, 0x01, 0x10}, 6);
+  // mov al, [0x1122334455667788]
+  CheckDecode({0xa0, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11}, 9);
+  // mov al, [0x11223344]
+  CheckDecode({0x67, 0xa0, 0x44, 0x33, 0x22, 0x11}, 9);
+  // mov eax, [0x1122334455667788], with the offset encoded as an immediate.
+  CheckDecode({0xa1, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11}, 13);
+  // mov eax, [0x11223344]; the address size override prefix selects the
+  // 32-bit form of the same opcode.
+  CheckDecode({0x67, 0xa1, 0x44, 0x33, 0x22, 0x11}, 14);
+  // call rel32
+  CheckDecode({0xe8, 0x00, 0x00, 0x00, 0x00}, 10);
+  // push rbx
+  CheckDecode({0x53}, 11);
+}
+
+TEST_F(InstructionDecoderTest, ModRmAndSib) {
+  // add dword ptr [rax + 0x10], 1
+  CheckDecode({0x83, 0x40, 0x10, 0x01}, 0);
+  // add dword ptr [rax + 0x1000], 1
+  CheckDecode({0x83, 0x80, 0x00, 0x10, 0x00, 0x00, 0x01}, 0);
+  // add dword ptr [rip + 0x10], 1
+  CheckDecode({0x83, 0x05, 0x10, 0x00, 0x00, 0x00, 0x01}, 0);
+  // add dword ptr [rax + rbx*4], 1
+  CheckDecode({0x83, 0x04, 0x98, 0x01}, 0);
+  // add dword ptr [rbx*4 + 0x10], 1
+  CheckDecode({0x83, 0x04, 0x9d, 0x10, 0x00, 0x00, 0x00, 0x01}, 0);
+  // add dword ptr fs:[rax + rbx*4 + 0x10], 1
+  CheckDecode({0x64, 0x83, 0x44, 0x98, 0x10, 0x01}, 0);
+}
+
+TEST_F(InstructionDecoderTest, VexInstructions) {
+  // vaddps ymm0, ymm1, ymm2 with the two-byte VEX prefix.
+  CheckDecode({0xc5, 0xf4, 0x58, 0xc2}, 7);
+  // vaddps ymm0, ymm1, ymm2 with the three-byte VEX prefix and VEX.W = 1.
+  CheckDecode({0xc4, 0xe1, 0xf4, 0x58, 0xc2}, 7);
+  // vblendvps xmm0, xmm1, xmm2, xmm3
+  CheckDecode({0xc4, 0xe3, 0x71, 0x4a, 0xc2, 0x30}, 8);
+  // vaddps zmm0, zmm1, zmm2
+  CheckDecode({0x62, 0xf1, 0x74, 0x48, 0x58, 0xc2}, 12);
+  // vaddps zmm0, zmm1, zmm2, {rz-sae}
+  CheckDecode({0x62, 0xf1, 0x74, 0x78, 0x58, 0xc2}, 12);
+}
+
+TEST_F(InstructionDecoderTest, InvalidInstructions) {
+  DecodedInstruction instruction;
+  // An unknown opcode.
+  const uint8_t kUnknownOpcode[] = {0x0f, 0x0b};
+  EXPECT_FALSE(decoder_.DecodeInstruction(kUnknownOpcode,
+                                          sizeof(kUnknownOpcode), &instruction));
+  // An opcode extension that is not in the instruction set.
+  const uint8_t kUnknownExtension[] = {0x83, 0xe8, 0x01};
+  EXPECT_FALSE(decoder_.DecodeInstruction(
+      kUnknownExtension, sizeof(kUnknownExtension), &instruction));
+  // vaddps with VEX.L = 0.
+  const uint8_t kWrongVectorLength[] = {0xc5, 0xf0, 0x58, 0xc2};
+  EXPECT_FALSE(decoder_.DecodeInstruction(
+      kWrongVectorLength, sizeof(kWrongVectorLength), &instruction));
+  // Only prefixes.
+  const uint8_t kOnlyPrefixes[] = {0x66, 0x48};
+  EXPECT_FALSE(decoder_.DecodeInstruction(kOnlyPrefixes, sizeof(kOnlyPrefixes),
+                                          &instruction));
+  EXPECT_EQ(instruction.instruction_index, -1);
+}
+
+}  // namespace
+}  // namespace x86
+}  // namespace cpu_instructions
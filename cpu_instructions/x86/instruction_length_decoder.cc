@@ -0,0 +1,422 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/x86/instruction_length_decoder.h"
+
+#include <immintrin.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "cpu_instructions/proto/x86/encoding_specification.pb.h"
+#include "cpu_instructions/proto/x86/instruction_encoding.pb.h"
+#include "cpu_instructions/x86/encoding_specification.h"
+#include "cpu_instructions/x86/opcode_index.h"
+#include "glog/logging.h"
+
+namespace cpu_instructions {
+namespace x86 {
+namespace {
+
+// The number of bytes classified at once by the prefix mask functions.
+constexpr int kPrefixMaskWidth = 32;
+
+// Returns true if 'byte' is a legacy prefix or a REX prefix.
+bool IsPrefix(uint8_t byte) {
+  switch (byte) {
+    case 0x26:
+    case 0x2e:
+    case 0x36:
+    case 0x3e:
+    case 0x64:
+    case 0x65:
+    case 0x66:
+    case 0x67:
+    case 0xf0:
+    case 0xf2:
+    case 0xf3:
+      return true;
+    default:
+      return (byte & 0xf0) == 0x40;
+  }
+}
+
+// Returns a bit mask where bit i is set if bytes[i] is a legacy or REX prefix.
+// Uses SSE2, which is available on all x86-64 CPUs.
+uint32_t GetPrefixMaskSse2(const uint8_t* bytes) {
+  uint32_t mask = 0;
+  for (int half = 0; half < 2; ++half) {
+    const __m128i data = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(bytes + 16 * half));
+    __m128i is_prefix = _mm_cmpeq_epi8(
+        _mm_and_si128(data, _mm_set1_epi8(static_cast<char>(0xf0))),
+        _mm_set1_epi8(0x40));
+    for (const uint8_t prefix : {0x26, 0x2e, 0x36, 0x3e, 0x64, 0x65, 0x66,
+                                 0x67, 0xf0, 0xf2, 0xf3}) {
+      is_prefix = _mm_or_si128(
+          is_prefix,
+          _mm_cmpeq_epi8(data, _mm_set1_epi8(static_cast<char>(prefix))));
+    }
+    mask |= static_cast<uint32_t>(_mm_movemask_epi8(is_prefix)) << (16 * half);
+  }
+  return mask;
+}
+
+// The AVX2 version of GetPrefixMaskSse2. It is compiled for AVX2 regardless of
+// the compiler flags, and it is used only when the host supports AVX2.
+__attribute__((target("avx2"))) uint32_t GetPrefixMaskAvx2(
+    const uint8_t* bytes) {
+  const __m256i data =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes));
+  __m256i is_prefix = _mm256_cmpeq_epi8(
+      _mm256_and_si256(data, _mm256_set1_epi8(static_cast<char>(0xf0))),
+      _mm256_set1_epi8(0x40));
+  for (const uint8_t prefix : {0x26, 0x2e, 0x36, 0x3e, 0x64, 0x65, 0x66, 0x67,
+                               0xf0, 0xf2, 0xf3}) {
+    is_prefix = _mm256_or_si256(
+        is_prefix,
+        _mm256_cmpeq_epi8(data, _mm256_set1_epi8(static_cast<char>(prefix))));
+  }
+  return static_cast<uint32_t>(_mm256_movemask_epi8(is_prefix));
+}
+
+}  // namespace
+
+constexpr uint8_t InstructionLengthDecoder::kInvalidLength;
+
+int GetModRmAndSibLength(const uint8_t* modrm, size_t size) {
+  if (size < 1) return -1;
+  const int mod = *modrm >> 6;
+  const int rm = *modrm & 7;
+  if (mod == 3) return 1;
+  int length = 1;
+  int base = rm;
+  if (rm == 4) {
+    // The SIB byte follows the ModR/M byte.
+    if (size < 2) return -1;
+    base = modrm[1] & 7;
+    ++length;
+  }
+  switch (mod) {
+    case 0:
+      // RIP-relative addressing without SIB, or no base register with SIB.
+      if (base == 5) length += 4;
+      break;
+    case 1:
+      length += 1;
+      break;
+    case 2:
+      length += 4;
+      break;
+  }
+  return length <= static_cast<int>(size) ? length : -1;
+}
+
+InstructionLengthDecoder::InstructionLengthDecoder(
+    const InstructionSetProto& instruction_set)
+    : opcode_info_index_(3 * 4 * 4 * 256, -1),
+      uses_avx2_(__builtin_cpu_supports("avx2")) {
+  std::vector<bool> is_ambiguous;
+  for (const InstructionProto& instruction : instruction_set.instructions()) {
+    if (!instruction.has_x86_encoding_specification()) continue;
+    const EncodingSpecification& encoding_specification =
+        instruction.x86_encoding_specification();
+    OpcodeIndex::Key key;
+    GetOpcodeIndexKey(encoding_specification, &key);
+    const int num_trailing_opcode_bytes =
+        GetNumTrailingOpcodeBytes(encoding_specification);
+
+    // The first opcode byte after the opcode byte in the key has the same
+    // length as a register-only ModR/M byte, e.g. "D0" in "0F 01 D0". Any
+    // further opcode bytes are treated as immediate values.
+    const bool has_modrm = encoding_specification.modrm_usage() !=
+                               EncodingSpecification::NO_MODRM_USAGE ||
+                           num_trailing_opcode_bytes > 0;
+    // The size of the memory offset (moffs) depends only on the address size
+    // override prefix; it is added by GetLengthAfterPrefixes. The cleanup of
+    // the instruction set encodes the offset as an immediate value ('A0 io',
+    // '67 A0 id'), and both forms share one opcode slot, so the immediate
+    // values of these instructions are not counted here. The instructions
+    // with a memory offset have no other immediate values.
+    const bool has_memory_offset = HasMemoryOffsetOperand(instruction);
+    int num_immediate_bytes = encoding_specification.code_offset_bytes() +
+                              std::max(0, num_trailing_opcode_bytes - 1);
+    if (!has_memory_offset) {
+      for (const uint32_t immediate_value_bytes :
+           encoding_specification.immediate_value_bytes()) {
+        num_immediate_bytes += immediate_value_bytes;
+      }
+    }
+    if (encoding_specification.vex_prefix().has_vex_operand_suffix()) {
+      ++num_immediate_bytes;
+    }
+
+    // The values of modrm.reg and the W bit accepted by the instruction.
+    int first_digit = 0;
+    int last_digit = 7;
+    if (encoding_specification.modrm_usage() ==
+        EncodingSpecification::OPCODE_EXTENSION_IN_MODRM) {
+      first_digit = last_digit =
+          encoding_specification.modrm_opcode_extension();
+    } else if (num_trailing_opcode_bytes > 0) {
+      const int shift = 8 * (num_trailing_opcode_bytes - 1);
+      first_digit = last_digit =
+          (encoding_specification.opcode() >> (shift + 3)) & 7;
+    }
+    int first_w_bit = 0;
+    int last_w_bit = 1;
+    if (!encoding_specification.has_vex_prefix()) {
+      first_w_bit = last_w_bit =
+          encoding_specification.legacy_prefixes().has_mandatory_rex_w_prefix()
+              ? 1
+              : 0;
+    }
+
+    const int num_opcode_values =
+        encoding_specification.operand_in_opcode() !=
+                    EncodingSpecification::NO_OPERAND_IN_OPCODE &&
+                num_trailing_opcode_bytes == 0
+            ? 8
+            : 1;
+    for (int register_index = 0; register_index < num_opcode_values;
+         ++register_index) {
+      const int slot =
+          OpcodeSlot(key.encoding_space, key.map_select, key.mandatory_prefix,
+                     key.opcode + register_index);
+      if (opcode_info_index_[slot] < 0) {
+        CHECK_LT(opcodes_.size(), INT16_MAX);
+        opcode_info_index_[slot] = opcodes_.size();
+        OpcodeInfo new_info;
+        new_info.has_modrm = has_modrm;
+        new_info.has_memory_offset = has_memory_offset;
+        memset(new_info.num_immediate_bytes, kInvalidLength,
+               sizeof(new_info.num_immediate_bytes));
+        opcodes_.push_back(new_info);
+        is_ambiguous.push_back(false);
+      }
+      const int info_index = opcode_info_index_[slot];
+      OpcodeInfo& info = opcodes_[info_index];
+      bool ambiguous = info.has_modrm != has_modrm ||
+                       info.has_memory_offset != has_memory_offset;
+      for (int w_bit = first_w_bit; w_bit <= last_w_bit; ++w_bit) {
+        for (int digit = first_digit; digit <= last_digit; ++digit) {
+          uint8_t& length = info.num_immediate_bytes[w_bit][digit];
+          if (length == kInvalidLength) {
+            length = num_immediate_bytes;
+          } else if (length != num_immediate_bytes) {
+            ambiguous = true;
+          }
+        }
+      }
+      if (ambiguous && !is_ambiguous[info_index]) {
+        is_ambiguous[info_index] = true;
+        ++num_ambiguous_opcodes_;
+        VLOG(1) << "Ambiguous length: "
+                << instruction.raw_encoding_specification();
+      }
+    }
+  }
+
+  // Legacy instructions that ignore REX.W are only in the W = 0 entries.
+  for (OpcodeInfo& info : opcodes_) {
+    for (int digit = 0; digit < 8; ++digit) {
+      if (info.num_immediate_bytes[1][digit] == kInvalidLength) {
+        info.num_immediate_bytes[1][digit] = info.num_immediate_bytes[0][digit];
+      }
+    }
+  }
+}
+
+int InstructionLengthDecoder::GetInstructionLength(const uint8_t* code,
+                                                   size_t size) const {
+  CHECK(code != nullptr);
+  const size_t max_size = std::min<size_t>(size, kMaxInstructionLengthBytes);
+  int num_prefix_bytes = 0;
+  while (num_prefix_bytes < max_size && IsPrefix(code[num_prefix_bytes])) {
+    ++num_prefix_bytes;
+  }
+  return GetLengthAfterPrefixes(code, size, num_prefix_bytes);
+}
+
+size_t InstructionLengthDecoder::GetInstructionBoundaries(
+    const uint8_t* code, size_t size,
+    std::vector<uint32_t>* instruction_offsets) const {
+  CHECK(code != nullptr);
+  CHECK(instruction_offsets != nullptr);
+  CHECK_LE(size, UINT32_MAX);
+  // The prefix mask covers 32 bytes starting at 'window_begin'. It is
+  // recomputed when fewer than kMaxInstructionLengthBytes bytes of the window
+  // remain, so that the prefixes of an instruction always fit into the window.
+  constexpr size_t kMaxWindowOffset =
+      kPrefixMaskWidth - kMaxInstructionLengthBytes;
+  uint8_t padded_window[kPrefixMaskWidth];
+  size_t window_begin = 0;
+  uint32_t window_prefix_mask = 0;
+  bool has_window = false;
+  size_t num_skipped_bytes = 0;
+  size_t position = 0;
+  while (position < size) {
+    if (!has_window || position - window_begin > kMaxWindowOffset) {
+      window_begin = position;
+      const uint8_t* window = code + position;
+      if (size - position < kPrefixMaskWidth) {
+        // Zero is not a prefix, so the padding does not change the result.
+        memset(padded_window, 0, sizeof(padded_window));
+        memcpy(padded_window, code + position, size - position);
+        window = padded_window;
+      }
+      window_prefix_mask = uses_avx2_ ? GetPrefixMaskAvx2(window)
+                                      : GetPrefixMaskSse2(window);
+      has_window = true;
+    }
+    // The number of consecutive prefix bytes starting at 'position'. The shift
+    // fills the top bits with zeros, so the complement is never zero.
+    const int num_prefix_bytes = std::min<int>(
+        __builtin_ctz(~(window_prefix_mask >> (position - window_begin))),
+        kMaxInstructionLengthBytes);
+    const int length = GetLengthAfterPrefixes(code + position, size - position,
+                                              num_prefix_bytes);
+    if (length > 0) {
+      instruction_offsets->push_back(position);
+      position += length;
+    } else {
+      ++num_skipped_bytes;
+      ++position;
+    }
+  }
+  return num_skipped_bytes;
+}
+
+int InstructionLengthDecoder::GetLengthAfterPrefixes(
+    const uint8_t* code, size_t size, int num_prefix_bytes) const {
+  size = std::min<size_t>(size, kMaxInstructionLengthBytes);
+  bool has_operand_size_override = false;
+  bool has_address_size_override = false;
+  int rep_prefix = VexEncoding::NO_MANDATORY_PREFIX;
+  int w_bit = 0;
+  bool has_rex_prefix = false;
+  for (int i = 0; i < num_prefix_bytes; ++i) {
+    const uint8_t byte = code[i];
+    // A REX prefix is ignored unless it is the last prefix.
+    has_rex_prefix = (byte & 0xf0) == 0x40;
+    w_bit = has_rex_prefix ? (byte >> 3) & 1 : 0;
+    if (byte == 0x66) {
+      has_operand_size_override = true;
+    } else if (byte == 0x67) {
+      has_address_size_override = true;
+    } else if (byte == 0xf2) {
+      rep_prefix = VexEncoding::MANDATORY_PREFIX_REPNE;
+    } else if (byte == 0xf3) {
+      rep_prefix = VexEncoding::MANDATORY_PREFIX_REPE;
+    }
+  }
+  size_t position = num_prefix_bytes;
+  if (position >= size) return 0;
+
+  int encoding_space = OpcodeIndex::LEGACY_ENCODING;
+  int map_select = VexEncoding::UNDEFINED_OPERAND_MAP;
+  int mandatory_prefixes[3];
+  int num_mandatory_prefixes = 0;
+  const uint8_t first_byte = code[position];
+  if (first_byte == 0xc4 || first_byte == 0xc5 || first_byte == 0x62) {
+    if (has_rex_prefix || has_operand_size_override ||
+        rep_prefix != VexEncoding::NO_MANDATORY_PREFIX) {
+      return 0;
+    }
+    uint8_t payload = 0;
+    if (first_byte == 0xc5) {
+      if (position + 2 > size) return 0;
+      encoding_space = OpcodeIndex::VEX_ENCODING;
+      map_select = VexEncoding::MAP_SELECT_0F;
+      payload = code[position + 1];
+      position += 2;
+    } else if (first_byte == 0xc4) {
+      if (position + 3 > size) return 0;
+      encoding_space = OpcodeIndex::VEX_ENCODING;
+      map_select = code[position + 1] & 0x1f;
+      payload = code[position + 2];
+      position += 3;
+    } else {
+      if (position + 4 > size) return 0;
+      encoding_space = OpcodeIndex::EVEX_ENCODING;
+      map_select = code[position + 1] & 0x03;
+      payload = code[position + 2];
+      position += 4;
+    }
+    if (map_select < 1 || map_select > 3) return 0;
+    // The W bit does not change the length of VEX-encoded instructions.
+    w_bit = 0;
+    mandatory_prefixes[num_mandatory_prefixes++] = payload & 3;
+  } else {
+    if (first_byte == 0x0f) {
+      map_select = VexEncoding::MAP_SELECT_0F;
+      ++position;
+      if (position < size && code[position] == 0x38) {
+        map_select = VexEncoding::MAP_SELECT_0F38;
+        ++position;
+      } else if (position < size && code[position] == 0x3a) {
+        map_select = VexEncoding::MAP_SELECT_0F3A;
+        ++position;
+      }
+    }
+    if (rep_prefix != VexEncoding::NO_MANDATORY_PREFIX) {
+      mandatory_prefixes[num_mandatory_prefixes++] = rep_prefix;
+    }
+    if (has_operand_size_override) {
+      mandatory_prefixes[num_mandatory_prefixes++] =
+          VexEncoding::MANDATORY_PREFIX_OPERAND_SIZE_OVERRIDE;
+    }
+    mandatory_prefixes[num_mandatory_prefixes++] =
+        VexEncoding::NO_MANDATORY_PREFIX;
+  }
+  if (position >= size) return 0;
+  const uint8_t opcode = code[position++];
+
+  for (int i = 0; i < num_mandatory_prefixes; ++i) {
+    const int info_index = opcode_info_index_[OpcodeSlot(
+        encoding_space, map_select, mandatory_prefixes[i], opcode)];
+    if (info_index < 0) continue;
+    const OpcodeInfo& info = opcodes_[info_index];
+    size_t length = position;
+    int digit = 0;
+    if (info.has_modrm) {
+      if (length >= size) return 0;
+      digit = (code[length] >> 3) & 7;
+      const int modrm_length =
+          GetModRmAndSibLength(code + length, size - length);
+      if (modrm_length < 0) return 0;
+      length += modrm_length;
+    }
+    const uint8_t num_immediate_bytes = info.num_immediate_bytes[w_bit][digit];
+    if (num_immediate_bytes == kInvalidLength) continue;
+    length += num_immediate_bytes;
+    if (info.has_memory_offset) {
+      length += has_address_size_override ? 4 : 8;
+    }
+    return length <= size ? length : 0;
+  }
+  return 0;
+}
+
+int InstructionLengthDecoder::OpcodeSlot(int encoding_space, int map_select,
+                                         int mandatory_prefix,
+                                         uint8_t opcode) {
+  return ((encoding_space * 4 + map_select) * 4 + mandatory_prefix) * 256 +
+         opcode;
+}
+
+}  // namespace x86
+}  // namespace cpu_instructions
@@ -0,0 +1,113 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains a decoder that finds the boundaries of x86-64 instructions without
+// identifying the instructions. The tables of the decoder are derived from the
+// encoding specifications of an InstructionSetProto; for each opcode, they
+// store whether the instruction uses the ModR/M byte and the number of bytes
+// of the immediate values, the code offset and the memory offset.
+//
+// When scanning a block of code, the decoder classifies the bytes as prefixes
+// or non-prefixes 32 bytes at a time using SSE2 or AVX2 (when available), so
+// that the prefixes of an instruction are skipped with a single bit scan.
+
+#ifndef CPU_INSTRUCTIONS_X86_INSTRUCTION_LENGTH_DECODER_H_
+#define CPU_INSTRUCTIONS_X86_INSTRUCTION_LENGTH_DECODER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cpu_instructions/proto/instructions.pb.h"
+
+namespace cpu_instructions {
+namespace x86 {
+
+// The maximal length of an x86-64 instruction in bytes.
+constexpr int kMaxInstructionLengthBytes = 15;
+
+// Returns the total length of the ModR/M byte at 'modrm' and of the SIB byte
+// and the displacement that follow it, or -1 if they do not fit into 'size'
+// bytes. Assumes the 64-bit mode, where the address size override prefix does
+// not change the length.
+int GetModRmAndSibLength(const uint8_t* modrm, size_t size);
+
+class InstructionLengthDecoder {
+ public:
+  // Creates the decoder tables from the instructions in 'instruction_set' that
+  // have a parsed x86 encoding specification. The decoder does not keep a
+  // reference to 'instruction_set'.
+  explicit InstructionLengthDecoder(const InstructionSetProto& instruction_set);
+
+  InstructionLengthDecoder(const InstructionLengthDecoder&) = delete;
+  InstructionLengthDecoder& operator=(const InstructionLengthDecoder&) = delete;
+
+  // Returns the length of the instruction at the beginning of 'code' in bytes,
+  // or 0 if the bytes are not an encoding of an instruction from the
+  // instruction set or if the instruction does not fit into 'size' bytes.
+  int GetInstructionLength(const uint8_t* code, size_t size) const;
+
+  // Splits 'code' into instructions, and appends the offsets of the first bytes
+  // of the instructions to 'instruction_offsets'. Bytes that are not a valid
+  // instruction are skipped one by one. Returns the number of skipped bytes.
+  size_t GetInstructionBoundaries(
+      const uint8_t* code, size_t size,
+      std::vector<uint32_t>* instruction_offsets) const;
+
+  // Returns the number of opcodes for which the instruction set contains
+  // instructions with different lengths that the decoder can't tell apart,
+  // e.g. because they differ only in the operand types. For these opcodes, the
+  // decoder uses the length of the first instruction in the instruction set.
+  int num_ambiguous_opcodes() const { return num_ambiguous_opcodes_; }
+
+  // Returns true if the decoder uses AVX2 to classify the prefix bytes.
+  bool uses_avx2() const { return uses_avx2_; }
+
+ private:
+  // Returns the length of the instruction at the beginning of 'code', assuming
+  // that the first 'num_prefix_bytes' bytes are legacy or REX prefixes.
+  int GetLengthAfterPrefixes(const uint8_t* code, size_t size,
+                             int num_prefix_bytes) const;
+
+  // The decoding information for a single opcode. The opcodes are indexed by
+  // the encoding space, the opcode map, the mandatory prefix and the opcode
+  // byte, the same way as in OpcodeIndex.
+  struct OpcodeInfo {
+    bool has_modrm = false;
+    // True for the instructions with a memory offset operand (moffs). The size
+    // of the offset is given by the address size override prefix.
+    bool has_memory_offset = false;
+    // The number of bytes that follow the ModR/M byte and the displacement,
+    // indexed by the W bit and by modrm.reg. kInvalidLength marks the
+    // combinations that do not belong to any instruction.
+    uint8_t num_immediate_bytes[2][8];
+  };
+  static constexpr uint8_t kInvalidLength = 0xff;
+
+  static int OpcodeSlot(int encoding_space, int map_select,
+                        int mandatory_prefix, uint8_t opcode);
+
+  // For each opcode slot, the index of its OpcodeInfo in 'opcodes_', or -1 when
+  // there is no instruction with the opcode.
+  std::vector<int16_t> opcode_info_index_;
+  std::vector<OpcodeInfo> opcodes_;
+
+  int num_ambiguous_opcodes_ = 0;
+  bool uses_avx2_ = false;
+};
+
+}  // namespace x86
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_X86_INSTRUCTION_LENGTH_DECODER_H_
@@ -0,0 +1,237 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/x86/instruction_length_decoder.h"
+
+#include <cstdint>
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "cpu_instructions/util/proto_util.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace cpu_instructions {
+namespace x86 {
+namespace {
+
+using ::testing::ElementsAreArray;
+
+constexpr char kInstructionSet[] = R"(
+  instructions {
+    raw_encoding_specification: 'F6 /0 ib'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0xf6 modrm_usage: OPCODE_EXTENSION_IN_MODRM
+      modrm_opcode_extension: 0 immediate_value_bytes: 1 }}
+  instructions {
+    raw_encoding_specification: 'F6 /2'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0xf6 modrm_usage: OPCODE_EXTENSION_IN_MODRM
+      modrm_opcode_extension: 2 }}
+  instructions {
+    raw_encoding_specification: '05 id'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0x05 immediate_value_bytes: 4 }}
+  instructions {
+    raw_encoding_specification: '66 05 iw'
+    x86_encoding_specification {
+      legacy_prefixes { has_mandatory_operand_size_override_prefix: true }
+      opcode: 0x05 immediate_value_bytes: 2 }}
+  instructions {
+    raw_encoding_specification: 'B8+rd id'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0xb8 immediate_value_bytes: 4
+      operand_in_opcode: GENERAL_PURPOSE_REGISTER_IN_OPCODE }}
+  instructions {
+    raw_encoding_specification: 'REX.W + B8+rd io'
+    x86_encoding_specification {
+      legacy_prefixes { has_mandatory_rex_w_prefix: true } opcode: 0xb8
+      immediate_value_bytes: 8
+      operand_in_opcode: GENERAL_PURPOSE_REGISTER_IN_OPCODE }}
+  instructions {
+    raw_encoding_specification: '0F 01 D0'
+    x86_encoding_specification { legacy_prefixes {} opcode: 0x0f01d0 }}
+  instructions {
+    raw_encoding_specification: '0F 01 /2'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0x0f01 modrm_usage: OPCODE_EXTENSION_IN_MODRM
+      modrm_opcode_extension: 2 }}
+  instructions {
+    raw_encoding_specification: 'F3 0F B8 /r'
+    x86_encoding_specification {
+      legacy_prefixes { has_mandatory_repe_prefix: true }
+      opcode: 0x0fb8 modrm_usage: FULL_MODRM }}
+  instructions {
+    raw_encoding_specification: '66 0F 3A 0F /r ib'
+    x86_encoding_specification {
+      legacy_prefixes { has_mandatory_operand_size_override_prefix: true }
+      opcode: 0x0f3a0f modrm_usage: FULL_MODRM immediate_value_bytes: 1 }}
+  instructions {
+    vendor_syntax { mnemonic: 'MOV' operands { name: 'AL' }
+                    operands { name: 'moffs8' }}
+    raw_encoding_specification: 'A0 io'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0xa0 immediate_value_bytes: 8 }}
+  instructions {
+    vendor_syntax { mnemonic: 'MOV' operands { name: 'AL' }
+                    operands { name: 'moffs8' }}
+    raw_encoding_specification: '67 A0 id'
+    x86_encoding_specification {
+      legacy_prefixes { has_mandatory_address_size_override_prefix: true }
+      opcode: 0xa0 immediate_value_bytes: 4 }}
+  instructions {
+    vendor_syntax { mnemonic: 'MOV' operands { name: 'EAX' }
+                    operands { name: 'moffs32' }}
+    raw_encoding_specification: 'A1'
+    x86_encoding_specification { legacy_prefixes {} opcode: 0xa1 }}
+  instructions {
+    raw_encoding_specification: 'E8 cd'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0xe8 code_offset_bytes: 4 }}
+  instructions {
+    raw_encoding_specification: 'VEX.NDS.128.66.0F3A.W0 4A /r /is4'
+    x86_encoding_specification {
+      opcode: 0x0f3a4a modrm_usage: FULL_MODRM
+      vex_prefix {
+        prefix_type: VEX_PREFIX map_select: MAP_SELECT_0F3A
+        mandatory_prefix: MANDATORY_PREFIX_OPERAND_SIZE_OVERRIDE
+        vector_size: VEX_VECTOR_SIZE_128_BIT vex_w_usage: VEX_W_IS_ZERO
+        has_vex_operand_suffix: true }}}
+  instructions {
+    raw_encoding_specification: 'VEX.NDS.256.0F.WIG 58 /r'
+    x86_encoding_specification {
+      opcode: 0x0f58 modrm_usage: FULL_MODRM
+      vex_prefix {
+        prefix_type: VEX_PREFIX map_select: MAP_SELECT_0F
+        vector_size: VEX_VECTOR_SIZE_256_BIT vex_w_usage: VEX_W_IS_IGNORED }}}
+  instructions {
+    raw_encoding_specification: 'EVEX.NDS.512.0F.W0 58 /r'
+    x86_encoding_specification {
+      opcode: 0x0f58 modrm_usage: FULL_MODRM
+      vex_prefix {
+        prefix_type: EVEX_PREFIX map_select: MAP_SELECT_0F
+        vector_size: VEX_VECTOR_SIZE_512_BIT vex_w_usage: VEX_W_IS_ZERO }}})";
+
+// The instructions used in the tests, each of them encoded in the instruction
+// set above.
+const std::vector<std::vector<uint8_t>>& GetTestInstructions() {
+  static const auto* const kInstructions =
+      new std::vector<std::vector<uint8_t>>({
+          // test byte ptr [rax], 1
+          {0xf6, 0x00, 0x01},
+          // not byte ptr [rax + rbx*8 + 0x10]
+          {0xf6, 0x54, 0xd8, 0x10},
+          // add eax, 0x11223344
+          {0x05, 0x44, 0x33, 0x22, 0x11},
+          // add ax, 0x1122
+          {0x66, 0x05, 0x22, 0x11},
+          // mov ecx, 1
+          {0xb9, 0x01, 0x00, 0x00, 0x00},
+          // movabs rcx, 1
+          {0x48, 0xb9, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+          // xgetbv
+          {0x0f, 0x01, 0xd0},
+          // lgdt [rip + 0x10]
+          {0x0f, 0x01, 0x15, 0x10, 0x00, 0x00, 0x00},
+          // popcnt rax, qword ptr fs:[rax]
+          {0x64, 0xf3, 0x48, 0x0f, 0xb8, 0x00},
+          // palignr xmm0, xmm1, 4
+          {0x66, 0x0f, 0x3a, 0x0f, 0xc1, 0x04},
+          // mov al, [0x1122334455667788]
+          {0xa0, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11},
+          // mov al, [0x11223344]
+          {0x67, 0xa0, 0x44, 0x33, 0x22, 0x11},
+          // mov eax, [0x1122334455667788]
+          {0xa1, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11},
+          // mov eax, [0x11223344]
+          {0x67, 0xa1, 0x44, 0x33, 0x22, 0x11},
+          // call rel32
+          {0xe8, 0x00, 0x00, 0x00, 0x00},
+          // vblendvps xmm0, xmm1, xmm2, xmm3
+          {0xc4, 0xe3, 0x71, 0x4a, 0xc2, 0x30},
+          // vaddps ymm0, ymm1, ymmword ptr [rax + 0x100]
+          {0xc5, 0xf4, 0x58, 0x80, 0x00, 0x01, 0x00, 0x00},
+          // vaddps zmm0, zmm1, zmmword ptr [rax + 0x40]
+          {0x62, 0xf1, 0x74, 0x48, 0x58, 0x40, 0x01},
+      });
+  return *kInstructions;
+}
+
+class InstructionLengthDecoderTest : public ::testing::Test {
+ protected:
+  InstructionLengthDecoderTest()
+      : decoder_(
+            ParseProtoFromStringOrDie<InstructionSetProto>(kInstructionSet)) {}
+
+  const InstructionLengthDecoder decoder_;
+};
+
+TEST_F(InstructionLengthDecoderTest, GetInstructionLength) {
+  for (const std::vector<uint8_t>& instruction : GetTestInstructions()) {
+    SCOPED_TRACE(instruction.size());
+    EXPECT_EQ(decoder_.GetInstructionLength(instruction.data(),
+                                            instruction.size()),
+              instruction.size());
+    // The decoder must not read past the end of the buffer.
+    EXPECT_EQ(decoder_.GetInstructionLength(instruction.data(),
+                                            instruction.size() - 1),
+              0);
+  }
+  EXPECT_EQ(decoder_.num_ambiguous_opcodes(), 0);
+}
+
+TEST_F(InstructionLengthDecoderTest, InvalidInstructions) {
+  // Opcode extension that is not in the instruction set.
+  const uint8_t kUnknownExtension[] = {0xf6, 0xd8};
+  EXPECT_EQ(decoder_.GetInstructionLength(kUnknownExtension,
+                                          sizeof(kUnknownExtension)),
+            0);
+  // Unknown opcode.
+  const uint8_t kUnknownOpcode[] = {0x0f, 0x0b};
+  EXPECT_EQ(
+      decoder_.GetInstructionLength(kUnknownOpcode, sizeof(kUnknownOpcode)), 0);
+  // Sixteen prefixes.
+  const std::vector<uint8_t> kTooManyPrefixes(16, 0x66);
+  EXPECT_EQ(decoder_.GetInstructionLength(kTooManyPrefixes.data(),
+                                          kTooManyPrefixes.size()),
+            0);
+}
+
+TEST_F(InstructionLengthDecoderTest, GetInstructionBoundaries) {
+  // Concatenate the instructions several times, so that the code spans
+  // multiple prefix mask windows, and separate them with an undecodable byte
+  // from time to time.
+  std::vector<uint8_t> code;
+  std::vector<uint32_t> expected_offsets;
+  int expected_num_skipped_bytes = 0;
+  for (int round = 0; round < 20; ++round) {
+    for (const std::vector<uint8_t>& instruction : GetTestInstructions()) {
+      expected_offsets.push_back(code.size());
+      code.insert(code.end(), instruction.begin(), instruction.end());
+    }
+    code.push_back(0x0b);
+    ++expected_num_skipped_bytes;
+  }
+
+  std::vector<uint32_t> offsets;
+  EXPECT_EQ(decoder_.GetInstructionBoundaries(code.data(), code.size(),
+                                              &offsets),
+            expected_num_skipped_bytes);
+  EXPECT_THAT(offsets, ElementsAreArray(expected_offsets));
+}
+
+}  // namespace
+}  // namespace x86
+}  // namespace cpu_instructions
@@ -0,0 +1,325 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/x86/opcode_index.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace cpu_instructions {
+namespace x86 {
+namespace {
+
+constexpr uint8_t kAllModRmDigits = 0xff;
+constexpr uint8_t kAllVectorLengths = 0x0f;
+constexpr uint8_t kAllWBits = 0x03;
+
+// A single entry of the index before it is sorted into the slots.
+struct IndexEntry {
+  int primary_slot;
+  int instruction_index;
+  // Bit masks of the values of modrm.reg, the vector length and the W bit
+  // accepted by the instruction.
+  uint8_t modrm_digit_mask;
+  uint8_t vector_length_mask;
+  uint8_t w_bit_mask;
+};
+
+// Fills in the primary key of 'encoding_specification' to 'key', and returns
+// the number of opcode bytes that follow the opcode byte in the key.
+int GetKeyAndNumTrailingOpcodeBytes(
+    const EncodingSpecification& encoding_specification,
+    OpcodeIndex::Key* key) {
+  CHECK(key != nullptr);
+  // Split the opcode into bytes, starting with the most significant non-zero
+  // byte. The opcode always has at least one byte, even if it is 0x00.
+  uint32_t opcode = encoding_specification.opcode();
+  uint8_t opcode_bytes[4];
+  int num_opcode_bytes = 0;
+  do {
+    opcode_bytes[num_opcode_bytes++] = opcode & 0xff;
+    opcode >>= 8;
+  } while (opcode != 0);
+  for (int i = 0; i < num_opcode_bytes / 2; ++i) {
+    std::swap(opcode_bytes[i], opcode_bytes[num_opcode_bytes - i - 1]);
+  }
+
+  key->modrm_digit = OpcodeIndex::kAny;
+  key->vector_length = OpcodeIndex::kAny;
+  key->w_bit = OpcodeIndex::kAny;
+  if (encoding_specification.has_vex_prefix()) {
+    // The opcode of VEX-encoded instructions contains the bytes of the opcode
+    // map that are implied by VEX.mmmmm; the map is taken from the prefix.
+    const VexPrefixEncodingSpecification& vex_prefix =
+        encoding_specification.vex_prefix();
+    key->encoding_space = vex_prefix.prefix_type() == EVEX_PREFIX
+                              ? OpcodeIndex::EVEX_ENCODING
+                              : OpcodeIndex::VEX_ENCODING;
+    key->map_select = vex_prefix.map_select();
+    key->mandatory_prefix = vex_prefix.mandatory_prefix();
+    key->opcode = opcode_bytes[num_opcode_bytes - 1];
+    return 0;
+  }
+
+  const LegacyPrefixEncodingSpecification& legacy_prefixes =
+      encoding_specification.legacy_prefixes();
+  key->encoding_space = OpcodeIndex::LEGACY_ENCODING;
+  // When an instruction has both the operand size override prefix and one of
+  // the REP prefixes (e.g. CRC32 r32, r/m16), the REP prefix is the one that
+  // selects the opcode table.
+  if (legacy_prefixes.has_mandatory_repne_prefix()) {
+    key->mandatory_prefix = VexEncoding::MANDATORY_PREFIX_REPNE;
+  } else if (legacy_prefixes.has_mandatory_repe_prefix()) {
+    key->mandatory_prefix = VexEncoding::MANDATORY_PREFIX_REPE;
+  } else if (legacy_prefixes.has_mandatory_operand_size_override_prefix()) {
+    key->mandatory_prefix = VexEncoding::MANDATORY_PREFIX_OPERAND_SIZE_OVERRIDE;
+  } else {
+    key->mandatory_prefix = VexEncoding::NO_MANDATORY_PREFIX;
+  }
+  int opcode_byte_index = 0;
+  key->map_select = VexEncoding::UNDEFINED_OPERAND_MAP;
+  if (num_opcode_bytes > 1 && opcode_bytes[0] == 0x0f) {
+    key->map_select = VexEncoding::MAP_SELECT_0F;
+    opcode_byte_index = 1;
+    if (num_opcode_bytes > 2) {
+      if (opcode_bytes[1] == 0x38) {
+        key->map_select = VexEncoding::MAP_SELECT_0F38;
+        opcode_byte_index = 2;
+      } else if (opcode_bytes[1] == 0x3a) {
+        key->map_select = VexEncoding::MAP_SELECT_0F3A;
+        opcode_byte_index = 2;
+      }
+    }
+  }
+  key->opcode = opcode_bytes[opcode_byte_index];
+  return num_opcode_bytes - opcode_byte_index - 1;
+}
+
+// Returns the bit mask of the values of the vector length accepted by the
+// instruction.
+uint8_t GetVectorLengthMask(
+    const EncodingSpecification& encoding_specification) {
+  if (!encoding_specification.has_vex_prefix()) return kAllVectorLengths;
+  switch (encoding_specification.vex_prefix().vector_size()) {
+    case VEX_VECTOR_SIZE_BIT_IS_ZERO:
+    case VEX_VECTOR_SIZE_128_BIT:
+      return 1 << 0;
+    case VEX_VECTOR_SIZE_BIT_IS_ONE:
+    case VEX_VECTOR_SIZE_256_BIT:
+      return 1 << 1;
+    case VEX_VECTOR_SIZE_512_BIT:
+      return 1 << 2;
+    default:
+      return kAllVectorLengths;
+  }
+}
+
+// Returns the bit mask of the values of the W bit accepted by the instruction.
+// Legacy instructions that do not require REX.W are indexed only under W = 0,
+// so that they do not collide with their REX.W counterparts.
+uint8_t GetWBitMask(const EncodingSpecification& encoding_specification) {
+  if (!encoding_specification.has_vex_prefix()) {
+    return encoding_specification.legacy_prefixes()
+                   .has_mandatory_rex_w_prefix()
+               ? 1 << 1
+               : 1 << 0;
+  }
+  switch (encoding_specification.vex_prefix().vex_w_usage()) {
+    case VexPrefixEncodingSpecification::VEX_W_IS_ZERO:
+      return 1 << 0;
+    case VexPrefixEncodingSpecification::VEX_W_IS_ONE:
+      return 1 << 1;
+    default:
+      return kAllWBits;
+  }
+}
+
+// Calls 'callback' for the (modrm digit, vector length, W bit) triples, where
+// each element is either kAny or one of the values from the respective mask.
+template <typename Callback>
+void ForEachSecondaryKey(const IndexEntry& entry, const Callback& callback) {
+  for (int digit = OpcodeIndex::kAny; digit < 8; ++digit) {
+    if (digit != OpcodeIndex::kAny && !(entry.modrm_digit_mask & (1 << digit)))
+      continue;
+    for (int length = OpcodeIndex::kAny; length < 4; ++length) {
+      if (length != OpcodeIndex::kAny &&
+          !(entry.vector_length_mask & (1 << length)))
+        continue;
+      for (int w_bit = OpcodeIndex::kAny; w_bit < 2; ++w_bit) {
+        if (w_bit != OpcodeIndex::kAny && !(entry.w_bit_mask & (1 << w_bit)))
+          continue;
+        callback(digit, length, w_bit);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+constexpr int OpcodeIndex::kAny;
+constexpr int OpcodeIndex::kNumPrimarySlots;
+constexpr int OpcodeIndex::kNumSecondarySlots;
+
+OpcodeIndex::OpcodeIndex(const InstructionSetProto& instruction_set)
+    : secondary_table_index_(kNumPrimarySlots, -1) {
+  // Collect the entries in a single pass over the instruction set.
+  std::vector<IndexEntry> entries;
+  entries.reserve(instruction_set.instructions_size());
+  for (int i = 0; i < instruction_set.instructions_size(); ++i) {
+    const InstructionProto& instruction = instruction_set.instructions(i);
+    if (!instruction.has_x86_encoding_specification()) continue;
+    const EncodingSpecification& encoding_specification =
+        instruction.x86_encoding_specification();
+    ++num_instructions_;
+
+    Key key;
+    const int num_trailing_opcode_bytes =
+        GetKeyAndNumTrailingOpcodeBytes(encoding_specification, &key);
+    IndexEntry entry;
+    entry.instruction_index = i;
+    entry.modrm_digit_mask =
+        encoding_specification.modrm_usage() ==
+                EncodingSpecification::OPCODE_EXTENSION_IN_MODRM
+            ? 1 << encoding_specification.modrm_opcode_extension()
+            : kAllModRmDigits;
+    entry.vector_length_mask = GetVectorLengthMask(encoding_specification);
+    entry.w_bit_mask = GetWBitMask(encoding_specification);
+
+    // When the operand is encoded in the three least significant bits of the
+    // opcode byte, the instruction occupies eight consecutive opcode values.
+    const bool operand_in_opcode_byte =
+        encoding_specification.operand_in_opcode() !=
+            EncodingSpecification::NO_OPERAND_IN_OPCODE &&
+        num_trailing_opcode_bytes == 0;
+    const int num_opcode_values = operand_in_opcode_byte ? 8 : 1;
+    for (int register_index = 0; register_index < num_opcode_values;
+         ++register_index) {
+      entry.primary_slot =
+          PrimarySlot(key.encoding_space, key.map_select, key.mandatory_prefix,
+                      key.opcode + register_index);
+      secondary_table_index_[entry.primary_slot] = 0;
+      entries.push_back(entry);
+    }
+  }
+
+  // Assign secondary tables to the non-empty primary slots.
+  int num_tables = 0;
+  for (int& table_index : secondary_table_index_) {
+    if (table_index >= 0) table_index = num_tables++;
+  }
+  constexpr int kTableSize = kNumSecondarySlots + 1;
+  secondary_tables_.assign(num_tables * kTableSize, 0);
+
+  // Count the instructions in each slot, and compute the offsets of the slots
+  // in 'instruction_indices_'. The counts are stored shifted by one entry, so
+  // that the prefix sum turns them directly into [begin, end) offsets.
+  std::vector<uint32_t> slot_sizes(num_tables * kNumSecondarySlots, 0);
+  for (const IndexEntry& entry : entries) {
+    const int table_index = secondary_table_index_[entry.primary_slot];
+    ForEachSecondaryKey(entry, [&](int digit, int length, int w_bit) {
+      ++slot_sizes[table_index * kNumSecondarySlots +
+                   SecondarySlot(digit, length, w_bit)];
+    });
+  }
+  uint32_t offset = 0;
+  for (int table = 0; table < num_tables; ++table) {
+    uint32_t* const offsets = &secondary_tables_[table * kTableSize];
+    offsets[0] = offset;
+    for (int slot = 0; slot < kNumSecondarySlots; ++slot) {
+      offset += slot_sizes[table * kNumSecondarySlots + slot];
+      offsets[slot + 1] = offset;
+    }
+  }
+
+  // Fill the slots. The entries are ordered by the instruction index, so the
+  // indices in each slot end up sorted.
+  instruction_indices_.resize(offset);
+  std::vector<uint32_t>& next_position = slot_sizes;
+  for (int table = 0; table < num_tables; ++table) {
+    for (int slot = 0; slot < kNumSecondarySlots; ++slot) {
+      next_position[table * kNumSecondarySlots + slot] =
+          secondary_tables_[table * kTableSize + slot];
+    }
+  }
+  for (const IndexEntry& entry : entries) {
+    const int table_index = secondary_table_index_[entry.primary_slot];
+    ForEachSecondaryKey(entry, [&](int digit, int length, int w_bit) {
+      const int slot = table_index * kNumSecondarySlots +
+                       SecondarySlot(digit, length, w_bit);
+      instruction_indices_[next_position[slot]++] = entry.instruction_index;
+    });
+  }
+}
+
+OpcodeIndex::InstructionRange OpcodeIndex::Lookup(
+    EncodingSpace encoding_space, VexEncoding::MapSelect map_select,
+    VexEncoding::MandatoryPrefix mandatory_prefix, uint8_t opcode) const {
+  return GetRange(
+      PrimarySlot(encoding_space, map_select, mandatory_prefix, opcode),
+      SecondarySlot(kAny, kAny, kAny));
+}
+
+OpcodeIndex::InstructionRange OpcodeIndex::Lookup(const Key& key) const {
+  DCHECK_GE(key.modrm_digit, kAny);
+  DCHECK_LT(key.modrm_digit, 8);
+  DCHECK_GE(key.vector_length, kAny);
+  DCHECK_LT(key.vector_length, 4);
+  DCHECK_GE(key.w_bit, kAny);
+  DCHECK_LT(key.w_bit, 2);
+  const int vector_length =
+      key.encoding_space == LEGACY_ENCODING ? kAny : key.vector_length;
+  return GetRange(PrimarySlot(key.encoding_space, key.map_select,
+                              key.mandatory_prefix, key.opcode),
+                  SecondarySlot(key.modrm_digit, vector_length, key.w_bit));
+}
+
+int OpcodeIndex::PrimarySlot(EncodingSpace encoding_space,
+                             VexEncoding::MapSelect map_select,
+                             VexEncoding::MandatoryPrefix mandatory_prefix,
+                             uint8_t opcode) {
+  DCHECK_GE(map_select, 0);
+  DCHECK_LT(map_select, 4);
+  DCHECK_GE(mandatory_prefix, 0);
+  DCHECK_LT(mandatory_prefix, 4);
+  return ((encoding_space * 4 + map_select) * 4 + mandatory_prefix) * 256 +
+         opcode;
+}
+
+OpcodeIndex::InstructionRange OpcodeIndex::GetRange(int primary_slot,
+                                                    int secondary_slot) const {
+  const int table_index = secondary_table_index_[primary_slot];
+  if (table_index < 0) return InstructionRange(nullptr, nullptr);
+  const uint32_t* const offsets =
+      &secondary_tables_[table_index * (kNumSecondarySlots + 1)];
+  const int* const indices = instruction_indices_.data();
+  return InstructionRange(indices + offsets[secondary_slot],
+                          indices + offsets[secondary_slot + 1]);
+}
+
+void GetOpcodeIndexKey(const EncodingSpecification& encoding_specification,
+                       OpcodeIndex::Key* key) {
+  GetKeyAndNumTrailingOpcodeBytes(encoding_specification, key);
+}
+
+int GetNumTrailingOpcodeBytes(
+    const EncodingSpecification& encoding_specification) {
+  OpcodeIndex::Key key;
+  return GetKeyAndNumTrailingOpcodeBytes(encoding_specification, &key);
+}
+
+}  // namespace x86
+}  // namespace cpu_instructions
@@ -0,0 +1,182 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains a dense index of the instructions of an InstructionSetProto keyed by
+// the components of their binary encoding. The index answers queries of the
+// form "all instructions whose opcode is X in opcode map Y with mandatory
+// prefix Z" in constant time, without scanning the instruction set.
+//
+// Typical usage:
+//   const OpcodeIndex index(instruction_set);
+//   for (const int instruction_index : index.Lookup(
+//            OpcodeIndex::LEGACY_ENCODING, VexEncoding::MAP_SELECT_0F,
+//            VexEncoding::NO_MANDATORY_PREFIX, 0x58)) {
+//     const InstructionProto& instruction =
+//         instruction_set.instructions(instruction_index);
+//     ...
+//   }
+
+#ifndef CPU_INSTRUCTIONS_X86_OPCODE_INDEX_H_
+#define CPU_INSTRUCTIONS_X86_OPCODE_INDEX_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "cpu_instructions/proto/x86/encoding_specification.pb.h"
+#include "cpu_instructions/proto/x86/instruction_encoding.pb.h"
+
+namespace cpu_instructions {
+namespace x86 {
+
+class OpcodeIndex {
+ public:
+  // The encoding space of the instruction. The same opcode byte in the same
+  // opcode map denotes unrelated instructions in the legacy, the VEX and the
+  // EVEX encoding, so these are indexed separately.
+  enum EncodingSpace {
+    LEGACY_ENCODING = 0,
+    VEX_ENCODING = 1,
+    EVEX_ENCODING = 2,
+  };
+
+  // A special value for the ModR/M digit and the vector length/W bit fields of
+  // OpcodeIndex::Key that matches any value of the field.
+  static constexpr int kAny = -1;
+
+  // The full lookup key. 'map_select' uses the values from the VEX prefix; for
+  // legacy instructions, UNDEFINED_OPERAND_MAP denotes the one-byte opcode map
+  // (instructions without the 0F escape byte). For legacy instructions, the
+  // mandatory prefix is one of 66, F2 or F3 as required by the encoding
+  // specification.
+  struct Key {
+    EncodingSpace encoding_space = LEGACY_ENCODING;
+    VexEncoding::MapSelect map_select = VexEncoding::UNDEFINED_OPERAND_MAP;
+    VexEncoding::MandatoryPrefix mandatory_prefix =
+        VexEncoding::NO_MANDATORY_PREFIX;
+    // The opcode byte following the opcode map escape bytes.
+    uint8_t opcode = 0;
+    // The value of modrm.reg (0-7), or kAny.
+    int modrm_digit = kAny;
+    // The value of the VEX.L (resp. EVEX.L'L) bits (0-3), or kAny. This field
+    // is ignored for legacy instructions.
+    int vector_length = kAny;
+    // The value of the VEX.W/EVEX.W/REX.W bit (0 or 1), or kAny.
+    int w_bit = kAny;
+  };
+
+  // A range of instruction indices returned by a lookup. The range points to
+  // the internal storage of the index; it is valid as long as the index
+  // exists.
+  class InstructionRange {
+   public:
+    InstructionRange(const int* begin, const int* end)
+        : begin_(begin), end_(end) {}
+
+    const int* begin() const { return begin_; }
+    const int* end() const { return end_; }
+    int size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
+
+   private:
+    const int* begin_;
+    const int* end_;
+  };
+
+  // Builds the index in a single pass over the instructions in
+  // 'instruction_set'. Instructions that do not have a parsed x86 encoding
+  // specification are skipped. The index stores only the positions of the
+  // instructions in 'instruction_set', and it does not keep a reference to it.
+  explicit OpcodeIndex(const InstructionSetProto& instruction_set);
+
+  OpcodeIndex(const OpcodeIndex&) = delete;
+  OpcodeIndex& operator=(const OpcodeIndex&) = delete;
+
+  // Returns the indices of all instructions with the given opcode in the given
+  // encoding space, opcode map and with the given mandatory prefix, regardless
+  // of their ModR/M opcode extension, vector length and W bit. The indices are
+  // sorted in the increasing order.
+  InstructionRange Lookup(EncodingSpace encoding_space,
+                          VexEncoding::MapSelect map_select,
+                          VexEncoding::MandatoryPrefix mandatory_prefix,
+                          uint8_t opcode) const;
+
+  // Returns the indices of all instructions that match 'key'. An instruction
+  // matches the key if it is compatible with all fields of the key that are
+  // not kAny; e.g. an instruction that ignores VEX.W is returned both for
+  // w_bit == 0 and w_bit == 1. The returned indices are sorted in the
+  // increasing order.
+  InstructionRange Lookup(const Key& key) const;
+
+  // Returns the number of instructions in the index.
+  int num_instructions() const { return num_instructions_; }
+
+ private:
+  // The number of values of the primary key: encoding space, opcode map,
+  // mandatory prefix, opcode byte.
+  static constexpr int kNumPrimarySlots = 3 * 4 * 4 * 256;
+  // The number of values of the secondary key: modrm.reg, vector length and
+  // the W bit, each of them extended with kAny.
+  static constexpr int kNumModRmDigits = 8 + 1;
+  static constexpr int kNumVectorLengths = 4 + 1;
+  static constexpr int kNumWBits = 2 + 1;
+  static constexpr int kNumSecondarySlots =
+      kNumModRmDigits * kNumVectorLengths * kNumWBits;
+
+  static int PrimarySlot(EncodingSpace encoding_space,
+                         VexEncoding::MapSelect map_select,
+                         VexEncoding::MandatoryPrefix mandatory_prefix,
+                         uint8_t opcode);
+  // Returns the secondary slot for the given values; each of the values may be
+  // kAny.
+  static int SecondarySlot(int modrm_digit, int vector_length, int w_bit) {
+    return ((modrm_digit + 1) * kNumVectorLengths + (vector_length + 1)) *
+               kNumWBits +
+           (w_bit + 1);
+  }
+
+  InstructionRange GetRange(int primary_slot, int secondary_slot) const;
+
+  int num_instructions_ = 0;
+
+  // For each primary slot, the index of its secondary table, or -1 if there
+  // are no instructions in the slot.
+  std::vector<int> secondary_table_index_;
+
+  // The secondary tables. Each table has kNumSecondarySlots + 1 entries; the
+  // i-th entry is the offset of the first instruction of secondary slot i in
+  // 'instruction_indices_', and the i+1-th entry is the end of the slot.
+  std::vector<uint32_t> secondary_tables_;
+
+  // The indices of the instructions, grouped by their slots.
+  std::vector<int> instruction_indices_;
+};
+
+// Returns the lookup key components of 'encoding_specification', i.e. the
+// encoding space, the opcode map, the mandatory prefix and the opcode byte.
+// Any bytes of the opcode that follow the opcode byte (e.g. the fixed ModR/M
+// byte of "0F 01 D0") are not part of the key.
+void GetOpcodeIndexKey(const EncodingSpecification& encoding_specification,
+                       OpcodeIndex::Key* key);
+
+// Returns the number of bytes of the opcode of 'encoding_specification' that
+// follow the opcode byte used in the lookup key. These are the least
+// significant bytes of EncodingSpecification.opcode.
+int GetNumTrailingOpcodeBytes(
+    const EncodingSpecification& encoding_specification);
+
+}  // namespace x86
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_X86_OPCODE_INDEX_H_
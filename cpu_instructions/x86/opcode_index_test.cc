@@ -0,0 +1,317 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/x86/opcode_index.h"
+
+#include <vector>
+#include "strings/string.h"
+
+#include "cpu_instructions/proto/instructions.pb.h"
+#include "cpu_instructions/util/proto_util.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace cpu_instructions {
+namespace x86 {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+// A small instruction set covering the different parts of the lookup key. The
+// indices of the instructions are referenced by the tests below.
+constexpr char kInstructionSet[] = R"(
+  instructions {  # 0
+    vendor_syntax { mnemonic: 'ADD' }
+    raw_encoding_specification: '04 ib'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0x04 immediate_value_bytes: 1 }}
+  instructions {  # 1
+    vendor_syntax { mnemonic: 'ADD' }
+    raw_encoding_specification: '80 /0 ib'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0x80 modrm_usage: OPCODE_EXTENSION_IN_MODRM
+      modrm_opcode_extension: 0 immediate_value_bytes: 1 }}
+  instructions {  # 2
+    vendor_syntax { mnemonic: 'SUB' }
+    raw_encoding_specification: '80 /5 ib'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0x80 modrm_usage: OPCODE_EXTENSION_IN_MODRM
+      modrm_opcode_extension: 5 immediate_value_bytes: 1 }}
+  instructions {  # 3
+    vendor_syntax { mnemonic: 'ADDPS' }
+    raw_encoding_specification: '0F 58 /r'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0x0f58 modrm_usage: FULL_MODRM }}
+  instructions {  # 4
+    vendor_syntax { mnemonic: 'ADDPD' }
+    raw_encoding_specification: '66 0F 58 /r'
+    x86_encoding_specification {
+      legacy_prefixes { has_mandatory_operand_size_override_prefix: true }
+      opcode: 0x0f58 modrm_usage: FULL_MODRM }}
+  instructions {  # 5
+    vendor_syntax { mnemonic: 'MULX' }
+    raw_encoding_specification: 'VEX.NDS.LZ.F2.0F38.W0 F6 /r'
+    x86_encoding_specification {
+      opcode: 0x0f38f6 modrm_usage: FULL_MODRM
+      vex_prefix {
+        prefix_type: VEX_PREFIX mandatory_prefix: MANDATORY_PREFIX_REPNE
+        map_select: MAP_SELECT_0F38 vector_size: VEX_VECTOR_SIZE_BIT_IS_ZERO
+        vex_w_usage: VEX_W_IS_ZERO }}}
+  instructions {  # 6
+    vendor_syntax { mnemonic: 'MULX' }
+    raw_encoding_specification: 'VEX.NDS.LZ.F2.0F38.W1 F6 /r'
+    x86_encoding_specification {
+      opcode: 0x0f38f6 modrm_usage: FULL_MODRM
+      vex_prefix {
+        prefix_type: VEX_PREFIX mandatory_prefix: MANDATORY_PREFIX_REPNE
+        map_select: MAP_SELECT_0F38 vector_size: VEX_VECTOR_SIZE_BIT_IS_ZERO
+        vex_w_usage: VEX_W_IS_ONE }}}
+  instructions {  # 7
+    vendor_syntax { mnemonic: 'VADDPS' }
+    raw_encoding_specification: 'VEX.NDS.256.0F.WIG 58 /r'
+    x86_encoding_specification {
+      opcode: 0x0f58 modrm_usage: FULL_MODRM
+      vex_prefix {
+        prefix_type: VEX_PREFIX map_select: MAP_SELECT_0F
+        vector_size: VEX_VECTOR_SIZE_256_BIT vex_w_usage: VEX_W_IS_IGNORED }}}
+  instructions {  # 8
+    vendor_syntax { mnemonic: 'BSWAP' }
+    raw_encoding_specification: '0F C8+rd'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0x0fc8
+      operand_in_opcode: GENERAL_PURPOSE_REGISTER_IN_OPCODE }}
+  instructions {  # 9
+    vendor_syntax { mnemonic: 'FADD' }
+    raw_encoding_specification: 'D8 C0+i'
+    x86_encoding_specification {
+      legacy_prefixes {} opcode: 0xd8c0
+      operand_in_opcode: FP_STACK_REGISTER_IN_OPCODE }}
+  instructions {  # 10
+    vendor_syntax { mnemonic: 'ADD' }
+    raw_encoding_specification: 'REX.W + 81 /0 id'
+    x86_encoding_specification {
+      legacy_prefixes { has_mandatory_rex_w_prefix: true } opcode: 0x81
+      modrm_usage: OPCODE_EXTENSION_IN_MODRM modrm_opcode_extension: 0
+      immediate_value_bytes: 4 }}
+  instructions {  # 11
+    vendor_syntax { mnemonic: 'NO_ENCODING' }
+  }
+  instructions {  # 12
+    vendor_syntax { mnemonic: 'VADDPS' }
+    raw_encoding_specification: 'EVEX.NDS.512.0F.W0 58 /r'
+    x86_encoding_specification {
+      opcode: 0x0f58 modrm_usage: FULL_MODRM
+      vex_prefix {
+        prefix_type: EVEX_PREFIX map_select: MAP_SELECT_0F
+        vector_size: VEX_VECTOR_SIZE_512_BIT vex_w_usage: VEX_W_IS_ZERO }}}
+  instructions {  # 13
+    vendor_syntax { mnemonic: 'PSHUFB' }
+    raw_encoding_specification: '66 0F 38 00 /r'
+    x86_encoding_specification {
+      legacy_prefixes { has_mandatory_operand_size_override_prefix: true }
+      opcode: 0x0f3800 modrm_usage: FULL_MODRM }})";
+
+std::vector<int> ToVector(OpcodeIndex::InstructionRange range) {
+  return std::vector<int>(range.begin(), range.end());
+}
+
+class OpcodeIndexTest : public ::testing::Test {
+ protected:
+  OpcodeIndexTest()
+      : instruction_set_(
+            ParseProtoFromStringOrDie<InstructionSetProto>(kInstructionSet)),
+        index_(instruction_set_) {}
+
+  const InstructionSetProto instruction_set_;
+  const OpcodeIndex index_;
+};
+
+TEST_F(OpcodeIndexTest, NumInstructions) {
+  EXPECT_EQ(index_.num_instructions(), 13);
+}
+
+TEST_F(OpcodeIndexTest, LookupByOpcode) {
+  EXPECT_THAT(ToVector(index_.Lookup(OpcodeIndex::LEGACY_ENCODING,
+                                     VexEncoding::UNDEFINED_OPERAND_MAP,
+                                     VexEncoding::NO_MANDATORY_PREFIX, 0x04)),
+              ElementsAre(0));
+  EXPECT_THAT(ToVector(index_.Lookup(OpcodeIndex::LEGACY_ENCODING,
+                                     VexEncoding::UNDEFINED_OPERAND_MAP,
+                                     VexEncoding::NO_MANDATORY_PREFIX, 0x80)),
+              ElementsAre(1, 2));
+  EXPECT_THAT(ToVector(index_.Lookup(OpcodeIndex::LEGACY_ENCODING,
+                                     VexEncoding::MAP_SELECT_0F,
+                                     VexEncoding::NO_MANDATORY_PREFIX, 0x58)),
+              ElementsAre(3));
+  EXPECT_THAT(
+      ToVector(index_.Lookup(OpcodeIndex::LEGACY_ENCODING,
+                             VexEncoding::MAP_SELECT_0F,
+                             VexEncoding::MANDATORY_PREFIX_OPERAND_SIZE_OVERRIDE,
+                             0x58)),
+      ElementsAre(4));
+  EXPECT_THAT(
+      ToVector(index_.Lookup(OpcodeIndex::LEGACY_ENCODING,
+                             VexEncoding::MAP_SELECT_0F38,
+                             VexEncoding::MANDATORY_PREFIX_OPERAND_SIZE_OVERRIDE,
+                             0x00)),
+      ElementsAre(13));
+  EXPECT_THAT(ToVector(index_.Lookup(OpcodeIndex::VEX_ENCODING,
+                                     VexEncoding::MAP_SELECT_0F,
+                                     VexEncoding::NO_MANDATORY_PREFIX, 0x58)),
+              ElementsAre(7));
+  EXPECT_THAT(ToVector(index_.Lookup(OpcodeIndex::EVEX_ENCODING,
+                                     VexEncoding::MAP_SELECT_0F,
+                                     VexEncoding::NO_MANDATORY_PREFIX, 0x58)),
+              ElementsAre(12));
+  EXPECT_THAT(ToVector(index_.Lookup(OpcodeIndex::VEX_ENCODING,
+                                     VexEncoding::MAP_SELECT_0F38,
+                                     VexEncoding::MANDATORY_PREFIX_REPNE,
+                                     0xf6)),
+              ElementsAre(5, 6));
+}
+
+TEST_F(OpcodeIndexTest, LookupMissingOpcode) {
+  EXPECT_THAT(ToVector(index_.Lookup(OpcodeIndex::LEGACY_ENCODING,
+                                     VexEncoding::UNDEFINED_OPERAND_MAP,
+                                     VexEncoding::NO_MANDATORY_PREFIX, 0x05)),
+              IsEmpty());
+  EXPECT_THAT(ToVector(index_.Lookup(OpcodeIndex::LEGACY_ENCODING,
+                                     VexEncoding::MAP_SELECT_0F,
+                                     VexEncoding::MANDATORY_PREFIX_REPE, 0x58)),
+              IsEmpty());
+}
+
+TEST_F(OpcodeIndexTest, LookupOperandInOpcode) {
+  for (int opcode = 0xc8; opcode < 0xd0; ++opcode) {
+    SCOPED_TRACE(opcode);
+    EXPECT_THAT(ToVector(index_.Lookup(OpcodeIndex::LEGACY_ENCODING,
+                                       VexEncoding::MAP_SELECT_0F,
+                                       VexEncoding::NO_MANDATORY_PREFIX,
+                                       opcode)),
+                ElementsAre(8));
+  }
+  EXPECT_THAT(ToVector(index_.Lookup(OpcodeIndex::LEGACY_ENCODING,
+                                     VexEncoding::MAP_SELECT_0F,
+                                     VexEncoding::NO_MANDATORY_PREFIX, 0xd0)),
+              IsEmpty());
+  // The register in FADD is encoded in the second opcode byte, which is not
+  // a part of the key.
+  EXPECT_THAT(ToVector(index_.Lookup(OpcodeIndex::LEGACY_ENCODING,
+                                     VexEncoding::UNDEFINED_OPERAND_MAP,
+                                     VexEncoding::NO_MANDATORY_PREFIX, 0xd8)),
+              ElementsAre(9));
+  EXPECT_THAT(ToVector(index_.Lookup(OpcodeIndex::LEGACY_ENCODING,
+                                     VexEncoding::UNDEFINED_OPERAND_MAP,
+                                     VexEncoding::NO_MANDATORY_PREFIX, 0xd9)),
+              IsEmpty());
+}
+
+TEST_F(OpcodeIndexTest, LookupByModRmDigit) {
+  OpcodeIndex::Key key;
+  key.opcode = 0x80;
+  key.modrm_digit = 0;
+  EXPECT_THAT(ToVector(index_.Lookup(key)), ElementsAre(1));
+  key.modrm_digit = 5;
+  EXPECT_THAT(ToVector(index_.Lookup(key)), ElementsAre(2));
+  key.modrm_digit = 7;
+  EXPECT_THAT(ToVector(index_.Lookup(key)), IsEmpty());
+
+  // Instructions that use the full ModR/M byte match any digit.
+  key.opcode = 0x58;
+  key.map_select = VexEncoding::MAP_SELECT_0F;
+  key.modrm_digit = 3;
+  EXPECT_THAT(ToVector(index_.Lookup(key)), ElementsAre(3));
+}
+
+TEST_F(OpcodeIndexTest, LookupByWBit) {
+  OpcodeIndex::Key key;
+  key.encoding_space = OpcodeIndex::VEX_ENCODING;
+  key.map_select = VexEncoding::MAP_SELECT_0F38;
+  key.mandatory_prefix = VexEncoding::MANDATORY_PREFIX_REPNE;
+  key.opcode = 0xf6;
+  key.w_bit = 0;
+  EXPECT_THAT(ToVector(index_.Lookup(key)), ElementsAre(5));
+  key.w_bit = 1;
+  EXPECT_THAT(ToVector(index_.Lookup(key)), ElementsAre(6));
+
+  // Legacy instructions without a mandatory REX.W are indexed under W = 0.
+  OpcodeIndex::Key legacy_key;
+  legacy_key.opcode = 0x81;
+  legacy_key.w_bit = 1;
+  EXPECT_THAT(ToVector(index_.Lookup(legacy_key)), ElementsAre(10));
+  legacy_key.w_bit = 0;
+  EXPECT_THAT(ToVector(index_.Lookup(legacy_key)), IsEmpty());
+  legacy_key.opcode = 0x04;
+  EXPECT_THAT(ToVector(index_.Lookup(legacy_key)), ElementsAre(0));
+}
+
+TEST_F(OpcodeIndexTest, LookupByVectorLength) {
+  OpcodeIndex::Key key;
+  key.encoding_space = OpcodeIndex::VEX_ENCODING;
+  key.map_select = VexEncoding::MAP_SELECT_0F;
+  key.opcode = 0x58;
+  key.vector_length = 1;
+  EXPECT_THAT(ToVector(index_.Lookup(key)), ElementsAre(7));
+  key.vector_length = 0;
+  EXPECT_THAT(ToVector(index_.Lookup(key)), IsEmpty());
+  // VEX.W is ignored by VADDPS, so it matches both values of the bit.
+  key.vector_length = 1;
+  key.w_bit = 0;
+  EXPECT_THAT(ToVector(index_.Lookup(key)), ElementsAre(7));
+  key.w_bit = 1;
+  EXPECT_THAT(ToVector(index_.Lookup(key)), ElementsAre(7));
+
+  key.encoding_space = OpcodeIndex::EVEX_ENCODING;
+  key.vector_length = 2;
+  key.w_bit = 0;
+  EXPECT_THAT(ToVector(index_.Lookup(key)), ElementsAre(12));
+
+  // The vector length is ignored for legacy instructions.
+  OpcodeIndex::Key legacy_key;
+  legacy_key.map_select = VexEncoding::MAP_SELECT_0F;
+  legacy_key.opcode = 0x58;
+  legacy_key.vector_length = 1;
+  EXPECT_THAT(ToVector(index_.Lookup(legacy_key)), ElementsAre(3));
+}
+
+TEST(GetOpcodeIndexKeyTest, LegacyInstruction) {
+  const EncodingSpecification specification =
+      ParseProtoFromStringOrDie<EncodingSpecification>(
+          R"(legacy_prefixes { has_mandatory_repne_prefix: true
+                               has_mandatory_operand_size_override_prefix: true}
+             opcode: 0x0f38f1 modrm_usage: FULL_MODRM)");
+  OpcodeIndex::Key key;
+  GetOpcodeIndexKey(specification, &key);
+  EXPECT_EQ(key.encoding_space, OpcodeIndex::LEGACY_ENCODING);
+  EXPECT_EQ(key.map_select, VexEncoding::MAP_SELECT_0F38);
+  EXPECT_EQ(key.mandatory_prefix, VexEncoding::MANDATORY_PREFIX_REPNE);
+  EXPECT_EQ(key.opcode, 0xf1);
+  EXPECT_EQ(GetNumTrailingOpcodeBytes(specification), 0);
+}
+
+TEST(GetOpcodeIndexKeyTest, InstructionWithFixedModRm) {
+  const EncodingSpecification specification =
+      ParseProtoFromStringOrDie<EncodingSpecification>(
+          "legacy_prefixes {} opcode: 0x0f01d0");
+  OpcodeIndex::Key key;
+  GetOpcodeIndexKey(specification, &key);
+  EXPECT_EQ(key.map_select, VexEncoding::MAP_SELECT_0F);
+  EXPECT_EQ(key.opcode, 0x01);
+  EXPECT_EQ(GetNumTrailingOpcodeBytes(specification), 1);
+}
+
+}  // namespace
+}  // namespace x86
+}  // namespace cpu_instructions
@@ -0,0 +1,201 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/x86/registers.h"
+
+#include <unordered_map>
+#include "strings/string.h"
+
+#include "strings/case.h"
+#include "strings/str_cat.h"
+#include "util/gtl/map_util.h"
+
+namespace cpu_instructions {
+namespace x86 {
+
+namespace {
+
+constexpr int kNumGeneralPurposeRegisters = 16;
+constexpr int kNumMmxRegisters = 8;
+constexpr int kNumVectorRegisters = 16;
+constexpr int kNumEvexVectorRegisters = 32;
+constexpr int kNumOpmaskRegisters = 8;
+
+// The names of the general purpose registers that do not follow the pattern
+// of R8 to R15, in the order of their index.
+constexpr const char* const kLegacyRegisterNames64[] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi"};
+constexpr const char* const kLegacyRegisterNames32[] = {
+    "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi"};
+constexpr const char* const kLegacyRegisterNames16[] = {
+    "ax", "cx", "dx", "bx", "sp", "bp", "si", "di"};
+constexpr const char* const kLegacyRegisterNames8[] = {
+    "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil"};
+constexpr const char* const kHighByteRegisterNames[] = {"ah", "ch", "dh",
+                                                        "bh"};
+
+string GetGeneralPurposeRegisterName(int index, int size_bits) {
+  if (index < 0 || index >= kNumGeneralPurposeRegisters) return "";
+  if (index < 8) {
+    switch (size_bits) {
+      case 64:
+        return kLegacyRegisterNames64[index];
+      case 32:
+        return kLegacyRegisterNames32[index];
+      case 16:
+        return kLegacyRegisterNames16[index];
+      case 8:
+        return kLegacyRegisterNames8[index];
+      default:
+        return "";
+    }
+  }
+  switch (size_bits) {
+    case 64:
+      return StrCat("r", index);
+    case 32:
+      return StrCat("r", index, "d");
+    case 16:
+      return StrCat("r", index, "w");
+    case 8:
+      return StrCat("r", index, "b");
+    default:
+      return "";
+  }
+}
+
+string GetVectorRegisterName(int index, int size_bits) {
+  if (index < 0 || index >= kNumEvexVectorRegisters) return "";
+  switch (size_bits) {
+    case 128:
+      return StrCat("xmm", index);
+    case 256:
+      return StrCat("ymm", index);
+    case 512:
+      return StrCat("zmm", index);
+    default:
+      return "";
+  }
+}
+
+using RegisterMap = std::unordered_map<string, RegisterInfo>;
+
+void AddRegister(const string& name, RegisterClass register_class, int index,
+                 int size_bits, RegisterMap* registers) {
+  RegisterInfo& info = (*registers)[name];
+  info.register_class = register_class;
+  info.index = index;
+  info.size_bits = size_bits;
+}
+
+// Returns all the registers, indexed by their name in lower case.
+const RegisterMap& GetRegistersByName() {
+  static const RegisterMap* const kRegisters = []() {
+    RegisterMap* const registers = new RegisterMap();
+    for (int index = 0; index < kNumGeneralPurposeRegisters; ++index) {
+      for (const int size_bits : {8, 16, 32, 64}) {
+        AddRegister(GetGeneralPurposeRegisterName(index, size_bits),
+                    RegisterClass::kGeneralPurpose, index, size_bits,
+                    registers);
+      }
+    }
+    for (int index = 0; index < 4; ++index) {
+      AddRegister(kHighByteRegisterNames[index], RegisterClass::kGeneralPurpose,
+                  index, 8, registers);
+      (*registers)[kHighByteRegisterNames[index]].is_high_byte = true;
+    }
+    for (int index = 0; index < kNumMmxRegisters; ++index) {
+      AddRegister(StrCat("mm", index), RegisterClass::kMmx, index, 64,
+                  registers);
+    }
+    for (int index = 0; index < kNumEvexVectorRegisters; ++index) {
+      for (const int size_bits : {128, 256, 512}) {
+        AddRegister(GetVectorRegisterName(index, size_bits),
+                    RegisterClass::kVector, index, size_bits, registers);
+      }
+    }
+    for (int index = 0; index < kNumOpmaskRegisters; ++index) {
+      AddRegister(StrCat("k", index), RegisterClass::kOpmask, index, 64,
+                  registers);
+    }
+    AddRegister("flags", RegisterClass::kFlags, 0, 16, registers);
+    AddRegister("eflags", RegisterClass::kFlags, 0, 32, registers);
+    AddRegister("rflags", RegisterClass::kFlags, 0, 64, registers);
+    return registers;
+  }();
+  return *kRegisters;
+}
+
+}  // namespace
+
+RegisterInfo GetRegisterInfo(const string& name) {
+  string key = name;
+  if (key.size() >= 2 && key.front() == '<' && key.back() == '>') {
+    key = key.substr(1, key.size() - 2);
+  }
+  LowerString(&key);
+  return FindWithDefault(GetRegistersByName(), key, RegisterInfo());
+}
+
+string GetRegisterName(RegisterClass register_class, int index,
+                       int size_bits) {
+  switch (register_class) {
+    case RegisterClass::kGeneralPurpose:
+      return GetGeneralPurposeRegisterName(index, size_bits);
+    case RegisterClass::kMmx:
+      if (index < 0 || index >= kNumMmxRegisters || size_bits != 64) return "";
+      return StrCat("mm", index);
+    case RegisterClass::kVector:
+      return GetVectorRegisterName(index, size_bits);
+    case RegisterClass::kOpmask:
+      if (index < 0 || index >= kNumOpmaskRegisters) return "";
+      return StrCat("k", index);
+    case RegisterClass::kFlags:
+      if (index != 0) return "";
+      switch (size_bits) {
+        case 16:
+          return "flags";
+        case 32:
+          return "eflags";
+        case 64:
+          return "rflags";
+        default:
+          return "";
+      }
+    case RegisterClass::kNone:
+      return "";
+  }
+  return "";
+}
+
+int GetNumRegisters(RegisterClass register_class) {
+  switch (register_class) {
+    case RegisterClass::kGeneralPurpose:
+      return kNumGeneralPurposeRegisters;
+    case RegisterClass::kMmx:
+      return kNumMmxRegisters;
+    case RegisterClass::kVector:
+      return kNumVectorRegisters;
+    case RegisterClass::kOpmask:
+      return kNumOpmaskRegisters;
+    case RegisterClass::kFlags:
+      return 1;
+    case RegisterClass::kNone:
+      return 0;
+  }
+  return 0;
+}
+
+}  // namespace x86
+}  // namespace cpu_instructions
@@ -0,0 +1,78 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Names of the x86-64 registers that may carry a data dependency between two
+// instructions. Registers of the same class and with the same index alias
+// each other: e.g. 'cl', 'cx', 'ecx' and 'rcx' are all the general purpose
+// register 1 of different sizes, and 'xmm5' is the lower half of 'ymm5'.
+
+#ifndef CPU_INSTRUCTIONS_X86_REGISTERS_H_
+#define CPU_INSTRUCTIONS_X86_REGISTERS_H_
+
+#include "strings/string.h"
+
+namespace cpu_instructions {
+namespace x86 {
+
+enum class RegisterClass {
+  // Not a register, or a register that is not modeled (e.g. the x87 stack).
+  kNone,
+  // RAX to R15, and their lower parts.
+  kGeneralPurpose,
+  // MM0 to MM7.
+  kMmx,
+  // XMM, YMM and ZMM registers.
+  kVector,
+  // The AVX-512 mask registers K0 to K7.
+  kOpmask,
+  // The flags register. There is only one, with index 0.
+  kFlags,
+};
+
+struct RegisterInfo {
+  RegisterClass register_class = RegisterClass::kNone;
+  // The index of the register in its class, in the order of the encoding,
+  // e.g. 1 for 'ecx' and 9 for 'r9d'.
+  int index = 0;
+  int size_bits = 0;
+  // True for AH, CH, DH and BH. They use the index of the register they are a
+  // part of.
+  bool is_high_byte = false;
+};
+
+// Returns the register named 'name'. The name is case-insensitive, and it may
+// be enclosed in angle brackets, as in the vendor syntax of implicit operands
+// like "<XMM0>". Returns a register of class kNone if 'name' is not a register.
+RegisterInfo GetRegisterInfo(const string& name);
+
+// Returns the name of the register of 'register_class' with the given index
+// and size, in lower case, e.g. "r10w" for kGeneralPurpose, 10 and 16. Never
+// returns the name of a high-byte register. Returns an empty string when
+// there is no such register.
+string GetRegisterName(RegisterClass register_class, int index, int size_bits);
+
+// Returns the number of registers of 'register_class' that can be used by
+// instructions without an EVEX prefix.
+int GetNumRegisters(RegisterClass register_class);
+
+// Returns true if 'a' and 'b' are the same register, or if they overlap.
+inline bool RegistersAlias(const RegisterInfo& a, const RegisterInfo& b) {
+  return a.register_class != RegisterClass::kNone &&
+         a.register_class == b.register_class && a.index == b.index;
+}
+
+}  // namespace x86
+}  // namespace cpu_instructions
+
+#endif  // CPU_INSTRUCTIONS_X86_REGISTERS_H_
@@ -0,0 +1,93 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_instructions/x86/registers.h"
+
+#include "gtest/gtest.h"
+
+namespace cpu_instructions {
+namespace x86 {
+namespace {
+
+TEST(RegistersTest, GetRegisterInfo) {
+  const RegisterInfo ecx = GetRegisterInfo("ECX");
+  EXPECT_EQ(ecx.register_class, RegisterClass::kGeneralPurpose);
+  EXPECT_EQ(ecx.index, 1);
+  EXPECT_EQ(ecx.size_bits, 32);
+  EXPECT_FALSE(ecx.is_high_byte);
+
+  const RegisterInfo r9b = GetRegisterInfo("r9b");
+  EXPECT_EQ(r9b.index, 9);
+  EXPECT_EQ(r9b.size_bits, 8);
+
+  const RegisterInfo ch = GetRegisterInfo("ch");
+  EXPECT_EQ(ch.index, 1);
+  EXPECT_TRUE(ch.is_high_byte);
+
+  const RegisterInfo xmm0 = GetRegisterInfo("<XMM0>");
+  EXPECT_EQ(xmm0.register_class, RegisterClass::kVector);
+  EXPECT_EQ(xmm0.index, 0);
+  EXPECT_EQ(xmm0.size_bits, 128);
+
+  EXPECT_EQ(GetRegisterInfo("EFLAGS").register_class, RegisterClass::kFlags);
+  EXPECT_EQ(GetRegisterInfo("mm6").register_class, RegisterClass::kMmx);
+  EXPECT_EQ(GetRegisterInfo("k1").register_class, RegisterClass::kOpmask);
+  EXPECT_EQ(GetRegisterInfo("0x7e").register_class, RegisterClass::kNone);
+  EXPECT_EQ(GetRegisterInfo("dword ptr[RSI]").register_class,
+            RegisterClass::kNone);
+  EXPECT_EQ(GetRegisterInfo("ST(2)").register_class, RegisterClass::kNone);
+}
+
+TEST(RegistersTest, GetRegisterName) {
+  EXPECT_EQ(GetRegisterName(RegisterClass::kGeneralPurpose, 1, 64), "rcx");
+  EXPECT_EQ(GetRegisterName(RegisterClass::kGeneralPurpose, 1, 8), "cl");
+  EXPECT_EQ(GetRegisterName(RegisterClass::kGeneralPurpose, 6, 8), "sil");
+  EXPECT_EQ(GetRegisterName(RegisterClass::kGeneralPurpose, 10, 16), "r10w");
+  EXPECT_EQ(GetRegisterName(RegisterClass::kGeneralPurpose, 16, 64), "");
+  EXPECT_EQ(GetRegisterName(RegisterClass::kVector, 5, 256), "ymm5");
+  EXPECT_EQ(GetRegisterName(RegisterClass::kVector, 5, 64), "");
+  EXPECT_EQ(GetRegisterName(RegisterClass::kMmx, 3, 64), "mm3");
+  EXPECT_EQ(GetRegisterName(RegisterClass::kFlags, 0, 32), "eflags");
+  EXPECT_EQ(GetRegisterName(RegisterClass::kNone, 0, 32), "");
+}
+
+TEST(RegistersTest, NamesRoundTrip) {
+  for (const RegisterClass register_class :
+       {RegisterClass::kGeneralPurpose, RegisterClass::kVector}) {
+    for (int index = 0; index < GetNumRegisters(register_class); ++index) {
+      for (const int size_bits : {8, 16, 32, 64, 128, 256}) {
+        const string name = GetRegisterName(register_class, index, size_bits);
+        if (name.empty()) continue;
+        const RegisterInfo info = GetRegisterInfo(name);
+        EXPECT_EQ(info.register_class, register_class) << name;
+        EXPECT_EQ(info.index, index) << name;
+        EXPECT_EQ(info.size_bits, size_bits) << name;
+      }
+    }
+  }
+}
+
+TEST(RegistersTest, RegistersAlias) {
+  EXPECT_TRUE(RegistersAlias(GetRegisterInfo("cl"), GetRegisterInfo("rcx")));
+  EXPECT_TRUE(RegistersAlias(GetRegisterInfo("ch"), GetRegisterInfo("ecx")));
+  EXPECT_TRUE(
+      RegistersAlias(GetRegisterInfo("xmm3"), GetRegisterInfo("ymm3")));
+  EXPECT_FALSE(RegistersAlias(GetRegisterInfo("ecx"), GetRegisterInfo("edx")));
+  EXPECT_FALSE(RegistersAlias(GetRegisterInfo("mm1"), GetRegisterInfo("xmm1")));
+  EXPECT_FALSE(RegistersAlias(GetRegisterInfo("0x1"), GetRegisterInfo("0x1")));
+}
+
+}  // namespace
+}  // namespace x86
+}  // namespace cpu_instructions